@@ -0,0 +1,79 @@
+/**
+ * Micro-benchmark for records that wrap around the end of a
+ * connection buffer. It compares joining the two halves of the
+ * record in a temporary allocation, which is what the buffers
+ * did before they were mirrored, with reading the record in
+ * place from a mirrored buffer.
+ *
+ * Build and run with: make benchmarks && bench/bench_circbuf
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "circbuf.h"
+
+#define ITERATIONS 2000000
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Touches both ends of a record, so the reads are not optimized
+// away while the cost of getting a contiguous record dominates
+static uint64_t checksum(const char *rec, int len) {
+    __asm__ volatile("" : : "r"(rec) : "memory");
+    return (unsigned char)rec[0] + (unsigned char)rec[len - 1];
+}
+
+// Joins a wrapped record the way the unmirrored buffer did
+static uint64_t read_copied(circular_buffer *buf, int len) {
+    uint64_t end_size = buf->buf_size - buf->read_cursor;
+    char *rec = malloc(len);
+    memcpy(rec, buf->buffer + buf->read_cursor, end_size);
+    memcpy(rec + end_size, buf->buffer, len - end_size);
+    uint64_t sum = checksum(rec, len);
+    free(rec);
+    return sum;
+}
+
+// Reads a wrapped record in place from the mirrored buffer
+static uint64_t read_mirrored(circular_buffer *buf, int len) {
+    return checksum(buf->buffer + buf->read_cursor, len);
+}
+
+int main(int argc, char **argv) {
+    int sizes[] = {32, 128, 512, 4096};
+    circular_buffer buf;
+    if (circbuf_init(&buf)) {
+        fprintf(stderr, "Failed to map the buffer\n");
+        return 1;
+    }
+    memset(buf.buffer, 'x', buf.buf_size);
+
+    printf("%-12s %16s %16s\n", "record", "copied ns/op", "mirrored ns/op");
+    for (int s=0; s < sizeof(sizes) / sizeof(int); s++) {
+        int len = sizes[s];
+
+        // Place the record so that it straddles the wrap point
+        buf.read_cursor = buf.buf_size - len / 2;
+        buf.write_cursor = len - len / 2;
+
+        uint64_t sum = 0;
+        double start = now_ns();
+        for (int i=0; i < ITERATIONS; i++) sum += read_copied(&buf, len);
+        double copied = (now_ns() - start) / ITERATIONS;
+
+        start = now_ns();
+        for (int i=0; i < ITERATIONS; i++) sum += read_mirrored(&buf, len);
+        double mirrored = (now_ns() - start) / ITERATIONS;
+
+        printf("%-12d %16.2f %16.2f   (%llu)\n", len, copied, mirrored, (unsigned long long)sum);
+    }
+
+    circbuf_free(&buf);
+    return 0;
+}
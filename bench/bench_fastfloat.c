@@ -0,0 +1,112 @@
+/**
+ * Micro-benchmark for parsing metric values. It compares the
+ * simple conversion the connection handler used before, which was
+ * not correctly rounded and used strtod for exponents, with strtod
+ * and with the fast float parser.
+ *
+ * Build and run with: make benchmarks && bench/bench_fastfloat
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include "fastfloat.h"
+
+#define ITERATIONS 20000000
+#define INPUTS 1024
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// The conversion the connection handler used to do
+static double str2double(const char *s, char **end) {
+    double val = 0.0;
+    char neg = 0;
+    const char *orig_s = s;
+
+    switch (*s) {
+        case '-':
+            neg = 1;
+        case '+':
+            s++;
+    }
+    for (; *s >= '0' && *s <= '9'; s++) {
+        val = (val * 10.0) + (*s - '0');
+    }
+    if (*s == '.') {
+        s++;
+        double frac = 0.0;
+        int digits = 0;
+        for (; *s >= '0' && *s <= '9'; s++) {
+            frac = (frac * 10.0) + (*s - '0');
+            digits++;
+        }
+        val += frac / pow(10.0, digits);
+    }
+    if (*s == 'E' || *s == 'e') {
+        errno = 0;
+        return strtod(orig_s, end);
+    }
+    if (neg) val *= -1.0;
+    if (end) *end = (char*)s;
+    errno = 0;
+    return val;
+}
+
+// Fills the inputs with values of the given kind
+static void make_inputs(char inputs[][32], int *lens, int kind) {
+    srand(42);
+    for (int i=0; i < INPUTS; i++) {
+        switch (kind) {
+            case 0: // Counters
+                snprintf(inputs[i], 32, "%d", 1 + rand() % 100);
+                break;
+            case 1: // Timers in milliseconds
+                snprintf(inputs[i], 32, "%d.%03d", rand() % 10000, rand() % 1000);
+                break;
+            case 2: // Gauges at full precision
+                snprintf(inputs[i], 32, "%.17g", rand() / (double)RAND_MAX * 1e6);
+                break;
+            case 3: // Scientific notation
+                snprintf(inputs[i], 32, "%.6e", rand() / (double)RAND_MAX * 1e-3);
+                break;
+        }
+        lens[i] = strlen(inputs[i]);
+    }
+}
+
+int main(int argc, char **argv) {
+    static char inputs[INPUTS][32];
+    static int lens[INPUTS];
+    const char *kinds[] = {"counters", "timers", "gauges", "scientific"};
+    char *end;
+
+    printf("%-12s %14s %14s %14s\n", "values", "old ns/op", "strtod ns/op", "fast ns/op");
+    for (int k=0; k < sizeof(kinds) / sizeof(char*); k++) {
+        make_inputs(inputs, lens, k);
+
+        double sum = 0;
+        double start = now_ns();
+        for (int i=0; i < ITERATIONS; i++) sum += str2double(inputs[i % INPUTS], &end);
+        double old = (now_ns() - start) / ITERATIONS;
+
+        start = now_ns();
+        for (int i=0; i < ITERATIONS; i++) sum += strtod(inputs[i % INPUTS], &end);
+        double libc = (now_ns() - start) / ITERATIONS;
+
+        start = now_ns();
+        for (int i=0; i < ITERATIONS; i++) {
+            sum += fastfloat_parse(inputs[i % INPUTS], lens[i % INPUTS], &end);
+        }
+        double fast = (now_ns() - start) / ITERATIONS;
+
+        printf("%-12s %14.2f %14.2f %14.2f   (%g)\n", kinds[k], old, libc, fast, sum);
+    }
+    return 0;
+}
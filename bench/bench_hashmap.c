@@ -0,0 +1,92 @@
+/**
+ * Micro-benchmark for adding samples to the metric maps. It
+ * compares the lookup the metrics used to do, a get followed by a
+ * put when the key is missing, with a single upsert. Both are
+ * measured for keys that are already in the map, which is the
+ * common case, and for new keys, as seen at the start of each
+ * flush interval.
+ *
+ * Build and run with: make benchmarks && bench/bench_hashmap
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "hashmap.h"
+
+#define NUM_KEYS 100000
+#define ROUNDS 20
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Stands in for a counter update
+static void update(void *value) {
+    (*(uint64_t*)value)++;
+}
+
+// Get, then put a new value if the key is missing
+static void add_get_put(hashmap *map, char *key, uint64_t *values, int i) {
+    void *value;
+    if (hashmap_get(map, key, &value) == -1) {
+        value = values + i;
+        hashmap_put(map, key, value);
+    }
+    update(value);
+}
+
+// Upsert, then create the value in place if the key is new
+static void add_upsert(hashmap *map, char *key, uint64_t *values, int i) {
+    void **slot;
+    if (hashmap_upsert(map, key, &slot)) *slot = values + i;
+    update(*slot);
+}
+
+typedef void (*add_func)(hashmap *map, char *key, uint64_t *values, int i);
+
+// Returns the ns per sample for new keys, then existing keys
+static void run(add_func add, char **keys, uint64_t *values, double *new_ns, double *existing_ns) {
+    double new_total = 0, existing_total = 0;
+    for (int r=0; r < ROUNDS; r++) {
+        hashmap *map;
+        hashmap_init(0, &map);
+
+        double start = now_ns();
+        for (int i=0; i < NUM_KEYS; i++) add(map, keys[i], values, i);
+        new_total += now_ns() - start;
+
+        start = now_ns();
+        for (int i=0; i < NUM_KEYS; i++) add(map, keys[i], values, i);
+        existing_total += now_ns() - start;
+
+        hashmap_destroy(map);
+    }
+    *new_ns = new_total / (ROUNDS * NUM_KEYS);
+    *existing_ns = existing_total / (ROUNDS * NUM_KEYS);
+}
+
+int main(int argc, char **argv) {
+    char **keys = malloc(NUM_KEYS * sizeof(char*));
+    uint64_t *values = calloc(NUM_KEYS, sizeof(uint64_t));
+    char buf[128];
+    for (int i=0; i < NUM_KEYS; i++) {
+        snprintf(buf, sizeof(buf), "app.server%d.requests.endpoint%d.latency", i % 100, i);
+        keys[i] = strdup(buf);
+    }
+
+    double new_ns, existing_ns;
+    printf("%-12s %14s %18s\n", "lookup", "new ns/op", "existing ns/op");
+    run(add_get_put, keys, values, &new_ns, &existing_ns);
+    printf("%-12s %14.2f %18.2f\n", "get+put", new_ns, existing_ns);
+    run(add_upsert, keys, values, &new_ns, &existing_ns);
+    printf("%-12s %14.2f %18.2f\n", "upsert", new_ns, existing_ns);
+
+    for (int i=0; i < NUM_KEYS; i++) free(keys[i]);
+    free(keys);
+    free(values);
+    return 0;
+}
@@ -0,0 +1,79 @@
+/**
+ * Micro-benchmark for adding samples to timers. Each round
+ * fills a timer with the samples of one flush interval and
+ * queries its quantiles, as a flush does. Intervals from ten
+ * to ten million samples are measured, with random
+ * values and with values that arrive already sorted, for
+ * each quantile engine.
+ *
+ * Build and run with: make benchmarks && bench/bench_timer
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include "timer.h"
+
+// The samples added for each interval size, over all rounds
+#define TOTAL_SAMPLES 10000000
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Returns the ns per sample to fill and query timers
+static double run(quantile_engine engine, double *samples, int n, uint64_t *kept) {
+    double quants[] = {0.5, 0.95, 0.99};
+    int rounds = TOTAL_SAMPLES / n;
+    double total = 0;
+    for (int r=0; r < rounds; r++) {
+        timer t;
+        init_timer_with_engine(engine, 0.01, quants, 3, &t);
+
+        double start = now_ns();
+        for (int i=0; i < n; i++) timer_add_sample(&t, samples[i], 1.0);
+        for (int q=0; q < 3; q++) timer_query(&t, quants[q]);
+        total += now_ns() - start;
+
+        *kept = (t.type == TIMER_APPROX) ? quantile_size(&t.store.q) : t.store.e.count;
+        destroy_timer(&t);
+    }
+    return total / ((double)rounds * n);
+}
+
+int main(int argc, char **argv) {
+    int max_n = 10000000;
+    double *random_samples = malloc(max_n * sizeof(double));
+    double *sorted_samples = malloc(max_n * sizeof(double));
+
+    // Latencies in ms, mostly small with a long tail
+    srandom(42);
+    for (int i=0; i < max_n; i++) {
+        double u = (random() + 1.0) / (RAND_MAX + 2.0);
+        random_samples[i] = 5.0 / u;
+        sorted_samples[i] = i * 0.001;
+    }
+
+    const char *names[] = {"cm", "tdigest", "ddsketch"};
+    quantile_engine engines[] = {QUANTILE_CM, QUANTILE_TDIGEST, QUANTILE_DDSKETCH};
+    for (int e=0; e < 3; e++) {
+        printf("%s\n", names[e]);
+        printf("%-10s %18s %10s %18s %10s\n", "samples", "random ns/sample",
+                "kept", "sorted ns/sample", "kept");
+        for (int n=10; n <= max_n; n *= 10) {
+            uint64_t random_kept, sorted_kept;
+            double random_ns = run(engines[e], random_samples, n, &random_kept);
+            double sorted_ns = run(engines[e], sorted_samples, n, &sorted_kept);
+            printf("%-10d %18.2f %10llu %18.2f %10llu\n", n, random_ns,
+                    (unsigned long long)random_kept, sorted_ns,
+                    (unsigned long long)sorted_kept);
+        }
+        printf("\n");
+    }
+
+    free(random_samples);
+    free(sorted_samples);
+    return 0;
+}
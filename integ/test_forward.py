@@ -0,0 +1,162 @@
+"""
+Integration testing for the forward mode, which shards
+the metrics across several local statsite instances.
+"""
+import os
+import os.path
+import shutil
+import socket
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+import random
+
+try:
+    import pytest
+except ImportError:
+    print >> sys.stderr, "Integ tests require pytests!"
+    sys.exit(1)
+
+
+BINARY_HEADER = struct.Struct("<BBHd")
+NUM_UPSTREAMS = 3
+
+
+def start_statsite(tmpdir, name, conf, request):
+    "Starts a statsite instance with the given configuration"
+    config_path = os.path.join(tmpdir, "%s.cfg" % name)
+    open(config_path, "w").write(conf)
+    proc = subprocess.Popen(['./statsite', '-f', config_path])
+    proc.poll()
+    assert proc.returncode is None
+
+    def cleanup():
+        try:
+            proc.kill()
+            proc.wait()
+        except:
+            print proc
+            pass
+    request.addfinalizer(cleanup)
+    return proc
+
+
+def connect(port):
+    "Connects to a statsite instance over TCP"
+    for x in xrange(3):
+        try:
+            conn = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+            conn.settimeout(1)
+            conn.connect(("localhost", port))
+            return conn
+        except Exception, e:
+            print e
+            time.sleep(0.5)
+    raise EnvironmentError("Failed to connect!")
+
+
+def pytest_funcarg__servers(request):
+    "Returns connections to a forwarder, and the outputs of its upstreams"
+    # Create tmpdir and delete after
+    tmpdir = tempfile.mkdtemp()
+    request.addfinalizer(lambda: shutil.rmtree(tmpdir))
+
+    # Start the upstreams on consecutive ports
+    base_port = random.randrange(10000, 60000)
+    outputs = []
+    hosts = []
+    for i in xrange(NUM_UPSTREAMS):
+        port = base_port + i + 1
+        output = "%s/output%d" % (tmpdir, i)
+        conf = """[statsite]
+flush_interval = 1
+port = %d
+udp_port = %d
+stream_cmd = cat >> %s
+""" % (port, port, output)
+        start_statsite(tmpdir, "upstream%d" % i, conf, request)
+        outputs.append(output)
+        hosts.append("localhost:%d" % port)
+
+    # Start the forwarder in front of them
+    conf = """[statsite]
+flush_interval = 1
+port = %d
+udp_port = %d
+stream_cmd = cat > /dev/null
+forward_hosts = %s
+""" % (base_port, base_port, ", ".join(hosts))
+    start_statsite(tmpdir, "forwarder", conf, request)
+
+    conn = connect(base_port)
+    conn2 = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    conn2.connect(("localhost", base_port))
+    return conn, conn2, outputs
+
+
+def read_outputs(outputs, timeout=5):
+    """
+    Waits for the upstreams to flush, and maps each key to
+    the upstreams that output it, and the sum of its values.
+    A key may be flushed over several intervals.
+    """
+    time.sleep(timeout)
+    keys = {}
+    for i, output in enumerate(outputs):
+        if not os.path.isfile(output):
+            continue
+        for line in open(output):
+            key, val, _ = line.strip().split("|")
+            upstreams, total = keys.get(key, (set(), 0))
+            upstreams.add(i)
+            keys[key] = (upstreams, total + float(val))
+    return keys
+
+
+class TestForward(object):
+    def test_counters_sharded(self, servers):
+        "Tests that each counter is aggregated by a single upstream"
+        server, _, outputs = servers
+        msg = ""
+        for i in xrange(100):
+            msg += "c%d:1|c\n" % i
+        server.sendall(msg)
+        server.sendall(msg)
+
+        keys = read_outputs(outputs)
+        assert len(keys) == 100
+        used = set()
+        for key, (upstreams, total) in keys.iteritems():
+            assert len(upstreams) == 1
+            assert total == 2
+            used |= upstreams
+
+        # The keys are spread over the upstreams
+        assert len(used) == NUM_UPSTREAMS
+
+    def test_partial_lines(self, servers):
+        "Tests that lines split across writes are forwarded whole"
+        server, _, outputs = servers
+        server.sendall("split:")
+        time.sleep(0.2)
+        server.sendall("5|c\n")
+
+        keys = read_outputs(outputs)
+        assert keys.keys() == ["counts.split"]
+        assert keys["counts.split"][1] == 5
+
+    def test_udp_and_binary(self, servers):
+        "Tests that the protocols of a key reach the same upstream"
+        server, udp, outputs = servers
+        for i in xrange(20):
+            udp.send("t%d:10|c" % i)
+            key = "t%d\0" % i
+            server.sendall(BINARY_HEADER.pack(170, 2, len(key), 5.0) + key)
+
+        keys = read_outputs(outputs)
+        for i in xrange(20):
+            upstreams, total = keys["counts.t%d" % i]
+            assert len(upstreams) == 1
+            assert total == 15
@@ -0,0 +1,125 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "arena.h"
+
+/**
+ * The first block is small, so that idle metrics
+ * objects stay cheap. Each block is twice the size
+ * of the last one, up to the maximum.
+ */
+#define MIN_BLOCK_SIZE 16384
+#define MAX_BLOCK_SIZE (4 * 1024 * 1024)
+
+// Alignment of every allocation
+#define ARENA_ALIGN 16
+
+struct arena_block {
+    arena_block *next;  // The previous head
+    size_t size;        // The usable bytes in the block
+    size_t used;        // The bytes allocated so far
+    char data[] __attribute__((aligned(ARENA_ALIGN)));
+};
+
+// Initializes an empty arena
+void arena_init(arena *a) {
+    a->head = NULL;
+    a->next_size = MIN_BLOCK_SIZE;
+}
+
+/**
+ * Pushes a new head block, big enough for the allocation.
+ * @return 0 on success, -1 if the block could not be allocated.
+ */
+static int arena_add_block(arena *a, size_t size) {
+    size_t block_size = a->next_size;
+    if (block_size < size) block_size = size;
+
+    arena_block *block = malloc(sizeof(arena_block) + block_size);
+    if (!block) return -1;
+    block->size = block_size;
+    block->used = 0;
+    block->next = a->head;
+    a->head = block;
+
+    if (a->next_size < MAX_BLOCK_SIZE) a->next_size *= 2;
+    return 0;
+}
+
+// Bumps the head block, adding a block when it is full
+void* arena_alloc(arena *a, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    arena_block *block = a->head;
+    if (!block || block->size - block->used < size) {
+        if (arena_add_block(a, size)) return NULL;
+        block = a->head;
+    }
+    void *ptr = block->data + block->used;
+    block->used += size;
+    return ptr;
+}
+
+// Allocates zeroed memory
+void* arena_calloc(arena *a, size_t size) {
+    void *ptr = arena_alloc(a, size);
+    if (ptr) memset(ptr, 0, size);
+    return ptr;
+}
+
+// Copies a string into the arena
+char* arena_strndup(arena *a, const char *s, size_t len) {
+    char *copy = arena_alloc(a, len + 1);
+    if (!copy) return NULL;
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+// Moves the blocks of one arena into another
+void arena_merge(arena *into, arena *from) {
+    if (!from->head) return;
+
+    // Link the blocks behind our head, so that we
+    // keep allocating from our partially used block
+    arena_block *tail = from->head;
+    while (tail->next) tail = tail->next;
+    if (into->head) {
+        tail->next = into->head->next;
+        into->head->next = from->head;
+    } else {
+        into->head = from->head;
+    }
+    arena_init(from);
+}
+
+// Frees all but the largest block, and empties it
+void arena_reset(arena *a) {
+    arena_block *keep = a->head, *block;
+    for (block = a->head; block; block = block->next) {
+        if (block->size > keep->size) keep = block;
+    }
+
+    block = a->head;
+    while (block) {
+        arena_block *next = block->next;
+        if (block != keep) free(block);
+        block = next;
+    }
+
+    a->head = keep;
+    if (keep) {
+        keep->next = NULL;
+        keep->used = 0;
+    }
+}
+
+// Frees all the blocks
+void arena_destroy(arena *a) {
+    arena_block *block = a->head, *next;
+    while (block) {
+        next = block->next;
+        free(block);
+        block = next;
+    }
+    arena_init(a);
+}
@@ -0,0 +1,79 @@
+/**
+ * This module implements a bump allocator. The memory for
+ * the metrics of a flush interval is carved out of large
+ * blocks, and released all at once when the interval has
+ * been flushed, instead of with a free per allocation.
+ */
+#ifndef ARENA_H
+#define ARENA_H
+#include <stddef.h>
+
+typedef struct arena_block arena_block;
+
+/**
+ * An arena is a list of blocks. Allocations are
+ * made from the head block, until it is full.
+ */
+typedef struct {
+    arena_block *head;  // The block being allocated from
+    size_t next_size;   // The size of the next block
+} arena;
+
+/**
+ * Initializes an empty arena. No memory is
+ * allocated until the first allocation.
+ * @arg a The arena to initialize
+ */
+void arena_init(arena *a);
+
+/**
+ * Allocates memory from the arena. The memory is suitably
+ * aligned for any type, and is valid until the arena is destroyed.
+ * @arg a The arena
+ * @arg size The number of bytes to allocate
+ * @return The memory, or NULL if a block could not be allocated.
+ */
+void* arena_alloc(arena *a, size_t size);
+
+/**
+ * Allocates zeroed memory from the arena.
+ * @arg a The arena
+ * @arg size The number of bytes to allocate
+ * @return The memory, or NULL if a block could not be allocated.
+ */
+void* arena_calloc(arena *a, size_t size);
+
+/**
+ * Copies a string into the arena.
+ * @arg a The arena
+ * @arg s The string to copy
+ * @arg len The length of the string, without the null terminator
+ * @return The null terminated copy, or NULL on error.
+ */
+char* arena_strndup(arena *a, const char *s, size_t len);
+
+/**
+ * Moves all the memory of one arena into another, so that
+ * it lives as long as the destination. The source is left
+ * empty, but can still be used.
+ * @arg into The arena that takes the memory
+ * @arg from The arena to move from
+ */
+void arena_merge(arena *into, arena *from);
+
+/**
+ * Empties the arena so it can be used again, keeping its
+ * largest block to allocate from. All the memory
+ * previously allocated is invalidated.
+ * @arg a The arena to reset
+ */
+void arena_reset(arena *a);
+
+/**
+ * Frees all the memory of the arena at once. The
+ * arena is left empty, and can be used again.
+ * @arg a The arena to destroy
+ */
+void arena_destroy(arena *a);
+
+#endif
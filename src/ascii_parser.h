@@ -1,3 +1,5 @@
+#ifndef ASCII_PARSER_H
+#define ASCII_PARSER_H
 #include <stdlib.h>
 #include <string.h>
 
@@ -20,8 +22,10 @@ typedef struct {
   token value;
   token samplerate;
   metric_cb emit_cb;
+  size_t scanned;   // Bytes of the partial line searched for a terminator
 } ascpp;
 
 ascpp ascpp_init(metric_cb cb);
 void ascpp_exec(ascpp *parser, char *buffer, size_t len);
 
+#endif
@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <syslog.h>
+#include <sys/mman.h>
+#include "buildconfig.h"
+#include "circbuf.h"
+
+/**
+ * How big should the default connection
+ * buffer size be. One page seems reasonable
+ * since most requests will not be this large
+ */
+#define INIT_CONN_BUF_SIZE 32768
+
+/**
+ * This is the scale factor we use when
+ * we are growing our connection buffers.
+ * We want this to be aggressive enough to reduce
+ * the number of resizes, but to also avoid wasted
+ * space. With this, we will go from:
+ * 32K -> 64K -> 128K
+ */
+#define CONN_BUF_MULTIPLIER 2
+
+/**
+ * Creates an anonymous shared memory file of the given size,
+ * which backs both mappings of a buffer.
+ * @return The file descriptor, or -1 on error.
+ */
+static int create_backing_fd(uint64_t size) {
+    int fd;
+#ifdef HAVE_MEMFD_CREATE
+    fd = memfd_create("statsite-circbuf", MFD_CLOEXEC);
+#else
+    // Use a uniquely named POSIX shared memory object,
+    // and unlink it right away so it is anonymous
+    static unsigned long counter = 0;
+    char name[64];
+    snprintf(name, sizeof(name), "/statsite-circbuf-%d-%lu",
+            (int)getpid(), __sync_fetch_and_add(&counter, 1));
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd != -1) shm_unlink(name);
+#endif
+    if (fd == -1) return -1;
+
+    if (ftruncate(fd, size)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Maps size bytes of memory twice, back to back.
+ * @arg size The size, must be a multiple of the page size
+ * @return The start of the mapping, or NULL on error.
+ */
+static char* map_mirrored(uint64_t size) {
+    int fd = create_backing_fd(size);
+    if (fd == -1) {
+        syslog(LOG_ERR, "Failed to create buffer memory! Err: %s", strerror(errno));
+        return NULL;
+    }
+
+    // Reserve the address space for both halves, then map
+    // the memory over each of them
+    char *addr = mmap(NULL, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED) goto ERR;
+    if (mmap(addr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+        mmap(addr + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(addr, 2 * size);
+        goto ERR;
+    }
+
+    // The mappings keep the memory alive
+    close(fd);
+    return addr;
+
+ERR:
+    syslog(LOG_ERR, "Failed to map buffer memory! Err: %s", strerror(errno));
+    close(fd);
+    return NULL;
+}
+
+// Initializes a buffer with the default size
+int circbuf_init(circular_buffer *buf) {
+    uint64_t size = INIT_CONN_BUF_SIZE;
+    uint64_t page_size = getpagesize();
+    if (size % page_size) size += page_size - size % page_size;
+
+    buf->read_cursor = 0;
+    buf->write_cursor = 0;
+    buf->buffer = map_mirrored(size);
+    buf->buf_size = (buf->buffer) ? size : 0;
+    return (buf->buffer) ? 0 : -1;
+}
+
+// Frees a buffer
+void circbuf_free(circular_buffer *buf) {
+    if (buf->buffer) munmap(buf->buffer, 2 * buf->buf_size);
+    buf->buffer = NULL;
+}
+
+// Calculates the available buffer size
+uint64_t circbuf_avail_buf(circular_buffer *buf) {
+    return buf->buf_size - circbuf_used_buf(buf) - 1;
+}
+
+// Calculates the used buffer size
+uint64_t circbuf_used_buf(circular_buffer *buf) {
+    if (buf->write_cursor < buf->read_cursor) {
+        return buf->buf_size - buf->read_cursor + buf->write_cursor;
+    }
+    return buf->write_cursor - buf->read_cursor;
+}
+
+// Grows the circular buffer to make room for more data.
+// The used bytes are contiguous, so they are moved to the
+// start of the new mapping with a single copy.
+int circbuf_grow_buf(circular_buffer *buf) {
+    uint64_t new_size = buf->buf_size * CONN_BUF_MULTIPLIER;
+    char *new_buf = map_mirrored(new_size);
+    if (!new_buf) return -1;
+
+    uint64_t used = circbuf_used_buf(buf);
+    memcpy(new_buf, buf->buffer + buf->read_cursor, used);
+
+    munmap(buf->buffer, 2 * buf->buf_size);
+    buf->buffer = new_buf;
+    buf->buf_size = new_size;
+    buf->read_cursor = 0;
+    buf->write_cursor = used;
+    return 0;
+}
+
+// Copies data into the buffer, growing it as needed
+int circbuf_write(circular_buffer *buf, const char *in, uint64_t bytes) {
+    while (circbuf_avail_buf(buf) < bytes) {
+        if (circbuf_grow_buf(buf)) return -1;
+    }
+    memcpy(buf->buffer + buf->write_cursor, in, bytes);
+    circbuf_advance_write(buf, bytes);
+    return 0;
+}
+
+// Advances the cursors
+void circbuf_advance_write(circular_buffer *buf, uint64_t bytes) {
+    buf->write_cursor = (buf->write_cursor + bytes) % buf->buf_size;
+}
+
+void circbuf_advance_read(circular_buffer *buf, uint64_t bytes) {
+    buf->read_cursor = (buf->read_cursor + bytes) % buf->buf_size;
+
+    // Optimization, reset the cursors if they catchup with each other
+    if (buf->read_cursor == buf->write_cursor) {
+        buf->read_cursor = 0;
+        buf->write_cursor = 0;
+    }
+}
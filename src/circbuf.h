@@ -0,0 +1,84 @@
+/**
+ * This module implements the circular buffers used
+ * for connection input. The pages of the buffer are
+ * mapped twice, back to back, so that the data between
+ * the cursors is always contiguous in memory, even when
+ * it wraps around the end of the buffer.
+ */
+#ifndef CIRCBUF_H
+#define CIRCBUF_H
+#include <stdint.h>
+
+/**
+ * Represents a simple circular buffer. The
+ * byte at buffer[i] is also at buffer[i + buf_size],
+ * so buf_size bytes can be accessed linearly
+ * from any offset into the buffer.
+ */
+typedef struct {
+    uint64_t write_cursor;
+    uint64_t read_cursor;
+    uint64_t buf_size;
+    char *buffer;
+} circular_buffer;
+
+/**
+ * Initializes a circular buffer with the default size.
+ * @arg buf The buffer to initialize
+ * @return 0 on success, -1 if the buffer could not be mapped.
+ */
+int circbuf_init(circular_buffer *buf);
+
+/**
+ * Unmaps the memory of a circular buffer.
+ * @arg buf The buffer to free
+ */
+void circbuf_free(circular_buffer *buf);
+
+/**
+ * Returns the number of bytes that can be written.
+ * @arg buf The buffer
+ * @return The bytes available
+ */
+uint64_t circbuf_avail_buf(circular_buffer *buf);
+
+/**
+ * Returns the number of bytes that can be read.
+ * @arg buf The buffer
+ * @return The bytes used
+ */
+uint64_t circbuf_used_buf(circular_buffer *buf);
+
+/**
+ * Grows the circular buffer to make room for more data.
+ * @arg buf The buffer
+ * @return 0 on success, -1 if the new buffer could not be mapped.
+ */
+int circbuf_grow_buf(circular_buffer *buf);
+
+/**
+ * Copies data into the buffer, growing it as needed.
+ * @arg buf The buffer
+ * @arg in The data to copy
+ * @arg bytes The number of bytes to copy
+ * @return 0 on success, -1 if the buffer could not grow.
+ */
+int circbuf_write(circular_buffer *buf, const char *in, uint64_t bytes);
+
+/**
+ * Advances the write cursor after data has been
+ * written at buffer + write_cursor.
+ * @arg buf The buffer
+ * @arg bytes The number of bytes written
+ */
+void circbuf_advance_write(circular_buffer *buf, uint64_t bytes);
+
+/**
+ * Advances the read cursor, consuming the data
+ * at buffer + read_cursor.
+ * @arg buf The buffer
+ * @arg bytes The number of bytes consumed
+ */
+void circbuf_advance_read(circular_buffer *buf, uint64_t bytes);
+
+#endif
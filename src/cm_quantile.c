@@ -3,6 +3,10 @@
  * for computation of biased quantiles over data streams from
  * "Effective Computation of Biased Quantiles over Data Streams"
  *
+ * New values are buffered, and inserted into the sorted array
+ * of samples in batches, by radix sorting the buffer and merging it
+ * in a single pass. Each full batch is followed by a compression
+ * pass over the whole array.
  */
 #include <stdint.h>
 #include <iso646.h>
@@ -11,35 +15,23 @@
 #include <math.h>
 #include <limits.h>
 #include <stdio.h>
-#include "heap.h"
 #include "cm_quantile.h"
+#include "sort.h"
+
+/**
+ * The number of values buffered before they are inserted.
+ * The buffer starts small, so that timers with few values
+ * stay cheap, and doubles up to this size.
+ */
+#define CM_BUFFER_SIZE 512
+#define CM_MIN_BUFFER_SIZE 16
 
 /* Static declarations */
-static void cm_add_to_buffer(cm_quantile *cm, double value);
-static double cm_insert_point_value(cm_quantile *cm);
-static void cm_reset_insert_cursor(cm_quantile *cm);
-static int cm_cursor_increment(cm_quantile *cm);
-static void cm_insert_sample(cm_quantile *cm, cm_sample *position, cm_sample *new);
-static void cm_append_sample(cm_quantile *cm, cm_sample *new);
 static void cm_insert(cm_quantile *cm);
 static void cm_compress(cm_quantile *cm);
+static int cm_reserve(cm_quantile *cm, uint64_t size);
 static uint64_t cm_threshold(cm_quantile *cm, uint64_t rank);
 
-// This is a comparison function that treats keys as doubles
-static int compare_double_keys(register void* key1, register void* key2) {
-    // Cast them as double* and read them in
-    register double val1 = *((double*)key1);
-    register double val2 = *((double*)key2);
-
-    // Perform the comparison
-    if (val1 < val2)
-        return -1;
-    else if (val1 == val2)
-        return 0;
-    else
-        return 1;
-}
-
 /**
  * Initializes the CM quantile struct
  * @arg eps The maximum error for the quantiles
@@ -66,63 +58,30 @@ int init_cm_quantile(double eps, double *quantiles, uint32_t num_quants, cm_quan
     cm->eps = eps;
     cm->num_samples = 0;
     cm->num_values = 0;
+    cm->samples_size = 0;
     cm->samples = NULL;
-    cm->end = NULL;
 
     // Copy the quantiles
     cm->quantiles = malloc(num_quants * sizeof(double));
     memcpy(cm->quantiles, quantiles, num_quants * sizeof(double));
     cm->num_quantiles = num_quants;
 
-    // Initialize the buffers
-    heap *heaps = malloc(2*sizeof(heap));
-    cm->bufLess = heaps;
-    cm->bufMore = heaps+1;
-    heap_create(cm->bufLess, 0, compare_double_keys);
-    heap_create(cm->bufMore, 0, compare_double_keys);
-
-    // Setup the cursors
-    cm->insert.curs = NULL;
-    cm->compress.curs = NULL;
-
+    // The buffer is allocated on the first value
+    cm->buffer = NULL;
+    cm->num_buffered = 0;
+    cm->buffer_size = 0;
     return 0;
 }
 
-/*
- * Callback function to delete the sample inside the
- * heap buffer.
- */
-static void free_buffer_sample(void *key, void *val) {
-    free(val);
-}
-
 /**
  * Destroy the CM quantile struct.
  * @arg cm_quantile The cm_quantile to destroy
  * @return 0 on success.
  */
 int destroy_cm_quantile(cm_quantile *cm) {
-    // Free the quantiles
     free(cm->quantiles);
-
-    // Destroy everything in the buffer
-    heap_foreach(cm->bufLess, free_buffer_sample);
-    heap_destroy(cm->bufLess);
-    heap_foreach(cm->bufMore, free_buffer_sample);
-    heap_destroy(cm->bufMore);
-
-    // Free the lower address, since they are allocated to be adjacent
-    free((cm->bufLess < cm->bufMore) ? cm->bufLess : cm->bufMore);
-
-    // Iterate through the linked list, free all
-    cm_sample *next;
-    cm_sample *current = cm->samples;
-    while (current) {
-        next = current->next;
-        free(current);
-        current = next;
-    }
-
+    free(cm->buffer);
+    free(cm->samples);
     return 0;
 }
 
@@ -133,9 +92,21 @@ int destroy_cm_quantile(cm_quantile *cm) {
  * @return 0 on success.
  */
 int cm_add_sample(cm_quantile *cm, double sample) {
-    cm_add_to_buffer(cm, sample);
-    cm_insert(cm);
-    cm_compress(cm);
+    if (cm->num_buffered == cm->buffer_size) {
+        // Insert a full buffer, or grow a small one
+        if (cm->buffer_size == CM_BUFFER_SIZE) {
+            cm_insert(cm);
+            cm_compress(cm);
+        } else {
+            // The second half is scratch space for sorting
+            uint32_t size = (cm->buffer_size) ? cm->buffer_size * 2 : CM_MIN_BUFFER_SIZE;
+            double *buffer = realloc(cm->buffer, 2 * size * sizeof(double));
+            if (!buffer) return -1;
+            cm->buffer = buffer;
+            cm->buffer_size = size;
+        }
+    }
+    cm->buffer[cm->num_buffered++] = sample;
     return 0;
 }
 
@@ -146,210 +117,246 @@ int cm_add_sample(cm_quantile *cm, double sample) {
  * @return 0 on success.
  */
 int cm_flush(cm_quantile *cm) {
-    while (heap_size(cm->bufLess) or heap_size(cm->bufMore)) {
-        if (heap_size(cm->bufMore) == 0) cm_reset_insert_cursor(cm);
-        cm_insert(cm);
-        cm_compress(cm);
-    }
+    // Only full batches are compressed, so the
+    // last values are kept exact for the queries
+    cm_insert(cm);
     return 0;
 }
 
 /**
- * Queries for a quantile value
- * @arg cm_quantile The cm_quantile to query
- * @arg quantile The quantile to query
- * @return The value on success or 0.
+ * Merges the samples of one CM quantile into another.
+ * The samples of from are moved into the target, leaving it empty.
+ * Both should be configured with the same epsilon and quantiles.
+ * @arg into The cm_quantile to merge into
+ * @arg from The cm_quantile to merge from
+ * @return 0 on success.
  */
-double cm_query(cm_quantile *cm, double quantile) {
-    uint64_t rank = ceil(quantile * cm->num_values);
-	uint64_t min_rank=0;
-    uint64_t max_rank;
-	uint64_t threshold = ceil(cm_threshold(cm, rank) / 2.);
-
-    cm_sample *prev = cm->samples;
-    cm_sample *current = cm->samples;
-    while (current) {
-        max_rank = min_rank + current->width + current->delta;
-        if (max_rank > rank + threshold || min_rank > rank) {
-            break;
+int cm_merge(cm_quantile *into, cm_quantile *from) {
+    // Drain both buffers so the sample arrays are complete
+    cm_flush(into);
+    cm_flush(from);
+    if (!from->num_samples) return 0;
+
+    /*
+     * Merge the two sorted arrays. A tuple taken from one array
+     * may have any number of values from the other array before
+     * it, so the rank uncertainty of the next tuple of the other
+     * array is added to its delta.
+     */
+    uint64_t size = into->num_samples + from->num_samples;
+    cm_sample *merged = malloc(size * sizeof(cm_sample));
+    if (!merged) return -1;
+
+    cm_sample *a = into->samples, *a_end = a + into->num_samples;
+    cm_sample *b = from->samples, *b_end = b + from->num_samples;
+    cm_sample *s = merged;
+    while (a < a_end || b < b_end) {
+        if (b == b_end || (a < a_end && a->value <= b->value)) {
+            *s = *a++;
+            if (b < b_end) s->delta += b->width + b->delta - 1;
+        } else {
+            *s = *b++;
+            if (a < a_end) s->delta += a->width + a->delta - 1;
         }
-        min_rank += current->width;
-        prev = current;
-        current = current->next;
+        s++;
     }
-    return (prev) ? prev->value : 0;
+
+    free(into->samples);
+    into->samples = merged;
+    into->samples_size = size;
+    into->num_samples = size;
+    into->num_values += from->num_values;
+
+    // The source no longer owns any samples
+    free(from->samples);
+    from->samples = NULL;
+    from->samples_size = 0;
+    from->num_samples = 0;
+    from->num_values = 0;
+
+    cm_compress(into);
+    return 0;
+}
+
+// Reads the samples, which must be sorted and cover every value
+static int cm_decode_samples(codec_reader *r, cm_quantile *cm, uint64_t num_samples, uint64_t num_values) {
+    if (cm_reserve(cm, num_samples)) return -1;
+    uint64_t width = 0;
+    for (uint64_t i=0; i < num_samples; i++) {
+        cm_sample *s = cm->samples + i;
+        if (codec_get_double(r, &s->value)) return -1;
+        if (codec_get_varint(r, &s->width)) return -1;
+        if (codec_get_varint(r, &s->delta)) return -1;
+        if (i && s->value < s[-1].value) return -1;
+        width += s->width;
+    }
+    if (width != num_values) return -1;
+    cm->num_samples = num_samples;
+    cm->num_values = num_values;
+    return 0;
 }
 
 /**
- * Adds a new sample to the buffer
+ * Encodes the samples, after flushing the buffer.
+ * The quantiles are not encoded.
+ * @arg cm_quantile The cm_quantile to encode
+ * @arg buf The buffer to append to
+ * @return 0 on success.
  */
-static void cm_add_to_buffer(cm_quantile *cm, double value) {
-    // Allocate a new sample
-    cm_sample *s = calloc(1, sizeof(cm_sample));
-    s->value = value;
-
-    /*
-     * Check the cursor value.
-     * Only use bufLess if we have at least a single value.
-     */
-    if (cm->num_values && value < cm_insert_point_value(cm)) {
-        heap_insert(cm->bufLess, &s->value, s);
-    } else {
-        heap_insert(cm->bufMore, &s->value, s);
+int cm_encode(cm_quantile *cm, codec_buf *buf) {
+    cm_flush(cm);
+    if (codec_put_double(buf, cm->eps)) return -1;
+    if (codec_put_varint(buf, cm->num_values)) return -1;
+    if (codec_put_varint(buf, cm->num_samples)) return -1;
+    for (uint64_t i=0; i < cm->num_samples; i++) {
+        cm_sample *s = cm->samples + i;
+        if (codec_put_double(buf, s->value)) return -1;
+        if (codec_put_varint(buf, s->width)) return -1;
+        if (codec_put_varint(buf, s->delta)) return -1;
     }
+    return 0;
 }
 
-// Returns the value under the insertion cursor or 0
-static double cm_insert_point_value(cm_quantile *cm) {
-    return (cm->insert.curs) ? cm->insert.curs->value : 0;
+/**
+ * Decodes a CM quantile, which can then be merged
+ * @arg r The reader of the encoding
+ * @arg quantiles A sorted array of double quantile values, must be on (0, 1)
+ * @arg num_quants The number of entries in the quantiles array
+ * @arg cm_quantile The cm_quantile struct to initialize
+ * @return 0 on success, -1 on bad input.
+ */
+int cm_decode(codec_reader *r, double *quantiles, uint32_t num_quants, cm_quantile *cm) {
+    double eps;
+    uint64_t num_values, num_samples;
+    if (codec_get_double(r, &eps)) return -1;
+    if (codec_get_varint(r, &num_values)) return -1;
+    if (codec_get_varint(r, &num_samples)) return -1;
+
+    // Each sample takes a double and two varints
+    if (codec_check_count(r, num_samples, 10)) return -1;
+    if (!isfinite(eps) || init_cm_quantile(eps, quantiles, num_quants, cm)) return -1;
+    if (cm_decode_samples(r, cm, num_samples, num_values)) {
+        destroy_cm_quantile(cm);
+        return -1;
+    }
+    return 0;
 }
 
-// Resets the insert cursor
-static void cm_reset_insert_cursor(cm_quantile *cm) {
-    // Swap the buffers, reset the cursor
-    heap *tmp = cm->bufLess;
-    cm->bufLess = cm->bufMore;
-    cm->bufMore = tmp;
-    cm->insert.curs = NULL;
-}
+/**
+ * Queries for a quantile value. This returns the sample
+ * whose possible ranks are closest to the queried rank,
+ * which is within the error of the rank.
+ * @arg cm_quantile The cm_quantile to query
+ * @arg quantile The quantile to query
+ * @return The value on success or 0.
+ */
+double cm_query(cm_quantile *cm, double quantile) {
+    cm_flush(cm);
+    if (!cm->num_samples) return 0;
 
-// Computes the number of items to process in one iteration
-static int cm_cursor_increment(cm_quantile *cm) {
-    return ceil(cm->num_samples * cm->eps);
-}
+    uint64_t rank = ceil(quantile * cm->num_values);
+    uint64_t min_rank = 0, max_rank, err, below, above;
+    uint64_t best = 0, best_err = UINT64_MAX;
+    for (uint64_t i=0; i < cm->num_samples; i++) {
+        cm_sample *current = cm->samples + i;
+        min_rank += current->width;
+        max_rank = min_rank + current->delta;
+
+        // The error only grows past the rank
+        if (min_rank > rank && min_rank - rank >= best_err) break;
 
-/* Inserts a new sample before the position sample */
-static void cm_insert_sample(cm_quantile *cm, cm_sample *position, cm_sample *new) {
-    // Inserting at the head
-    if (!position->prev) {
-        position->prev = new;
-        cm->samples = new;
-        new->next = position;
-    } else {
-        cm_sample *prev = position->prev;
-        prev->next = new;
-        position->prev = new;
-        new->prev = prev;
-        new->next = position;
+        below = (rank > min_rank) ? rank - min_rank : min_rank - rank;
+        above = (max_rank > rank) ? max_rank - rank : rank - max_rank;
+        err = (below > above) ? below : above;
+        if (err < best_err) {
+            best = i;
+            best_err = err;
+        }
     }
+    return cm->samples[best].value;
 }
 
-/* Inserts a new sample at the end */
-static void cm_append_sample(cm_quantile *cm, cm_sample *new) {
-    new->prev = cm->end;
-    cm->end->next = new;
-    cm->end = new;
+// Makes room for a number of samples
+static int cm_reserve(cm_quantile *cm, uint64_t size) {
+    if (size <= cm->samples_size) return 0;
+    uint64_t new_size = (cm->samples_size) ? cm->samples_size * 2 : CM_MIN_BUFFER_SIZE;
+    while (new_size < size) new_size *= 2;
+    cm_sample *samples = realloc(cm->samples, new_size * sizeof(cm_sample));
+    if (!samples) return -1;
+    cm->samples = samples;
+    cm->samples_size = new_size;
+    return 0;
 }
 
 /**
- * Incrementally processes inserts by moving
- * data from the buffer to the samples using a cursor
+ * Inserts the buffered values into the samples. The buffer
+ * is sorted and merged with the samples from the end of the
+ * array, so the samples only move once. A new value is
+ * inserted before the first sample that is not smaller, and
+ * takes its rank uncertainty. Values past the end are exact.
  */
 static void cm_insert(cm_quantile *cm) {
-    // Check if this is the first element
-    cm_sample *samp;
-    if (!cm->samples) {
-        if (!heap_delmin(cm->bufMore, NULL, (void**)&samp)) return;
-        samp->width = 1;
-        samp->delta = 0;
-        cm->samples = samp;
-        cm->end = samp;
-        cm->num_values++;
-        cm->num_samples++;
-        cm->insert.curs = samp;
-		return;
-	}
-
-    // Check if we need to initialize the cursor
-    if (!cm->insert.curs) {
-        cm->insert.curs = cm->samples;
-    }
-
-    // Handle adding values in the middle
-    int incr_size = cm_cursor_increment(cm);
-    double *val;
-    for (int i=0; i < incr_size and cm->insert.curs; i++) {
-        while (heap_min(cm->bufMore, (void**)&val, NULL) && *val <= cm_insert_point_value(cm)) {
-            heap_delmin(cm->bufMore, NULL, (void**)&samp);
-            samp->width = 1;
-            samp->delta = cm->insert.curs->width + cm->insert.curs->delta - 1;
-            cm_insert_sample(cm, cm->insert.curs, samp);
-            cm->num_values++;
-            cm->num_samples++;
-
-            // Check if we need to update the compress cursor
-            if (cm->compress.curs && cm->compress.curs->value >= samp->value) {
-                cm->compress.min_rank++;
-            }
-        }
-        // Increment the cursor
-        cm->insert.curs = cm->insert.curs->next;
-	}
-
-    // Handle adding values at the end
-    if (cm->insert.curs == NULL) {
-        while (heap_min(cm->bufMore, (void**)&val, NULL) && *val > cm->end->value) {
-            heap_delmin(cm->bufMore, NULL, (void**)&samp);
-            samp->width = 1;
-            samp->delta = 0;
-            cm_append_sample(cm, samp);
-            cm->num_values++;
-            cm->num_samples++;
+    uint32_t n = cm->num_buffered;
+    if (!n || cm_reserve(cm, cm->num_samples + n)) return;
+    sort_doubles(cm->buffer, cm->buffer + cm->buffer_size, n);
+
+    int64_t i = cm->num_samples - 1;
+    int64_t j = n - 1;
+    int64_t k = cm->num_samples + n - 1;
+    uint64_t next_delta = 0;
+    while (j >= 0) {
+        if (i >= 0 && cm->samples[i].value >= cm->buffer[j]) {
+            cm_sample *s = cm->samples + i--;
+            next_delta = s->width + s->delta - 1;
+            cm->samples[k--] = *s;
+        } else {
+            cm_sample *s = cm->samples + k--;
+            s->value = cm->buffer[j--];
+            s->width = 1;
+            s->delta = next_delta;
         }
+    }
 
-        // Reset the cursor
-        cm_reset_insert_cursor(cm);
-	}
+    cm->num_samples += n;
+    cm->num_values += n;
+    cm->num_buffered = 0;
 }
 
-/* Incrementally processes compression by using a cursor */
+/**
+ * Compresses the samples in a single pass from the end,
+ * combining each tuple into the next one when their error
+ * stays under the threshold of their rank. The first and
+ * last samples are kept, so the min and max are exact.
+ */
 static void cm_compress(cm_quantile *cm) {
     // Bail early if there is nothing to really compress..
     if (cm->num_samples < 3) return;
 
-    // Check if we need to initialize the cursor
-    if (!cm->compress.curs) {
-        cm->compress.curs = cm->end->prev;
-        cm->compress.min_rank = cm->num_values - 1 - cm->compress.curs->width;
-        cm->compress.curs = cm->compress.curs->prev;
-    }
-
-    int incr_size = cm_cursor_increment(cm);
-    cm_sample *next, *prev;
-    uint64_t threshold;
-    uint64_t max_rank, test_val;
-    for (int i=0; i < incr_size and cm->compress.curs != cm->samples; i++) {
-        next = cm->compress.curs->next;
-        max_rank = cm->compress.min_rank + cm->compress.curs->width + cm->compress.curs->delta;
-        cm->compress.min_rank -= cm->compress.curs->width;
+    // The kept samples are packed at the end of the array.
+    // Nothing is combined into the last sample, so the max
+    // does not absorb the ranks below it.
+    cm_sample *samples = cm->samples;
+    uint64_t kept = cm->num_samples - 2;
+    uint64_t min_rank = cm->num_values - samples[kept + 1].width - samples[kept].width;
+    uint64_t threshold, max_rank;
+    for (uint64_t i=kept - 1; i > 0; i--) {
+        cm_sample *curs = samples + i, *next = samples + kept;
+        min_rank -= curs->width;
+        max_rank = min_rank + curs->width + curs->delta;
 
         threshold = cm_threshold(cm, max_rank);
-        test_val = cm->compress.curs->width + next->width + next->delta;
-        if (test_val <= threshold) {
-            // Make sure we don't stomp the insertion cursor
-            if (cm->insert.curs == cm->compress.curs) {
-                cm->insert.curs = next;
-            }
-
-            // Combine the widths
-            next->width += cm->compress.curs->width;
-
-            // Remove the tuple
-            prev = cm->compress.curs->prev;
-            prev->next = next;
-            next->prev = prev;
-            free(cm->compress.curs);
-            cm->compress.curs = prev;
-
-            // Reduce the sample count
-            cm->num_samples--;
+        if (curs->width + next->width + next->delta <= threshold) {
+            // Combine the widths, removing the tuple
+            next->width += curs->width;
         } else {
-            cm->compress.curs = cm->compress.curs->prev;
+            samples[--kept] = *curs;
         }
     }
+    samples[--kept] = samples[0];
 
-    // Reset the cursor if we hit the start
-    if (cm->compress.curs == cm->samples) cm->compress.curs = NULL;
+    // Move the kept samples to the start
+    cm->num_samples -= kept;
+    memmove(samples, samples + kept, cm->num_samples * sizeof(cm_sample));
 }
 
 /* Computes the minimum threshold value */
@@ -7,25 +7,14 @@
 #ifndef CM_QUANTILE_H
 #define CM_QUANTILE_H
 #include <stdint.h>
-#include "heap.h"
+#include "codec.h"
 
-typedef struct cm_sample {
+typedef struct {
     double value;       // The sampled value
     uint64_t width;     // The number of ranks represented
     uint64_t delta;     // Delta between min/max rank
-    struct cm_sample *next;
-    struct cm_sample *prev;
 } cm_sample;
 
-struct cm_insert_cursor {
-    cm_sample *curs;
-};
-
-struct cm_compress_cursor {
-    cm_sample *curs;
-    uint64_t min_rank;
-};
-
 typedef struct {
     double eps;  // Desired epsilon
 
@@ -34,13 +23,13 @@ typedef struct {
 
     uint64_t num_samples;   // Number of samples
     uint64_t num_values;    // Number of values added
+    uint64_t samples_size;  // Size of the samples array
 
-    cm_sample *samples;     // Sorted linked list of samples
-    cm_sample *end;         // Pointer to the end of the sampels
-    heap *bufLess, *bufMore;// Sample buffer
+    cm_sample *samples;     // Sorted array of samples
 
-    struct cm_insert_cursor insert;     // Insertion cursor
-    struct cm_compress_cursor compress; // Compression cursor
+    double *buffer;         // Values not yet inserted into the samples
+    uint32_t num_buffered;  // Number of buffered values
+    uint32_t buffer_size;   // Size of the buffer
 } cm_quantile;
 
 
@@ -70,7 +59,8 @@ int destroy_cm_quantile(cm_quantile *cm);
 int cm_add_sample(cm_quantile *cm, double sample);
 
 /**
- * Queries for a quantile value
+ * Queries for a quantile value. Any buffered
+ * values are inserted first.
  * @arg cm_quantile The cm_quantile to query
  * @arg quantile The quantile to query
  * @return The value on success or 0.
@@ -85,4 +75,33 @@ double cm_query(cm_quantile *cm, double quantile);
  */
 int cm_flush(cm_quantile *cm);
 
+/**
+ * Merges the samples of one CM quantile into another.
+ * The samples of from are moved into the target, leaving it empty.
+ * Both should be configured with the same epsilon and quantiles.
+ * @arg into The cm_quantile to merge into
+ * @arg from The cm_quantile to merge from
+ * @return 0 on success.
+ */
+int cm_merge(cm_quantile *into, cm_quantile *from);
+
+/**
+ * Encodes the samples, after flushing the buffer.
+ * The quantiles are not encoded.
+ * @arg cm_quantile The cm_quantile to encode
+ * @arg buf The buffer to append to
+ * @return 0 on success.
+ */
+int cm_encode(cm_quantile *cm, codec_buf *buf);
+
+/**
+ * Decodes a CM quantile, which can then be merged
+ * @arg r The reader of the encoding
+ * @arg quantiles A sorted array of double quantile values, must be on (0, 1)
+ * @arg num_quants The number of entries in the quantiles array
+ * @arg cm_quantile The cm_quantile struct to initialize
+ * @return 0 on success, -1 on bad input.
+ */
+int cm_decode(codec_reader *r, double *quantiles, uint32_t num_quants, cm_quantile *cm);
+
 #endif
@@ -0,0 +1,149 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "codec.h"
+
+// The initial size of a buffer
+#define MIN_BUF_SIZE 64
+
+// A varint takes at most 10 bytes
+#define MAX_VARINT_BYTES 10
+
+/**
+ * Initializes an empty buffer
+ */
+void codec_buf_init(codec_buf *buf) {
+    buf->data = NULL;
+    buf->len = 0;
+    buf->size = 0;
+}
+
+/**
+ * Frees the memory of a buffer
+ */
+void codec_buf_destroy(codec_buf *buf) {
+    free(buf->data);
+    codec_buf_init(buf);
+}
+
+/**
+ * Initializes a reader over some input
+ */
+void codec_reader_init(codec_reader *r, const void *data, size_t len) {
+    r->data = data;
+    r->len = len;
+    r->pos = 0;
+}
+
+// Makes room for more bytes, doubling the buffer
+static int codec_reserve(codec_buf *buf, size_t bytes) {
+    if (buf->len + bytes <= buf->size) return 0;
+    size_t size = (buf->size) ? buf->size : MIN_BUF_SIZE;
+    while (size < buf->len + bytes) size *= 2;
+    unsigned char *data = realloc(buf->data, size);
+    if (!data) return -1;
+    buf->data = data;
+    buf->size = size;
+    return 0;
+}
+
+int codec_put_u8(codec_buf *buf, uint8_t val) {
+    if (codec_reserve(buf, 1)) return -1;
+    buf->data[buf->len++] = val;
+    return 0;
+}
+
+// Writes 7 bits per byte, the high bit is set if more follow
+int codec_put_varint(codec_buf *buf, uint64_t val) {
+    if (codec_reserve(buf, MAX_VARINT_BYTES)) return -1;
+    while (val >= 0x80) {
+        buf->data[buf->len++] = (val & 0x7f) | 0x80;
+        val >>= 7;
+    }
+    buf->data[buf->len++] = val;
+    return 0;
+}
+
+// Zigzag encoding, so small negative values stay short
+int codec_put_svarint(codec_buf *buf, int64_t val) {
+    return codec_put_varint(buf, ((uint64_t)val << 1) ^ (uint64_t)(val >> 63));
+}
+
+int codec_put_u64(codec_buf *buf, uint64_t val) {
+    if (codec_reserve(buf, 8)) return -1;
+    for (int i=0; i < 8; i++) {
+        buf->data[buf->len++] = val >> (8 * i);
+    }
+    return 0;
+}
+
+int codec_put_double(codec_buf *buf, double val) {
+    uint64_t bits;
+    memcpy(&bits, &val, sizeof(bits));
+    return codec_put_u64(buf, bits);
+}
+
+int codec_put_version(codec_buf *buf) {
+    return codec_put_u8(buf, CODEC_VERSION);
+}
+
+int codec_get_u8(codec_reader *r, uint8_t *val) {
+    if (r->pos >= r->len) return -1;
+    *val = r->data[r->pos++];
+    return 0;
+}
+
+int codec_get_varint(codec_reader *r, uint64_t *val) {
+    uint64_t result = 0;
+    for (int shift=0; shift < 64; shift += 7) {
+        if (r->pos >= r->len) return -1;
+        unsigned char byte = r->data[r->pos++];
+        result |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *val = result;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int codec_get_u32(codec_reader *r, uint32_t *val) {
+    uint64_t v;
+    if (codec_get_varint(r, &v) || v > UINT32_MAX) return -1;
+    *val = v;
+    return 0;
+}
+
+int codec_get_svarint(codec_reader *r, int64_t *val) {
+    uint64_t v;
+    if (codec_get_varint(r, &v)) return -1;
+    *val = (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+    return 0;
+}
+
+int codec_get_u64(codec_reader *r, uint64_t *val) {
+    if (r->len - r->pos < 8) return -1;
+    uint64_t result = 0;
+    for (int i=0; i < 8; i++) {
+        result |= (uint64_t)r->data[r->pos++] << (8 * i);
+    }
+    *val = result;
+    return 0;
+}
+
+int codec_get_double(codec_reader *r, double *val) {
+    uint64_t bits;
+    if (codec_get_u64(r, &bits)) return -1;
+    memcpy(val, &bits, sizeof(bits));
+    return 0;
+}
+
+int codec_get_version(codec_reader *r) {
+    uint8_t version;
+    if (codec_get_u8(r, &version)) return -1;
+    return (version == CODEC_VERSION) ? 0 : -1;
+}
+
+int codec_check_count(codec_reader *r, uint64_t count, size_t min_bytes) {
+    return (count > (r->len - r->pos) / min_bytes) ? -1 : 0;
+}
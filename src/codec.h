@@ -0,0 +1,98 @@
+/**
+ * This module implements the binary encoding used to move
+ * the state of a metric between statsite instances. Integers
+ * are written as varints, hashes and doubles as 8 little-endian bytes,
+ * so the encoding does not depend on the host.
+ *
+ * Each metric type encodes itself, starting with CODEC_VERSION,
+ * and decodes into a fresh struct that can then be merged.
+ */
+#ifndef CODEC_H
+#define CODEC_H
+#include <stdint.h>
+#include <stddef.h>
+
+// The version of the encoding, bumped on incompatible changes
+#define CODEC_VERSION 1
+
+/**
+ * A growable output buffer
+ */
+typedef struct {
+    unsigned char *data;
+    size_t len;         // Bytes written
+    size_t size;        // Bytes allocated
+} codec_buf;
+
+/**
+ * A cursor over encoded input
+ */
+typedef struct {
+    const unsigned char *data;
+    size_t len;         // Bytes of input
+    size_t pos;         // Bytes consumed
+} codec_reader;
+
+/**
+ * Initializes an empty buffer
+ * @arg buf The buffer to initialize
+ */
+void codec_buf_init(codec_buf *buf);
+
+/**
+ * Frees the memory of a buffer
+ * @arg buf The buffer to destroy
+ */
+void codec_buf_destroy(codec_buf *buf);
+
+/**
+ * Initializes a reader over some input
+ * @arg r The reader to initialize
+ * @arg data The encoded input
+ * @arg len The length of the input
+ */
+void codec_reader_init(codec_reader *r, const void *data, size_t len);
+
+/**
+ * Functions to append a value to a buffer.
+ * @return 0 on success, -1 if the buffer could not grow.
+ */
+int codec_put_u8(codec_buf *buf, uint8_t val);
+int codec_put_varint(codec_buf *buf, uint64_t val);
+int codec_put_svarint(codec_buf *buf, int64_t val);
+int codec_put_u64(codec_buf *buf, uint64_t val);
+int codec_put_double(codec_buf *buf, double val);
+
+/**
+ * Writes the version byte that starts an encoded metric
+ * @return 0 on success.
+ */
+int codec_put_version(codec_buf *buf);
+
+/**
+ * Functions to read a value from a reader.
+ * @return 0 on success, -1 if the input is truncated,
+ * or the varint does not fit.
+ */
+int codec_get_u8(codec_reader *r, uint8_t *val);
+int codec_get_varint(codec_reader *r, uint64_t *val);
+int codec_get_u32(codec_reader *r, uint32_t *val);
+int codec_get_svarint(codec_reader *r, int64_t *val);
+int codec_get_u64(codec_reader *r, uint64_t *val);
+int codec_get_double(codec_reader *r, double *val);
+
+/**
+ * Reads and checks the version byte of an encoded metric
+ * @return 0 on success, -1 if the version is not supported.
+ */
+int codec_get_version(codec_reader *r);
+
+/**
+ * Checks that a count of encoded items, each taking at least
+ * min_bytes, could fit in the rest of the input. Used to
+ * reject bad counts before allocating for them.
+ * @return 0 if the count is possible, -1 otherwise.
+ */
+int codec_check_count(codec_reader *r, uint64_t count, size_t min_bytes);
+
+#endif
@@ -5,6 +5,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <syslog.h>
 #include <unistd.h>
@@ -20,6 +21,13 @@
 static char* histogram_section;
 static histogram_config *in_progress;
 
+/**
+ * Static pointers used while we are still
+ * parsing the configs for a quantile engine.
+ */
+static char* quantile_section;
+static quantile_config *quantile_in_progress;
+
 /**
  * Default statsite_config values. Should create
  * filters that are about 300KB initially, and suited
@@ -59,6 +67,18 @@ static const statsite_config DEFAULT_CONFIG = {
                         // Number of quantiles
     sizeof(default_quantiles) / sizeof(double),
     default_quantiles,  // Quantiles
+    0,                  // Handle all input on the main thread
+    32,                 // Receive up to 32 UDP datagrams per call
+    NULL,               // Do not track the UDP batch fill
+    false,              // Use the event loop for network input
+    10,                 // Evict names unused for 10 intervals
+    QUANTILE_CM,        // Cormode-Muthukrishnan quantiles by default
+    NULL,               // No per prefix quantile engines by default
+    NULL,
+    false,              // Stream results, not the state of the metrics
+    NULL,               // Aggregate locally, do not forward
+    65536,              // Forward in writes of up to 64KB
+    false,              // Run the stream command once per flush
 };
 
 /**
@@ -285,6 +305,71 @@ static int histogram_callback(void* user, const char* section, const char* name,
     return res;
 }
 
+/**
+ * Attempts to convert a string to a quantile engine,
+ * and write the value out.
+ * @arg val The string value
+ * @arg result The destination for the result
+ * @return 1 on success, 0 on error.
+ */
+static int value_to_quantile_engine(const char *val, quantile_engine *result) {
+    if (quantile_engine_from_name(val, result)) {
+        syslog(LOG_ERR, "Unknown quantile engine: %s", val);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Callback function to use with INIH for parsing quantile engine configs
+ * @arg user Opaque value. Actually a statsite_config pointer
+ * @arg name The config name
+ * @value = The config value
+ * @return 1 on success
+ */
+static int quantile_callback(void* user, const char* section, const char* name, const char* value) {
+    // Make sure we don't change sections with an unfinished config
+    if (quantile_in_progress && strcasecmp(quantile_section, section)) {
+        syslog(LOG_WARNING, "Unfinished configuration for section: %s", quantile_section);
+        return 0;
+    }
+
+    // Ensure we have something in progress
+    if (!quantile_in_progress) {
+        quantile_in_progress = calloc(1, sizeof(quantile_config));
+        quantile_section = strdup(section);
+    }
+
+    // Cast the user handle
+    statsite_config *config = (statsite_config*)user;
+
+    // Switch on the config
+    #define NAME_MATCH(param) (strcasecmp(param, name) == 0)
+
+    int res = 1;
+    if (NAME_MATCH("prefix")) {
+        quantile_in_progress->parts |= 1;
+        quantile_in_progress->prefix = strdup(value);
+
+    } else if (NAME_MATCH("engine")) {
+        quantile_in_progress->parts |= 1 << 1;
+        res = value_to_quantile_engine(value, &quantile_in_progress->engine);
+
+    } else {
+        syslog(LOG_NOTICE, "Unrecognized quantile config parameter: %s", value);
+    }
+
+    // Check if this config is done, and push into the list of configs
+    if (quantile_in_progress->parts == 3) {
+        quantile_in_progress->next = config->quantile_configs;
+        config->quantile_configs = quantile_in_progress;
+        quantile_in_progress = NULL;
+        free(quantile_section);
+        quantile_section = NULL;
+    }
+    return res;
+}
+
 /**
  * Callback function to use with INI-H.
  * @arg user Opaque user value. We use the statsite_config pointer
@@ -299,6 +384,11 @@ static int config_callback(void* user, const char* section, const char* name, co
         return histogram_callback(user, section, name, value);
     }
 
+    // Specially handle quantile engine sections
+    if (strncasecmp("quantile", section, 8) == 0) {
+        return quantile_callback(user, section, name, value);
+    }
+
     // Ignore any non-statsite sections
     if (strcasecmp("statsite", section) != 0) {
         return 0;
@@ -321,10 +411,20 @@ static int config_callback(void* user, const char* section, const char* name, co
         return value_to_int(value, &config->udp_rcvbuf);
     } else if (NAME_MATCH("flush_interval")) {
          return value_to_int(value, &config->flush_interval);
+    } else if (NAME_MATCH("worker_threads")) {
+        return value_to_int(value, &config->worker_threads);
+    } else if (NAME_MATCH("key_idle_intervals")) {
+        return value_to_int(value, &config->key_idle_intervals);
+    } else if (NAME_MATCH("udp_batch_size")) {
+        return value_to_int(value, &config->udp_batch_size);
+    } else if (NAME_MATCH("forward_batch_size")) {
+        return value_to_int(value, &config->forward_batch_size);
     } else if (NAME_MATCH("parse_stdin")) {
         return value_to_bool(value, &config->parse_stdin);
     } else if (NAME_MATCH("daemonize")) {
         return value_to_bool(value, &config->daemonize);
+    } else if (NAME_MATCH("io_uring")) {
+        return value_to_bool(value, &config->io_uring);
     } else if (NAME_MATCH("aligned_flush")) {
         return value_to_bool(value, &config->aligned_flush);
     } else if (NAME_MATCH("binary_stream")) {
@@ -337,6 +437,10 @@ static int config_callback(void* user, const char* section, const char* name, co
         return value_to_bool(value, &config->legacy_extended_counters);
     } else if (NAME_MATCH("prefix_binary_stream")) {
         return value_to_bool(value, &config->prefix_binary_stream);
+    } else if (NAME_MATCH("state_stream")) {
+        return value_to_bool(value, &config->state_stream);
+    } else if (NAME_MATCH("persistent_stream")) {
+        return value_to_bool(value, &config->persistent_stream);
 
     // Handle the double cases
     } else if (NAME_MATCH("timer_eps")) {
@@ -344,6 +448,10 @@ static int config_callback(void* user, const char* section, const char* name, co
     } else if (NAME_MATCH("set_eps")) {
         return value_to_double(value, &config->set_eps);
 
+    // Handle the quantile engine by name
+    } else if (NAME_MATCH("quantile_engine")) {
+        return value_to_quantile_engine(value, &config->quantile_engine);
+
     // Handle quantiles as a comma-separated list of doubles
     } else if (NAME_MATCH("quantiles")) {
         return value_to_list_of_doubles(value, &config->quantiles, &config->num_quantiles);
@@ -359,6 +467,10 @@ static int config_callback(void* user, const char* section, const char* name, co
         config->pid_file = strdup(value);
     } else if (NAME_MATCH("input_counter")) {
         config->input_counter = strdup(value);
+    } else if (NAME_MATCH("udp_batch_timer")) {
+        config->udp_batch_timer = strdup(value);
+    } else if (NAME_MATCH("forward_hosts")) {
+        config->forward_hosts = strdup(value);
     } else if (NAME_MATCH("bind_address")) {
         config->bind_address = strdup(value);
     } else if (NAME_MATCH("global_prefix")) {
@@ -446,6 +558,16 @@ int config_from_filename(char *filename, statsite_config *config) {
         histogram_section = NULL;
     }
 
+    // Check for an unfinished quantile engine
+    if (quantile_in_progress) {
+        syslog(LOG_WARNING, "Unfinished configuration for section: %s", quantile_section);
+        free(quantile_section);
+        free(quantile_in_progress->prefix);
+        free(quantile_in_progress);
+        quantile_in_progress = NULL;
+        quantile_section = NULL;
+    }
+
     return 0;
 }
 
@@ -623,6 +745,77 @@ int sane_quantiles(int num_quantiles, double quantiles[]) {
     return 0;
 }
 
+int sane_worker_threads(int threads) {
+    if (threads < 0) {
+        syslog(LOG_ERR, "Worker threads cannot be negative!");
+        return 1;
+    } else if (threads > 64) {
+        syslog(LOG_WARNING, "Worker thread count very high! Threads: %d", threads);
+    }
+#ifndef SO_REUSEPORT
+    if (threads > 0) {
+        syslog(LOG_ERR, "Worker threads require SO_REUSEPORT support!");
+        return 1;
+    }
+#endif
+    return 0;
+}
+
+int sane_udp_batch_size(int batch_size) {
+    if (batch_size < 1) {
+        syslog(LOG_ERR, "UDP batch size must be at least 1!");
+        return 1;
+    } else if (batch_size > 1024) {
+        syslog(LOG_ERR, "UDP batch size cannot be greater than 1024!");
+        return 1;
+    }
+    return 0;
+}
+
+int sane_key_idle_intervals(int intervals) {
+    if (intervals < 0) {
+        syslog(LOG_ERR, "Key idle intervals cannot be negative!");
+        return 1;
+    }
+    return 0;
+}
+
+int sane_forward_hosts(char *hosts) {
+    // Forwarding is disabled by default
+    if (!hosts) return 0;
+
+    // Each upstream is a host:port, separated by commas
+    char *copy = strdup(hosts), *saveptr = NULL, *port, *end;
+    int num = 0, res = 0;
+    for (char *host = strtok_r(copy, ", ", &saveptr); host && !res;
+            host = strtok_r(NULL, ", ", &saveptr)) {
+        port = strrchr(host, ':');
+        long val = (port) ? strtol(port + 1, &end, 10) : 0;
+        if (!port || port == host || *end || val < 1 || val > 65535) {
+            syslog(LOG_ERR, "Forward hosts must be given as host:port! Got: %s", host);
+            res = 1;
+        }
+        num++;
+    }
+    free(copy);
+    if (!res && !num) {
+        syslog(LOG_ERR, "Forward hosts cannot be empty!");
+        res = 1;
+    }
+    return res;
+}
+
+int sane_forward_batch_size(int batch_size) {
+    if (batch_size < 512) {
+        syslog(LOG_ERR, "Forward batch size must be at least 512 bytes!");
+        return 1;
+    } else if (batch_size > 1048576) {
+        syslog(LOG_ERR, "Forward batch size cannot be greater than 1MB!");
+        return 1;
+    }
+    return 0;
+}
+
 /**
  * Allocates memory for a new config structure
  * @return a pointer to a new config structure on success.
@@ -639,6 +832,19 @@ void free_config(statsite_config* config) {
     if (config->quantiles != default_quantiles) {
         free (config->quantiles);
     }
+
+    // Free the quantile engine configs
+    if (config->quantile_engines) {
+        radix_destroy(config->quantile_engines);
+        free(config->quantile_engines);
+    }
+    quantile_config *next, *current = config->quantile_configs;
+    while (current) {
+        next = current->next;
+        free(current->prefix);
+        free(current);
+        current = next;
+    }
     free(config);
 }
 
@@ -658,15 +864,58 @@ int validate_config(statsite_config *config) {
     res |= sane_histograms(config->hist_configs);
     res |= sane_set_precision(config->set_eps, &config->set_precision);
     res |= sane_quantiles(config->num_quantiles, config->quantiles);
+    res |= sane_worker_threads(config->worker_threads);
+    res |= sane_udp_batch_size(config->udp_batch_size);
+    res |= sane_key_idle_intervals(config->key_idle_intervals);
+    res |= sane_forward_hosts(config->forward_hosts);
+    res |= sane_forward_batch_size(config->forward_batch_size);
 
     return res;
 }
 
+/**
+ * Builds the radix tree of the quantile engines
+ * @return 0 on success
+ */
+static int build_quantile_tree(statsite_config *config) {
+    // Do nothing if there is no config
+    if (!config->quantile_configs)
+        return 0;
+
+    radix_tree *t = malloc(sizeof(radix_tree));
+    int res = radix_init(t);
+    if (res) {
+        free(t);
+        return 1;
+    }
+
+    // Add all the prefixes
+    quantile_config *current = config->quantile_configs;
+    void *val;
+    while (!res && current) {
+        val = current;
+        res = radix_insert(t, current->prefix, &val);
+        current = current->next;
+    }
+
+    if (res) {
+        radix_destroy(t);
+        free(t);
+        return 1;
+    }
+    config->quantile_engines = t;
+    return 0;
+}
+
 /**
  * Builds the radix tree for prefix matching
  * @return 0 on success
  */
 int build_prefix_tree(statsite_config *config) {
+    // Build the quantile engine tree first
+    if (build_quantile_tree(config))
+        return 1;
+
     // Do nothing if there is no config
     if (!config->hist_configs)
         return 0;
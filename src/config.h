@@ -4,6 +4,7 @@
 #include <syslog.h>
 #include <stdbool.h>
 #include "radix.h"
+#include "quantile.h"
 
 typedef enum {
     UNKNOWN,
@@ -41,6 +42,14 @@ typedef struct histogram_config {
     char parts;
 } histogram_config;
 
+// Selects the quantile engine of the timers under a prefix
+typedef struct quantile_config {
+    char *prefix;
+    quantile_engine engine;
+    struct quantile_config *next;
+    char parts;
+} quantile_config;
+
 
 /**
  * Stores our configuration
@@ -77,6 +86,18 @@ typedef struct {
     bool prefix_binary_stream;
     int num_quantiles;
     double* quantiles;
+    int worker_threads;
+    int udp_batch_size;
+    char *udp_batch_timer;
+    bool io_uring;
+    int key_idle_intervals;
+    quantile_engine quantile_engine;
+    quantile_config *quantile_configs;
+    radix_tree *quantile_engines;
+    bool state_stream;
+    char *forward_hosts;
+    int forward_batch_size;
+    bool persistent_stream;
 } statsite_config;
 
 /**
@@ -123,6 +144,11 @@ int sane_flush_interval(int intv);
 int sane_histograms(histogram_config *config);
 int sane_set_precision(double eps, unsigned char *precision);
 int sane_quantiles(int num_quantiles, double quantiles[]);
+int sane_worker_threads(int threads);
+int sane_udp_batch_size(int batch_size);
+int sane_key_idle_intervals(int intervals);
+int sane_forward_hosts(char *hosts);
+int sane_forward_batch_size(int batch_size);
 
 /**
  * Joins two strings as part of a path,
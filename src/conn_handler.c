@@ -6,6 +6,7 @@
 #include <assert.h>
 #include <pthread.h>
 #include <signal.h>
+#include <time.h>
 #include <sys/time.h>
 #include <netinet/in.h>
 #include <math.h>
@@ -14,16 +15,20 @@
 #include "conn_handler.h"
 #include <inttypes.h>
 #include "ascii_parser.h"
+#include "fastfloat.h"
+#include "forward.h"
 
 /*
  * Binary defines
  */
+#define BIN_TYPE_NONE           0x0
 #define BIN_TYPE_KV             0x1
 #define BIN_TYPE_COUNTER        0x2
 #define BIN_TYPE_TIMER          0x3
 #define BIN_TYPE_SET            0x4
 #define BIN_TYPE_GAUGE          0x5
 #define BIN_TYPE_GAUGE_DELTA    0x6
+#define BIN_TYPE_STATE          0x7
 
 #define BIN_OUT_NO_TYPE 0x0
 #define BIN_OUT_SUM     0x1
@@ -60,7 +65,14 @@ int BIN_TYPE_MAP[METRIC_TYPES] = {
 /* Static method declarations */
 static int handle_binary_client_connect(statsite_conn_handler *handle);
 static int handle_ascii_client_connect(statsite_conn_handler *handle);
+static int handle_binary_datagram(unsigned char *buf, int len);
+static int handle_state(unsigned char *key, uint16_t key_len, unsigned char *state, uint32_t state_len);
+static size_t parse_ascii_lines(ascpp *parser, char *buf, size_t len, size_t skip);
+static int forward_client_connect(statsite_conn_handler *handle, forwarder *fw, unsigned char magic);
+static void forward_datagrams(forwarder *fw, struct iovec *datagrams, int num);
 static int buffer_after_terminator(char *buf, int buf_len, char terminator, char **after_term, int *after_len);
+static metrics* new_metrics(int shard);
+static metrics* next_metrics(int shard);
 
 // This is the magic byte that indicates we are handling
 // a binary command, instead of an ASCII command. We use
@@ -69,28 +81,159 @@ static const unsigned char BINARY_MAGIC_BYTE = 0xaa;
 static const int MAX_BINARY_HEADER_SIZE = 12;
 static const int MIN_BINARY_HEADER_SIZE = 6;
 
+// The header of a state command is followed by a 4 byte state
+// length, and the largest state accepted bounds the buffering
+static const int STATE_HEADER_SIZE = 8;
+static const uint32_t MAX_STATE_SIZE = 16 * 1024 * 1024;
+
+// How long the final flush waits for the forwarded commands to be sent
+static const int FORWARD_DRAIN_MS = 5000;
+
+// How long the final flush waits for the earlier flushes to finish
+static const int FLUSH_WAIT_MS = 30000;
+
 /**
- * This is the current metrics object we are using
+ * Each event loop updates its own metrics shard. The
+ * lock is only contended when the flush swaps the shards.
+ * Once flushed, the metrics of a shard are reset and kept
+ * as its spare, to be swapped in at the next interval.
+ * The names are interned in a table of the shard, which
+ * outlives its metrics, and is guarded by the lock.
  */
-static metrics *GLOBAL_METRICS;
+typedef struct {
+    pthread_mutex_t lock;
+    metrics *m;
+    metrics *spare;     // Reset metrics to reuse, guarded by SPARE_LOCK
+    intern_table *names;
+    forwarder *fw;      // Set in forward mode, used only by the event loop
+} metrics_shard;
+
+/**
+ * These are the current metrics shards we are using.
+ * Shard 0 belongs to the main event loop, and the rest
+ * to the worker threads.
+ */
+static metrics_shard *GLOBAL_SHARDS;
+static int NUM_SHARDS;
 static statsite_config *GLOBAL_CONFIG;
 
+/**
+ * The stream command kept running between flushes,
+ * if persistent_stream is enabled.
+ */
+static stream_sink *GLOBAL_SINK;
+static pthread_mutex_t SPARE_LOCK = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * The number of flushes in progress. Interned names are
+ * only evicted when there are none, since the metrics
+ * being flushed may still refer to them. The final flush
+ * waits on FLUSH_DONE until the count drops to zero.
+ */
+static pthread_mutex_t FLUSH_LOCK = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t FLUSH_DONE = PTHREAD_COND_INITIALIZER;
+static int FLUSHES_RUNNING = 0;
+
+/**
+ * The metrics of the shard held by the calling thread,
+ * used by the parser callbacks.
+ */
+static __thread metrics *GLOBAL_METRICS;
+
 void emit_stat(metric_type type,
     token *name, token *value, token *samplerate);
 
 /**
  * Invoked to initialize the conn handler layer.
+ * @return 0 on success.
  */
-void init_conn_handler(statsite_config *config) {
-    // Make the initial metrics object
+int init_conn_handler(statsite_config *config) {
+    // Store the config
+    GLOBAL_CONFIG = config;
+
+    // The sink command is started by the first flush
+    if (config->persistent_stream) {
+        int res = stream_sink_init(config->stream_cmd, &GLOBAL_SINK);
+        assert(res == 0);
+    }
+
+    // Make the initial metrics objects
+    NUM_SHARDS = config->worker_threads + 1;
+    GLOBAL_SHARDS = calloc(NUM_SHARDS, sizeof(metrics_shard));
+    for (int i=0; i < NUM_SHARDS; i++) {
+        pthread_mutex_init(&GLOBAL_SHARDS[i].lock, NULL);
+        intern_init(&GLOBAL_SHARDS[i].names);
+        GLOBAL_SHARDS[i].m = new_metrics(i);
+
+        // In forward mode each event loop has its own upstream connections
+        if (config->forward_hosts) {
+            GLOBAL_SHARDS[i].fw = malloc(sizeof(forwarder));
+            if (init_forwarder(config->forward_hosts, config->forward_batch_size, GLOBAL_SHARDS[i].fw)) {
+                free(GLOBAL_SHARDS[i].fw);
+                GLOBAL_SHARDS[i].fw = NULL;
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * Allocates and initializes a metrics object for a
+ * shard using the global configuration.
+ */
+static metrics* new_metrics(int shard) {
     metrics *m = malloc(sizeof(metrics));
-    int res = init_metrics(config->timer_eps, config->quantiles,
-            config->num_quantiles, config->histograms, config->set_precision, m);
+    int res = init_metrics(GLOBAL_CONFIG->timer_eps, GLOBAL_CONFIG->quantiles,
+            GLOBAL_CONFIG->num_quantiles, GLOBAL_CONFIG->histograms,
+            GLOBAL_CONFIG->set_precision, m);
     assert(res == 0);
-    GLOBAL_METRICS = m;
+    metrics_set_quantile_engines(m, GLOBAL_CONFIG->quantile_engine, GLOBAL_CONFIG->quantile_engines);
+    metrics_share_names(m, GLOBAL_SHARDS[shard].names);
+    return m;
+}
 
-    // Store the config
-    GLOBAL_CONFIG = config;
+/**
+ * Returns the metrics to swap into a shard. This is the spare
+ * of the shard if the last flush has finished with it. Otherwise
+ * new metrics are sized like the current ones, so that the maps
+ * do not have to grow during the interval.
+ */
+static metrics* next_metrics(int shard) {
+    pthread_mutex_lock(&SPARE_LOCK);
+    metrics *m = GLOBAL_SHARDS[shard].spare;
+    GLOBAL_SHARDS[shard].spare = NULL;
+    pthread_mutex_unlock(&SPARE_LOCK);
+    if (m) return m;
+
+    metrics_sizes sizes;
+    pthread_mutex_lock(&GLOBAL_SHARDS[shard].lock);
+    metrics_get_sizes(GLOBAL_SHARDS[shard].m, &sizes);
+    pthread_mutex_unlock(&GLOBAL_SHARDS[shard].lock);
+
+    m = new_metrics(shard);
+    reset_metrics(m, &sizes);
+    return m;
+}
+
+/**
+ * Resets flushed metrics and keeps them as the spare of
+ * a shard. If the shard still has a spare, it is replaced.
+ * @arg shard The shard the metrics came from
+ * @arg m The flushed metrics
+ * @arg sizes The number of metrics the shard had
+ */
+static void recycle_metrics(int shard, metrics *m, metrics_sizes *sizes) {
+    reset_metrics(m, sizes);
+    pthread_mutex_lock(&SPARE_LOCK);
+    metrics *old = GLOBAL_SHARDS[shard].spare;
+    GLOBAL_SHARDS[shard].spare = m;
+    pthread_mutex_unlock(&SPARE_LOCK);
+
+    if (old) {
+        destroy_metrics(old);
+        free(old);
+    }
 }
 
 /**
@@ -281,29 +424,187 @@ static int stream_formatter_bin(FILE *pipe, void *data, metric_type type, char *
     return 0;
 }
 
+/* The header of a state command */
+#pragma pack(push,1)
+struct binary_state_prefix {
+    uint8_t  magic;
+    uint8_t  type;
+    uint16_t key_len;
+    uint32_t state_len;
+};
+
+/* The header of a K/V command */
+struct binary_kv_prefix {
+    uint8_t  magic;
+    uint8_t  type;
+    uint16_t key_len;
+    double   val;
+};
+#pragma pack(pop)
+
 /**
- * This is the thread that is invoked to handle flushing metrics
+ * Streaming callback to write the state of each metric as
+ * binary commands, so that another statsite instance can
+ * merge them. K/V pairs are written as K/V commands.
+ * @arg data A buffer to encode into
+ */
+static int stream_formatter_state(FILE *pipe, void *data, metric_type type, char *name, void *value) {
+    codec_buf *buf = data;
+    uint16_t key_len = strlen(name) + 1;
+    uint8_t bin_type;
+    switch (type) {
+        case KEY_VAL: {
+            struct binary_kv_prefix out = {BINARY_MAGIC_BYTE, BIN_TYPE_KV, key_len, *(double*)value};
+            if (!fwrite(&out, sizeof(out), 1, pipe)) return 1;
+            if (!fwrite(name, key_len, 1, pipe)) return 1;
+            return 0;
+        }
+        case COUNTER:
+            bin_type = BIN_TYPE_COUNTER;
+            break;
+        case TIMER:
+            bin_type = BIN_TYPE_TIMER;
+            break;
+        case SET:
+            bin_type = BIN_TYPE_SET;
+            break;
+        case GAUGE:
+            bin_type = BIN_TYPE_GAUGE;
+            break;
+        default:
+            syslog(LOG_ERR, "Unknown metric type: %d", type);
+            return 0;
+    }
+
+    // The state starts with the metric type
+    buf->len = 0;
+    if (codec_put_u8(buf, bin_type) || metrics_encode_state(type, value, buf)) {
+        syslog(LOG_ERR, "Failed to encode the state of: %s", name);
+        return 0;
+    }
+    if (buf->len > MAX_STATE_SIZE) {
+        syslog(LOG_ERR, "The state of %s is too large to stream: %zu bytes", name, buf->len);
+        return 0;
+    }
+
+    struct binary_state_prefix out = {BINARY_MAGIC_BYTE, BIN_TYPE_STATE, key_len, buf->len};
+    if (!fwrite(&out, sizeof(out), 1, pipe)) return 1;
+    if (!fwrite(name, key_len, 1, pipe)) return 1;
+    if (!fwrite(buf->data, buf->len, 1, pipe)) return 1;
+    return 0;
+}
+
+/**
+ * Streams the metrics to the stream command. A persistent
+ * command gets them as a batch, followed by an end marker.
+ * @arg m The metrics to stream
+ * @arg data An opaque handle passed to the callback
+ * @arg cb The callback to invoke
+ * @arg end The marker that ends a batch
+ * @arg end_len The length of the marker
+ * @return 0 on success.
+ */
+static int stream_metrics(metrics *m, void *data, stream_callback cb, const void *end, size_t end_len) {
+    if (GLOBAL_SINK)
+        return stream_to_sink(GLOBAL_SINK, m, data, cb, end, end_len);
+
+    int res = stream_to_command(m, data, cb, GLOBAL_CONFIG->stream_cmd);
+    if (res != 0) {
+        syslog(LOG_WARNING, "Streaming command exited with status %d", res);
+    }
+    return res;
+}
+
+/**
+ * Counts a flush as started
+ * @return The number of flushes that were already running.
+ */
+static int flush_started() {
+    pthread_mutex_lock(&FLUSH_LOCK);
+    int running = FLUSHES_RUNNING++;
+    pthread_mutex_unlock(&FLUSH_LOCK);
+    return running;
+}
+
+/**
+ * Counts a flush as finished, and wakes the
+ * final flush once none are running
+ */
+static void flush_finished() {
+    pthread_mutex_lock(&FLUSH_LOCK);
+    if (--FLUSHES_RUNNING == 0) pthread_cond_broadcast(&FLUSH_DONE);
+    pthread_mutex_unlock(&FLUSH_LOCK);
+}
+
+/**
+ * Waits for the running flushes to finish
+ * @arg timeout_ms The most time to wait
+ * @return 0 if none are running, -1 on timeout.
+ */
+static int wait_for_flushes(int timeout_ms) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&FLUSH_LOCK);
+    int err = 0;
+    while (FLUSHES_RUNNING && err != ETIMEDOUT) {
+        err = pthread_cond_timedwait(&FLUSH_DONE, &FLUSH_LOCK, &deadline);
+    }
+    int running = FLUSHES_RUNNING;
+    pthread_mutex_unlock(&FLUSH_LOCK);
+    return (running) ? -1 : 0;
+}
+
+/**
+ * This is the thread that is invoked to handle flushing metrics.
+ * It is given an array with the metrics of every shard, which
+ * are merged into the first before streaming.
  */
 static void* flush_thread(void *arg) {
     // Cast the args
-    metrics *m = arg;
+    metrics **shards = arg;
+    metrics *m = shards[0];
+
+    // Note the size of each shard, before combining them
+    metrics_sizes sizes[NUM_SHARDS];
+    for (int i=0; i < NUM_SHARDS; i++) {
+        metrics_get_sizes(shards[i], sizes + i);
+    }
+    for (int i=1; i < NUM_SHARDS; i++) {
+        metrics_merge(m, shards[i]);
+    }
 
     // Get the current time
     struct timeval tv;
     gettimeofday(&tv, NULL);
 
-    // Determine which callback to use
-    stream_callback cb = (GLOBAL_CONFIG->binary_stream)? stream_formatter_bin: stream_formatter;
-
-    // Stream the records
-    int res = stream_to_command(m, &tv, cb, GLOBAL_CONFIG->stream_cmd);
-    if (res != 0) {
-        syslog(LOG_WARNING, "Streaming command exited with status %d", res);
+    // Stream the records, or the state of the metrics. A batch ends
+    // with an empty line, which the binary protocol skips as well,
+    // or with a binary record of no type.
+    if (GLOBAL_CONFIG->state_stream) {
+        codec_buf buf;
+        codec_buf_init(&buf);
+        stream_metrics(m, &buf, stream_formatter_state, "\n", 1);
+        codec_buf_destroy(&buf);
+    } else if (GLOBAL_CONFIG->binary_stream) {
+        struct binary_out_prefix end = {tv.tv_sec, BIN_TYPE_NONE, BIN_OUT_NO_TYPE, 0, 0};
+        stream_metrics(m, &tv, stream_formatter_bin, &end, sizeof(end));
+    } else {
+        stream_metrics(m, &tv, stream_formatter, "\n", 1);
     }
 
-    // Cleanup
-    destroy_metrics(m);
-    free(m);
+    // Reuse the metrics for the next interval of each shard
+    for (int i=0; i < NUM_SHARDS; i++) {
+        recycle_metrics(i, shards[i], sizes + i);
+    }
+    free(shards);
+    flush_finished();
     return NULL;
 }
 
@@ -311,15 +612,28 @@ static void* flush_thread(void *arg) {
  * Invoked to when we've reached the flush interval timeout
  */
 void flush_interval_trigger() {
-    // Make a new metrics object
-    metrics *m = malloc(sizeof(metrics));
-    init_metrics(GLOBAL_CONFIG->timer_eps, GLOBAL_CONFIG->quantiles,
-            GLOBAL_CONFIG->num_quantiles, GLOBAL_CONFIG->histograms,
-            GLOBAL_CONFIG->set_precision, m);
-
-    // Swap with the new one
-    metrics *old = GLOBAL_METRICS;
-    GLOBAL_METRICS = m;
+    // Nothing is aggregated when forwarding
+    if (GLOBAL_CONFIG->forward_hosts) return;
+
+    // Names unused for a while can be evicted, unless an
+    // earlier flush is still streaming metrics that use them
+    int idle = GLOBAL_CONFIG->key_idle_intervals;
+    if (flush_started()) idle = 0;
+
+    // Swap each shard with a new metrics object
+    metrics **old = malloc(NUM_SHARDS * sizeof(metrics*));
+    for (int i=0; i < NUM_SHARDS; i++) {
+        metrics *m = next_metrics(i);
+        pthread_mutex_lock(&GLOBAL_SHARDS[i].lock);
+        old[i] = GLOBAL_SHARDS[i].m;
+        GLOBAL_SHARDS[i].m = m;
+
+        // The inputs are added while the names can still be interned
+        if (GLOBAL_CONFIG->input_counter)
+            metrics_flush_inputs(old[i], GLOBAL_CONFIG->input_counter);
+        intern_next_interval(GLOBAL_SHARDS[i].names, idle);
+        pthread_mutex_unlock(&GLOBAL_SHARDS[i].lock);
+    }
 
     // Start a flush thread
     pthread_t thread;
@@ -340,10 +654,20 @@ void flush_interval_trigger() {
         return;
     }
 
+    // Fold anything received since the swap back into
+    // the old metrics, and restore them for the next interval
     syslog(LOG_WARNING, "Failed to spawn flush thread: %s", strerror(err));
-    GLOBAL_METRICS = old;
-    destroy_metrics(m);
-    free(m);
+    flush_finished();
+    for (int i=0; i < NUM_SHARDS; i++) {
+        pthread_mutex_lock(&GLOBAL_SHARDS[i].lock);
+        metrics *m = GLOBAL_SHARDS[i].m;
+        metrics_merge(old[i], m);
+        GLOBAL_SHARDS[i].m = old[i];
+        pthread_mutex_unlock(&GLOBAL_SHARDS[i].lock);
+        destroy_metrics(m);
+        free(m);
+    }
+    free(old);
 }
 
 /**
@@ -351,13 +675,76 @@ void flush_interval_trigger() {
  * final set of metrics
  */
 void final_flush() {
-    // Get the last set of metrics
-    metrics *old = GLOBAL_METRICS;
-    GLOBAL_METRICS = NULL;
-    flush_thread(old);
+    // Earlier flushes still use the sink and the spares, and
+    // waiting for them keeps the last batch after theirs
+    int done = !wait_for_flushes(FLUSH_WAIT_MS);
+    if (!done) syslog(LOG_WARNING, "Timed out waiting for the earlier flushes!");
+
+    // Get the last set of metrics, the
+    // worker threads have been stopped by now
+    metrics **old = malloc(NUM_SHARDS * sizeof(metrics*));
+    for (int i=0; i < NUM_SHARDS; i++) {
+        old[i] = GLOBAL_SHARDS[i].m;
+        GLOBAL_SHARDS[i].m = NULL;
+        if (GLOBAL_CONFIG->input_counter)
+            metrics_flush_inputs(old[i], GLOBAL_CONFIG->input_counter);
+    }
+    if (!GLOBAL_CONFIG->forward_hosts) {
+        flush_started();
+        flush_thread(old);
+    } else {
+        // The metrics are empty, since nothing was aggregated
+        for (int i=0; i < NUM_SHARDS; i++) {
+            destroy_metrics(old[i]);
+            free(old[i]);
+        }
+        free(old);
+    }
+
+    // Let the sink command handle the last batch and exit
+    if (GLOBAL_SINK && done) {
+        int res = stream_sink_destroy(GLOBAL_SINK);
+        if (res != 0) syslog(LOG_WARNING, "Streaming command exited with status %d", res);
+        GLOBAL_SINK = NULL;
+    }
+
+    // Send what is left to forward
+    for (int i=0; i < NUM_SHARDS; i++) {
+        forwarder *fw = GLOBAL_SHARDS[i].fw;
+        if (!fw) continue;
+        if (forward_drain(fw, FORWARD_DRAIN_MS))
+            syslog(LOG_WARNING, "Timed out forwarding the final commands!");
+        destroy_forwarder(fw);
+        free(fw);
+        GLOBAL_SHARDS[i].fw = NULL;
+    }
+
+    // Nothing will be swapped in again, but a flush
+    // that timed out may still recycle into the spares
+    if (!done) return;
+    pthread_mutex_lock(&SPARE_LOCK);
+    for (int i=0; i < NUM_SHARDS; i++) {
+        metrics *m = GLOBAL_SHARDS[i].spare;
+        GLOBAL_SHARDS[i].spare = NULL;
+        if (m) {
+            destroy_metrics(m);
+            free(m);
+        }
+    }
+    pthread_mutex_unlock(&SPARE_LOCK);
 }
 
 
+/**
+ * Invoked by each event loop in forward mode, to write
+ * out the commands batched by its shard.
+ * @arg shard The shard of the event loop
+ */
+void forward_interval_trigger(int shard) {
+    forwarder *fw = GLOBAL_SHARDS[shard].fw;
+    if (fw) forward_flush(fw);
+}
+
 /**
  * Invoked by the networking layer when there is new
  * data to be handled. The connection handler should
@@ -371,48 +758,88 @@ int handle_client_connect(statsite_conn_handler *handle) {
     unsigned char magic;
     if (unlikely(peek_client_byte(handle->conn, &magic) == -1)) return 0;
 
+    // Forward the commands instead of aggregating them
+    forwarder *fw = GLOBAL_SHARDS[handle->shard].fw;
+    if (fw) return forward_client_connect(handle, fw, magic);
+
+    // Hold our shard while we are updating it
+    metrics_shard *shard = GLOBAL_SHARDS + handle->shard;
+    pthread_mutex_lock(&shard->lock);
+    GLOBAL_METRICS = shard->m;
+
     // Check the magic byte
+    int res;
     if (magic == BINARY_MAGIC_BYTE)
-        return handle_binary_client_connect(handle);
+        res = handle_binary_client_connect(handle);
     else
-        return handle_ascii_client_connect(handle);
+        res = handle_ascii_client_connect(handle);
+
+    GLOBAL_METRICS = NULL;
+    pthread_mutex_unlock(&shard->lock);
+    return res;
 }
 
 /**
- * Simple string to double conversion
+ * Invoked by the networking layer with a batch of datagrams,
+ * each of which holds complete ASCII or binary records. The end
+ * of a datagram terminates its last record, so the byte after
+ * each datagram must be writable to hold a newline.
+ * @arg handle The connection related information
+ * @arg datagrams The datagrams to handle, empty ones are skipped
+ * @arg num The number of datagrams
+ * @return 0 on success.
  */
-static double str2double(const char *s, char **end) {
-    double val = 0.0;
-    char neg = 0;
-    const char *orig_s = s;
+int handle_client_datagrams(statsite_conn_handler *handle, struct iovec *datagrams, int num) {
+    ascpp ascii_parser = ascpp_init(emit_stat);
+    char *buf;
+    int len;
 
-    switch (*s) {
-        case '-':
-            neg = 1;
-        case '+':
-            s++;
-    }
-    for (; *s >= '0' && *s <= '9'; s++) {
-        val = (val * 10.0) + (*s - '0');
+    // Forward the commands instead of aggregating them
+    forwarder *fw = GLOBAL_SHARDS[handle->shard].fw;
+    if (fw) {
+        forward_datagrams(fw, datagrams, num);
+        return 0;
     }
-    if (*s == '.') {
-        s++;
-        double frac = 0.0;
-        int digits = 0;
-        for (; *s >= '0' && *s <= '9'; s++) {
-            frac = (frac * 10.0) + (*s - '0');
-            digits++;
+
+    // Hold our shard while we are updating it
+    metrics_shard *shard = GLOBAL_SHARDS + handle->shard;
+    pthread_mutex_lock(&shard->lock);
+    GLOBAL_METRICS = shard->m;
+
+    for (int i=0; i < num; i++) {
+        buf = datagrams[i].iov_base;
+        len = datagrams[i].iov_len;
+        if (unlikely(len == 0)) continue;
+
+        // Parse the datagram in place
+        if ((unsigned char)buf[0] == BINARY_MAGIC_BYTE) {
+            handle_binary_datagram((unsigned char*)buf, len);
+        } else {
+            if (buf[len-1] != '\n') buf[len++] = '\n';
+            parse_ascii_lines(&ascii_parser, buf, len, 0);
         }
-        val += frac / pow(10.0, digits);
     }
-    if (unlikely(*s == 'E' || *s == 'e')) {
-        errno = 0;
-        return strtod(orig_s, end);
-    }
-    if (neg) val *= -1.0;
-    if (end) *end = (char*)s;
-    errno = 0;
-    return val;
+
+    GLOBAL_METRICS = NULL;
+    pthread_mutex_unlock(&shard->lock);
+    return 0;
+}
+
+/**
+ * Invoked by the networking layer after each batched
+ * UDP receive, so that the batch fill can be tracked.
+ * The fill is recorded as a timer, so its mean is the
+ * average number of datagrams per receive.
+ * @arg handle The connection related information
+ * @arg datagrams The number of datagrams received
+ */
+void handle_udp_batch(statsite_conn_handler *handle, int datagrams) {
+    if (!GLOBAL_CONFIG->udp_batch_timer || GLOBAL_CONFIG->forward_hosts) return;
+
+    metrics_shard *shard = GLOBAL_SHARDS + handle->shard;
+    pthread_mutex_lock(&shard->lock);
+    metrics_add_sample(shard->m, TIMER, GLOBAL_CONFIG->udp_batch_timer, datagrams, 1.0);
+    pthread_mutex_unlock(&shard->lock);
 }
 
 void emit_stat(metric_type type,
@@ -428,8 +855,7 @@ void emit_stat(metric_type type,
         }
     }
     // Increment the number of inputs received
-    if (GLOBAL_CONFIG->input_counter)
-    metrics_add_sample(GLOBAL_METRICS, COUNTER, GLOBAL_CONFIG->input_counter, 1, sample_rate);
+    GLOBAL_METRICS->inputs++;
 
     name->start[name->len] = '\0';
     value->start[value->len] = '\0';
@@ -441,15 +867,15 @@ void emit_stat(metric_type type,
     }
 
     // Convert the value to a double
-    val = str2double(value->start, &endptr);
-    if (unlikely(endptr == value->start || errno == ERANGE)) {
+    val = fastfloat_parse(value->start, value->len, &endptr);
+    if (unlikely(endptr == value->start || isinf(val))) {
         syslog(LOG_WARNING, "Failed value conversion! Input: %.*s", value->len, value->start);
         return;
     }
 
     // Handle counter/timer sampling if applicable
     if ((type == COUNTER || type == TIMER) && samplerate->len > 1) {
-        double unchecked_rate = str2double(samplerate->start, &endptr);
+        double unchecked_rate = fastfloat_parse(samplerate->start, samplerate->len, &endptr);
         if (unlikely(endptr == samplerate->start)) {
             syslog(LOG_WARNING, "Failed sample rate conversion! Input: %.*s", samplerate->len, samplerate->start);
             return;
@@ -466,6 +892,26 @@ void emit_stat(metric_type type,
     metrics_add_sample(GLOBAL_METRICS, type, name->start, val, sample_rate);
 }
 
+/**
+ * Parses the complete lines of a buffer, one at a time,
+ * since the generated parser handles a single line.
+ * @arg parser The ASCII parser
+ * @arg buf The buffer
+ * @arg len The length of the buffer
+ * @arg skip Leading bytes known to hold no newline, which
+ * are not searched again
+ * @return The number of bytes of complete lines.
+ */
+static size_t parse_ascii_lines(ascpp *parser, char *buf, size_t len, size_t skip) {
+    char *line = buf, *nl = buf + skip;
+    while ((nl = memchr(nl, '\n', buf + len - nl))) {
+        nl++;
+        ascpp_exec(parser, line, nl - line);
+        line = nl;
+    }
+    return line - buf;
+}
+
 /**
  * Invoked to handle ASCII commands. This is the default
  * mode for statsite, to be backwards compatible with statsd
@@ -473,26 +919,26 @@ void emit_stat(metric_type type,
  * @return 0 on success.
  */
 static int handle_ascii_client_connect(statsite_conn_handler *handle) {
-    // Look for the next command line
-    char *buf;
-    int buf_len, should_free, status;
-
-		ascpp ascii_parser = ascpp_init(emit_stat);
-    while (1) {
-        status = extract_to_terminator(handle->conn, '\n', &buf, &buf_len, &should_free);
-        if (status == -1) return 0; // Return if no command is available
+    // The parser of the connection remembers how much of
+    // a partial line was searched between reads
+    ascpp *parser = client_parser(handle->conn);
+    if (unlikely(!parser->emit_cb)) *parser = ascpp_init(emit_stat);
 
-        buf[buf_len-1] = '\n';
-        ascpp_exec(&ascii_parser, buf, buf_len);
-
-        // Make sure to free the command buffer if we need to
-        if (should_free) free(buf);
-    }
+    char *buf;
+    uint64_t len = available_bytes(handle->conn);
+    peek_client_bytes(handle->conn, len, &buf);
+
+    // Parse the complete lines, and leave any partial
+    // line in the buffer until more data arrives
+    size_t consumed = parse_ascii_lines(parser, buf, len, parser->scanned);
+    parser->scanned = len - consumed;
+    seek_client_bytes(handle->conn, consumed);
+    return 0;
 }
 
 // Handles the binary set command
 // Return 0 on success, -1 on error, -2 if missing data
-static int handle_binary_set(statsite_conn_handler *handle, uint16_t *header, int should_free) {
+static int handle_binary_set(statsite_conn_handler *handle, uint16_t *header) {
     /*
      * Abort if we haven't received the command
      * header[1] is the key length
@@ -502,35 +948,50 @@ static int handle_binary_set(statsite_conn_handler *handle, uint16_t *header, in
     int val_bytes = header[1] + header[2];
 
     // Read the full command if available
-    if (unlikely(should_free)) free(header);
-    if (read_client_bytes(handle->conn, MIN_BINARY_HEADER_SIZE + val_bytes, (char**)&header, &should_free))
+    if (read_client_bytes(handle->conn, MIN_BINARY_HEADER_SIZE + val_bytes, (char**)&header))
         return -2;
     key = ((char*)header) + MIN_BINARY_HEADER_SIZE;
 
     // Verify the null terminators
     if (unlikely(*(key + header[1] - 1))) {
         syslog(LOG_WARNING, "Received command from binary stream with non-null terminated key: %.*s!", header[1], key);
-        goto ERR_RET;
+        return -1;
     }
     if (unlikely(*(key + val_bytes - 1))) {
         syslog(LOG_WARNING, "Received command from binary stream with non-null terminated set key: %.*s!", header[2], key+header[1]);
-        goto ERR_RET;
+        return -1;
     }
 
     // Increment the input counter
-    if (GLOBAL_CONFIG->input_counter)
-        metrics_add_sample(GLOBAL_METRICS, COUNTER, GLOBAL_CONFIG->input_counter, 1, 1.0);
+    GLOBAL_METRICS->inputs++;
 
     // Update the set
     metrics_set_update(GLOBAL_METRICS, key, key+header[1]);
-
-    // Make sure to free the command buffer if we need to
-    if (unlikely(should_free)) free(header);
     return 0;
+}
 
-ERR_RET:
-    if (unlikely(should_free)) free(header);
-    return -1;
+// Handles the binary state command
+// Return 0 on success, -1 on error, -2 if missing data
+static int handle_binary_state(statsite_conn_handler *handle) {
+    /*
+     * Abort if we haven't received the command
+     * cmd+2 is the key length
+     * cmd+4 is the state length
+     */
+    unsigned char *cmd;
+    if (peek_client_bytes(handle->conn, STATE_HEADER_SIZE, (char**)&cmd))
+        return -2;
+    uint16_t key_len = *(uint16_t*)(cmd+2);
+    uint32_t state_len = *(uint32_t*)(cmd+4);
+    if (unlikely(state_len > MAX_STATE_SIZE)) {
+        syslog(LOG_WARNING, "Received state command from binary stream with a state of %u bytes!", state_len);
+        return -1;
+    }
+
+    // Read the full command if available
+    if (read_client_bytes(handle->conn, STATE_HEADER_SIZE + key_len + state_len, (char**)&cmd))
+        return -2;
+    return handle_state(cmd + STATE_HEADER_SIZE, key_len, cmd + STATE_HEADER_SIZE + key_len, state_len);
 }
 
 /**
@@ -541,7 +1002,6 @@ ERR_RET:
 static int handle_binary_client_connect(statsite_conn_handler *handle) {
     metric_type type;
     uint16_t key_len;
-    int should_free;
     unsigned char *cmd, *key;
     while (1) {
         // Peek and check for the header. This is up to 12 bytes.
@@ -549,23 +1009,21 @@ static int handle_binary_client_connect(statsite_conn_handler *handle) {
         // Metric type - 1 byte
         // Key length - 2 bytes
         // Metric value - 8 bytes OR Set Length 2 bytes
-        if (peek_client_bytes(handle->conn, MIN_BINARY_HEADER_SIZE, (char**)&cmd, &should_free))
+        if (peek_client_bytes(handle->conn, MIN_BINARY_HEADER_SIZE, (char**)&cmd))
             return 0;  // Return if no command is available
 
         // Check for UDP record separator inserted by UDP handler
         if (cmd[0] == '\n') {
-            if (should_free)
-                free(cmd);
             if (seek_client_bytes(handle->conn, 1))
                 return 0;  // End of buffer, shouldn't happen
-            if (peek_client_bytes(handle->conn, MIN_BINARY_HEADER_SIZE, (char**)&cmd, &should_free))
+            if (peek_client_bytes(handle->conn, MIN_BINARY_HEADER_SIZE, (char**)&cmd))
                 return 0;  // found end of buffer
         }
 
         // Check for the magic byte
         if (unlikely(cmd[0] != BINARY_MAGIC_BYTE)) {
             syslog(LOG_WARNING, "Received command from binary stream without magic byte! Byte: %u", cmd[0]);
-            goto ERR_RET;
+            return -1;
         }
 
         // Get the metric type
@@ -588,7 +1046,18 @@ static int handle_binary_client_connect(statsite_conn_handler *handle) {
 
             // Special case set handling
             case BIN_TYPE_SET:
-                switch (handle_binary_set(handle, (uint16_t*)cmd, should_free)) {
+                switch (handle_binary_set(handle, (uint16_t*)cmd)) {
+                    case -1:
+                        return -1;
+                    case -2:
+                        return 0;
+                    default:
+                        continue;
+                }
+
+            // The state of a metric from another instance
+            case BIN_TYPE_STATE:
+                switch (handle_binary_state(handle)) {
                     case -1:
                         return -1;
                     case -2:
@@ -599,36 +1068,309 @@ static int handle_binary_client_connect(statsite_conn_handler *handle) {
 
             default:
                 syslog(LOG_WARNING, "Received command from binary stream with unknown type: %u!", cmd[1]);
-                goto ERR_RET;
+                return -1;
         }
 
         // Abort if we haven't received the full key, wait for the data
         key_len = *(uint16_t*)(cmd+2);
 
         // Read the full command if available
-        if (unlikely(should_free)) free(cmd);
-        if (read_client_bytes(handle->conn, MAX_BINARY_HEADER_SIZE + key_len, (char**)&cmd, &should_free))
+        if (read_client_bytes(handle->conn, MAX_BINARY_HEADER_SIZE + key_len, (char**)&cmd))
             return 0;
         key = cmd + MAX_BINARY_HEADER_SIZE;
 
         // Verify the key contains a null terminator
         if (unlikely(*(key + key_len - 1))) {
             syslog(LOG_WARNING, "Received command from binary stream with non-null terminated key: %.*s!", key_len, key);
-            goto ERR_RET;
+            return -1;
         }
 
         // Increment the input counter
-        if (GLOBAL_CONFIG->input_counter)
-            metrics_add_sample(GLOBAL_METRICS, COUNTER, GLOBAL_CONFIG->input_counter, 1, 1.0);
+        GLOBAL_METRICS->inputs++;
 
         // Add the sample
         metrics_add_sample(GLOBAL_METRICS, type, (char*)key, *(double*)(cmd+4), 1.0);
+    }
+    return 0;
+}
+
+/**
+ * Invoked to handle binary commands from a single datagram.
+ * Unlike a stream, the records must be complete, so any
+ * trailing partial record is discarded.
+ * @arg buf The datagram
+ * @arg len The length of the datagram
+ * @return 0 on success.
+ */
+static int handle_binary_datagram(unsigned char *buf, int len) {
+    unsigned char *cmd = buf, *end = buf + len, *key;
+    uint16_t key_len, set_len;
+    metric_type type;
+    while (cmd < end) {
+        // Skip any record separators
+        if (*cmd == '\n') {
+            cmd++;
+            continue;
+        }
+        if (unlikely(end - cmd < MIN_BINARY_HEADER_SIZE)) goto TRUNCATED;
+
+        // Check for the magic byte
+        if (unlikely(cmd[0] != BINARY_MAGIC_BYTE)) {
+            syslog(LOG_WARNING, "Received command from binary stream without magic byte! Byte: %u", cmd[0]);
+            return -1;
+        }
+
+        // Special case state handling
+        if (cmd[1] == BIN_TYPE_STATE) {
+            if (unlikely(end - cmd < STATE_HEADER_SIZE)) goto TRUNCATED;
+            key_len = *(uint16_t*)(cmd+2);
+            uint32_t state_len = *(uint32_t*)(cmd+4);
+            if (unlikely(end - cmd - STATE_HEADER_SIZE < (int64_t)key_len + state_len)) goto TRUNCATED;
+            key = cmd + STATE_HEADER_SIZE;
+            if (handle_state(key, key_len, key + key_len, state_len)) return -1;
+            cmd += STATE_HEADER_SIZE + key_len + state_len;
+            continue;
+        }
+
+        // Get the metric type
+        type = (cmd[1] < METRIC_TYPES) ? BIN_TYPE_MAP[cmd[1]] : UNKNOWN;
+        if (unlikely(type == UNKNOWN)) {
+            syslog(LOG_WARNING, "Received command from binary stream with unknown type: %u!", cmd[1]);
+            return -1;
+        }
+        key_len = *(uint16_t*)(cmd+2);
+
+        // Special case set handling
+        if (type == SET) {
+            set_len = *(uint16_t*)(cmd+4);
+            if (unlikely(end - cmd < MIN_BINARY_HEADER_SIZE + key_len + set_len)) goto TRUNCATED;
+            key = cmd + MIN_BINARY_HEADER_SIZE;
+
+            // Verify the null terminators
+            if (unlikely(*(key + key_len - 1))) {
+                syslog(LOG_WARNING, "Received command from binary stream with non-null terminated key: %.*s!", key_len, key);
+                return -1;
+            }
+            if (unlikely(*(key + key_len + set_len - 1))) {
+                syslog(LOG_WARNING, "Received command from binary stream with non-null terminated set key: %.*s!", set_len, key+key_len);
+                return -1;
+            }
+
+            GLOBAL_METRICS->inputs++;
+            metrics_set_update(GLOBAL_METRICS, (char*)key, (char*)key+key_len);
+            cmd += MIN_BINARY_HEADER_SIZE + key_len + set_len;
+            continue;
+        }
+
+        if (unlikely(end - cmd < MAX_BINARY_HEADER_SIZE + key_len)) goto TRUNCATED;
+        key = cmd + MAX_BINARY_HEADER_SIZE;
+
+        // Verify the key contains a null terminator
+        if (unlikely(*(key + key_len - 1))) {
+            syslog(LOG_WARNING, "Received command from binary stream with non-null terminated key: %.*s!", key_len, key);
+            return -1;
+        }
 
-        // Make sure to free the command buffer if we need to
-        if (unlikely(should_free)) free(cmd);
+        GLOBAL_METRICS->inputs++;
+        metrics_add_sample(GLOBAL_METRICS, type, (char*)key, *(double*)(cmd+4), 1.0);
+        cmd += MAX_BINARY_HEADER_SIZE + key_len;
     }
     return 0;
-ERR_RET:
-    if (unlikely(should_free)) free(cmd);
+
+TRUNCATED:
+    syslog(LOG_WARNING, "Received truncated command from binary datagram!");
     return -1;
 }
+
+/**
+ * Merges the state of a metric, streamed by another
+ * statsite instance with state_stream enabled. A state
+ * that cannot be merged is skipped.
+ * @arg key The key, with its null terminator
+ * @arg key_len The length of the key
+ * @arg state The metric type, followed by the encoded state
+ * @arg state_len The length of the state
+ * @return 0 on success, -1 if the command is malformed.
+ */
+static int handle_state(unsigned char *key, uint16_t key_len, unsigned char *state, uint32_t state_len) {
+    // Verify the key contains a null terminator
+    if (unlikely(!key_len || *(key + key_len - 1))) {
+        syslog(LOG_WARNING, "Received command from binary stream with non-null terminated key: %.*s!", key_len, key);
+        return -1;
+    }
+
+    // Get the metric type
+    metric_type type = (state_len && state[0] < METRIC_TYPES) ? BIN_TYPE_MAP[state[0]] : UNKNOWN;
+    if (unlikely(type != COUNTER && type != TIMER && type != SET && type != GAUGE)) {
+        syslog(LOG_WARNING, "Received state from binary stream with unknown type: %u!", (state_len) ? state[0] : 0);
+        return -1;
+    }
+
+    // Merge the state. It is not counted as an input, since the
+    // input counter of the sender is merged as a counter instead
+    codec_reader r;
+    codec_reader_init(&r, state + 1, state_len - 1);
+    if (unlikely(metrics_merge_state(GLOBAL_METRICS, type, (char*)key, &r))) {
+        syslog(LOG_WARNING, "Failed to merge the state of: %s", key);
+    }
+    return 0;
+}
+
+/**
+ * Finds the length and key of the binary command at the
+ * start of a buffer, without handling it.
+ * @arg cmd The start of the command
+ * @arg avail The bytes available
+ * @arg key Output. The key, with its null terminator
+ * @arg key_len Output. The length of the key
+ * @return The length of the command, 0 if it is
+ * incomplete, or -1 if it is malformed.
+ */
+static int64_t binary_command_len(unsigned char *cmd, size_t avail, unsigned char **key, uint16_t *key_len) {
+    if (avail < (size_t)MIN_BINARY_HEADER_SIZE) return 0;
+    if (unlikely(cmd[0] != BINARY_MAGIC_BYTE)) {
+        syslog(LOG_WARNING, "Received command from binary stream without magic byte! Byte: %u", cmd[0]);
+        return -1;
+    }
+
+    int64_t len;
+    *key_len = *(uint16_t*)(cmd+2);
+    switch (cmd[1]) {
+        case BIN_TYPE_KV:
+        case BIN_TYPE_COUNTER:
+        case BIN_TYPE_TIMER:
+        case BIN_TYPE_GAUGE:
+        case BIN_TYPE_GAUGE_DELTA:
+            *key = cmd + MAX_BINARY_HEADER_SIZE;
+            len = MAX_BINARY_HEADER_SIZE + *key_len;
+            break;
+        case BIN_TYPE_SET:
+            *key = cmd + MIN_BINARY_HEADER_SIZE;
+            len = MIN_BINARY_HEADER_SIZE + *key_len + *(uint16_t*)(cmd+4);
+            break;
+        case BIN_TYPE_STATE:
+            if (avail < (size_t)STATE_HEADER_SIZE) return 0;
+            if (unlikely(*(uint32_t*)(cmd+4) > MAX_STATE_SIZE)) {
+                syslog(LOG_WARNING, "Received state command from binary stream with a state of %u bytes!", *(uint32_t*)(cmd+4));
+                return -1;
+            }
+            *key = cmd + STATE_HEADER_SIZE;
+            len = STATE_HEADER_SIZE + *key_len + (int64_t)*(uint32_t*)(cmd+4);
+            break;
+        default:
+            syslog(LOG_WARNING, "Received command from binary stream with unknown type: %u!", cmd[1]);
+            return -1;
+    }
+    if (unlikely(!*key_len)) {
+        syslog(LOG_WARNING, "Received command from binary stream with an empty key!");
+        return -1;
+    }
+    return ((size_t)len <= avail) ? len : 0;
+}
+
+/**
+ * Forwards the complete binary commands in a buffer
+ * @arg fw The forwarder
+ * @arg buf The buffered commands
+ * @arg len The length of the buffer
+ * @arg consumed Output. The bytes of complete commands
+ * @return 0 on success, -1 if a command is malformed.
+ */
+static int forward_binary(forwarder *fw, unsigned char *buf, size_t len, size_t *consumed) {
+    unsigned char *cmd = buf, *key;
+    uint16_t key_len;
+    int64_t cmd_len;
+    int res = 0;
+    while (cmd < buf + len) {
+        // Skip any record separators
+        if (*cmd == '\n') {
+            cmd++;
+            continue;
+        }
+
+        // Stop at a partial command
+        cmd_len = binary_command_len(cmd, buf + len - cmd, &key, &key_len);
+        if (cmd_len <= 0) {
+            res = cmd_len;
+            break;
+        }
+
+        // The key is hashed without its null terminator, like an ASCII name
+        forward_command(fw, FORWARD_BINARY, (char*)key, key_len - 1, (char*)cmd, cmd_len);
+        cmd += cmd_len;
+    }
+    *consumed = cmd - buf;
+    return res;
+}
+
+/**
+ * Forwards the complete ASCII lines in a buffer. The name
+ * of a metric is everything before the first colon.
+ * @arg fw The forwarder
+ * @arg buf The buffered lines
+ * @arg len The length of the buffer
+ * @return The bytes of complete lines.
+ */
+static size_t forward_ascii(forwarder *fw, char *buf, size_t len) {
+    char *line = buf, *end = buf + len, *newline, *sep;
+    while (line < end && (newline = memchr(line, '\n', end - line))) {
+        sep = memchr(line, ':', newline - line);
+        if (likely(sep != NULL)) {
+            forward_command(fw, FORWARD_ASCII, line, sep - line, line, newline + 1 - line);
+        } else if (newline > line) {
+            syslog(LOG_WARNING, "Failed to forward line without a name! Input: %.*s", (int)(newline - line), line);
+        }
+        line = newline + 1;
+    }
+    return line - buf;
+}
+
+/**
+ * Invoked to forward the commands of a client in forward mode.
+ * Only the complete commands are consumed, the rest is kept
+ * until more data arrives.
+ * @arg handle The connection related information
+ * @arg fw The forwarder of the shard
+ * @arg magic The first byte of the input
+ * @return 0 on success.
+ */
+static int forward_client_connect(statsite_conn_handler *handle, forwarder *fw, unsigned char magic) {
+    char *buf;
+    uint64_t len = available_bytes(handle->conn);
+    peek_client_bytes(handle->conn, len, &buf);
+
+    size_t consumed;
+    int res = 0;
+    if (magic == BINARY_MAGIC_BYTE)
+        res = forward_binary(fw, (unsigned char*)buf, len, &consumed);
+    else
+        consumed = forward_ascii(fw, buf, len);
+    seek_client_bytes(handle->conn, consumed);
+    return res;
+}
+
+/**
+ * Forwards the commands of a batch of datagrams
+ * in forward mode. Partial commands are discarded.
+ * @arg fw The forwarder of the shard
+ * @arg datagrams The datagrams, the byte after each must be writable
+ * @arg num The number of datagrams
+ */
+static void forward_datagrams(forwarder *fw, struct iovec *datagrams, int num) {
+    char *buf;
+    int len;
+    size_t consumed;
+    for (int i=0; i < num; i++) {
+        buf = datagrams[i].iov_base;
+        len = datagrams[i].iov_len;
+        if (unlikely(len == 0)) continue;
+
+        if ((unsigned char)buf[0] == BINARY_MAGIC_BYTE) {
+            if (forward_binary(fw, (unsigned char*)buf, len, &consumed) || consumed < (size_t)len)
+                syslog(LOG_WARNING, "Received truncated command from binary datagram!");
+        } else {
+            if (buf[len-1] != '\n') buf[len++] = '\n';
+            forward_ascii(fw, buf, len);
+        }
+    }
+}
@@ -1,5 +1,6 @@
 #ifndef CONN_HANDLER_H
 #define CONN_HANDLER_H
+#include <sys/uio.h>
 #include "config.h"
 #include "networking.h"
 
@@ -11,18 +12,28 @@
 typedef struct {
     statsite_config *config;     // Global configuration
     statsite_conn_info *conn;    // Opaque handle into the networking stack
+    int shard;                   // Metrics shard to update, one per event loop
 } statsite_conn_handler;
 
 /**
  * Invoked to initialize the conn handler layer.
+ * @return 0 on success, -1 if the forward hosts
+ * cannot be resolved.
  */
-void init_conn_handler(statsite_config *config);
+int init_conn_handler(statsite_config *config);
 
 /**
  * Invoked to when we've reached the flush interval timeout
  */
 void flush_interval_trigger();
 
+/**
+ * Invoked by each event loop in forward mode, to write
+ * out the commands batched by its shard.
+ * @arg shard The shard of the event loop
+ */
+void forward_interval_trigger(int shard);
+
 /**
  * Called when statsite is terminating to flush the
  * final set of metrics
@@ -39,4 +50,24 @@ void final_flush();
  */
 int handle_client_connect(statsite_conn_handler *handle);
 
+/**
+ * Invoked by the networking layer with a batch of datagrams,
+ * each of which holds complete ASCII or binary records. The end
+ * of a datagram terminates its last record, so the byte after
+ * each datagram must be writable to hold a newline.
+ * @arg handle The connection related information
+ * @arg datagrams The datagrams to handle, empty ones are skipped
+ * @arg num The number of datagrams
+ * @return 0 on success.
+ */
+int handle_client_datagrams(statsite_conn_handler *handle, struct iovec *datagrams, int num);
+
+/**
+ * Invoked by the networking layer after each batched
+ * UDP receive, so that the batch fill can be tracked.
+ * @arg handle The connection related information
+ * @arg datagrams The number of datagrams received
+ */
+void handle_udp_batch(statsite_conn_handler *handle, int datagrams);
+
 #endif
@@ -41,3 +41,40 @@ uint64_t counter_count(counter *counter) {
 double counter_sum(counter *counter) {
     return counter->sum;
 }
+
+/**
+ * Merges the samples of one counter into another
+ * @arg into The counter to merge into
+ * @arg from The counter to merge from, left unchanged
+ * @return 0 on success.
+ */
+int counter_merge(counter *into, counter *from) {
+    into->sum += from->sum;
+    into->count += from->count;
+    return 0;
+}
+
+/**
+ * Encodes the counter
+ * @arg counter The counter to encode
+ * @arg buf The buffer to append to
+ * @return 0 on success.
+ */
+int counter_encode(counter *counter, codec_buf *buf) {
+    if (codec_put_version(buf)) return -1;
+    if (codec_put_varint(buf, counter->count)) return -1;
+    return codec_put_double(buf, counter->sum);
+}
+
+/**
+ * Decodes a counter, which can then be merged
+ * @arg r The reader of the encoding
+ * @arg counter The counter to initialize
+ * @return 0 on success, -1 on bad input.
+ */
+int counter_decode(codec_reader *r, counter *counter) {
+    init_counter(counter);
+    if (codec_get_version(r)) return -1;
+    if (codec_get_varint(r, &counter->count)) return -1;
+    return codec_get_double(r, &counter->sum);
+}
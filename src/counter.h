@@ -1,6 +1,7 @@
 #ifndef COUNTER_H
 #define COUNTER_H
 #include <stdint.h>
+#include "codec.h"
 
 typedef struct {
     uint64_t count;        // Count of items
@@ -36,4 +37,28 @@ uint64_t counter_count(counter *counter);
  */
 double counter_sum(counter *counter);
 
+/**
+ * Merges the samples of one counter into another
+ * @arg into The counter to merge into
+ * @arg from The counter to merge from, left unchanged
+ * @return 0 on success.
+ */
+int counter_merge(counter *into, counter *from);
+
+/**
+ * Encodes the counter
+ * @arg counter The counter to encode
+ * @arg buf The buffer to append to
+ * @return 0 on success.
+ */
+int counter_encode(counter *counter, codec_buf *buf);
+
+/**
+ * Decodes a counter, which can then be merged
+ * @arg r The reader of the encoding
+ * @arg counter The counter to initialize
+ * @return 0 on success, -1 on bad input.
+ */
+int counter_decode(codec_reader *r, counter *counter);
+
 #endif
@@ -0,0 +1,306 @@
+/**
+ * This module implements DDSketch from "DDSketch: A Fast and
+ * Fully-Mergeable Quantile Sketch with Relative-Error Guarantees"
+ * by Masson, Rim and Lee.
+ *
+ * A value v is counted in the bucket ceil(log(v) / log(gamma)),
+ * with gamma = (1 + alpha) / (1 - alpha). Each bucket spans a
+ * range of values that are all within alpha of its midpoint.
+ * The buckets of a store are a dense array, which grows to cover
+ * new indexes up to a fixed size. Past that, the lowest buckets
+ * are collapsed into one, so the high quantiles stay accurate.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "ddsketch.h"
+
+// The initial and maximum number of buckets of a store
+#define DD_MIN_BUCKETS 64
+#define DD_MAX_BUCKETS 2048
+
+// Values closer to 0 than this are counted as 0
+#define DD_MIN_VALUE 1e-9
+
+/**
+ * Initializes the sketch
+ * @arg alpha The relative accuracy, must be on (0, 1)
+ * @arg dd The ddsketch to initialize
+ * @return 0 on success.
+ */
+int init_ddsketch(double alpha, ddsketch *dd) {
+    if (alpha <= 0 || alpha >= 1) return -1;
+    memset(dd, 0, sizeof(ddsketch));
+    dd->alpha = alpha;
+    dd->gamma = (1 + alpha) / (1 - alpha);
+    dd->log_gamma = log(dd->gamma);
+    dd->min = INFINITY;
+    dd->max = -INFINITY;
+    return 0;
+}
+
+/**
+ * Destroy the sketch
+ * @return 0 on success.
+ */
+int destroy_ddsketch(ddsketch *dd) {
+    free(dd->positive.counts);
+    free(dd->negative.counts);
+    return 0;
+}
+
+/**
+ * Grows a store to cover an index. If the buckets would
+ * exceed the maximum, the lowest ones are collapsed.
+ */
+static int dd_store_extend(dd_store *s, int32_t index) {
+    int64_t lo = (index < s->offset) ? index : s->offset;
+    int64_t hi = s->offset + (int64_t)s->size - 1;
+    if (index > hi) hi = index;
+    int64_t span = hi - lo + 1;
+
+    uint32_t size = s->size;
+    while (size < span && size < DD_MAX_BUCKETS) size *= 2;
+    if (size > DD_MAX_BUCKETS) size = DD_MAX_BUCKETS;
+
+    // Leave the room on the side that is growing
+    int32_t offset;
+    if (span > size) {
+        offset = hi - size + 1;
+    } else if (index < s->offset) {
+        offset = hi - size + 1;
+    } else {
+        offset = lo;
+    }
+
+    uint64_t *counts = calloc(size, sizeof(uint64_t));
+    if (!counts) return -1;
+    for (uint32_t i=0; i < s->size; i++) {
+        int64_t idx = s->offset + (int64_t)i;
+        counts[(idx < offset) ? 0 : idx - offset] += s->counts[i];
+    }
+    free(s->counts);
+    s->counts = counts;
+    s->offset = offset;
+    s->size = size;
+    return 0;
+}
+
+// Adds to the count of a bucket
+static int dd_store_add(dd_store *s, int32_t index, uint64_t count) {
+    if (!s->counts) {
+        s->counts = calloc(DD_MIN_BUCKETS, sizeof(uint64_t));
+        if (!s->counts) return -1;
+        s->size = DD_MIN_BUCKETS;
+        s->offset = index - DD_MIN_BUCKETS / 2;
+    }
+
+    if (index < s->offset) {
+        // Below a full store, the lowest bucket takes it
+        if (s->size == DD_MAX_BUCKETS) {
+            s->counts[0] += count;
+            return 0;
+        }
+        if (dd_store_extend(s, index)) return -1;
+    } else if (index >= s->offset + (int64_t)s->size) {
+        if (dd_store_extend(s, index)) return -1;
+    }
+
+    int64_t i = (int64_t)index - s->offset;
+    s->counts[(i < 0) ? 0 : i] += count;
+    return 0;
+}
+
+// Returns the bucket index of a positive value
+static inline int32_t dd_index(ddsketch *dd, double value) {
+    return (int32_t)ceil(log(value) / dd->log_gamma);
+}
+
+// Returns the value of a bucket, within alpha of all its values
+static inline double dd_value(ddsketch *dd, int32_t index) {
+    return 2 * exp(index * dd->log_gamma) / (dd->gamma + 1);
+}
+
+/**
+ * Adds a new value to the sketch
+ * @return 0 on success.
+ */
+int dd_add_sample(ddsketch *dd, double value) {
+    int res = 0;
+    if (value >= DD_MIN_VALUE) {
+        res = dd_store_add(&dd->positive, dd_index(dd, value), 1);
+    } else if (value <= -DD_MIN_VALUE) {
+        res = dd_store_add(&dd->negative, dd_index(dd, -value), 1);
+    } else {
+        dd->zero_count++;
+    }
+    if (res) return res;
+
+    dd->count++;
+    if (value < dd->min) dd->min = value;
+    if (value > dd->max) dd->max = value;
+    return 0;
+}
+
+/**
+ * Queries for a quantile value
+ * @return The value on success or 0.
+ */
+double dd_query(ddsketch *dd, double quantile) {
+    if (!dd->count) return 0;
+    double rank = quantile * (dd->count - 1);
+    double result = dd->max;
+    uint64_t seen = 0;
+    int found = 0;
+
+    // The negative values, from the largest magnitude
+    dd_store *s = &dd->negative;
+    for (int64_t i = (int64_t)s->size - 1; i >= 0 && !found; i--) {
+        seen += s->counts[i];
+        if (seen > rank) {
+            result = -dd_value(dd, s->offset + i);
+            found = 1;
+        }
+    }
+
+    // Then the zeros
+    if (!found) {
+        seen += dd->zero_count;
+        if (seen > rank) {
+            result = 0;
+            found = 1;
+        }
+    }
+
+    // The positive values, from the smallest
+    s = &dd->positive;
+    for (uint32_t i=0; i < s->size && !found; i++) {
+        seen += s->counts[i];
+        if (seen > rank) {
+            result = dd_value(dd, s->offset + i);
+            found = 1;
+        }
+    }
+
+    if (result < dd->min) return dd->min;
+    if (result > dd->max) return dd->max;
+    return result;
+}
+
+// Adds the buckets of one store to another
+static int dd_store_merge(dd_store *into, dd_store *from) {
+    for (uint32_t i=0; i < from->size; i++) {
+        if (!from->counts[i]) continue;
+        if (dd_store_add(into, from->offset + i, from->counts[i])) return -1;
+    }
+    free(from->counts);
+    memset(from, 0, sizeof(dd_store));
+    return 0;
+}
+
+/**
+ * Merges one sketch into another, leaving the source empty.
+ * @return 0 on success, -1 if the accuracies differ.
+ */
+int dd_merge(ddsketch *into, ddsketch *from) {
+    if (into->alpha != from->alpha) return -1;
+    if (dd_store_merge(&into->positive, &from->positive)) return -1;
+    if (dd_store_merge(&into->negative, &from->negative)) return -1;
+
+    into->zero_count += from->zero_count;
+    into->count += from->count;
+    if (from->min < into->min) into->min = from->min;
+    if (from->max > into->max) into->max = from->max;
+
+    from->zero_count = 0;
+    from->count = 0;
+    from->min = INFINITY;
+    from->max = -INFINITY;
+    return 0;
+}
+
+// Encodes the used range of a store
+static int dd_store_encode(dd_store *s, codec_buf *buf) {
+    uint32_t lo = 0, hi = s->size;
+    while (lo < hi && !s->counts[lo]) lo++;
+    while (hi > lo && !s->counts[hi-1]) hi--;
+
+    if (codec_put_svarint(buf, (int64_t)s->offset + lo)) return -1;
+    if (codec_put_varint(buf, hi - lo)) return -1;
+    for (uint32_t i=lo; i < hi; i++) {
+        if (codec_put_varint(buf, s->counts[i])) return -1;
+    }
+    return 0;
+}
+
+/**
+ * Encodes the sketch
+ * @return 0 on success.
+ */
+int dd_encode(ddsketch *dd, codec_buf *buf) {
+    if (codec_put_double(buf, dd->alpha)) return -1;
+    if (codec_put_double(buf, dd->min)) return -1;
+    if (codec_put_double(buf, dd->max)) return -1;
+    if (codec_put_varint(buf, dd->zero_count)) return -1;
+    if (dd_store_encode(&dd->positive, buf)) return -1;
+    return dd_store_encode(&dd->negative, buf);
+}
+
+/**
+ * Decodes the buckets of a store, adding them as
+ * they are read, so the store has the usual layout.
+ * @arg total Incremented by the counts
+ */
+static int dd_store_decode(codec_reader *r, dd_store *s, uint64_t *total) {
+    int64_t offset;
+    uint32_t size;
+    uint64_t count;
+    if (codec_get_svarint(r, &offset)) return -1;
+    if (codec_get_u32(r, &size) || size > DD_MAX_BUCKETS) return -1;
+    if (offset < INT32_MIN || offset + size > INT32_MAX) return -1;
+
+    for (uint32_t i=0; i < size; i++) {
+        if (codec_get_varint(r, &count)) return -1;
+        if (!count) continue;
+        if (dd_store_add(s, offset + i, count)) return -1;
+        *total += count;
+    }
+    return 0;
+}
+
+/**
+ * Decodes a sketch, which can then be merged
+ * @return 0 on success, -1 on bad input.
+ */
+int dd_decode(codec_reader *r, ddsketch *dd) {
+    double alpha, min, max;
+    uint64_t zero_count;
+    if (codec_get_double(r, &alpha)) return -1;
+    if (codec_get_double(r, &min)) return -1;
+    if (codec_get_double(r, &max)) return -1;
+    if (codec_get_varint(r, &zero_count)) return -1;
+    if (!isfinite(alpha) || init_ddsketch(alpha, dd)) return -1;
+
+    // The count is the sum of the buckets
+    uint64_t count = zero_count;
+    if (dd_store_decode(r, &dd->positive, &count) ||
+        dd_store_decode(r, &dd->negative, &count)) {
+        destroy_ddsketch(dd);
+        return -1;
+    }
+    dd->zero_count = zero_count;
+    dd->count = count;
+    if (count) {
+        dd->min = min;
+        dd->max = max;
+    }
+    return 0;
+}
+
+/**
+ * Returns the number of buckets in use
+ */
+uint32_t dd_num_buckets(ddsketch *dd) {
+    return dd->positive.size + dd->negative.size;
+}
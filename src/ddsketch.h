@@ -0,0 +1,101 @@
+/**
+ * This module implements DDSketch from "DDSketch: A Fast and
+ * Fully-Mergeable Quantile Sketch with Relative-Error Guarantees"
+ * by Masson, Rim and Lee. Values are counted in logarithmic
+ * buckets, so every quantile is within a relative error of the
+ * true value. Inserts take constant time, and the number of
+ * buckets is bounded, by collapsing the lowest ones.
+ */
+#ifndef DDSKETCH_H
+#define DDSKETCH_H
+#include <stdint.h>
+#include "codec.h"
+
+/**
+ * The counts of a range of bucket indexes
+ */
+typedef struct {
+    uint64_t *counts;   // The count of each bucket
+    int32_t offset;     // The index of the first bucket
+    uint32_t size;      // Number of buckets
+} dd_store;
+
+typedef struct {
+    double alpha;           // Relative accuracy
+    double gamma;           // Ratio between bucket bounds
+    double log_gamma;       // Natural log of gamma
+
+    dd_store positive;      // Buckets of the positive values
+    dd_store negative;      // Buckets of the negated negative values
+    uint64_t zero_count;    // Values too close to 0 for a bucket
+
+    uint64_t count;         // Number of values
+    double min;             // The smallest value
+    double max;             // The largest value
+} ddsketch;
+
+/**
+ * Initializes the sketch
+ * @arg alpha The relative accuracy, must be on (0, 1)
+ * @arg dd The ddsketch to initialize
+ * @return 0 on success.
+ */
+int init_ddsketch(double alpha, ddsketch *dd);
+
+/**
+ * Destroy the sketch
+ * @arg dd The ddsketch to destroy
+ * @return 0 on success.
+ */
+int destroy_ddsketch(ddsketch *dd);
+
+/**
+ * Adds a new value to the sketch
+ * @arg dd The ddsketch to add to
+ * @arg value The new value
+ * @return 0 on success.
+ */
+int dd_add_sample(ddsketch *dd, double value);
+
+/**
+ * Queries for a quantile value
+ * @arg dd The ddsketch to query
+ * @arg quantile The quantile to query
+ * @return The value on success or 0.
+ */
+double dd_query(ddsketch *dd, double quantile);
+
+/**
+ * Merges one sketch into another, leaving the source empty.
+ * Both must use the same relative accuracy.
+ * @arg into The ddsketch to merge into
+ * @arg from The ddsketch to merge from
+ * @return 0 on success, -1 if the accuracies differ.
+ */
+int dd_merge(ddsketch *into, ddsketch *from);
+
+/**
+ * Encodes the sketch. Only the buckets between
+ * the first and last used ones are written.
+ * @arg dd The ddsketch to encode
+ * @arg buf The buffer to append to
+ * @return 0 on success.
+ */
+int dd_encode(ddsketch *dd, codec_buf *buf);
+
+/**
+ * Decodes a sketch, which can then be merged
+ * @arg r The reader of the encoding
+ * @arg dd The ddsketch to initialize
+ * @return 0 on success, -1 on bad input.
+ */
+int dd_decode(codec_reader *r, ddsketch *dd);
+
+/**
+ * Returns the number of buckets in use
+ * @arg dd The ddsketch
+ * @return The number of allocated buckets
+ */
+uint32_t dd_num_buckets(ddsketch *dd);
+
+#endif
@@ -0,0 +1,281 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "fastfloat.h"
+#include "fastfloat_constants.h"
+
+// Layout of a double
+#define MANTISSA_BITS 52
+#define MIN_EXPONENT -1023
+#define INFINITE_POWER 0x7FF
+
+// Mantissas up to 2^53 convert to a double exactly
+#define MAX_FAST_MANTISSA (1ULL << 53)
+#define MAX_FAST_EXPONENT 22
+
+// The most significant digits that always fit a uint64_t
+#define MAX_DIGITS 19
+#define MIN_19_DIGITS 1000000000000000000ULL
+
+#define IS_DIGIT(c) ((unsigned char)((c) - '0') < 10)
+
+// The powers of ten that are exactly representable
+static const double EXACT_POWERS[MAX_FAST_EXPONENT + 1] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+typedef struct {
+    uint64_t low;
+    uint64_t high;
+} uint128;
+
+// Computes the full 128 bit product of two 64 bit integers
+static inline uint128 full_multiply(uint64_t a, uint64_t b) {
+    uint128 res;
+#ifdef __SIZEOF_INT128__
+    unsigned __int128 r = (unsigned __int128)a * b;
+    res.low = (uint64_t)r;
+    res.high = (uint64_t)(r >> 64);
+#else
+    uint64_t a_lo = (uint32_t)a, a_hi = a >> 32;
+    uint64_t b_lo = (uint32_t)b, b_hi = b >> 32;
+    uint64_t lo_lo = a_lo * b_lo, hi_lo = a_hi * b_lo;
+    uint64_t lo_hi = a_lo * b_hi, hi_hi = a_hi * b_hi;
+    uint64_t cross = (lo_lo >> 32) + (uint32_t)hi_lo + lo_hi;
+    res.high = hi_hi + (hi_lo >> 32) + (cross >> 32);
+    res.low = (cross << 32) | (uint32_t)lo_lo;
+#endif
+    return res;
+}
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define HAVE_SWAR_DIGITS
+
+// Checks if all the bytes of a word are ASCII digits
+static inline int is_eight_digits(uint64_t val) {
+    return !(((val + 0x4646464646464646ULL) | (val - 0x3030303030303030ULL)) &
+            0x8080808080808080ULL);
+}
+
+// Converts eight ASCII digits with three multiplications,
+// combining pairs, then quads, then the two halves
+static inline uint32_t parse_eight_digits(uint64_t val) {
+    const uint64_t mask = 0x000000FF000000FFULL;
+    const uint64_t mul1 = 0x000F424000000064ULL; // 100 + (1000000 << 32)
+    const uint64_t mul2 = 0x0000271000000001ULL; // 1 + (10000 << 32)
+    val -= 0x3030303030303030ULL;
+    val = (val * 10) + (val >> 8);
+    val = (((val & mask) * mul1) + (((val >> 16) & mask) * mul2)) >> 32;
+    return (uint32_t)val;
+}
+#endif
+
+/**
+ * Accumulates a run of digits into the mantissa. The digits are
+ * handled eight at a time in a single word while they last, then
+ * one at a time. The mantissa may wrap when there are more than 19
+ * digits, the caller must handle that.
+ * @return The first byte that is not a digit
+ */
+static inline const char* parse_digits(const char *p, const char *pe, uint64_t *mantissa) {
+    uint64_t i = *mantissa;
+#ifdef HAVE_SWAR_DIGITS
+    while (pe - p >= 8) {
+        uint64_t val;
+        memcpy(&val, p, sizeof(val));
+        if (!is_eight_digits(val)) break;
+        i = i * 100000000 + parse_eight_digits(val);
+        p += 8;
+    }
+#endif
+    for (; p < pe && IS_DIGIT(*p); p++) {
+        i = i * 10 + (*p - '0');
+    }
+    *mantissa = i;
+    return p;
+}
+
+/**
+ * Computes the closest double to w * 10^q, using the Eisel-Lemire
+ * algorithm. The result is correctly rounded for any w, ties are
+ * resolved to even.
+ * @arg w The decimal mantissa
+ * @arg q The decimal exponent
+ * @return The bits of the positive double
+ */
+static uint64_t eisel_lemire(uint64_t w, int64_t q) {
+    if (w == 0 || q < FASTFLOAT_SMALLEST_POWER) return 0;
+    if (q > FASTFLOAT_LARGEST_POWER) return (uint64_t)INFINITE_POWER << MANTISSA_BITS;
+
+    // Normalize the mantissa, then multiply by the truncated power
+    // of five. The low half of the power is only needed when the
+    // bits below the result are all set, and may carry into it.
+    int lz = __builtin_clzll(w);
+    w <<= lz;
+    const uint64_t *pow5 = powerOfFive128 + 2 * (q - FASTFLOAT_SMALLEST_POWER);
+    uint128 product = full_multiply(w, pow5[0]);
+    if ((product.high & 0x1FF) == 0x1FF) {
+        uint128 second = full_multiply(w, pow5[1]);
+        product.low += second.high;
+        if (second.high > product.low) product.high++;
+    }
+
+    // Keep one extra bit for rounding. The binary exponent
+    // of 10^q is approximated by q * log2(10)
+    int upperbit = (int)(product.high >> 63);
+    int shift = upperbit + 64 - MANTISSA_BITS - 3;
+    uint64_t mantissa = product.high >> shift;
+    int32_t power2 = (int32_t)(((((152170 + 65536) * (int32_t)q) >> 16) + 63) +
+            upperbit - lz - MIN_EXPONENT);
+
+    // Subnormal results lose bits of the mantissa
+    if (power2 <= 0) {
+        if (-power2 + 1 >= 64) return 0;
+        mantissa >>= -power2 + 1;
+        mantissa += mantissa & 1;
+        mantissa >>= 1;
+        power2 = (mantissa < (1ULL << MANTISSA_BITS)) ? 0 : 1;
+        return mantissa | ((uint64_t)power2 << MANTISSA_BITS);
+    }
+
+    // Products that are exactly halfway can only occur for small
+    // exponents, where they are rounded to even instead of up
+    if (product.low <= 1 && q >= -4 && q <= 23 && (mantissa & 3) == 1) {
+        if ((mantissa << shift) == product.high) mantissa &= ~1ULL;
+    }
+
+    // Round, and renormalize if the mantissa overflowed
+    mantissa += mantissa & 1;
+    mantissa >>= 1;
+    if (mantissa >= (2ULL << MANTISSA_BITS)) {
+        mantissa = 1ULL << MANTISSA_BITS;
+        power2++;
+    }
+    mantissa &= ~(1ULL << MANTISSA_BITS);
+    if (power2 >= INFINITE_POWER) return (uint64_t)INFINITE_POWER << MANTISSA_BITS;
+    return mantissa | ((uint64_t)power2 << MANTISSA_BITS);
+}
+
+/**
+ * Converts a number using strtod. This is only needed when the
+ * digits beyond the 19th make the rounding ambiguous. The number is
+ * copied, so that strtod does not read beyond it.
+ * @arg s The start of the number
+ * @arg len The length of the number
+ * @return The parsed value
+ */
+static double parse_slow(const char *s, size_t len) {
+    char stack_buf[128];
+    char *copy = (len < sizeof(stack_buf)) ? stack_buf : malloc(len + 1);
+    if (!copy) return 0.0;
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    double val = strtod(copy, NULL);
+    if (copy != stack_buf) free(copy);
+    return val;
+}
+
+double fastfloat_parse(const char *s, size_t len, char **end) {
+    const char *p = s, *pe = s + len;
+    int neg = 0;
+    if (p < pe && (*p == '-' || *p == '+')) {
+        neg = (*p == '-');
+        p++;
+    }
+
+    // Accumulate the integer and fraction digits
+    uint64_t mantissa = 0;
+    const char *int_start = p;
+    p = parse_digits(p, pe, &mantissa);
+    const char *int_end = p, *frac_start = p, *frac_end = p;
+    if (p < pe && *p == '.') {
+        frac_start = ++p;
+        p = parse_digits(p, pe, &mantissa);
+        frac_end = p;
+    }
+    int64_t digits = (int_end - int_start) + (frac_end - frac_start);
+    int64_t exponent = frac_start - frac_end;
+    if (digits == 0) {
+        if (end) *end = (char*)s;
+        return 0.0;
+    }
+
+    // The exponent is only consumed if it has digits. Huge
+    // exponents are clamped, since they saturate anyway.
+    int64_t exp_number = 0;
+    if (p < pe && (*p == 'e' || *p == 'E')) {
+        const char *e = p + 1;
+        int exp_neg = 0;
+        if (e < pe && (*e == '-' || *e == '+')) {
+            exp_neg = (*e == '-');
+            e++;
+        }
+        if (e < pe && IS_DIGIT(*e)) {
+            for (; e < pe && IS_DIGIT(*e); e++) {
+                if (exp_number < 0x10000000) exp_number = exp_number * 10 + (*e - '0');
+            }
+            if (exp_neg) exp_number = -exp_number;
+            exponent += exp_number;
+            p = e;
+        }
+    }
+    if (end) *end = (char*)p;
+
+    // With more than 19 significant digits, the mantissa may have
+    // wrapped. Keep the leading 19 digits, and note the truncation.
+    int truncated = 0;
+    if (digits > MAX_DIGITS) {
+        const char *d = int_start;
+        for (; d < frac_end && (*d == '0' || *d == '.'); d++) {
+            if (*d == '0') digits--;
+        }
+        if (digits > MAX_DIGITS) {
+            truncated = 1;
+            mantissa = 0;
+            for (d = int_start; mantissa < MIN_19_DIGITS && d < int_end; d++) {
+                mantissa = mantissa * 10 + (*d - '0');
+            }
+            if (mantissa >= MIN_19_DIGITS) {
+                exponent = (int_end - d) + exp_number;
+            } else {
+                for (d = frac_start; mantissa < MIN_19_DIGITS && d < frac_end; d++) {
+                    mantissa = mantissa * 10 + (*d - '0');
+                }
+                exponent = (frac_start - d) + exp_number;
+            }
+        }
+    }
+
+    double val;
+    if (mantissa == 0) {
+        val = 0.0;
+
+    // Both operands are exact, so the single rounding is correct
+    } else if (!truncated && mantissa <= MAX_FAST_MANTISSA &&
+            exponent >= -MAX_FAST_EXPONENT && exponent <= MAX_FAST_EXPONENT) {
+        val = (double)(int64_t)mantissa;
+        if (exponent < 0)
+            val /= EXACT_POWERS[-exponent];
+        else if (exponent > 0)
+            val *= EXACT_POWERS[exponent];
+
+    } else {
+        // The truncated digits lie between the mantissa and the
+        // next one, if both round the same the result is exact
+        uint64_t bits = eisel_lemire(mantissa, exponent);
+        if (truncated && bits != eisel_lemire(mantissa + 1, exponent)) {
+            return parse_slow(s, p - s);
+        }
+
+        // Subnormal results, and those rounded up to the smallest
+        // normal, are left to strtod to decide if they underflow
+        if (bits && bits <= (1ULL << MANTISSA_BITS)) {
+            return parse_slow(s, p - s);
+        }
+        memcpy(&val, &bits, sizeof(val));
+        if (bits == 0 || bits == ((uint64_t)INFINITE_POWER << MANTISSA_BITS)) errno = ERANGE;
+    }
+    return neg ? -val : val;
+}
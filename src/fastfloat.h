@@ -0,0 +1,27 @@
+/**
+ * This module converts decimal strings to doubles. It is
+ * used instead of strtod for metric values, and is correctly
+ * rounded like strtod, but does not depend on the locale and
+ * does not allocate. Most values are handled by an exact fast
+ * path, the rest by the Eisel-Lemire algorithm, and only the
+ * rare inputs it cannot decide fall back to strtod.
+ */
+#ifndef FASTFLOAT_H
+#define FASTFLOAT_H
+#include <stddef.h>
+
+/**
+ * Parses a decimal number, with an optional sign, fraction and
+ * exponent. Unlike strtod, leading whitespace, hex, infinity and
+ * NaN are not accepted.
+ * @arg s The string to parse
+ * @arg len The number of bytes of the string that may be read
+ * @arg end Output. Set to the first byte after the number,
+ * or to s if there is no number. May be NULL.
+ * @return The parsed value. Like strtod, errno is set to ERANGE
+ * if the value overflows or underflows, including subnormal
+ * results, and is left unchanged otherwise.
+ */
+double fastfloat_parse(const char *s, size_t len, char **end);
+
+#endif
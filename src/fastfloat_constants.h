@@ -0,0 +1,12 @@
+#ifndef FASTFLOAT_CONSTANT_H
+#define FASTFLOAT_CONSTANT_H
+#include <stdint.h>
+
+// The range of decimal exponents covered by the table
+#define FASTFLOAT_SMALLEST_POWER -342
+#define FASTFLOAT_LARGEST_POWER 308
+#define FASTFLOAT_POWERS (FASTFLOAT_LARGEST_POWER - FASTFLOAT_SMALLEST_POWER + 1)
+
+extern const uint64_t powerOfFive128[2 * FASTFLOAT_POWERS];
+
+#endif
@@ -0,0 +1,386 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "hashmap.h"
+#include "forward.h"
+
+// The points of each node on the ring, so the keys spread evenly
+#define VNODES_PER_NODE 160
+
+// The most bytes batched for a connection before commands are dropped
+#define MAX_BUFFER_SIZE (4 * 1024 * 1024)
+
+// The delay before retrying an upstream that is down, doubled up to the max
+#define MIN_BACKOFF_MS 1000
+#define MAX_BACKOFF_MS 30000
+
+static int compare_points(const void *a, const void *b) {
+    const forward_point *pa = a, *pb = b;
+    if (pa->hash != pb->hash) return (pa->hash < pb->hash) ? -1 : 1;
+    return pa->node - pb->node;
+}
+
+/**
+ * Initializes a hash ring
+ * @return 0 on success.
+ */
+int forward_ring_init(forward_ring *ring, char **names, int num) {
+    ring->num_nodes = num;
+    ring->down = calloc(num, sizeof(char));
+    ring->num_points = num * VNODES_PER_NODE;
+    ring->points = malloc(ring->num_points * sizeof(forward_point));
+    if (!ring->down || !ring->points) {
+        forward_ring_destroy(ring);
+        return -1;
+    }
+
+    // Each point is hashed from the name and its index
+    char buf[512];
+    forward_point *p = ring->points;
+    for (int i=0; i < num; i++) {
+        for (int j=0; j < VNODES_PER_NODE; j++, p++) {
+            int len = snprintf(buf, sizeof(buf), "%s-%d", names[i], j);
+            if (len >= (int)sizeof(buf)) len = sizeof(buf) - 1;
+            p->hash = hashmap_hash(buf, len);
+            p->node = i;
+        }
+    }
+    qsort(ring->points, ring->num_points, sizeof(forward_point), compare_points);
+    return 0;
+}
+
+/**
+ * Finds the node of a key
+ * @return The node, or -1 if all are down.
+ */
+int forward_ring_lookup(forward_ring *ring, const char *key, uint32_t key_len) {
+    // Find the first point at or after the hash
+    uint64_t hash = hashmap_hash(key, key_len);
+    int low = 0, high = ring->num_points;
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        if (ring->points[mid].hash < hash)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    // Walk the ring past the nodes that are down
+    for (int i=0; i < ring->num_points; i++) {
+        forward_point *p = ring->points + (low + i) % ring->num_points;
+        if (!ring->down[p->node]) return p->node;
+    }
+    return -1;
+}
+
+void forward_ring_set_down(forward_ring *ring, int node, int down) {
+    ring->down[node] = (down != 0);
+}
+
+void forward_ring_destroy(forward_ring *ring) {
+    free(ring->down);
+    free(ring->points);
+    ring->down = NULL;
+    ring->points = NULL;
+    ring->num_nodes = 0;
+    ring->num_points = 0;
+}
+
+// Returns the monotonic time in milliseconds
+static uint64_t now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Splits a host:port into the upstream, a IPv6 host can be in brackets.
+// The address is resolved once here, so retries never block the event loop.
+static int init_upstream(char *name, forward_upstream *up) {
+    char *sep = strrchr(name, ':');
+    if (!sep || sep == name) return -1;
+    char *host;
+    if (name[0] == '[' && sep[-1] == ']')
+        host = strndup(name + 1, sep - name - 2);
+    else
+        host = strndup(name, sep - name);
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICSERV;
+    int err = getaddrinfo(host, sep + 1, &hints, &up->addrs);
+    if (err) {
+        syslog(LOG_ERR, "Failed to resolve forward host %s! Err: %s", name, gai_strerror(err));
+        free(host);
+        up->addrs = NULL;
+        return -1;
+    }
+
+    up->name = strdup(name);
+    up->host = host;
+    up->port = strdup(sep + 1);
+    for (int i=0; i < FORWARD_PROTOCOLS; i++) {
+        up->conns[i].fd = -1;
+    }
+    up->backoff_ms = MIN_BACKOFF_MS;
+    return 0;
+}
+
+/**
+ * Initializes a forwarder
+ * @return 0 on success.
+ */
+int init_forwarder(char *hosts, int batch_size, forwarder *fw) {
+    memset(fw, 0, sizeof(forwarder));
+    fw->batch_size = batch_size;
+
+    // Split the list, there are at most as many upstreams as commas
+    int max = 1;
+    for (char *c=hosts; *c; c++) {
+        if (*c == ',') max++;
+    }
+    fw->upstreams = calloc(max, sizeof(forward_upstream));
+    char **names = calloc(max, sizeof(char*));
+    char *copy = strdup(hosts), *saveptr = NULL;
+    int res = 0;
+    for (char *host = strtok_r(copy, ", ", &saveptr); host;
+            host = strtok_r(NULL, ", ", &saveptr)) {
+        res = init_upstream(host, fw->upstreams + fw->num_upstreams);
+        if (res) break;
+        names[fw->num_upstreams] = fw->upstreams[fw->num_upstreams].name;
+        fw->num_upstreams++;
+    }
+    free(copy);
+
+    if (!res && !fw->num_upstreams) res = -1;
+    if (!res) res = forward_ring_init(&fw->ring, names, fw->num_upstreams);
+    free(names);
+    if (res) {
+        syslog(LOG_ERR, "Failed to initialize the forward hosts: %s", hosts);
+        destroy_forwarder(fw);
+    }
+    return res;
+}
+
+// Closes a connection, and drops anything batched for it
+static void close_conn(forwarder *fw, forward_conn *c) {
+    if (c->fd >= 0) close(c->fd);
+    c->fd = -1;
+    c->connecting = 0;
+    fw->dropped += c->len;
+    c->len = 0;
+}
+
+// Closes the connections of an upstream, and skips it until it is retried
+static void upstream_down(forwarder *fw, int idx, const char *err) {
+    forward_upstream *up = fw->upstreams + idx;
+    syslog(LOG_WARNING, "Failed to forward to %s! Err: %s. Retrying in %d ms",
+            up->name, err, up->backoff_ms);
+    for (int i=0; i < FORWARD_PROTOCOLS; i++) {
+        close_conn(fw, up->conns + i);
+    }
+    forward_ring_set_down(&fw->ring, idx, 1);
+    up->retry_at = now_ms() + up->backoff_ms;
+    up->backoff_ms *= 2;
+    if (up->backoff_ms > MAX_BACKOFF_MS) up->backoff_ms = MAX_BACKOFF_MS;
+}
+
+// Starts a non-blocking connect to an upstream
+static int open_conn(forward_upstream *up, forward_conn *c) {
+    int fd = -1, optval = 1;
+    for (struct addrinfo *rp = up->addrs; rp != NULL; rp = rp->ai_next) {
+        fd = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+        if (fd == -1) continue;
+
+        // The batching is ours, so send the writes right away
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval));
+        if (connect(fd, rp->ai_addr, rp->ai_addrlen) == 0) {
+            c->connecting = 0;
+            break;
+        } else if (errno == EINPROGRESS) {
+            c->connecting = 1;
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    c->fd = fd;
+    return (fd == -1) ? -1 : 0;
+}
+
+// Checks if a connection is established, 0 if still waiting
+static int conn_ready(forward_conn *c) {
+    if (!c->connecting) return 1;
+    struct pollfd pfd = {c->fd, POLLOUT, 0};
+    if (poll(&pfd, 1, 0) == 0) return 0;
+
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) || err) {
+        errno = (err) ? err : errno;
+        return -1;
+    }
+    c->connecting = 0;
+    return 1;
+}
+
+// Writes out as much of the batch as the socket takes
+static int flush_conn(forwarder *fw, int idx, forward_conn *c) {
+    forward_upstream *up = fw->upstreams + idx;
+    if (!c->len) return 0;
+    if (c->fd == -1 && open_conn(up, c)) {
+        upstream_down(fw, idx, "could not connect");
+        return -1;
+    }
+
+    int ready = conn_ready(c);
+    if (ready <= 0) {
+        if (ready < 0) upstream_down(fw, idx, strerror(errno));
+        return ready;
+    }
+
+    size_t sent = 0;
+    while (sent < c->len) {
+        ssize_t n = send(c->fd, c->buf + sent, c->len - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n > 0) {
+            sent += n;
+        } else if (n == -1 && errno == EINTR) {
+            continue;
+        } else if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        } else {
+            upstream_down(fw, idx, (n == 0) ? "connection closed" : strerror(errno));
+            return -1;
+        }
+    }
+
+    // The upstream is healthy again once it takes data
+    if (sent) up->backoff_ms = MIN_BACKOFF_MS;
+
+    // Keep the rest of the batch for the next write
+    memmove(c->buf, c->buf + sent, c->len - sent);
+    c->len -= sent;
+    return 0;
+}
+
+/**
+ * Batches a command for the upstream of its key
+ * @return 0 on success, -1 if the command was dropped.
+ */
+int forward_command(forwarder *fw, int protocol, const char *key, uint32_t key_len,
+        const char *cmd, size_t len) {
+    int idx = forward_ring_lookup(&fw->ring, key, key_len);
+    if (idx < 0) {
+        fw->dropped += len;
+        return -1;
+    }
+
+    // Grow the batch, unless the upstream is too far behind
+    forward_conn *c = fw->upstreams[idx].conns + protocol;
+    if (c->len + len > c->size) {
+        size_t size = (c->size) ? c->size : fw->batch_size * 2;
+        while (size < c->len + len) size *= 2;
+        if (size > MAX_BUFFER_SIZE) {
+            fw->dropped += len;
+            return -1;
+        }
+        char *buf = realloc(c->buf, size);
+        if (!buf) {
+            fw->dropped += len;
+            return -1;
+        }
+        c->buf = buf;
+        c->size = size;
+    }
+    memcpy(c->buf + c->len, cmd, len);
+    c->len += len;
+
+    // Write out a full batch
+    if (c->len >= fw->batch_size) flush_conn(fw, idx, c);
+    return 0;
+}
+
+/**
+ * Writes out the batched commands without blocking,
+ * and retries the upstreams that are due.
+ */
+void forward_flush(forwarder *fw) {
+    uint64_t now = now_ms();
+    for (int i=0; i < fw->num_upstreams; i++) {
+        forward_upstream *up = fw->upstreams + i;
+        if (fw->ring.down[i]) {
+            if (now < up->retry_at) continue;
+            forward_ring_set_down(&fw->ring, i, 0);
+        }
+        for (int j=0; j < FORWARD_PROTOCOLS && !fw->ring.down[i]; j++) {
+            flush_conn(fw, i, up->conns + j);
+        }
+    }
+
+    if (fw->dropped) {
+        syslog(LOG_WARNING, "Dropped %llu bytes of commands to forward!",
+                (unsigned long long)fw->dropped);
+        fw->dropped = 0;
+    }
+}
+
+/**
+ * Writes out the batched commands, blocking until
+ * they are sent or the timeout expires.
+ * @return 0 if everything was sent, -1 otherwise.
+ */
+int forward_drain(forwarder *fw, int timeout_ms) {
+    struct pollfd *pfds = calloc(fw->num_upstreams * FORWARD_PROTOCOLS, sizeof(struct pollfd));
+    uint64_t deadline = now_ms() + timeout_ms;
+    int pending;
+    do {
+        forward_flush(fw);
+
+        // Wait for the connections that still have a batch
+        pending = 0;
+        for (int i=0; i < fw->num_upstreams; i++) {
+            for (int j=0; j < FORWARD_PROTOCOLS; j++) {
+                forward_conn *c = fw->upstreams[i].conns + j;
+                if (c->len && c->fd >= 0) {
+                    pfds[pending].fd = c->fd;
+                    pfds[pending++].events = POLLOUT;
+                }
+            }
+        }
+        if (pending) poll(pfds, pending, 10);
+    } while (pending && now_ms() < deadline);
+    free(pfds);
+    return (pending) ? -1 : 0;
+}
+
+/**
+ * Closes the connections and frees the memory of a forwarder
+ */
+void destroy_forwarder(forwarder *fw) {
+    for (int i=0; i < fw->num_upstreams; i++) {
+        forward_upstream *up = fw->upstreams + i;
+        for (int j=0; j < FORWARD_PROTOCOLS; j++) {
+            close_conn(fw, up->conns + j);
+            free(up->conns[j].buf);
+        }
+        if (up->addrs) freeaddrinfo(up->addrs);
+        free(up->name);
+        free(up->host);
+        free(up->port);
+    }
+    free(fw->upstreams);
+    forward_ring_destroy(&fw->ring);
+    memset(fw, 0, sizeof(forwarder));
+}
@@ -0,0 +1,159 @@
+/**
+ * This module implements the forward mode, which shards the
+ * input across several upstream statsite instances instead
+ * of aggregating it. Each command is routed by its key on a
+ * consistent hash ring, and appended to a buffer per upstream
+ * that is written out in large batches.
+ *
+ * Each upstream is placed on the ring at many points, hashed
+ * from its host:port, so the ring does not depend on the order
+ * of the upstreams. Adding or removing one only moves the keys
+ * it owns, and the keys of an upstream that is down move to
+ * the next points on the ring until it is retried.
+ */
+#ifndef FORWARD_H
+#define FORWARD_H
+#include <stdint.h>
+#include <stddef.h>
+#include <netdb.h>
+
+// The protocols of the commands, which are never mixed on a connection
+#define FORWARD_ASCII   0
+#define FORWARD_BINARY  1
+#define FORWARD_PROTOCOLS 2
+
+/**
+ * A point on the hash ring
+ */
+typedef struct {
+    uint64_t hash;
+    int node;
+} forward_point;
+
+/**
+ * The consistent hash ring
+ */
+typedef struct {
+    int num_nodes;
+    char *down;             // Nodes skipped by lookups
+    int num_points;
+    forward_point *points;  // Sorted by hash
+} forward_ring;
+
+/**
+ * A connection to an upstream, and the commands
+ * batched for it
+ */
+typedef struct {
+    int fd;             // -1 if not connected
+    int connecting;     // Waiting on a non-blocking connect
+    char *buf;
+    size_t len;         // Bytes batched
+    size_t size;        // Bytes allocated
+} forward_conn;
+
+/**
+ * An upstream statsite instance
+ */
+typedef struct {
+    char *name;         // The host:port, which places it on the ring
+    char *host;
+    char *port;
+    struct addrinfo *addrs; // Resolved when the forwarder is initialized
+    forward_conn conns[FORWARD_PROTOCOLS];
+    uint64_t retry_at;  // When an upstream that is down is retried
+    int backoff_ms;     // The delay before the next retry
+} forward_upstream;
+
+/**
+ * Forwards the commands of one event loop
+ */
+typedef struct {
+    forward_ring ring;
+    int num_upstreams;
+    forward_upstream *upstreams;
+    size_t batch_size;  // Bytes batched before a write
+    uint64_t dropped;   // Bytes dropped since the last warning
+} forwarder;
+
+/**
+ * Initializes a hash ring
+ * @arg ring The ring to initialize
+ * @arg names The names of the nodes
+ * @arg num The number of nodes
+ * @return 0 on success.
+ */
+int forward_ring_init(forward_ring *ring, char **names, int num);
+
+/**
+ * Finds the node of a key. Nodes that are down
+ * are skipped, moving their keys to the next node.
+ * @arg ring The ring
+ * @arg key The key
+ * @arg key_len The length of the key
+ * @return The node, or -1 if all are down.
+ */
+int forward_ring_lookup(forward_ring *ring, const char *key, uint32_t key_len);
+
+/**
+ * Marks a node as down or up
+ * @arg ring The ring
+ * @arg node The node
+ * @arg down Non-zero if the node is down
+ */
+void forward_ring_set_down(forward_ring *ring, int node, int down);
+
+/**
+ * Frees the memory of a hash ring
+ * @arg ring The ring to destroy
+ */
+void forward_ring_destroy(forward_ring *ring);
+
+/**
+ * Initializes a forwarder. The upstreams are resolved
+ * here, but connected lazily.
+ * @arg hosts A comma separated list of host:port upstreams
+ * @arg batch_size The bytes batched for an upstream before a write
+ * @arg fw The forwarder to initialize
+ * @return 0 on success.
+ */
+int init_forwarder(char *hosts, int batch_size, forwarder *fw);
+
+/**
+ * Batches a command for the upstream of its key, and writes
+ * the batch out once it is full. Commands are dropped if no
+ * upstream is up, or the upstream is too far behind.
+ * @arg fw The forwarder
+ * @arg protocol FORWARD_ASCII or FORWARD_BINARY
+ * @arg key The key of the command
+ * @arg key_len The length of the key
+ * @arg cmd The full command, forwarded as is
+ * @arg len The length of the command
+ * @return 0 on success, -1 if the command was dropped.
+ */
+int forward_command(forwarder *fw, int protocol, const char *key, uint32_t key_len,
+        const char *cmd, size_t len);
+
+/**
+ * Writes out the batched commands without blocking,
+ * and retries the upstreams that are due.
+ * @arg fw The forwarder
+ */
+void forward_flush(forwarder *fw);
+
+/**
+ * Writes out the batched commands, blocking until
+ * they are sent or the timeout expires.
+ * @arg fw The forwarder
+ * @arg timeout_ms The most time to wait
+ * @return 0 if everything was sent, -1 otherwise.
+ */
+int forward_drain(forwarder *fw, int timeout_ms);
+
+/**
+ * Closes the connections and frees the memory of a forwarder
+ * @arg fw The forwarder to destroy
+ */
+void destroy_forwarder(forwarder *fw);
+
+#endif
@@ -0,0 +1,42 @@
+#include "gauge.h"
+
+/**
+ * Merges one gauge into another
+ * @arg into The gauge to merge into
+ * @arg from The gauge to merge from, left unchanged
+ * @return 0 on success.
+ */
+int gauge_merge(gauge_t *into, gauge_t *from) {
+    // Only one absolute value is kept, with the deltas on top
+    if (!from->absolute || !into->absolute) into->value += from->value;
+    into->absolute = into->absolute || from->absolute;
+    return 0;
+}
+
+/**
+ * Encodes the gauge
+ * @arg g The gauge to encode
+ * @arg buf The buffer to append to
+ * @return 0 on success.
+ */
+int gauge_encode(gauge_t *g, codec_buf *buf) {
+    if (codec_put_version(buf)) return -1;
+    if (codec_put_u8(buf, g->absolute)) return -1;
+    return codec_put_double(buf, g->value);
+}
+
+/**
+ * Decodes a gauge, which can then be merged
+ * @arg r The reader of the encoding
+ * @arg g The gauge to initialize
+ * @return 0 on success, -1 on bad input.
+ */
+int gauge_decode(codec_reader *r, gauge_t *g) {
+    uint8_t absolute;
+    g->value = 0;
+    g->absolute = false;
+    if (codec_get_version(r)) return -1;
+    if (codec_get_u8(r, &absolute) || absolute > 1) return -1;
+    g->absolute = absolute;
+    return codec_get_double(r, &g->value);
+}
@@ -0,0 +1,39 @@
+#ifndef GAUGE_H
+#define GAUGE_H
+#include <stdbool.h>
+#include "codec.h"
+
+typedef struct {
+    double value;
+    bool absolute;      // Has the value been set, or only adjusted by deltas
+} gauge_t;
+
+/**
+ * Merges one gauge into another. Deltas are additive, but an
+ * absolute value replaces any deltas that were applied before it.
+ * Since there is no ordering between the two gauges, the deltas
+ * of a gauge without an absolute value are applied on top of
+ * the other gauge's absolute value.
+ * @arg into The gauge to merge into
+ * @arg from The gauge to merge from, left unchanged
+ * @return 0 on success.
+ */
+int gauge_merge(gauge_t *into, gauge_t *from);
+
+/**
+ * Encodes the gauge
+ * @arg g The gauge to encode
+ * @arg buf The buffer to append to
+ * @return 0 on success.
+ */
+int gauge_encode(gauge_t *g, codec_buf *buf);
+
+/**
+ * Decodes a gauge, which can then be merged
+ * @arg r The reader of the encoding
+ * @arg g The gauge to initialize
+ * @return 0 on success, -1 on bad input.
+ */
+int gauge_decode(codec_reader *r, gauge_t *g);
+
+#endif
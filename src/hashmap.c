@@ -1,22 +1,43 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 #include "hashmap.h"
 
 #define MAX_CAPACITY 0.75
 #define DEFAULT_CAPACITY 128
 
-// Basic hash entry.
-typedef struct hashmap_entry {
+/*
+ * The table uses open addressing. Slots are split into groups,
+ * and each slot has a control byte that is either empty, deleted,
+ * or holds the low 7 bits of the hash of its key. A probe matches
+ * a whole group of control bytes at once, and only compares the
+ * entries whose hash bits match. The probe sequence ends at the
+ * first group with an empty slot.
+ */
+#define GROUP_SIZE 16
+#define CTRL_EMPTY 0x80
+#define CTRL_DELETED 0xFE
+#define CTRL_HASH(hash) ((uint8_t)((hash) & 0x7F))
+
+// Basic hash entry. The hash and length of the key are
+// kept, so mismatches rarely need to compare the keys.
+typedef struct {
+    uint64_t hash;
     char *key;
+    uint32_t key_len;
     void *value;
-    struct hashmap_entry *next; // Support linking.
 } hashmap_entry;
 
 struct hashmap {
     int count;      // Number of entries
-    int table_size; // Size of table in nodes
-    int max_size;   // Max size before we resize
+    int deleted;    // Number of deleted slots
+    int table_size; // Size of table in slots
+    int max_size;   // Max used slots before we resize
+    uint8_t *ctrl;  // Control byte of each slot
+    int borrowed;   // Are the keys owned by the caller
     hashmap_entry *table; // Pointer to an arry of hashmap_entry objects
 };
 
@@ -24,12 +45,57 @@ struct hashmap {
 extern void MurmurHash3_x64_128(const void * key, const int len, const uint32_t seed, void *out);
 
 /**
- * Creates a new hashmap and allocates space for it.
- * @arg initial_size The minimim initial size. 0 for default (128).
- * @arg map Output. Set to the address of the map
- * @return 0 on success.
+ * Computes the hash of a key, as used by the map
  */
-int hashmap_init(int initial_size, hashmap **map) {
+uint64_t hashmap_hash(const char *key, uint32_t key_len) {
+    uint64_t out[2];
+    MurmurHash3_x64_128(key, key_len, 0, &out);
+    return out[1];
+}
+
+// Returns a bitmask of the slots in a group with the given control byte
+static inline uint32_t group_match(const uint8_t *group, uint8_t ctrl) {
+#if defined(__SSE2__)
+    __m128i bytes = _mm_loadu_si128((const __m128i*)group);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8((char)ctrl)));
+#else
+    uint32_t mask = 0;
+    for (int i=0; i < GROUP_SIZE; i++) {
+        mask |= (uint32_t)(group[i] == ctrl) << i;
+    }
+    return mask;
+#endif
+}
+
+// Returns a bitmask of the empty or deleted slots in a group
+static inline uint32_t group_match_free(const uint8_t *group) {
+#if defined(__SSE2__)
+    return _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)group));
+#else
+    uint32_t mask = 0;
+    for (int i=0; i < GROUP_SIZE; i++) {
+        mask |= (uint32_t)(group[i] >> 7) << i;
+    }
+    return mask;
+#endif
+}
+
+/**
+ * Allocates the slots of a map, all empty
+ */
+static void hashmap_alloc_table(hashmap *map, int table_size) {
+    map->table_size = table_size;
+    map->max_size = MAX_CAPACITY * table_size;
+    map->ctrl = malloc(table_size);
+    memset(map->ctrl, CTRL_EMPTY, table_size);
+    map->table = (hashmap_entry*)malloc(table_size * sizeof(hashmap_entry));
+}
+
+/**
+ * Rounds a requested table size up to a power of 2,
+ * of at least one group. 0 is the default size.
+ */
+static int hashmap_table_size(int initial_size) {
     // Default to 128 if no size
     if (initial_size <= 0) {
        initial_size = DEFAULT_CAPACITY;
@@ -49,48 +115,64 @@ int hashmap_init(int initial_size, hashmap **map) {
         initial_size = 1 << most_sig_bit;
     }
 
-    // Allocate the map
+    // The table holds at least one group
+    if (initial_size < GROUP_SIZE) initial_size = GROUP_SIZE;
+    return initial_size;
+}
+
+/**
+ * Allocates a map with an empty table
+ */
+static hashmap* hashmap_alloc(int initial_size, int borrowed) {
     hashmap *m = calloc(1, sizeof(hashmap));
-    m->table_size = initial_size;
-    m->max_size = MAX_CAPACITY * initial_size;
+    hashmap_alloc_table(m, hashmap_table_size(initial_size));
+    m->borrowed = borrowed;
+    return m;
+}
 
-    // Allocate the table
-    m->table = (hashmap_entry*)calloc(initial_size, sizeof(hashmap_entry));
+/**
+ * Creates a new hashmap and allocates space for it.
+ * @arg initial_size The minimim initial size. 0 for default (128).
+ * @arg map Output. Set to the address of the map
+ * @return 0 on success.
+ */
+int hashmap_init(int initial_size, hashmap **map) {
+    *map = hashmap_alloc(initial_size, 0);
+    return 0;
+}
 
-    // Return the table
-    *map = m;
+/**
+ * Creates a new hashmap that stores the keys it is given,
+ * instead of copies. The keys must outlive the map.
+ * @arg initial_size The minimim initial size. 0 for default (128).
+ * @arg map Output. Set to the address of the map
+ * @return 0 on success.
+ */
+int hashmap_init_borrowed(int initial_size, hashmap **map) {
+    *map = hashmap_alloc(initial_size, 1);
     return 0;
 }
 
+/**
+ * Frees the keys of all the entries, unless they are borrowed
+ */
+static void hashmap_free_keys(hashmap *map) {
+    if (map->borrowed) return;
+    for (int i=0; i < map->table_size; i++) {
+        if (map->ctrl[i] & 0x80) continue;
+        free(map->table[i].key);
+    }
+}
+
 /**
  * Destroys a map and cleans up all associated memory
  * @arg map The hashmap to destroy. Frees memory.
  */
 int hashmap_destroy(hashmap *map) {
-    // Free each entry
-    hashmap_entry *entry, *old;
-    int in_table;
-    for (int i=0; i < map->table_size; i++) {
-        entry = map->table+i;
-        in_table = 1;
-        while (entry && entry->key) {
-            // Walk the next links
-            old = entry;
-            entry = entry->next;
-
-            // Clear the objects
-            free(old->key);
-
-            // The initial entry is in the table
-            // and we should not free that one.
-            if (!in_table) {
-                free(old);
-            }
-            in_table = 0;
-        }
-    }
+    hashmap_free_keys(map);
 
     // Free the table and hash map
+    free(map->ctrl);
     free(map->table);
     free(map);
     return 0;
@@ -104,140 +186,125 @@ int hashmap_size(hashmap *map) {
 }
 
 /**
- * Gets a value.
+ * Finds the slot holding a key.
+ * @arg map The hashmap
  * @arg key The key to look for
  * @arg key_len The key length
- * @arg value Output. Set to the value of th key.
- * 0 on success. -1 if not found.
+ * @arg hash The hash of the key
+ * @return The slot index, or -1 if not found.
  */
-int hashmap_get(hashmap *map, char *key, void **value) {
-    // Compute the hash value of the key
-    uint64_t out[2];
-    MurmurHash3_x64_128(key, strlen(key), 0, &out);
-
-    // Mod the lower 64bits of the hash function with the table
-    // size to get the index
-    unsigned int index = out[1] % map->table_size;
-
-    // Look for an entry
-    hashmap_entry *entry = map->table+index;
-
-    // Scan the keys
-    while (entry && entry->key) {
-        // Found it
-        if (strcmp(entry->key, key) == 0) {
-            *value = entry->value;
-            return 0;
+static int hashmap_find(hashmap *map, const char *key, uint32_t key_len, uint64_t hash) {
+    uint32_t groups_mask = map->table_size / GROUP_SIZE - 1;
+    uint32_t group = (hash >> 7) & groups_mask;
+    uint8_t ctrl_hash = CTRL_HASH(hash);
+
+    // Triangular steps visit every group, since
+    // the number of groups is a power of 2
+    for (uint32_t step=1; ; step++) {
+        const uint8_t *ctrl = map->ctrl + group * GROUP_SIZE;
+        uint32_t match = group_match(ctrl, ctrl_hash);
+        while (match) {
+            int slot = group * GROUP_SIZE + __builtin_ctz(match);
+            hashmap_entry *entry = map->table + slot;
+            if (entry->hash == hash && entry->key_len == key_len &&
+                    (entry->key == key || memcmp(entry->key, key, key_len) == 0)) {
+                return slot;
+            }
+            match &= match - 1;
         }
 
-        // Walk the chain
-        entry = entry->next;
+        // An empty slot ends the probe sequence
+        if (group_match(ctrl, CTRL_EMPTY)) return -1;
+        group = (group + step) & groups_mask;
     }
-
-    // Not found
-    return -1;
 }
 
 /**
- * Internal method to insert into a hash table
- * @arg table The table to insert into
- * @arg table_size The size of the table
- * @arg key The key to insert
- * @arg key_len The length of the key
- * @arg value The value to associate
- * @arg should_cmp Should keys be compared to existing ones.
- * @arg should_dup Should duplicate keys
- * @return 1 if the key is new, 0 if updated.
+ * Finds the first empty or deleted slot on the probe
+ * sequence of a hash, where a new key is inserted.
+ * @return The slot index
  */
-static int hashmap_insert_table(hashmap_entry *table, int table_size, char *key, int key_len,
-                                void *value, int should_cmp, int should_dup) {
-    // Compute the hash value of the key
-    uint64_t out[2];
-    MurmurHash3_x64_128(key, key_len, 0, &out);
-
-    // Mod the lower 64bits of the hash function with the table
-    // size to get the index
-    unsigned int index = out[1] % table_size;
+static int hashmap_find_free(uint8_t *ctrl, int table_size, uint64_t hash) {
+    uint32_t groups_mask = table_size / GROUP_SIZE - 1;
+    uint32_t group = (hash >> 7) & groups_mask;
+    for (uint32_t step=1; ; step++) {
+        uint32_t match = group_match_free(ctrl + group * GROUP_SIZE);
+        if (match) return group * GROUP_SIZE + __builtin_ctz(match);
+        group = (group + step) & groups_mask;
+    }
+}
 
-    // Look for an entry
-    hashmap_entry *entry = table+index;
-    hashmap_entry *last_entry = NULL;
+/**
+ * Internal method to rebuild the table. The size is doubled,
+ * unless the deleted slots make up enough of the table that
+ * reclaiming them makes room. The cached hashes are reused.
+ */
+static void hashmap_resize(hashmap *map) {
+    uint8_t *old_ctrl = map->ctrl;
+    hashmap_entry *old_table = map->table;
+    int old_size = map->table_size;
+
+    int new_size = old_size;
+    if (map->count >= map->max_size / 2) new_size *= 2;
+    hashmap_alloc_table(map, new_size);
+    map->deleted = 0;
+
+    // Move each entry, keys are unique so there is nothing to compare
+    for (int i=0; i < old_size; i++) {
+        if (old_ctrl[i] & 0x80) continue;
+        int slot = hashmap_find_free(map->ctrl, new_size, old_table[i].hash);
+        map->ctrl[slot] = old_ctrl[i];
+        map->table[slot] = old_table[i];
+    }
 
-    // Scan the keys
-    while (entry && entry->key) {
-        // Found it, update the value
-        if (should_cmp && (strcmp(entry->key, key) == 0)) {
-            entry->value = value;
-            return 0;
-        }
+    free(old_ctrl);
+    free(old_table);
+}
 
-        // Walk the chain
-        last_entry = entry;
-        entry = entry->next;
+/**
+ * Internal method to insert a key that is not in the map.
+ * @arg key The key to insert, which is copied
+ * @arg key_len The key length
+ * @arg hash The hash of the key
+ * @arg value The value to associate
+ * @return The slot of the new entry
+ */
+static int hashmap_insert_new(hashmap *map, const char *key, uint32_t key_len, uint64_t hash, void *value) {
+    // Check if we need to grow, or clear out deleted slots
+    if (map->count + map->deleted + 1 > map->max_size) {
+        hashmap_resize(map);
     }
 
-    // If last entry is NULL, we can just
-    // insert directly into the table slot
-    // since it is empty
-    if (last_entry == NULL) {
-        entry->key = (should_dup) ? strdup(key) : key;
-        entry->value = value;
+    int slot = hashmap_find_free(map->ctrl, map->table_size, hash);
+    if (map->ctrl[slot] == CTRL_DELETED) map->deleted--;
+    map->ctrl[slot] = CTRL_HASH(hash);
 
-    // We have a last value, need to link against it
+    hashmap_entry *entry = map->table + slot;
+    entry->hash = hash;
+    if (map->borrowed) {
+        entry->key = (char*)key;
     } else {
-        entry = calloc(1, sizeof(hashmap_entry));
-        entry->key = (should_dup) ? strdup(key) : key;
-        entry->value = value;
-        last_entry->next = entry;
+        entry->key = malloc(key_len + 1);
+        memcpy(entry->key, key, key_len + 1);
     }
-    return 1;
+    entry->key_len = key_len;
+    entry->value = value;
+    map->count += 1;
+    return slot;
 }
 
-
 /**
- * Internal method to double the size of a hashmap
+ * Gets a value.
+ * @arg key The key to look for
+ * @arg value Output. Set to the value of th key.
+ * 0 on success. -1 if not found.
  */
-static void hashmap_double_size(hashmap *map) {
-    // Calculate the new sizes
-    int new_size = map->table_size * 2;
-    int new_max_size = map->max_size * 2;
-
-    // Allocate the table
-    hashmap_entry *new_table = (hashmap_entry*)calloc(new_size, sizeof(hashmap_entry));
-
-    // Move each entry
-    hashmap_entry *entry, *old;
-    int in_table;
-    for (int i=0; i < map->table_size; i++) {
-        entry = map->table+i;
-        in_table = 1;
-        while (entry && entry->key) {
-            // Walk the next links
-            old = entry;
-            entry = entry->next;
-
-            // Insert the value in the new map
-            // Do not compare keys or duplicate since we are just doubling our
-            // size, and we have unique keys and duplicates already.
-            hashmap_insert_table(new_table, new_size, old->key, strlen(old->key),
-                    old->value, 0, 0);
-
-            // The initial entry is in the table
-            // and we should not free that one.
-            if (!in_table) {
-                free(old);
-            }
-            in_table = 0;
-        }
-    }
-
-    // Free the old table
-    free(map->table);
-
-    // Update the pointers
-    map->table = new_table;
-    map->table_size = new_size;
-    map->max_size = new_max_size;
+int hashmap_get(hashmap *map, char *key, void **value) {
+    uint32_t key_len = strlen(key);
+    int slot = hashmap_find(map, key, key_len, hashmap_hash(key, key_len));
+    if (slot == -1) return -1;
+    *value = map->table[slot].value;
+    return 0;
 }
 
 /**
@@ -245,23 +312,86 @@ static void hashmap_double_size(hashmap *map) {
  * @arg key The key to set. This is copied, and a seperate
  * version is owned by the hashmap. The caller the key at will.
  * @notes This method is not thread safe.
- * @arg key_len The key length
  * @arg value The value to set.
  * 0 if updated, 1 if added.
  */
 int hashmap_put(hashmap *map, char *key, void *value) {
-    // Check if we need to double the size
-    if (map->count + 1 > map->max_size) {
-        // Doubles the size of the hashmap, re-try the insert
-        hashmap_double_size(map);
-        return hashmap_put(map, key, value);
+    uint32_t key_len = strlen(key);
+    uint64_t hash = hashmap_hash(key, key_len);
+    int slot = hashmap_find(map, key, key_len, hash);
+    if (slot != -1) {
+        map->table[slot].value = value;
+        return 0;
+    }
+    hashmap_insert_new(map, key, key_len, hash, value);
+    return 1;
+}
+
+/**
+ * Gets the value of a key, or puts a value if the key is not
+ * in the map, hashing and probing for the key only once.
+ * @arg key The key to look for. If added, this is copied.
+ * @notes This method is not thread safe.
+ * @arg value The value to put if the key is not found.
+ * @arg existing Output. Set to the value of the key, if found.
+ * 0 if found, 1 if added.
+ */
+int hashmap_get_or_insert(hashmap *map, char *key, void *value, void **existing) {
+    uint32_t key_len = strlen(key);
+    uint64_t hash = hashmap_hash(key, key_len);
+    int slot = hashmap_find(map, key, key_len, hash);
+    if (slot != -1) {
+        *existing = map->table[slot].value;
+        return 0;
     }
+    hashmap_insert_new(map, key, key_len, hash, value);
+    return 1;
+}
+
+/**
+ * Looks up a key, adding it with a NULL value if it is not in
+ * the map, and returns the slot that holds its value.
+ * @arg key The key to look for. If added, this is copied.
+ * @notes This method is not thread safe.
+ * @arg slot Output. Set to the address of the value of the key.
+ * It is only valid until the map is next modified.
+ * 0 if found, 1 if added.
+ */
+int hashmap_upsert(hashmap *map, char *key, void ***slot) {
+    uint32_t key_len = strlen(key);
+    return hashmap_upsert_hashed(map, key, key_len, hashmap_hash(key, key_len), slot);
+}
 
-    // Insert into the map, comparing keys and duplicating keys
-    int new = hashmap_insert_table(map->table, map->table_size, key, strlen(key), value, 1, 1);
-    if (new) map->count += 1;
+/**
+ * Gets a value, with the hash of the key already computed.
+ * @arg key The key to look for
+ * @arg key_len The key length
+ * @arg hash The hash of the key, from hashmap_hash
+ * @arg value Output. Set to the value of th key.
+ * 0 on success. -1 if not found.
+ */
+int hashmap_get_hashed(hashmap *map, const char *key, uint32_t key_len, uint64_t hash, void **value) {
+    int slot = hashmap_find(map, key, key_len, hash);
+    if (slot == -1) return -1;
+    *value = map->table[slot].value;
+    return 0;
+}
 
-    return new;
+/**
+ * Upserts a key, with the hash of the key already computed.
+ * @arg key The key to look for. If added, this is copied,
+ * unless the map borrows its keys.
+ * @arg key_len The key length
+ * @arg hash The hash of the key, from hashmap_hash
+ * @arg slot Output. Set to the address of the value of the key.
+ * 0 if found, 1 if added.
+ */
+int hashmap_upsert_hashed(hashmap *map, char *key, uint32_t key_len, uint64_t hash, void ***slot) {
+    int idx = hashmap_find(map, key, key_len, hash);
+    int added = (idx == -1);
+    if (added) idx = hashmap_insert_new(map, key, key_len, hash, NULL);
+    *slot = &map->table[idx].value;
+    return added;
 }
 
 /**
@@ -271,57 +401,23 @@ int hashmap_put(hashmap *map, char *key, void *value) {
  * 0 on success. -1 if not found.
  */
 int hashmap_delete(hashmap *map, char *key) {
-    // Compute the hash value of the key
-    uint64_t out[2];
-    MurmurHash3_x64_128(key, strlen(key), 0, &out);
-
-    // Mod the lower 64bits of the hash function with the table
-    // size to get the index
-    unsigned int index = out[1] % map->table_size;
-
-    // Look for an entry
-    hashmap_entry *entry = map->table+index;
-    hashmap_entry *last_entry = NULL;
-
-    // Scan the keys
-    while (entry && entry->key) {
-        // Found it
-        if (strcmp(entry->key, key) == 0) {
-            // Free the key
-            free(entry->key);
-            map->count -= 1;
-
-            // Check if we are in the table
-            if (last_entry == NULL) {
-                // Copy the keys from the node, and free it
-                if (entry->next) {
-                    hashmap_entry *n = entry->next;
-                    entry->key = n->key;
-                    entry->value = n->value;
-                    entry->next = n->next;
-                    free(n);
-
-                // Zero everything out
-                } else {
-                    entry->key = NULL;
-                    entry->value = NULL;
-                }
-
-            } else {
-                // Skip us in the list
-                last_entry->next = entry->next;
-
-                // Free ourself
-                free(entry);
-            }
-            return 0;
-        }
-        // Walk the chain
-        entry = entry->next;
+    uint32_t key_len = strlen(key);
+    int slot = hashmap_find(map, key, key_len, hashmap_hash(key, key_len));
+    if (slot == -1) return -1;
+
+    if (!map->borrowed) free(map->table[slot].key);
+    map->count -= 1;
+
+    // Probes only continue past groups without an empty slot, so
+    // in those the slot must stay marked to keep later keys reachable
+    uint8_t *group = map->ctrl + (slot & ~(GROUP_SIZE - 1));
+    if (group_match(group, CTRL_EMPTY)) {
+        map->ctrl[slot] = CTRL_EMPTY;
+    } else {
+        map->ctrl[slot] = CTRL_DELETED;
+        map->deleted += 1;
     }
-
-    // Not found
-    return -1;
+    return 0;
 }
 
 /**
@@ -330,32 +426,40 @@ int hashmap_delete(hashmap *map, char *key) {
  * 0 on success. -1 if not found.
  */
 int hashmap_clear(hashmap *map) {
-    hashmap_entry *entry, *old;
-    int in_table;
-    for (int i=0; i < map->table_size; i++) {
-        entry = map->table+i;
-        in_table = 1;
-        while (entry && entry->key) {
-            // Walk the next links
-            old = entry;
-            entry = entry->next;
-
-            // Clear the objects
-            free(old->key);
-
-            // The initial entry is in the table
-            // and we should not free that one.
-            if (!in_table) {
-                free(old);
-            } else {
-                old->key = NULL;
-            }
-            in_table = 0;
-        }
+    hashmap_free_keys(map);
+    memset(map->ctrl, CTRL_EMPTY, map->table_size);
+
+    // Reset the sizes
+    map->count = 0;
+    map->deleted = 0;
+    return 0;
+}
+
+/**
+ * Clears all the key/value pairs, and sizes the table to
+ * hold a number of entries without growing. The table is
+ * only reallocated if its size changes.
+ * @notes This method is not thread safe.
+ * @arg entries The number of entries to make room for
+ * @return 0 on success.
+ */
+int hashmap_reset(hashmap *map, int entries) {
+    hashmap_free_keys(map);
+
+    // Keep the load under the maximum with all the entries in
+    int table_size = hashmap_table_size(entries + (entries + 2) / 3);
+    if (table_size < DEFAULT_CAPACITY) table_size = DEFAULT_CAPACITY;
+    if (table_size == map->table_size) {
+        memset(map->ctrl, CTRL_EMPTY, map->table_size);
+    } else {
+        free(map->ctrl);
+        free(map->table);
+        hashmap_alloc_table(map, table_size);
     }
 
     // Reset the sizes
     map->count = 0;
+    map->deleted = 0;
     return 0;
 }
 
@@ -373,13 +477,9 @@ int hashmap_iter(hashmap *map, hashmap_callback cb, void *data) {
     hashmap_entry *entry;
     int should_break = 0;
     for (int i=0; i < map->table_size && !should_break; i++) {
+        if (map->ctrl[i] & 0x80) continue;
         entry = map->table+i;
-        while (entry && entry->key && !should_break) {
-            // Invoke the callback
-            should_break = cb(data, entry->key, entry->value);
-            entry = entry->next;
-        }
+        should_break = cb(data, entry->key, entry->value);
     }
     return should_break;
 }
-
@@ -1,5 +1,6 @@
 #ifndef HASHMAP_H
 #define HASHMAP_H
+#include <stdint.h>
 
 /**
  * Opaque hashmap reference
@@ -15,6 +16,25 @@ typedef int(*hashmap_callback)(void *data, const char *key, void *value);
  */
 int hashmap_init(int initial_size, hashmap **map);
 
+/**
+ * Creates a new hashmap that stores the keys it is given,
+ * instead of copying them. The keys are not freed by the
+ * map, and must stay valid for as long as they are in it.
+ * @arg initial_size The minimim initial size. 0 for default (128).
+ * @arg map Output. Set to the address of the map
+ * @return 0 on success.
+ */
+int hashmap_init_borrowed(int initial_size, hashmap **map);
+
+/**
+ * Computes the hash the maps use for a key, so that callers
+ * can compute it once for use with the *_hashed methods.
+ * @arg key The key to hash
+ * @arg key_len The key length
+ * @return The hash of the key
+ */
+uint64_t hashmap_hash(const char *key, uint32_t key_len);
+
 /**
  * Destroys a map and cleans up all associated memory
  * @arg map The hashmap to destroy. Frees memory.
@@ -45,6 +65,53 @@ int hashmap_get(hashmap *map, char *key, void **value);
  */
 int hashmap_put(hashmap *map, char *key, void *value);
 
+/**
+ * Gets the value of a key, or puts a value if the key is not
+ * in the map, hashing and probing for the key only once.
+ * @arg key The key to look for. If added, this is copied.
+ * @notes This method is not thread safe.
+ * @arg value The value to put if the key is not found.
+ * @arg existing Output. Set to the value of the key, if found.
+ * 0 if found, 1 if added.
+ */
+int hashmap_get_or_insert(hashmap *map, char *key, void *value, void **existing);
+
+/**
+ * Looks up a key, adding it with a NULL value if it is not in
+ * the map, and returns the slot that holds its value, hashing
+ * and probing for the key only once. The caller can then create
+ * the value in place for a new key.
+ * @arg key The key to look for. If added, this is copied.
+ * @notes This method is not thread safe.
+ * @arg slot Output. Set to the address of the value of the key.
+ * It is only valid until the map is next modified.
+ * 0 if found, 1 if added.
+ */
+int hashmap_upsert(hashmap *map, char *key, void ***slot);
+
+/**
+ * Gets a value, with the hash of the key already computed.
+ * @arg key The key to look for
+ * @arg key_len The key length
+ * @arg hash The hash of the key, from hashmap_hash
+ * @arg value Output. Set to the value of th key.
+ * 0 on success. -1 if not found.
+ */
+int hashmap_get_hashed(hashmap *map, const char *key, uint32_t key_len, uint64_t hash, void **value);
+
+/**
+ * Like hashmap_upsert, with the hash of the key already computed.
+ * @arg key The key to look for. If added, this is copied, unless
+ * the map borrows its keys, in which case it is stored as is.
+ * @notes This method is not thread safe.
+ * @arg key_len The key length
+ * @arg hash The hash of the key, from hashmap_hash
+ * @arg slot Output. Set to the address of the value of the key.
+ * It is only valid until the map is next modified.
+ * 0 if found, 1 if added.
+ */
+int hashmap_upsert_hashed(hashmap *map, char *key, uint32_t key_len, uint64_t hash, void ***slot);
+
 /**
  * Deletes a key/value pair.
  * @notes This method is not thread safe.
@@ -61,6 +128,16 @@ int hashmap_delete(hashmap *map, char *key);
  */
 int hashmap_clear(hashmap *map);
 
+/**
+ * Clears all the key/value pairs, and sizes the table to
+ * hold a number of entries without growing. Used to reuse
+ * a map when the expected number of keys is known.
+ * @notes This method is not thread safe.
+ * @arg entries The number of entries to make room for
+ * @return 0 on success.
+ */
+int hashmap_reset(hashmap *map, int entries);
+
 /**
  * Iterates through the key/value pairs in the map,
  * invoking a callback for each. The call back gets a
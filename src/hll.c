@@ -22,6 +22,7 @@ State of The Art Cardinality Estimation Algorithm"
 #define REG_PER_WORD 5  // floor(INT_WIDTH / REG_WIDTH)
 
 #define NUM_REG(precision) ((1 << precision))
+#define NUM_WORDS(precision) ((NUM_REG(precision) + REG_PER_WORD - 1) / REG_PER_WORD)
 
 // Link the external murmur hash in
 extern void MurmurHash3_x64_128(const void * key, const int len, const uint32_t seed, void *out);
@@ -116,6 +117,67 @@ void hll_add_hash(hll_t *h, uint64_t hash) {
     }
 }
 
+/**
+ * Merges the registers of one HLL into another,
+ * the result estimates the cardinality of the union.
+ * @arg into The hll to merge into
+ * @arg from The hll to merge from, left unchanged
+ * @return 0 on success, -1 if the precisions differ
+ */
+int hll_merge(hll_t *into, hll_t *from) {
+    if (into->precision != from->precision)
+        return -1;
+
+    // The union keeps the largest value seen for each register
+    int reg = NUM_REG(into->precision);
+    int val;
+    for (int i=0; i < reg; i++) {
+        val = get_register(from, i);
+        if (val > get_register(into, i)) {
+            set_register(into, i, val);
+        }
+    }
+    return 0;
+}
+
+/**
+ * Encodes the precision and registers of an HLL.
+ * Each word is a varint, so the empty registers
+ * of a sparse HLL take little space.
+ * @arg h The hll to encode
+ * @arg buf The buffer to append to
+ * @return 0 on success
+ */
+int hll_encode(hll_t *h, codec_buf *buf) {
+    if (codec_put_u8(buf, h->precision)) return -1;
+    int words = NUM_WORDS(h->precision);
+    for (int i=0; i < words; i++) {
+        if (codec_put_varint(buf, h->registers[i])) return -1;
+    }
+    return 0;
+}
+
+/**
+ * Decodes an HLL
+ * @arg r The reader of the encoding
+ * @arg h The HLL to initialize
+ * @return 0 on success, -1 on bad input
+ */
+int hll_decode(codec_reader *r, hll_t *h) {
+    unsigned char precision;
+    if (codec_get_u8(r, &precision)) return -1;
+    if (hll_init(precision, h)) return -1;
+
+    int words = NUM_WORDS(precision);
+    for (int i=0; i < words; i++) {
+        if (codec_get_u32(r, h->registers + i)) {
+            hll_destroy(h);
+            return -1;
+        }
+    }
+    return 0;
+}
+
 /*
  * Returns the bias correctors from the
  * hyperloglog paper
@@ -1,4 +1,5 @@
 #include <stdint.h>
+#include "codec.h"
 
 #ifndef HLL_H
 #define HLL_H
@@ -47,6 +48,31 @@ void hll_add_hash(hll_t *h, uint64_t hash);
  */
 double hll_size(hll_t *h);
 
+/**
+ * Merges the registers of one HLL into another,
+ * the result estimates the cardinality of the union.
+ * @arg into The hll to merge into
+ * @arg from The hll to merge from, left unchanged
+ * @return 0 on success, -1 if the precisions differ
+ */
+int hll_merge(hll_t *into, hll_t *from);
+
+/**
+ * Encodes the precision and registers of an HLL
+ * @arg h The hll to encode
+ * @arg buf The buffer to append to
+ * @return 0 on success
+ */
+int hll_encode(hll_t *h, codec_buf *buf);
+
+/**
+ * Decodes an HLL
+ * @arg r The reader of the encoding
+ * @arg h The HLL to initialize
+ * @return 0 on success, -1 on bad input
+ */
+int hll_decode(codec_reader *r, hll_t *h);
+
 /**
  * Computes the minimum digits of precision
  * needed to hit a target error.
@@ -0,0 +1,139 @@
+#include <stdlib.h>
+#include <string.h>
+#include "hashmap.h"
+#include "intern.h"
+
+struct intern_table {
+    hashmap *names;         // Map of name -> intern_key, borrowing the key names
+    uint64_t interval;      // The current interval
+    uint32_t next_id;       // The lowest ID never handed out
+    uint32_t *free_ids;     // IDs of evicted names, to reuse
+    uint32_t num_free;      // Number of free IDs
+    uint32_t free_size;     // Size of the free_ids array
+};
+
+/**
+ * Creates a new, empty intern table.
+ * @return 0 on success.
+ */
+int intern_init(intern_table **table) {
+    intern_table *t = calloc(1, sizeof(intern_table));
+    int res = hashmap_init_borrowed(0, &t->names);
+    if (res) {
+        free(t);
+        return res;
+    }
+    *table = t;
+    return 0;
+}
+
+static int free_key_cb(void *data, const char *key, void *value) {
+    free(value);
+    return 0;
+}
+
+/**
+ * Destroys a table and frees all of its names.
+ * @return 0 on success.
+ */
+int intern_destroy(intern_table *table) {
+    hashmap_iter(table->names, free_key_cb, NULL);
+    hashmap_destroy(table->names);
+    free(table->free_ids);
+    free(table);
+    return 0;
+}
+
+/**
+ * Returns the number of interned names
+ */
+int intern_size(intern_table *table) {
+    return hashmap_size(table->names);
+}
+
+/**
+ * Returns an upper bound on the IDs in use
+ */
+uint32_t intern_max_id(intern_table *table) {
+    return table->next_id;
+}
+
+/**
+ * Interns a name, and marks it used in the current interval.
+ * @return The interned name.
+ */
+intern_key* intern_name(intern_table *table, const char *name, uint32_t len) {
+    uint64_t hash = hashmap_hash(name, len);
+    intern_key *key;
+    if (!hashmap_get_hashed(table->names, name, len, hash, (void**)&key)) {
+        key->last_used = table->interval;
+        return key;
+    }
+
+    // Copy the new name, the map borrows the copy
+    key = malloc(sizeof(intern_key) + len + 1);
+    key->hash = hash;
+    key->last_used = table->interval;
+    key->id = (table->num_free) ? table->free_ids[--table->num_free] : table->next_id++;
+    key->len = len;
+    memcpy(key->name, name, len);
+    key->name[len] = '\0';
+
+    void **slot;
+    hashmap_upsert_hashed(table->names, key->name, len, hash, &slot);
+    *slot = key;
+    return key;
+}
+
+struct evict_info {
+    intern_table *table;
+    uint64_t before;        // Evict names last used before this interval
+    intern_key **evicted;   // The names to evict
+    int num_evicted;
+    int size;
+};
+
+static int find_idle_cb(void *data, const char *name, void *value) {
+    struct evict_info *info = data;
+    intern_key *key = value;
+    if (key->last_used >= info->before) return 0;
+
+    if (info->num_evicted == info->size) {
+        info->size = (info->size) ? info->size * 2 : 64;
+        info->evicted = realloc(info->evicted, info->size * sizeof(intern_key*));
+    }
+    info->evicted[info->num_evicted++] = key;
+    return 0;
+}
+
+/**
+ * Starts a new interval, and evicts the names that were
+ * not used in the given number of intervals before it.
+ * @return The number of names evicted.
+ */
+int intern_next_interval(intern_table *table, uint32_t idle_intervals) {
+    table->interval++;
+    if (!idle_intervals || table->interval <= idle_intervals) return 0;
+
+    // Find the idle names first, the map can not
+    // be modified while we iterate over it
+    struct evict_info info = {table, table->interval - idle_intervals, NULL, 0, 0};
+    hashmap_iter(table->names, find_idle_cb, &info);
+    if (!info.num_evicted) return 0;
+
+    // Make room to recycle all the IDs
+    uint32_t needed = table->num_free + info.num_evicted;
+    if (needed > table->free_size) {
+        table->free_size = needed;
+        table->free_ids = realloc(table->free_ids, needed * sizeof(uint32_t));
+    }
+
+    for (int i=0; i < info.num_evicted; i++) {
+        intern_key *key = info.evicted[i];
+        hashmap_delete(table->names, key->name);
+        table->free_ids[table->num_free++] = key->id;
+        free(key);
+    }
+    free(info.evicted);
+    return info.num_evicted;
+}
@@ -0,0 +1,78 @@
+/**
+ * This module interns metric names. Each distinct name is
+ * stored once, along with its hash and a dense integer ID,
+ * and is kept from one flush interval to the next. Metrics
+ * can then refer to a name that repeats every interval
+ * without copying or hashing it again. Names that go unused
+ * for a number of intervals are evicted, and their IDs reused.
+ */
+#ifndef INTERN_H
+#define INTERN_H
+#include <stdint.h>
+
+/**
+ * An interned name. The memory is stable
+ * until the name is evicted.
+ */
+typedef struct {
+    uint64_t hash;          // The hash of the name, from hashmap_hash
+    uint64_t last_used;     // The last interval the name was used in
+    uint32_t id;            // Dense ID, unique in the table
+    uint32_t len;           // The length of the name
+    char name[];            // The null terminated name
+} intern_key;
+
+/**
+ * Opaque intern table reference
+ */
+typedef struct intern_table intern_table;
+
+/**
+ * Creates a new, empty intern table.
+ * @arg table Output. Set to the address of the table
+ * @return 0 on success.
+ */
+int intern_init(intern_table **table);
+
+/**
+ * Destroys a table and frees all of its names.
+ * @arg table The table to destroy
+ * @return 0 on success.
+ */
+int intern_destroy(intern_table *table);
+
+/**
+ * Returns the number of interned names
+ */
+int intern_size(intern_table *table);
+
+/**
+ * Returns an upper bound on the IDs in use, for
+ * sizing the arrays that are indexed by ID.
+ */
+uint32_t intern_max_id(intern_table *table);
+
+/**
+ * Interns a name, and marks it used in the current interval.
+ * @notes This method is not thread safe.
+ * @arg table The intern table
+ * @arg name The name to intern. This is copied if it is new.
+ * @arg len The length of the name
+ * @return The interned name.
+ */
+intern_key* intern_name(intern_table *table, const char *name, uint32_t len);
+
+/**
+ * Starts a new interval, and evicts the names that were
+ * not used in the given number of intervals before it.
+ * The caller must make sure that no metrics still refer
+ * to names that were last used that long ago.
+ * @notes This method is not thread safe.
+ * @arg table The intern table
+ * @arg idle_intervals The intervals a name may go unused
+ * before it is evicted. 0 to never evict.
+ * @return The number of names evicted.
+ */
+int intern_next_interval(intern_table *table, uint32_t idle_intervals);
+
+#endif
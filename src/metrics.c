@@ -1,19 +1,27 @@
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include "metrics.h"
 #include "set.h"
 
-static int counter_delete_cb(void *data, const char *key, void *value);
-static int timer_delete_cb(void *data, const char *key, void *value);
-static int set_delete_cb(void *data, const char *key, void *value);
-static int gauge_delete_cb(void *data, const char *key, void *value);
-static int iter_cb(void *data, const char *key, void *value);
+// The slot of each list, in the slots of a name
+#define COUNTER_SLOT    0
+#define TIMER_SLOT      1
+#define SET_SLOT        2
+#define GAUGE_SLOT      3
 
-struct cb_info {
-    metric_type type;
-    void *data;
-    metric_callback cb;
-};
+// The size of a chunk of K/V pairs, unless a name needs more
+#define KV_CHUNK_SIZE   65536
+
+// The space taken by a K/V pair, keeping the next one aligned
+#define KV_SIZE(len) ((offsetof(key_val, name) + (len) + 1 + 7) & ~7)
+
+static void destroy_timers(value_list *timers);
+static void destroy_sets(value_list *sets);
+static void counter_merge_cb(metrics *into, uint32_t pos, metrics *from, uint32_t from_pos, bool exists);
+static void timer_merge_cb(metrics *into, uint32_t pos, metrics *from, uint32_t from_pos, bool exists);
+static void set_merge_cb(metrics *into, uint32_t pos, metrics *from, uint32_t from_pos, bool exists);
+static void gauge_merge_cb(metrics *into, uint32_t pos, metrics *from, uint32_t from_pos, bool exists);
 
 /**
  * Initializes the metrics struct.
@@ -32,20 +40,29 @@ int init_metrics(double timer_eps, double *quantiles, uint32_t num_quants, radix
     m->quantiles = malloc(num_quants * sizeof(double));
     memcpy(m->quantiles, quantiles, num_quants * sizeof(double));
     m->histograms = histograms;
+    m->engine = QUANTILE_CM;
+    m->engines = NULL;
     m->set_precision = set_precision;
 
-    // Allocate the hashmaps
-    int res = hashmap_init(0, &m->counters);
-    if (res) return res;
-    res = hashmap_init(0, &m->timers);
-    if (res) return res;
-    res = hashmap_init(0, &m->sets);
+    // Intern the names in a private table, until a shared one is set
+    int res = intern_init(&m->names);
     if (res) return res;
-    res = hashmap_init(0, &m->gauges);
-    if (res) return res;
-
-    // Set the head of our linked list to null
-    m->kv_vals = NULL;
+    m->own_names = true;
+    m->slots = NULL;
+    m->num_slots = 0;
+
+    // The lists are allocated on first use
+    memset(&m->counters, 0, sizeof(counter_list));
+    memset(&m->timers, 0, sizeof(value_list));
+    memset(&m->sets, 0, sizeof(value_list));
+    memset(&m->gauges, 0, sizeof(gauge_list));
+    arena_init(&m->mem);
+    timer_pool_init(&m->mem, &m->pool);
+
+    // The K/V chunks are allocated on first use
+    m->kv_head = NULL;
+    m->kv_tail = NULL;
+    m->inputs = 0;
     return 0;
 }
 
@@ -61,6 +78,77 @@ int init_metrics_defaults(metrics *m) {
     return init_metrics(0.01, (double*)&quants, 3, NULL, 12, m);
 }
 
+/**
+ * Sets the quantile engines of new timers
+ * @arg engine The engine of timers without a configured prefix
+ * @arg engines A radix tree with quantile engine configs, or NULL
+ * @return 0 on success.
+ */
+int metrics_set_quantile_engines(metrics *m, quantile_engine engine, radix_tree *engines) {
+    m->engine = engine;
+    m->engines = engines;
+    return 0;
+}
+
+// Returns the list of a slot
+static metric_list* metrics_list(metrics *m, int slot) {
+    switch (slot) {
+        case COUNTER_SLOT:
+            return &m->counters.list;
+        case TIMER_SLOT:
+            return &m->timers.list;
+        case SET_SLOT:
+            return &m->sets.list;
+        default:
+            return &m->gauges.list;
+    }
+}
+
+// Resizes an array, freeing it when empty
+static void* resize_array(void *array, uint32_t size, size_t width) {
+    if (!size) {
+        free(array);
+        return NULL;
+    }
+    return realloc(array, size * width);
+}
+
+/**
+ * Resizes the arrays of a list
+ * @arg slot The slot of the list
+ * @arg size The new size of the arrays
+ */
+static void list_resize(metrics *m, int slot, uint32_t size) {
+    metric_list *list = metrics_list(m, slot);
+    list->keys = resize_array(list->keys, size, sizeof(intern_key*));
+    switch (slot) {
+        case COUNTER_SLOT:
+            m->counters.sum = resize_array(m->counters.sum, size, sizeof(double));
+            m->counters.count = resize_array(m->counters.count, size, sizeof(uint64_t));
+            break;
+        case TIMER_SLOT:
+            m->timers.values = resize_array(m->timers.values, size, sizeof(void*));
+            break;
+        case SET_SLOT:
+            m->sets.values = resize_array(m->sets.values, size, sizeof(void*));
+            break;
+        case GAUGE_SLOT:
+            m->gauges.value = resize_array(m->gauges.value, size, sizeof(double));
+            m->gauges.absolute = resize_array(m->gauges.absolute, size, sizeof(bool));
+            break;
+    }
+    list->size = size;
+}
+
+// Empties a list, keeping the arrays
+static void list_clear(metric_list *list) {
+    list->count = 0;
+    if (list->by_name) {
+        hashmap_destroy(list->by_name);
+        list->by_name = NULL;
+    }
+}
+
 /**
  * Destroys the metrics
  * @return 0 on success.
@@ -69,35 +157,146 @@ int destroy_metrics(metrics *m) {
     // Clear the copied quantiles array
     free(m->quantiles);
 
-    // Nuke all the k/v pairs
-    key_val *current = m->kv_vals;
-    key_val *prev = NULL;
-    while (current) {
-        free(current->name);
-        prev = current;
-        current = current->next;
-        free(prev);
+    // Nuke the timers and sets, the rest lives in the arena
+    destroy_timers(&m->timers);
+    destroy_sets(&m->sets);
+    for (int slot=0; slot < METRIC_LISTS; slot++) {
+        list_clear(metrics_list(m, slot));
+        list_resize(m, slot, 0);
     }
 
-    // Nuke the counters
-    hashmap_iter(m->counters, counter_delete_cb, NULL);
-    hashmap_destroy(m->counters);
+    // Release the names
+    free(m->slots);
+    if (m->own_names) intern_destroy(m->names);
 
-    // Nuke the timers
-    hashmap_iter(m->timers, timer_delete_cb, NULL);
-    hashmap_destroy(m->timers);
-
-    // Nuke the timers
-    hashmap_iter(m->sets, set_delete_cb, NULL);
-    hashmap_destroy(m->sets);
+    // Release the k/v pairs and metric structs at once
+    arena_destroy(&m->mem);
+    return 0;
+}
 
-    // Nuke the gauges
-    hashmap_iter(m->gauges, gauge_delete_cb, NULL);
-    hashmap_destroy(m->gauges);
+/**
+ * Uses a shared table to intern the names.
+ * @return 0 on success.
+ */
+int metrics_share_names(metrics *m, intern_table *names) {
+    if (m->own_names) intern_destroy(m->names);
+    m->names = names;
+    m->own_names = false;
+    return 0;
+}
 
+/**
+ * Empties the metrics for reuse, sizing the lists
+ * for the expected number of metrics.
+ * @return 0 on success.
+ */
+int reset_metrics(metrics *m, metrics_sizes *sizes) {
+    // The timers and sets own memory outside the arena
+    destroy_timers(&m->timers);
+    destroy_sets(&m->sets);
+
+    int expected[METRIC_LISTS];
+    expected[COUNTER_SLOT] = sizes->counters;
+    expected[TIMER_SLOT] = sizes->timers;
+    expected[SET_SLOT] = sizes->sets;
+    expected[GAUGE_SLOT] = sizes->gauges;
+    for (int slot=0; slot < METRIC_LISTS; slot++) {
+        metric_list *list = metrics_list(m, slot);
+        list_clear(list);
+        if (list->size != (uint32_t)expected[slot]) list_resize(m, slot, expected[slot]);
+    }
+    if (m->slots) memset(m->slots, 0, m->num_slots * sizeof(name_slots));
+
+    // Keep a block of the arena, so the next
+    // interval starts without allocating
+    m->kv_head = NULL;
+    m->kv_tail = NULL;
+    m->inputs = 0;
+    arena_reset(&m->mem);
+    timer_pool_clear(&m->pool);
     return 0;
 }
 
+/**
+ * Gets the number of distinct metrics of each type.
+ */
+void metrics_get_sizes(metrics *m, metrics_sizes *sizes) {
+    sizes->counters = m->counters.list.count;
+    sizes->timers = m->timers.list.count;
+    sizes->sets = m->sets.list.count;
+    sizes->gauges = m->gauges.list.count;
+}
+
+/**
+ * Returns the slots of a name ID, growing the array if needed
+ */
+static name_slots* metrics_slots(metrics *m, uint32_t id) {
+    if (id >= m->num_slots) {
+        uint32_t size = (m->num_slots) ? m->num_slots * 2 : 64;
+        while (size <= id) size *= 2;
+        m->slots = realloc(m->slots, size * sizeof(name_slots));
+        memset(m->slots + m->num_slots, 0, (size - m->num_slots) * sizeof(name_slots));
+        m->num_slots = size;
+    }
+    return m->slots + id;
+}
+
+/**
+ * Finds the metric of a name in this interval, by
+ * the ID of the interned name.
+ * @arg slot The slot of the metric type
+ * @arg name The name of the metric
+ * @arg key Output. The interned name
+ * @return The position of the metric plus one, or 0 if it is new.
+ */
+static uint32_t metrics_find(metrics *m, int slot, char *name, intern_key **key) {
+    intern_key *k = intern_name(m->names, name, strlen(name));
+    *key = k;
+    return metrics_slots(m, k->id)->pos[slot];
+}
+
+/**
+ * Adds a name to the end of a list, growing its arrays.
+ * The caller must set the metric at the returned position.
+ * @arg slot The slot of the metric type
+ * @arg key The name of the metric
+ * @arg by_id Is the name interned in our table
+ * @return The position of the metric
+ */
+static uint32_t metrics_append(metrics *m, int slot, intern_key *key, bool by_id) {
+    metric_list *list = metrics_list(m, slot);
+    if (list->count == list->size) {
+        list_resize(m, slot, (list->size) ? list->size * 2 : 64);
+    }
+    uint32_t pos = list->count++;
+    list->keys[pos] = key;
+
+    // Keep the index up to date, once it is built
+    if (list->by_name) {
+        void **entry;
+        hashmap_upsert_hashed(list->by_name, key->name, key->len, key->hash, &entry);
+        *entry = (void*)(uintptr_t)pos;
+    }
+    if (by_id) metrics_slots(m, key->id)->pos[slot] = pos + 1;
+    return pos;
+}
+
+/**
+ * Returns the position of the counter with the given
+ * name, adding it if it is new.
+ */
+static uint32_t metrics_counter(metrics *m, char *name) {
+    intern_key *key;
+    uint32_t pos = metrics_find(m, COUNTER_SLOT, name, &key);
+    if (pos) return pos - 1;
+
+    // New counter
+    pos = metrics_append(m, COUNTER_SLOT, key, true);
+    m->counters.sum[pos] = 0;
+    m->counters.count[pos] = 0;
+    return pos;
+}
+
 /**
  * Increments the counter with the given name
  * by a value.
@@ -106,18 +305,52 @@ int destroy_metrics(metrics *m) {
  * @return 0 on success
  */
 static int metrics_increment_counter(metrics *m, char *name, double val, double sample_rate) {
-    counter *c;
-    int res = hashmap_get(m->counters, name, (void**)&c);
+    uint32_t pos = metrics_counter(m, name);
+    // Add the sample value, as counter_add_sample does
+    m->counters.sum[pos] += val;
+    m->counters.count[pos] += 1 / sample_rate;
+    return 0;
+}
 
-    // New counter
-    if (res == -1) {
-        c = malloc(sizeof(counter));
-        init_counter(c);
-        hashmap_put(m->counters, name, c);
+/**
+ * Returns the quantile engine of a timer, from
+ * the longest matching prefix.
+ */
+static quantile_engine metrics_timer_engine(metrics *m, char *name) {
+    quantile_config *qconf;
+    if (m->engines && !radix_longest_prefix(m->engines, name, (void**)&qconf)) {
+        return qconf->engine;
     }
+    return m->engine;
+}
 
-    // Add the sample value
-    return counter_add_sample(c, val, sample_rate);
+/**
+ * Returns the timer with the given name,
+ * adding it if it is new.
+ */
+static timer_hist* metrics_timer(metrics *m, char *name) {
+    histogram_config *conf;
+    intern_key *key;
+    uint32_t pos = metrics_find(m, TIMER_SLOT, name, &key);
+    if (pos) return m->timers.values[pos - 1];
+
+    // New timer
+    timer_hist *t = arena_alloc(&m->mem, sizeof(timer_hist));
+    init_timer_with_engine(metrics_timer_engine(m, name), m->timer_eps,
+            m->quantiles, m->num_quants, &t->tm);
+    timer_use_pool(&t->tm, &m->pool);
+
+    // Check if we have any histograms configured
+    if (m->histograms && !radix_longest_prefix(m->histograms, name, (void**)&conf)) {
+        t->conf = conf;
+        t->counts = arena_calloc(&m->mem, conf->num_bins * sizeof(unsigned int));
+    } else {
+        t->conf = NULL;
+        t->counts = NULL;
+    }
+    pos = metrics_append(m, TIMER_SLOT, key, true);
+    m->timers.values[pos] = t;
+    return t;
 }
 
 /**
@@ -129,25 +362,8 @@ static int metrics_increment_counter(metrics *m, char *name, double val, double
  * @return 0 on success.
  */
 static int metrics_add_timer_sample(metrics *m, char *name, double val, double sample_rate) {
-    timer_hist *t;
     histogram_config *conf;
-    int res = hashmap_get(m->timers, name, (void**)&t);
-
-    // New timer
-    if (res == -1) {
-        t = malloc(sizeof(timer_hist));
-        init_timer(m->timer_eps, m->quantiles, m->num_quants, &t->tm);
-        hashmap_put(m->timers, name, t);
-
-        // Check if we have any histograms configured
-        if (m->histograms && !radix_longest_prefix(m->histograms, name, (void**)&conf)) {
-            t->conf = conf;
-            t->counts = calloc(conf->num_bins, sizeof(unsigned int));
-        } else {
-            t->conf = NULL;
-            t->counts = NULL;
-        }
-    }
+    timer_hist *t = metrics_timer(m, name);
 
     // Add the histogram value
     if (t->conf) {
@@ -167,17 +383,37 @@ static int metrics_add_timer_sample(metrics *m, char *name, double val, double s
 }
 
 /**
- * Adds a new K/V pair
+ * Adds a new K/V pair to the end of the last chunk,
+ * starting a new chunk in the arena when it is full.
  * @arg name The key name
  * @arg val The value associated
  * @return 0 on success.
  */
 static int metrics_add_kv(metrics *m, char *name, double val) {
-    key_val *kv = malloc(sizeof(key_val));
-    kv->name = strdup(name);
+    uint32_t len = strlen(name);
+    uint32_t size = KV_SIZE(len);
+
+    kv_chunk *chunk = m->kv_tail;
+    if (!chunk || chunk->size - chunk->used < size) {
+        uint32_t chunk_size = (size > KV_CHUNK_SIZE) ? size : KV_CHUNK_SIZE;
+        chunk = arena_alloc(&m->mem, sizeof(kv_chunk) + chunk_size);
+        if (!chunk) return -1;
+        chunk->next = NULL;
+        chunk->used = 0;
+        chunk->size = chunk_size;
+        if (m->kv_tail) {
+            m->kv_tail->next = chunk;
+        } else {
+            m->kv_head = chunk;
+        }
+        m->kv_tail = chunk;
+    }
+
+    key_val *kv = (key_val*)(chunk->data + chunk->used);
     kv->val = val;
-    kv->next = m->kv_vals;
-    m->kv_vals = kv;
+    kv->len = len;
+    memcpy(kv->name, name, len + 1);
+    chunk->used += size;
     return 0;
 }
 
@@ -189,20 +425,23 @@ static int metrics_add_kv(metrics *m, char *name, double val) {
  * @return 0 on success
  */
 static int metrics_set_gauge(metrics *m, char *name, double val, bool delta) {
-    gauge_t *g;
-    int res = hashmap_get(m->gauges, name, (void**)&g);
+    intern_key *key;
+    uint32_t pos = metrics_find(m, GAUGE_SLOT, name, &key);
 
     // New gauge
-    if (res == -1) {
-        g = malloc(sizeof(gauge_t));
-        g->value = 0;
-        hashmap_put(m->gauges, name, g);
+    if (!pos) {
+        pos = metrics_append(m, GAUGE_SLOT, key, true);
+        m->gauges.value[pos] = 0;
+        m->gauges.absolute[pos] = false;
+    } else {
+        pos--;
     }
 
     if (delta) {
-        g->value += val;
+        m->gauges.value[pos] += val;
     } else {
-        g->value = val;
+        m->gauges.value[pos] = val;
+        m->gauges.absolute[pos] = true;
     }
     return 0;
 }
@@ -236,6 +475,38 @@ int metrics_add_sample(metrics *m, metric_type type, char *name, double val, dou
     }
 }
 
+/**
+ * Adds the counted inputs to a counter, and clears them.
+ * @arg name The name of the input counter
+ * @return 0 on success
+ */
+int metrics_flush_inputs(metrics *m, char *name) {
+    if (!m->inputs) return 0;
+    uint32_t pos = metrics_counter(m, name);
+    // Each input was a sample of 1
+    m->counters.sum[pos] += m->inputs;
+    m->counters.count[pos] += m->inputs;
+    m->inputs = 0;
+    return 0;
+}
+
+/**
+ * Returns the set with the given name,
+ * adding it if it is new.
+ */
+static set_t* metrics_set(metrics *m, char *name) {
+    intern_key *key;
+    uint32_t pos = metrics_find(m, SET_SLOT, name, &key);
+    if (pos) return m->sets.values[pos - 1];
+
+    // New set
+    set_t *s = arena_alloc(&m->mem, sizeof(set_t));
+    set_init(m->set_precision, s);
+    pos = metrics_append(m, SET_SLOT, key, true);
+    m->sets.values[pos] = s;
+    return s;
+}
+
 /**
  * Adds a value to a named set.
  * @arg name The name of the set
@@ -243,21 +514,191 @@ int metrics_add_sample(metrics *m, metric_type type, char *name, double val, dou
  * @return 0 on success
  */
 int metrics_set_update(metrics *m, char *name, char *value) {
-    set_t *s;
-    int res = hashmap_get(m->sets, name, (void**)&s);
+    set_add(metrics_set(m, name), value);
+    return 0;
+}
 
-    // New set
-    if (res == -1) {
-        s = malloc(sizeof(set_t));
-        set_init(m->set_precision, s);
-        hashmap_put(m->sets, name, s);
+// Encodes a timer, followed by its histogram counts
+static int encode_timer_hist(timer_hist *t, codec_buf *buf) {
+    if (timer_encode(&t->tm, buf)) return -1;
+    if (!t->conf) return codec_put_varint(buf, 0);
+
+    histogram_config *conf = t->conf;
+    if (codec_put_varint(buf, conf->num_bins)) return -1;
+    if (codec_put_double(buf, conf->min_val)) return -1;
+    if (codec_put_double(buf, conf->max_val)) return -1;
+    if (codec_put_double(buf, conf->bin_width)) return -1;
+    for (int i=0; i < conf->num_bins; i++) {
+        if (codec_put_varint(buf, t->counts[i])) return -1;
     }
+    return 0;
+}
 
-    // Add the sample value
-    set_add(s, value);
+/**
+ * Encodes the state of a metric
+ * @return 0 on success
+ */
+int metrics_encode_state(metric_type type, void *value, codec_buf *buf) {
+    switch (type) {
+        case COUNTER:
+            return counter_encode(value, buf);
+        case GAUGE:
+            return gauge_encode(value, buf);
+        case SET:
+            return set_encode(value, buf);
+        case TIMER:
+            return encode_timer_hist(value, buf);
+        default:
+            return -1;
+    }
+}
+
+// Merges an encoded counter
+static int merge_counter_state(metrics *m, char *name, codec_reader *r) {
+    counter c;
+    if (counter_decode(r, &c)) return -1;
+    uint32_t pos = metrics_counter(m, name);
+    m->counters.sum[pos] += c.sum;
+    m->counters.count[pos] += c.count;
+    return 0;
+}
+
+// Merges an encoded gauge
+static int merge_gauge_state(metrics *m, char *name, codec_reader *r) {
+    gauge_t f;
+    if (gauge_decode(r, &f)) return -1;
+
+    intern_key *key;
+    uint32_t pos = metrics_find(m, GAUGE_SLOT, name, &key);
+    gauge_t g = f;
+    if (!pos) {
+        pos = metrics_append(m, GAUGE_SLOT, key, true);
+    } else {
+        pos--;
+        g.value = m->gauges.value[pos];
+        g.absolute = m->gauges.absolute[pos];
+        gauge_merge(&g, &f);
+    }
+    m->gauges.value[pos] = g.value;
+    m->gauges.absolute[pos] = g.absolute;
+    return 0;
+}
+
+// Merges an encoded set
+static int merge_set_state(metrics *m, char *name, codec_reader *r) {
+    set_t s;
+    if (set_decode(r, &s)) return -1;
+    int res = set_merge(metrics_set(m, name), &s);
+    set_destroy(&s);
+    return res;
+}
+
+/**
+ * Reads the histogram counts of an encoded timer. The counts
+ * are returned if the bins match the histogram of the timer,
+ * and NULL otherwise.
+ * @arg counts Output, the counts to free, or NULL
+ * @return 0 on success, -1 on bad input
+ */
+static int decode_hist_counts(codec_reader *r, histogram_config *conf, uint64_t **counts) {
+    uint32_t num_bins;
+    double min_val, max_val, bin_width;
+    *counts = NULL;
+    if (codec_get_u32(r, &num_bins)) return -1;
+    if (!num_bins) return 0;
+    if (codec_get_double(r, &min_val)) return -1;
+    if (codec_get_double(r, &max_val)) return -1;
+    if (codec_get_double(r, &bin_width)) return -1;
+    if (codec_check_count(r, num_bins, 1)) return -1;
+
+    // Counts of other bins are read past
+    bool same = conf && conf->num_bins == num_bins && conf->min_val == min_val &&
+        conf->max_val == max_val && conf->bin_width == bin_width;
+    if (same) {
+        *counts = malloc(num_bins * sizeof(uint64_t));
+        if (!*counts) return -1;
+    }
+
+    uint64_t count;
+    for (uint32_t i=0; i < num_bins; i++) {
+        if (codec_get_varint(r, &count)) {
+            free(*counts);
+            *counts = NULL;
+            return -1;
+        }
+        if (same) (*counts)[i] = count;
+    }
     return 0;
 }
 
+// Merges an encoded timer and its histogram
+static int merge_timer_state(metrics *m, char *name, codec_reader *r) {
+    timer tm;
+    init_timer_with_engine(metrics_timer_engine(m, name), m->timer_eps,
+            m->quantiles, m->num_quants, &tm);
+    if (timer_decode(r, &tm)) {
+        destroy_timer(&tm);
+        return -1;
+    }
+
+    // Decode everything before the timer is added
+    histogram_config *conf = NULL;
+    if (m->histograms) radix_longest_prefix(m->histograms, name, (void**)&conf);
+    uint64_t *counts;
+    if (decode_hist_counts(r, conf, &counts)) {
+        destroy_timer(&tm);
+        return -1;
+    }
+
+    // A summary only merges into a timer of the same engine and error
+    if (tm.type == TIMER_APPROX &&
+            !quantile_mergeable(&tm.store.q, metrics_timer_engine(m, name), m->timer_eps)) {
+        free(counts);
+        destroy_timer(&tm);
+        return -1;
+    }
+
+    timer_hist *t = metrics_timer(m, name);
+    int res = timer_merge(&t->tm, &tm);
+    if (counts) {
+        for (int i=0; i < conf->num_bins; i++) t->counts[i] += counts[i];
+        free(counts);
+    }
+    destroy_timer(&tm);
+    return res;
+}
+
+/**
+ * Merges the encoded state of a metric
+ * @return 0 on success, -1 on bad input
+ */
+int metrics_merge_state(metrics *m, metric_type type, char *name, codec_reader *r) {
+    switch (type) {
+        case COUNTER:
+            return merge_counter_state(m, name, r);
+        case GAUGE:
+            return merge_gauge_state(m, name, r);
+        case SET:
+            return merge_set_state(m, name, r);
+        case TIMER:
+            return merge_timer_state(m, name, r);
+        default:
+            return -1;
+    }
+}
+
+/**
+ * Invokes the callback for each timer or set of a list
+ * @return 0 on success, or the return of the callback
+ */
+static int values_iter(value_list *l, metric_type type, void *data, metric_callback cb) {
+    int should_break = 0;
+    for (uint32_t i=0; i < l->list.count && !should_break; i++) {
+        should_break = cb(data, type, l->list.keys[i]->name, l->values[i]);
+    }
+    return should_break;
+}
+
 /**
  * Iterates through all the metrics
  * @arg m The metrics to iterate through
@@ -265,75 +706,218 @@ int metrics_set_update(metrics *m, char *name, char *value) {
  * @arg cb A callback function to invoke. Called with a type, name
  * and value. If the type is KEY_VAL, it is a pointer to a double,
  * for a counter, it is a pointer to a counter, and for a timer it is
- * a pointer to a timer. Return non-zero to stop iteration.
+ * a pointer to a timer. Counters and gauges are copied out of their
+ * arrays, so the pointer is only valid during the callback.
+ * Return non-zero to stop iteration.
  * @return 0 on success, or the return of the callback
  */
 int metrics_iter(metrics *m, void *data, metric_callback cb) {
-    // Handle the K/V pairs first
-    key_val *current = m->kv_vals;
+    // Handle the K/V pairs first, in the order they arrived
     int should_break = 0;
-    while (current && !should_break) {
-        should_break = cb(data, KEY_VAL, current->name, &current->val);
-        current = current->next;
+    for (kv_chunk *chunk = m->kv_head; chunk; chunk = chunk->next) {
+        uint32_t offset = 0;
+        while (offset < chunk->used) {
+            key_val *kv = (key_val*)(chunk->data + offset);
+            should_break = cb(data, KEY_VAL, kv->name, &kv->val);
+            if (should_break) return should_break;
+            offset += KV_SIZE(kv->len);
+        }
     }
-    if (should_break) return should_break;
-
-    // Store our data in a small struct
-    struct cb_info info = {COUNTER, data, cb};
 
-    // Send the counters
-    should_break = hashmap_iter(m->counters, iter_cb, &info);
-    if (should_break) return should_break;
+    // Send the counters, from a copy of their fields
+    counter c;
+    for (uint32_t i=0; i < m->counters.list.count; i++) {
+        c.sum = m->counters.sum[i];
+        c.count = m->counters.count[i];
+        should_break = cb(data, COUNTER, m->counters.list.keys[i]->name, &c);
+        if (should_break) return should_break;
+    }
 
     // Send the timers
-    info.type = TIMER;
-    should_break = hashmap_iter(m->timers, iter_cb, &info);
+    should_break = values_iter(&m->timers, TIMER, data, cb);
     if (should_break) return should_break;
 
     // Send the gauges
-    info.type = GAUGE;
-    should_break = hashmap_iter(m->gauges, iter_cb, &info);
-    if (should_break) return should_break;
+    gauge_t g;
+    for (uint32_t i=0; i < m->gauges.list.count; i++) {
+        g.value = m->gauges.value[i];
+        g.absolute = m->gauges.absolute[i];
+        should_break = cb(data, GAUGE, m->gauges.list.keys[i]->name, &g);
+        if (should_break) return should_break;
+    }
 
     // Send the sets
-    info.type = SET;
-    should_break = hashmap_iter(m->sets, iter_cb, &info);
+    return values_iter(&m->sets, SET, data, cb);
+}
 
-    return should_break;
+/**
+ * Combines the metric at a position of one list into another.
+ * If the metric did not exist, it is moved to its new position.
+ */
+typedef void(*merge_callback)(metrics *into, uint32_t pos, metrics *from, uint32_t from_pos, bool exists);
+
+/**
+ * Merges the metrics of a list into another metrics object.
+ * A name from our own table, or one we can intern in our
+ * private table, is found by its ID. Any other name can
+ * only be found in an index of the list by name, and keeps
+ * the interned name of the source when it is added.
+ * @arg into The metrics to merge into
+ * @arg from The metrics to merge from
+ * @arg slot The slot of the metric type
+ * @arg merge Combines the metrics of a name in both lists
+ */
+static void list_merge(metrics *into, metrics *from, int slot, merge_callback merge) {
+    metric_list *into_list = metrics_list(into, slot);
+    metric_list *from_list = metrics_list(from, slot);
+    bool same_names = into->names == from->names;
+    for (uint32_t i=0; i < from_list->count; i++) {
+        intern_key *key = from_list->keys[i];
+
+        // Find by ID
+        if (same_names || into->own_names) {
+            if (!same_names) key = intern_name(into->names, key->name, key->len);
+            uint32_t pos = metrics_slots(into, key->id)->pos[slot];
+            if (pos) {
+                merge(into, pos - 1, from, i, true);
+            } else {
+                merge(into, metrics_append(into, slot, key, true), from, i, false);
+            }
+            continue;
+        }
+
+        // Build the index the first time it is needed
+        if (!into_list->by_name) {
+            hashmap_init_borrowed(into_list->count, &into_list->by_name);
+            for (uint32_t j=0; j < into_list->count; j++) {
+                intern_key *k = into_list->keys[j];
+                void **entry;
+                hashmap_upsert_hashed(into_list->by_name, k->name, k->len, k->hash, &entry);
+                *entry = (void*)(uintptr_t)j;
+            }
+        }
+
+        // Find by name
+        void *pos;
+        if (!hashmap_get_hashed(into_list->by_name, key->name, key->len, key->hash, &pos)) {
+            merge(into, (uintptr_t)pos, from, i, true);
+        } else {
+            merge(into, metrics_append(into, slot, key, false), from, i, false);
+        }
+    }
+
+    // The source keeps nothing
+    list_clear(from_list);
 }
 
-// Counter map cleanup
-static int counter_delete_cb(void *data, const char *key, void *value) {
-    free(value);
+/**
+ * Merges all the metrics from one object into another.
+ * Metrics present in both are combined, others are moved.
+ * The source is left empty but initialized, and must still
+ * be destroyed by the caller. Both objects must be configured
+ * with the same timer and set parameters.
+ * @arg into The metrics to merge into
+ * @arg from The metrics to merge from
+ * @return 0 on success.
+ */
+int metrics_merge(metrics *into, metrics *from) {
+    // Take over the arena, so the moved metrics stay valid
+    arena_merge(&into->mem, &from->mem);
+
+    // Link the K/V chunks behind ours
+    if (from->kv_head) {
+        if (into->kv_tail) {
+            into->kv_tail->next = from->kv_head;
+        } else {
+            into->kv_head = from->kv_head;
+        }
+        into->kv_tail = from->kv_tail;
+        from->kv_head = NULL;
+        from->kv_tail = NULL;
+    }
+
+    into->inputs += from->inputs;
+    from->inputs = 0;
+
+    // Merge each of the lists, taking ownership of the moved metrics
+    list_merge(into, from, COUNTER_SLOT, counter_merge_cb);
+    list_merge(into, from, TIMER_SLOT, timer_merge_cb);
+    list_merge(into, from, SET_SLOT, set_merge_cb);
+    list_merge(into, from, GAUGE_SLOT, gauge_merge_cb);
+    if (from->slots) memset(from->slots, 0, from->num_slots * sizeof(name_slots));
+
+    // Arrays freed by the merged timers now belong to our arena
+    timer_pool_clear(&from->pool);
     return 0;
 }
 
-// Timer map cleanup
-static int timer_delete_cb(void *data, const char *key, void *value) {
-    timer_hist *t = value;
-    destroy_timer(&t->tm);
-    if (t->counts) free(t->counts);
-    free(t);
-    return 0;
+// Timer cleanup
+static void destroy_timers(value_list *timers) {
+    for (uint32_t i=0; i < timers->list.count; i++) {
+        timer_hist *t = timers->values[i];
+        destroy_timer(&t->tm);
+    }
 }
 
-// Set map cleanup
-static int set_delete_cb(void *data, const char *key, void *value) {
-    set_t *s = value;
-    set_destroy(s);
-    free(s);
-    return 0;
+// Set cleanup
+static void destroy_sets(value_list *sets) {
+    for (uint32_t i=0; i < sets->list.count; i++) {
+        set_destroy(sets->values[i]);
+    }
 }
 
-// Gauge map cleanup
-static int gauge_delete_cb(void *data, const char *key, void *value) {
-    gauge_t *g = value;
-    free(g);
-    return 0;
+// Counter merging
+static void counter_merge_cb(metrics *into, uint32_t pos, metrics *from, uint32_t from_pos, bool exists) {
+    if (!exists) {
+        into->counters.sum[pos] = 0;
+        into->counters.count[pos] = 0;
+    }
+    into->counters.sum[pos] += from->counters.sum[from_pos];
+    into->counters.count[pos] += from->counters.count[from_pos];
 }
 
-// Callback to invoke the user code
-static int iter_cb(void *data, const char *key, void *value) {
-    struct cb_info *info = data;
-    return info->cb(info->data, info->type, (char*)key, value);
+// Timer merging
+static void timer_merge_cb(metrics *into, uint32_t pos, metrics *from, uint32_t from_pos, bool exists) {
+    timer_hist *f = from->timers.values[from_pos];
+    if (!exists) {
+        // The values moved with the arena, so the pool does too
+        timer_use_pool(&f->tm, &into->pool);
+        into->timers.values[pos] = f;
+        return;
+    }
+
+    timer_hist *t = into->timers.values[pos];
+    timer_merge(&t->tm, &f->tm);
+
+    // Same name, so both resolve to the same histogram config
+    if (t->conf) {
+        for (int i=0; i < t->conf->num_bins; i++) {
+            t->counts[i] += f->counts[i];
+        }
+    }
+    destroy_timer(&f->tm);
+}
+
+// Set merging
+static void set_merge_cb(metrics *into, uint32_t pos, metrics *from, uint32_t from_pos, bool exists) {
+    set_t *f = from->sets.values[from_pos];
+    if (!exists) {
+        into->sets.values[pos] = f;
+        return;
+    }
+    set_merge(into->sets.values[pos], f);
+    set_destroy(f);
+}
+
+// Gauge merging, see gauge_merge
+static void gauge_merge_cb(metrics *into, uint32_t pos, metrics *from, uint32_t from_pos, bool exists) {
+    gauge_t f = {from->gauges.value[from_pos], from->gauges.absolute[from_pos]};
+    gauge_t g = f;
+    if (exists) {
+        g.value = into->gauges.value[pos];
+        g.absolute = into->gauges.absolute[pos];
+        gauge_merge(&g, &f);
+    }
+    into->gauges.value[pos] = g.value;
+    into->gauges.absolute[pos] = g.absolute;
 }
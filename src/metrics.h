@@ -4,16 +4,33 @@
 #include "config.h"
 #include "radix.h"
 #include "counter.h"
+#include "gauge.h"
 #include "timer.h"
 #include "hashmap.h"
 #include "set.h"
+#include "arena.h"
+#include "intern.h"
 
-typedef struct key_val {
-    char *name;
+/**
+ * A K/V pair, packed into a chunk
+ * behind the previous pair.
+ */
+typedef struct {
     double val;
-    struct key_val *next;
+    uint32_t len;       // The length of the name
+    char name[];        // The null terminated name
 } key_val;
 
+/**
+ * A block of K/V pairs, in the order they arrived
+ */
+typedef struct kv_chunk {
+    struct kv_chunk *next;
+    uint32_t used;      // Bytes used by the pairs
+    uint32_t size;      // Bytes available for pairs
+    char data[] __attribute__((aligned(8)));
+} kv_chunk;
+
 typedef struct {
     timer tm;
 
@@ -22,23 +39,90 @@ typedef struct {
     unsigned int *counts;
 } timer_hist;
 
+// Counters, timers, sets and gauges are kept in lists
+#define METRIC_LISTS 4
+
+/**
+ * The names of the metrics of one type, in the order they
+ * were first seen. The metrics themselves are kept in arrays
+ * indexed by the same position.
+ */
+typedef struct {
+    intern_key **keys;  // The name of each metric
+    uint32_t count;     // Number of metrics
+    uint32_t size;      // Size of the arrays
+    hashmap *by_name;   // Index of name -> position, only built to merge
+} metric_list;
+
+/**
+ * Counters, with an array per field so that updates
+ * and scans only touch the memory they use.
+ */
+typedef struct {
+    metric_list list;
+    double *sum;        // Sum of the values
+    uint64_t *count;    // Count of items
+} counter_list;
+
+/**
+ * Gauges, with an array per field.
+ */
+typedef struct {
+    metric_list list;
+    double *value;
+    bool *absolute;     // Has the value been set, or only adjusted by deltas
+} gauge_list;
+
+/**
+ * Timers or sets, which are too large to move around
+ */
 typedef struct {
-    double value;
-} gauge_t;
+    metric_list list;
+    void **values;
+} value_list;
 
+/**
+ * The position of the metric in each list for a name, plus
+ * one, found by the ID of the interned name. 0 if not seen yet.
+ */
 typedef struct {
-    hashmap *counters;  // Hashmap of name -> counter structs
-    hashmap *timers;    // Map of name -> timer_hist structs
-    hashmap *sets;      // Map of name -> set_t structs
-    hashmap *gauges;    // Map of name -> guage struct
-    key_val *kv_vals;   // Linked list of key_val structs
+    uint32_t pos[METRIC_LISTS];
+} name_slots;
+
+typedef struct {
+    counter_list counters;
+    value_list timers;  // List of timer_hist structs
+    value_list sets;    // List of set_t structs
+    gauge_list gauges;
+    kv_chunk *kv_head;  // The first chunk of K/V pairs
+    kv_chunk *kv_tail;  // The chunk new K/V pairs are added to
+    uint64_t inputs;    // Samples received, for the input counter
     double timer_eps;   // The error for timers
     double *quantiles;  // Array of quantiles
     uint32_t num_quants; // Size of quantiles array
     radix_tree *histograms; // Radix tree with histogram configs
+    quantile_engine engine; // The quantile engine of timers
+    radix_tree *engines; // Radix tree with quantile engine configs
     unsigned char set_precision; // The precision for sets
+    arena mem;          // Holds the metric structs
+    timer_pool pool;    // Holds the exact values of timers, in the arena
+    intern_table *names; // Interns the metric names
+    bool own_names;     // Is the names table private
+    name_slots *slots;  // The metrics of each name ID
+    uint32_t num_slots; // Size of the slots array
 } metrics;
 
+/**
+ * The number of distinct metrics of each type,
+ * used to size the lists of a reused metrics object.
+ */
+typedef struct {
+    int counters;
+    int timers;
+    int sets;
+    int gauges;
+} metrics_sizes;
+
 typedef int(*metric_callback)(void *data, metric_type type, char *name, void *val);
 
 /**
@@ -53,6 +137,16 @@ typedef int(*metric_callback)(void *data, metric_type type, char *name, void *va
  */
 int init_metrics(double timer_eps, double *quantiles, uint32_t num_quants, radix_tree *histograms, unsigned char set_precision, metrics *m);
 
+/**
+ * Sets the quantile engines of new timers
+ * @arg m The metrics
+ * @arg engine The engine of timers without a configured prefix
+ * @arg engines A radix tree with quantile engine configs, or NULL.
+ * This is not owned by the metrics object.
+ * @return 0 on success.
+ */
+int metrics_set_quantile_engines(metrics *m, quantile_engine engine, radix_tree *engines);
+
 /**
  * Initializes the metrics struct, with preset configurations.
  * This defaults to a epsilon of 0.01 (1% error), and quantiles at
@@ -67,6 +161,35 @@ int init_metrics_defaults(metrics *m);
  */
 int destroy_metrics(metrics *m);
 
+/**
+ * Uses a shared table to intern the names, instead of a private
+ * one. This lets the interned names outlive the metrics, so a
+ * new metrics object can reuse them. Must be called before any
+ * metrics are added.
+ * @arg m The metrics
+ * @arg names The names table. It must outlive the metrics,
+ * and keep the names they use.
+ * @return 0 on success.
+ */
+int metrics_share_names(metrics *m, intern_table *names);
+
+/**
+ * Empties the metrics, so that the object can be reused for
+ * another interval without being destroyed. The lists are sized
+ * to hold the given number of metrics without growing.
+ * @arg m The metrics to reset
+ * @arg sizes The number of metrics of each type to expect
+ * @return 0 on success.
+ */
+int reset_metrics(metrics *m, metrics_sizes *sizes);
+
+/**
+ * Gets the number of distinct metrics of each type.
+ * @arg m The metrics to count
+ * @arg sizes Output. Set to the number of metrics of each type
+ */
+void metrics_get_sizes(metrics *m, metrics_sizes *sizes);
+
 /**
  * Adds a new sampled value
  * arg type The type of the metrics
@@ -77,6 +200,16 @@ int destroy_metrics(metrics *m);
  */
 int metrics_add_sample(metrics *m, metric_type type, char *name, double val, double sample_rate);
 
+/**
+ * Adds the samples counted in the inputs field to a counter,
+ * and clears them. Counting the inputs in a field costs a single
+ * increment per sample, instead of a counter update.
+ * @arg m The metrics
+ * @arg name The name of the input counter
+ * @return 0 on success
+ */
+int metrics_flush_inputs(metrics *m, char *name);
+
 /**
  * Adds a value to a named set.
  * @arg name The name of the set
@@ -85,6 +218,30 @@ int metrics_add_sample(metrics *m, metric_type type, char *name, double val, dou
  */
 int metrics_set_update(metrics *m, char *name, char *value);
 
+/**
+ * Encodes the state of a metric, as it is passed to a
+ * metric_callback, so that other metrics can merge it.
+ * Timers include their histogram counts.
+ * @arg type The type of the metric, one of COUNTER, GAUGE, SET or TIMER
+ * @arg value The metric
+ * @arg buf The buffer to append to
+ * @return 0 on success
+ */
+int metrics_encode_state(metric_type type, void *value, codec_buf *buf);
+
+/**
+ * Merges the encoded state of a metric into the metric
+ * with the same name, as if its samples had been added.
+ * Histogram counts are only merged if the histogram of
+ * the name has the same bins.
+ * @arg type The type of the metric, one of COUNTER, GAUGE, SET or TIMER
+ * @arg name The name of the metric
+ * @arg r The reader of the encoding
+ * @return 0 on success, -1 on bad input, or if the
+ * state cannot be merged.
+ */
+int metrics_merge_state(metrics *m, metric_type type, char *name, codec_reader *r);
+
 /**
  * Iterates through all the metrics
  * @arg m The metrics to iterate through
@@ -92,9 +249,27 @@ int metrics_set_update(metrics *m, char *name, char *value);
  * @arg cb A callback function to invoke. Called with a type, name
  * and value. If the type is KEY_VAL, it is a pointer to a double,
  * for a counter, it is a pointer to a counter, and for a timer it is
- * a pointer to a timer. Return non-zero to stop iteration.
+ * a pointer to a timer. Counters and gauges are copied out of their
+ * arrays, so the pointer is only valid during the callback.
+ * Return non-zero to stop iteration.
  * @return 0 on success.
  */
 int metrics_iter(metrics *m, void *data, metric_callback cb);
 
+/**
+ * Merges all the metrics from one object into another.
+ * Metrics present in both are combined, others are moved.
+ * The source is left empty but initialized, and must still
+ * be destroyed by the caller. Both objects must be configured
+ * with the same timer and set parameters. If the destination
+ * has a shared names table, and the source uses another one,
+ * the moved metrics keep the names of the source. That table
+ * must then keep them until the destination is reset, and the
+ * destination can only be iterated, not updated.
+ * @arg into The metrics to merge into
+ * @arg from The metrics to merge from
+ * @return 0 on success.
+ */
+int metrics_merge(metrics *into, metrics *from);
+
 #endif
@@ -15,9 +15,14 @@
 #include <assert.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <pthread.h>
+#include <signal.h>
 
+#include "buildconfig.h"
 #include "networking.h"
 #include "conn_handler.h"
+#include "circbuf.h"
+#include "uring.h"
 
 // Length of string to represent maximum port of 65535
 #define MAX_PORT_LEN 6
@@ -31,35 +36,57 @@
 #define BACKLOG_SIZE 64
 
 /**
- * How big should the default connection
- * buffer size be. One page seems reasonable
- * since most requests will not be this large
+ * Size of the buffer slot used for each datagram
+ * when receiving UDP in batches. This fits a jumbo
+ * frame, larger datagrams are truncated and dropped.
+ * The last byte of the slot is kept free for a newline.
  */
-#define INIT_CONN_BUF_SIZE 32768
+#define UDP_SLOT_SIZE 9216
 
 /**
- * This is the scale factor we use when
- * we are growing our connection buffers.
- * We want this to be aggressive enough to reduce
- * the number of resizes, but to also avoid wasted
- * space. With this, we will go from:
- * 32K -> 64K -> 128K
+ * Size of the io_uring submission queue. Receives
+ * are multishot, so only new clients and re-arms use it.
  */
-#define CONN_BUF_MULTIPLIER 2
+#define URING_QUEUE_SIZE 256
 
-// Macro to provide branch meta-data
-#define likely(x)       __builtin_expect((x),1)
-#define unlikely(x)     __builtin_expect((x),0)
+/**
+ * Number and size of the buffers provided to io_uring
+ * for reads from TCP clients. The data is copied into
+ * the connection buffer as it arrives.
+ */
+#define URING_TCP_BUFS 64
+#define URING_TCP_BUF_SIZE 16384
 
 /**
- * Represents a simple circular buffer
+ * Interval at which each event loop writes out the
+ * commands it has batched in forward mode.
  */
-typedef struct {
-    int write_cursor;
-    int read_cursor;
-    uint32_t buf_size;
-    char *buffer;
-} circular_buffer;
+#define FORWARD_INTERVAL_MS 100
+
+// Buffer group ids of the provided buffer rings
+#define URING_UDP_GROUP 0
+#define URING_TCP_GROUP 1
+
+/**
+ * Maximum number of completions handled per event,
+ * so that a busy ring does not starve the timers.
+ */
+#define URING_MAX_REAP 4096
+
+/**
+ * Tags kept in the low bits of the io_uring user data to
+ * identify the request. Client reads carry the conn_info
+ * pointer, whose low bits are free due to alignment.
+ */
+#define URING_TAG_CLIENT 0
+#define URING_TAG_ACCEPT 1
+#define URING_TAG_UDP    2
+#define URING_TAG_CANCEL 3
+#define URING_TAG_MASK   3
+
+// Macro to provide branch meta-data
+#define likely(x)       __builtin_expect((x),1)
+#define unlikely(x)     __builtin_expect((x),0)
 
 /**
  * Stores the connection specific data.
@@ -69,6 +96,8 @@ struct conn_info {
     int client_fd;
     circular_buffer input;
     statsite_networking *nc;
+    int closing;    // Waiting for io_uring to release the connection
+    ascpp parser;   // Parses the ASCII stream, initialized on first use
 };
 typedef struct conn_info conn_info;
 
@@ -82,33 +111,48 @@ struct statsite_networking {
     aeEventLoop *loop;
     int tcp_listener_fd;
     long long flush_timer;
+    long long forward_timer;    // Writes the forwarded commands, -1 if not forwarding
     conn_info *stdin_client;
     conn_info *udp_client;
+
+    int shard;              // Metrics shard updated by this event loop
+    int reuse_port;         // Bind the listeners with SO_REUSEPORT
+    pthread_t thread;       // Thread running a worker event loop
+    int wake_pipe[2];       // Used to stop a worker event loop
+    int num_workers;
+    struct statsite_networking **workers;
+
+    struct iovec *udp_iovecs;   // Datagram slots for batched UDP reads
+#ifdef HAVE_RECVMMSG
+    struct mmsghdr *udp_msgs;   // Headers for batched UDP reads
+#endif
+
+#ifdef HAVE_IO_URING
+    statsite_uring *uring;      // Drives the listeners when enabled
+    uring_buf_group *udp_bufs;  // Provided buffers for UDP datagrams
+    uring_buf_group *tcp_bufs;  // Provided buffers for TCP clients
+    struct msghdr udp_msg;      // recvmsg template for UDP datagrams
+    int *udp_buf_ids;           // Buffers of the pending UDP batch
+    int udp_pending;            // Datagrams in the pending UDP batch
+#endif
 };
 
 
 // Static typedefs
 static int handle_flush_event(aeEventLoop *loop, long long id, void *edata);
+static int handle_forward_event(aeEventLoop *loop, long long id, void *edata);
 static void handle_new_client(aeEventLoop *loop, int fd, void *edata, int mask);
 static void handle_udp_message(aeEventLoop *loop, int fd, void *edata, int mask);
 static void invoke_event_handler(aeEventLoop *loop, int fd, void *edata, int mask);
+static void handle_worker_wake(aeEventLoop *loop, int fd, void *edata, int mask);
+#ifdef HAVE_IO_URING
+static void handle_uring_event(aeEventLoop *loop, int fd, void *edata, int mask);
+#endif
 
 // Utility methods
 static int set_client_sockopts(int client_fd);
 static conn_info* get_conn(statsite_networking *nc, int fd);
 
-// Circular buffer method
-static void circbuf_init(circular_buffer *buf);
-static void circbuf_clear(circular_buffer *buf);
-static void circbuf_free(circular_buffer *buf);
-static uint64_t circbuf_avail_buf(circular_buffer *buf);
-static uint64_t circbuf_used_buf(circular_buffer *buf);
-static void circbuf_grow_buf(circular_buffer *buf);
-static void circbuf_setup_readv_iovec(circular_buffer *buf, struct iovec *vectors, int *num_vectors);
-static void circbuf_advance_write(circular_buffer *buf, uint64_t bytes);
-static void circbuf_advance_read(circular_buffer *buf, uint64_t bytes);
-static int circbuf_write(circular_buffer *buf, char *in, uint64_t bytes);
-
 /**
  * Initializes the TCP listener
  * @arg netconf The network configuration
@@ -151,6 +195,14 @@ static int setup_tcp_listener(statsite_networking *netconf) {
             close(tcp_listener_fd);
             continue;
         }
+#ifdef SO_REUSEPORT
+        if (netconf->reuse_port &&
+                setsockopt(tcp_listener_fd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval))) {
+            syslog(LOG_ERR, "Failed to set SO_REUSEPORT! Err: %s", strerror(errno));
+            close(tcp_listener_fd);
+            continue;
+        }
+#endif
         if (bind(tcp_listener_fd, rp->ai_addr, rp->ai_addrlen) == 0)
             break;
         syslog(LOG_ERR, "Failed to bind on TCP socket! Err: %s", strerror(errno));
@@ -218,6 +270,14 @@ static int setup_udp_listener(statsite_networking *netconf) {
             close(udp_listener_fd);
             continue;
         }
+#ifdef SO_REUSEPORT
+        if (netconf->reuse_port &&
+                setsockopt(udp_listener_fd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval))) {
+            syslog(LOG_ERR, "Failed to set SO_REUSEPORT! Err: %s", strerror(errno));
+            close(udp_listener_fd);
+            continue;
+        }
+#endif
         if (bind(udp_listener_fd, rp->ai_addr, rp->ai_addrlen) == 0)
             break;
         syslog(LOG_ERR, "Failed to bind on UDP socket! Err: %s", strerror(errno));
@@ -240,14 +300,31 @@ static int setup_udp_listener(statsite_networking *netconf) {
         }
     }
 
-    // Allocate a connection object for the UDP socket,
-    // ensure a min-buffer size of 64K
+    // Allocate a connection object for the UDP socket. The
+    // buffer is used for the datagram slots of a batch
     conn_info *conn = get_conn(netconf, udp_listener_fd);
-    while (circbuf_avail_buf(&conn->input) < 65536) {
-        circbuf_grow_buf(&conn->input);
+    if (!conn) {
+        close(udp_listener_fd);
+        return 1;
+    }
+    int batch_size = netconf->config->udp_batch_size;
+    uint64_t min_buf = 65536;
+    if (min_buf < batch_size * UDP_SLOT_SIZE)
+        min_buf = batch_size * UDP_SLOT_SIZE;
+    while (circbuf_avail_buf(&conn->input) < min_buf) {
+        if (circbuf_grow_buf(&conn->input)) {
+            close_client_connection(conn);
+            return 1;
+        }
     }
     netconf->udp_client = conn;
 
+    // Setup the datagram slots
+    netconf->udp_iovecs = calloc(batch_size, sizeof(struct iovec));
+#ifdef HAVE_RECVMMSG
+    netconf->udp_msgs = calloc(batch_size, sizeof(struct mmsghdr));
+#endif
+
     syslog(LOG_INFO, "Listening on udp '%s:%d'.",
            netconf->config->bind_address, netconf->config->udp_port);
 
@@ -272,6 +349,7 @@ static int setup_stdin_listener(statsite_networking *netconf) {
 
     // Create an associated conn object
     conn_info *conn = get_conn(netconf, STDIN_FILENO);
+    if (!conn) return 1;
     netconf->stdin_client = conn;
 
     // Initialize the stdin event
@@ -279,6 +357,74 @@ static int setup_stdin_listener(statsite_networking *netconf) {
     return 0;
 }
 
+/**
+ * Moves the TCP and UDP listeners from the event loop onto
+ * io_uring, if it is enabled. A multishot accept and a multishot
+ * recvmsg are armed on the listeners, and the ring is watched
+ * by the event loop for completions. If the kernel lacks support
+ * the listeners are left on the event loop.
+ * @arg netconf The network configuration
+ */
+static void setup_uring(statsite_networking *netconf) {
+    if (!netconf->config->io_uring) return;
+#ifdef HAVE_IO_URING
+    statsite_uring *ring;
+    if (uring_init(URING_QUEUE_SIZE, &ring)) {
+        syslog(LOG_WARNING, "io_uring is not available, using the event loop");
+        return;
+    }
+
+    // Keep a few batches worth of buffers for UDP, so that the
+    // kernel can fill some while a batch is being parsed
+    int udp_bufs = 1;
+    while (udp_bufs < netconf->config->udp_batch_size * 4)
+        udp_bufs <<= 1;
+    int udp_buf_size = uring_recvmsg_overhead(&netconf->udp_msg) + UDP_SLOT_SIZE - 1;
+
+    if ((netconf->udp_client && uring_add_buf_group(ring, URING_UDP_GROUP, udp_bufs,
+                    udp_buf_size, &netconf->udp_bufs)) ||
+        (netconf->tcp_listener_fd != -1 && uring_add_buf_group(ring, URING_TCP_GROUP,
+                    URING_TCP_BUFS, URING_TCP_BUF_SIZE, &netconf->tcp_bufs))) {
+        syslog(LOG_WARNING, "io_uring buffer rings are not available, using the event loop");
+        uring_destroy(ring);
+        netconf->udp_bufs = NULL;
+        netconf->tcp_bufs = NULL;
+        return;
+    }
+
+    if (netconf->tcp_listener_fd != -1) {
+        aeDeleteFileEvent(netconf->loop, netconf->tcp_listener_fd, AE_READABLE);
+        uring_accept_multishot(ring, netconf->tcp_listener_fd, URING_TAG_ACCEPT);
+    }
+    if (netconf->udp_client) {
+        aeDeleteFileEvent(netconf->loop, netconf->udp_client->client_fd, AE_READABLE);
+        netconf->udp_buf_ids = calloc(netconf->config->udp_batch_size, sizeof(int));
+        uring_recvmsg_multishot(ring, netconf->udp_client->client_fd,
+                &netconf->udp_msg, netconf->udp_bufs, URING_TAG_UDP);
+    }
+    uring_submit(ring);
+
+    netconf->uring = ring;
+    aeCreateFileEvent(netconf->loop, uring_fd(ring), AE_READABLE, handle_uring_event, netconf);
+    syslog(LOG_INFO, "Using io_uring for network input");
+#else
+    syslog(LOG_WARNING, "io_uring is not supported by this build, using the event loop");
+#endif
+}
+
+/**
+ * Sets up the timer that writes out the forwarded
+ * commands of an event loop, when forwarding.
+ * @arg netconf The network configuration
+ */
+static void setup_forward_timer(statsite_networking *netconf) {
+    netconf->forward_timer = -1;
+    if (netconf->config->forward_hosts) {
+        netconf->forward_timer = aeCreateTimeEvent(netconf->loop, FORWARD_INTERVAL_MS,
+                handle_forward_event, netconf, NULL);
+    }
+}
+
 /**
  * Adjust flush interval to align with clock
  * @arg flush_interval The flush interval from configuration
@@ -293,6 +439,156 @@ static long long align_timer(int flush_interval) {
   return next_flush_ms;
 }
 
+/**
+ * Stops listening on the TCP and UDP ports
+ * @arg netconf The network configuration
+ */
+static void close_listeners(statsite_networking *netconf) {
+#ifdef HAVE_IO_URING
+    // Destroying the ring cancels the pending receives
+    if (netconf->uring) {
+        aeDeleteFileEvent(netconf->loop, uring_fd(netconf->uring), AE_READABLE);
+        uring_destroy(netconf->uring);
+        netconf->uring = NULL;
+        netconf->udp_bufs = NULL;
+        netconf->tcp_bufs = NULL;
+    }
+    free(netconf->udp_buf_ids);
+    netconf->udp_buf_ids = NULL;
+#endif
+
+    if (netconf->tcp_listener_fd != -1) {
+        aeDeleteFileEvent(netconf->loop, netconf->tcp_listener_fd, AE_READABLE);
+        close(netconf->tcp_listener_fd);
+        netconf->tcp_listener_fd = -1;
+    }
+
+    if (netconf->udp_client != NULL) {
+        close_client_connection(netconf->udp_client);
+        netconf->udp_client = NULL;
+    }
+
+    free(netconf->udp_iovecs);
+    netconf->udp_iovecs = NULL;
+#ifdef HAVE_RECVMMSG
+    free(netconf->udp_msgs);
+    netconf->udp_msgs = NULL;
+#endif
+}
+
+/**
+ * Sets up the event loop of a worker thread. Each worker
+ * binds its own TCP and UDP listeners using SO_REUSEPORT,
+ * so that the kernel spreads the input between them.
+ * @arg config The statsite configuration
+ * @arg maxclients The size of the event loop
+ * @arg shard The metrics shard used by the worker
+ * @arg worker_out Output. The networking stack of the worker.
+ * @return 0 on success.
+ */
+static int setup_worker(statsite_config *config, int maxclients, int shard, statsite_networking **worker_out) {
+    statsite_networking *worker = calloc(1, sizeof(struct statsite_networking));
+    worker->config = config;
+    worker->tcp_listener_fd = -1;
+    worker->shard = shard;
+    worker->reuse_port = 1;
+
+    worker->loop = aeCreateEventLoop(maxclients);
+    if (!worker->loop) {
+        syslog(LOG_CRIT, "Failed to initialize worker event loop!");
+        free(worker);
+        return 1;
+    }
+
+    // The pipe is used to wake the worker when stopping
+    if (pipe(worker->wake_pipe)) {
+        syslog(LOG_ERR, "Failed to create worker pipe! Err: %s", strerror(errno));
+        aeDeleteEventLoop(worker->loop);
+        free(worker);
+        return 1;
+    }
+    aeCreateFileEvent(worker->loop, worker->wake_pipe[0], AE_READABLE, handle_worker_wake, worker);
+    setup_forward_timer(worker);
+
+    if (setup_tcp_listener(worker) || setup_udp_listener(worker)) {
+        close_listeners(worker);
+        close(worker->wake_pipe[0]);
+        close(worker->wake_pipe[1]);
+        aeDeleteEventLoop(worker->loop);
+        free(worker);
+        return 1;
+    }
+    setup_uring(worker);
+
+    *worker_out = worker;
+    return 0;
+}
+
+/**
+ * Entry point for the worker threads. Runs
+ * the worker event loop until it is stopped.
+ */
+static void* worker_main(void *arg) {
+    statsite_networking *worker = arg;
+    aeMain(worker->loop);
+    return NULL;
+}
+
+/**
+ * Starts a thread for each worker event loop.
+ * The workers block all signals, leaving them
+ * to be handled by the main thread.
+ * @arg netconf The network configuration
+ * @return 0 on success.
+ */
+static int start_workers(statsite_networking *netconf) {
+    sigset_t oldset;
+    sigset_t newset;
+    sigfillset(&newset);
+    pthread_sigmask(SIG_BLOCK, &newset, &oldset);
+
+    int err = 0;
+    for (int i=0; i < netconf->num_workers && !err; i++) {
+        err = pthread_create(&netconf->workers[i]->thread, NULL, worker_main, netconf->workers[i]);
+        if (err) {
+            syslog(LOG_ERR, "Failed to start worker thread: %s", strerror(err));
+            netconf->num_workers = i;
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+    return err;
+}
+
+/**
+ * Stops the worker threads, and cleans up
+ * their event loops and listeners.
+ * @arg netconf The network configuration
+ */
+static void stop_workers(statsite_networking *netconf) {
+    // Wake all the workers first, so they stop concurrently
+    for (int i=0; i < netconf->num_workers; i++) {
+        if (write(netconf->workers[i]->wake_pipe[1], "", 1) != 1) {
+            syslog(LOG_ERR, "Failed to wake worker thread! Err: %s", strerror(errno));
+        }
+    }
+
+    statsite_networking *worker;
+    for (int i=0; i < netconf->num_workers; i++) {
+        worker = netconf->workers[i];
+        pthread_join(worker->thread, NULL);
+        close_listeners(worker);
+        close(worker->wake_pipe[0]);
+        close(worker->wake_pipe[1]);
+        if (worker->forward_timer != -1)
+            aeDeleteTimeEvent(worker->loop, worker->forward_timer);
+        aeDeleteEventLoop(worker->loop);
+        free(worker);
+    }
+    free(netconf->workers);
+    netconf->workers = NULL;
+    netconf->num_workers = 0;
+}
+
 /**
  * Initializes the networking interfaces
  * @arg config Takes the bloom server configuration
@@ -303,6 +599,7 @@ int init_networking(statsite_config *config, statsite_networking **netconf_out)
     // Initialize the netconf structure
     statsite_networking *netconf = calloc(1, sizeof(struct statsite_networking));
     netconf->config = config;
+    netconf->tcp_listener_fd = -1;
 
     struct rlimit limit;
     int maxclients = (getrlimit(RLIMIT_NOFILE,&limit) == -1) ? 1024 : limit.rlim_cur;
@@ -321,20 +618,36 @@ int init_networking(statsite_config *config, statsite_networking **netconf_out)
         return 1;
     }
 
-    // Setup the TCP listener
-    res = setup_tcp_listener(netconf);
-    if (res != 0) {
-        free(netconf);
-        return 1;
-    }
+    // With worker threads, the main loop only handles stdin and
+    // the flush timer, and each worker has its own listeners
+    if (config->worker_threads > 0) {
+        netconf->workers = calloc(config->worker_threads, sizeof(statsite_networking*));
+        for (int i=0; i < config->worker_threads; i++) {
+            if (setup_worker(config, maxclients, i + 1, netconf->workers + i)) {
+                stop_workers(netconf);
+                free(netconf);
+                return 1;
+            }
+            netconf->num_workers++;
+        }
+        syslog(LOG_INFO, "Started %d worker event loops", netconf->num_workers);
 
-    // Setup the UDP listener
-    res = setup_udp_listener(netconf);
-    if (res != 0) {
-        aeDeleteFileEvent(netconf->loop, netconf->tcp_listener_fd, AE_READABLE);
-        close(netconf->tcp_listener_fd);
-        free(netconf);
-        return 1;
+    } else {
+        // Setup the TCP listener
+        res = setup_tcp_listener(netconf);
+        if (res != 0) {
+            free(netconf);
+            return 1;
+        }
+
+        // Setup the UDP listener
+        res = setup_udp_listener(netconf);
+        if (res != 0) {
+            close_listeners(netconf);
+            free(netconf);
+            return 1;
+        }
+        setup_uring(netconf);
     }
 
     // Setup the timer
@@ -343,9 +656,18 @@ int init_networking(statsite_config *config, statsite_networking **netconf_out)
       first_flush_ms = align_timer(config->flush_interval);
     }
     netconf->flush_timer = aeCreateTimeEvent(netconf->loop, first_flush_ms, handle_flush_event, netconf, NULL);
-
-    // Prepare the conn handlers
-    init_conn_handler(config);
+    setup_forward_timer(netconf);
+
+    // Prepare the conn handlers, and start the
+    // workers once the handlers are ready
+    if (init_conn_handler(config) || start_workers(netconf)) {
+        stop_workers(netconf);
+        aeDeleteTimeEvent(netconf->loop, netconf->flush_timer);
+        if (netconf->forward_timer != -1)
+            aeDeleteTimeEvent(netconf->loop, netconf->forward_timer);
+        free(netconf);
+        return 1;
+    }
 
     // Success!
     *netconf_out = netconf;
@@ -369,6 +691,28 @@ static int handle_flush_event(aeEventLoop *loop, long long id, void *edata) {
 }
 
 
+/**
+ * Invoked periodically in forward mode, to write out
+ * the commands batched by the event loop.
+ */
+static int handle_forward_event(aeEventLoop *loop, long long id, void *edata) {
+    statsite_networking *netconf = (statsite_networking *) edata;
+    forward_interval_trigger(netconf->shard);
+    return FORWARD_INTERVAL_MS;
+}
+
+
+/**
+ * Invoked when a worker event loop is asked to stop.
+ */
+static void handle_worker_wake(aeEventLoop *loop, int fd, void *edata, int mask) {
+    char buf;
+    if (read(fd, &buf, 1) == 1) {
+        aeStop(loop);
+    }
+}
+
+
 /**
  * Invoked when a TCP listening socket fd is ready
  * to accept a new client. Accepts the client, initializes
@@ -402,6 +746,10 @@ static void handle_new_client(aeEventLoop *loop, int fd, void *edata, int mask)
 
     // Get the associated conn object
     conn_info *conn = get_conn(netconf, client_fd);
+    if (!conn) {
+        close(client_fd);
+        return;
+    }
 
     // Initialize the libev stuff
     aeCreateFileEvent(netconf->loop, client_fd, AE_READABLE, invoke_event_handler, conn);
@@ -420,18 +768,15 @@ static int read_client_data(conn_info *conn) {
      * If we have < 50% free, we resize the buffer using
      * a multiplier.
      */
-    int avail_buf = circbuf_avail_buf(&conn->input);
+    uint64_t avail_buf = circbuf_avail_buf(&conn->input);
     if (avail_buf < conn->input.buf_size / 2) {
-        circbuf_grow_buf(&conn->input);
+        if (circbuf_grow_buf(&conn->input) && !avail_buf) return 1;
+        avail_buf = circbuf_avail_buf(&conn->input);
     }
 
-    // Build the IO vectors to perform the read
-    struct iovec vectors[2];
-    int num_vectors;
-    circbuf_setup_readv_iovec(&conn->input, (struct iovec*)&vectors, &num_vectors);
-
-    // Issue the read
-    ssize_t read_bytes = readv(conn->client_fd, (struct iovec*)&vectors, num_vectors);
+    // The free space is contiguous, so issue a single read
+    ssize_t read_bytes = read(conn->client_fd,
+            conn->input.buffer + conn->input.write_cursor, avail_buf);
 
     // Make sure we actually read something
     if (read_bytes == 0) {
@@ -454,67 +799,261 @@ static int read_client_data(conn_info *conn) {
 
 
 /**
- * Invoked when a UDP connection has a message ready to be read.
- * We need to take care to add the data to our buffers, and then
- * invoke the connection handlers who have the business logic
- * of what to do.
+ * Receives a batch of UDP datagrams. Each datagram is read
+ * into its own slot of the connection buffer, and the iovec
+ * for each slot is updated with the datagram length. Slots
+ * are one byte larger than the read size, so the handlers
+ * can terminate the last record in place.
+ * @arg netconf The network configuration
+ * @arg fd The UDP socket
+ * @arg conn The UDP connection
+ * @return The number of datagrams received.
  */
-static void handle_udp_message(aeEventLoop *loop, int fd, void *edata, int mask) {
-    struct iovec vectors[2];
-    int num_vectors;
-    ssize_t read_bytes;
-    statsite_networking *netconf = (statsite_networking *) edata;
+static int recv_udp_batch(statsite_networking *netconf, int fd, conn_info *conn) {
+    int batch_size = netconf->config->udp_batch_size;
+    struct iovec *slots = netconf->udp_iovecs;
+    int num;
+
+    // Point each vector at its own slot
+    for (int i=0; i < batch_size; i++) {
+        slots[i].iov_base = conn->input.buffer + i * UDP_SLOT_SIZE;
+        slots[i].iov_len = UDP_SLOT_SIZE - 1;
+    }
 
-    // Get the associated connection struct
-    conn_info *conn = netconf->udp_client;
-
-    // Clear the input buffer
-    circbuf_clear(&conn->input);
-
-    // Loop until our buffer cannot hold another UDP packet (using a 1500
-    // byte MTU) or we cannot read another packet off the wire.  We do not
-    // read continuously off of the UDP socket to preserve timer execution.
-    while (circbuf_avail_buf(&conn->input) > 1500) {
-        // Build the IO vectors to perform the read
-        circbuf_setup_readv_iovec(&conn->input, (struct iovec*)&vectors, &num_vectors);
-
-        /*
-         * Issue the read, always use the first vector.
-         * since we just cleared the buffer, and it should
-         * be a contiguous buffer.
-         */
-        assert(num_vectors == 1);
-        read_bytes = recv(fd, vectors[0].iov_base, vectors[0].iov_len, 0);
-
-        // Make sure we actually read something
-        if (read_bytes == 0) {
-            syslog(LOG_DEBUG, "Got empty UDP packet. [%d]\n", fd);
-            continue;
+#ifdef HAVE_RECVMMSG
+    struct mmsghdr *msgs = netconf->udp_msgs;
+    for (int i=0; i < batch_size; i++) {
+        msgs[i].msg_hdr.msg_iov = slots + i;
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    num = recvmmsg(fd, msgs, batch_size, 0, NULL);
+    if (num == -1) {
+        if (errno != EAGAIN && errno != EINTR) {
+            syslog(LOG_ERR, "Failed to recvmmsg() from connection [%d]! %s.",
+                    fd, strerror(errno));
+        }
+        return 0;
+    }
 
-        } else if (read_bytes == -1) {
+    for (int i=0; i < num; i++) {
+        slots[i].iov_len = msgs[i].msg_len;
+        if (unlikely(msgs[i].msg_hdr.msg_flags & MSG_TRUNC)) {
+            syslog(LOG_WARNING, "Dropped UDP packet larger than %d bytes. [%d]", UDP_SLOT_SIZE - 1, fd);
+            slots[i].iov_len = 0;
+        }
+    }
+#else
+    // Read one datagram at a time until the batch is full or we
+    // cannot read another packet off the wire. We do not read
+    // continuously off of the UDP socket to preserve timer execution.
+    ssize_t read_bytes;
+    for (num=0; num < batch_size; num++) {
+        read_bytes = recv(fd, slots[num].iov_base, slots[num].iov_len, 0);
+        if (read_bytes == -1) {
             if (errno != EAGAIN && errno != EINTR) {
                 syslog(LOG_ERR, "Failed to recv() from connection [%d]! %s.",
                         fd, strerror(errno));
             }
             break;
         }
+        slots[num].iov_len = read_bytes;
+    }
+#endif
+    return num;
+}
 
-        // Update the write cursor
-        circbuf_advance_write(&conn->input, read_bytes);
 
-        // UDP clients don't need to append newlines to the messages like
-        // TCP clients do, but our parser requires them.  Append one if
-        // it's not present.
-        if (conn->input.buffer[conn->input.write_cursor - 1] != '\n')
-            circbuf_write(&conn->input, "\n", 1);
-    }
+/**
+ * Invoked when a UDP connection has a message ready to be read.
+ * The datagrams are parsed in place by the connection handlers,
+ * who have the business logic of what to do.
+ */
+static void handle_udp_message(aeEventLoop *loop, int fd, void *edata, int mask) {
+    statsite_networking *netconf = (statsite_networking *) edata;
+
+    // Read as many datagrams as we can in one go
+    int num = recv_udp_batch(netconf, fd, netconf->udp_client);
+    if (num == 0) return;
 
     // Invoke the connection handler
-    statsite_conn_handler handle = {netconf->config, netconf->udp_client};
-    handle_client_connect(&handle);
+    statsite_conn_handler handle = {netconf->config, netconf->udp_client, netconf->shard};
+    handle_udp_batch(&handle, num);
+    handle_client_datagrams(&handle, netconf->udp_iovecs, num);
+}
+
+
+#ifdef HAVE_IO_URING
+/**
+ * Parses the pending batch of datagrams received
+ * through io_uring, and hands their buffers back.
+ */
+static void flush_uring_datagrams(statsite_networking *netconf) {
+    int num = netconf->udp_pending;
+    if (num == 0) return;
+
+    statsite_conn_handler handle = {netconf->config, netconf->udp_client, netconf->shard};
+    handle_udp_batch(&handle, num);
+    handle_client_datagrams(&handle, netconf->udp_iovecs, num);
+
+    for (int i=0; i < num; i++) {
+        uring_put_buf(netconf->udp_bufs, netconf->udp_buf_ids[i]);
+    }
+    netconf->udp_pending = 0;
 }
 
 
+/**
+ * Handles a completion of the multishot recvmsg on the UDP
+ * socket. Datagrams are gathered into batches in place, and
+ * parsed when the batch is full or the ring is drained.
+ */
+static void handle_uring_datagram(statsite_networking *netconf, uring_completion *comp) {
+    int fd = netconf->udp_client->client_fd;
+    if (comp->buf_id >= 0) {
+        char *buf = uring_buf(netconf->udp_bufs, comp->buf_id);
+        int len, truncated;
+        char *payload = uring_recvmsg_payload(&netconf->udp_msg, buf, comp->res, &len, &truncated);
+        if (unlikely(truncated)) {
+            syslog(LOG_WARNING, "Dropped UDP packet larger than %d bytes. [%d]", UDP_SLOT_SIZE - 1, fd);
+            len = 0;
+        }
+
+        int num = netconf->udp_pending++;
+        netconf->udp_iovecs[num].iov_base = payload;
+        netconf->udp_iovecs[num].iov_len = len;
+        netconf->udp_buf_ids[num] = comp->buf_id;
+        if (netconf->udp_pending == netconf->config->udp_batch_size) {
+            flush_uring_datagrams(netconf);
+        }
+
+    } else if (comp->res < 0 && comp->res != -ENOBUFS) {
+        syslog(LOG_ERR, "Failed to recvmsg() from connection [%d]! %s.", fd, strerror(-comp->res));
+    }
+
+    // Re-arm the receive if the kernel stopped it, which happens
+    // when it runs out of buffers. Otherwise, e.g. on older kernels
+    // rejecting multishot receives, fall back to the event loop.
+    if (comp->more) return;
+    if (comp->res >= 0 || comp->res == -ENOBUFS) {
+        uring_recvmsg_multishot(netconf->uring, fd, &netconf->udp_msg, netconf->udp_bufs, URING_TAG_UDP);
+        return;
+    }
+    syslog(LOG_WARNING, "Multishot recvmsg failed, using the event loop for UDP");
+    aeCreateFileEvent(netconf->loop, fd, AE_READABLE, handle_udp_message, netconf);
+}
+
+
+/**
+ * Handles a completion of the multishot accept on the
+ * TCP listener, and arms a multishot receive on the client.
+ */
+static void handle_uring_accept(statsite_networking *netconf, uring_completion *comp) {
+    int client_fd = comp->res;
+    if (client_fd >= 0) {
+        if (!set_client_sockopts(client_fd)) {
+            syslog(LOG_DEBUG, "Accepted client connection: [%d]", client_fd);
+            conn_info *conn = get_conn(netconf, client_fd);
+            if (conn) {
+                uring_recv_multishot(netconf->uring, client_fd, netconf->tcp_bufs,
+                        (uint64_t)(uintptr_t)conn | URING_TAG_CLIENT);
+            } else {
+                close(client_fd);
+            }
+        }
+    } else {
+        syslog(LOG_ERR, "Failed to accept() connection! %s.", strerror(-client_fd));
+    }
+
+    // Accept errors such as running out of descriptors do not stop
+    // the listener, so re-arm unless multishot is not supported
+    if (comp->more) return;
+    if (comp->res != -EINVAL) {
+        uring_accept_multishot(netconf->uring, netconf->tcp_listener_fd, URING_TAG_ACCEPT);
+        return;
+    }
+    syslog(LOG_WARNING, "Multishot accept is not supported, using the event loop for TCP");
+    aeCreateFileEvent(netconf->loop, netconf->tcp_listener_fd, AE_READABLE, handle_new_client, netconf);
+}
+
+
+/**
+ * Handles a completion of the multishot receive on a TCP client.
+ * The data is appended to the connection buffer and the connection
+ * handlers are invoked. The connection is only closed once the
+ * kernel has finished with the receive.
+ */
+static void handle_uring_client(statsite_networking *netconf, uring_completion *comp) {
+    conn_info *conn = (conn_info*)(uintptr_t)(comp->user_data & ~(uint64_t)URING_TAG_MASK);
+    if (comp->buf_id >= 0) {
+        char *buf = uring_buf(netconf->tcp_bufs, comp->buf_id);
+        int err = 0;
+        if (!conn->closing && comp->res > 0) {
+            err = circbuf_write(&conn->input, buf, comp->res);
+        }
+        uring_put_buf(netconf->tcp_bufs, comp->buf_id);
+
+        // Invoke the connection handler, and cancel the receive on error
+        statsite_conn_handler handle = {netconf->config, conn, netconf->shard};
+        if (!conn->closing && comp->res > 0 && (err || handle_client_connect(&handle))) {
+            conn->closing = 1;
+            uring_cancel(netconf->uring, comp->user_data, URING_TAG_CANCEL);
+        }
+    }
+
+    if (comp->more) return;
+    if (!conn->closing && (comp->res > 0 || comp->res == -ENOBUFS)) {
+        uring_recv_multishot(netconf->uring, conn->client_fd, netconf->tcp_bufs, comp->user_data);
+        return;
+    }
+    if (!conn->closing && comp->res == -EINVAL) {
+        syslog(LOG_WARNING, "Multishot recv is not supported, using the event loop for TCP clients");
+        aeCreateFileEvent(netconf->loop, conn->client_fd, AE_READABLE, invoke_event_handler, conn);
+        return;
+    }
+
+    if (comp->res == 0) {
+        syslog(LOG_DEBUG, "Closed client connection. [%d]\n", conn->client_fd);
+    } else if (comp->res < 0 && comp->res != -ECANCELED) {
+        syslog(LOG_ERR, "Failed to read() from connection [%d]! %s.",
+                conn->client_fd, strerror(-comp->res));
+    }
+    close_client_connection(conn);
+}
+
+
+/**
+ * Invoked when the io_uring has completions to reap.
+ * Dispatches each one to its handler based on the tag,
+ * then submits any requests that need to be re-armed.
+ */
+static void handle_uring_event(aeEventLoop *loop, int fd, void *edata, int mask) {
+    statsite_networking *netconf = (statsite_networking *) edata;
+    uring_completion comp;
+
+    for (int i=0; i < URING_MAX_REAP && uring_next(netconf->uring, &comp); i++) {
+        switch (comp.user_data & URING_TAG_MASK) {
+            case URING_TAG_CLIENT:
+                handle_uring_client(netconf, &comp);
+                break;
+            case URING_TAG_ACCEPT:
+                handle_uring_accept(netconf, &comp);
+                break;
+            case URING_TAG_UDP:
+                handle_uring_datagram(netconf, &comp);
+                break;
+            default:
+                break;
+        }
+    }
+
+    // Parse any partial batch, and submit the re-armed requests
+    flush_uring_datagrams(netconf);
+    uring_submit(netconf->uring);
+}
+#endif
+
+
 /**
  * Reads the thread specific userdata to figure out what
  * we need to handle. Things that purely effect the network
@@ -533,7 +1072,7 @@ static void invoke_event_handler(aeEventLoop *loop, int fd, void *edata, int mas
     }
 
     // Invoke the connection handler, and close connection on error
-    statsite_conn_handler handle = {netconf->config, conn};
+    statsite_conn_handler handle = {netconf->config, conn, netconf->shard};
     if (handle_client_connect(&handle) && fd != STDIN_FILENO)
         close_client_connection(conn);
 }
@@ -561,14 +1100,11 @@ void enter_networking_loop(statsite_networking *netconf, volatile int *signum) {
  * @arg netconf The config for the networking stack.
  */
 int shutdown_networking(statsite_networking *netconf) {
-    // Stop listening for new connections
-    aeDeleteFileEvent(netconf->loop, netconf->tcp_listener_fd, AE_READABLE);
-    close(netconf->tcp_listener_fd);
+    // Stop the worker loops
+    stop_workers(netconf);
 
-    if (netconf->udp_client != NULL) {
-        close_client_connection(netconf->udp_client);
-        netconf->udp_client = NULL;
-    }
+    // Stop listening for new connections
+    close_listeners(netconf);
 
     if (netconf->stdin_client != NULL) {
         close_client_connection(netconf->stdin_client);
@@ -577,6 +1113,8 @@ int shutdown_networking(statsite_networking *netconf) {
 
     // Stop the other timers
     aeDeleteTimeEvent(netconf->loop, netconf->flush_timer);
+    if (netconf->forward_timer != -1)
+        aeDeleteTimeEvent(netconf->loop, netconf->forward_timer);
 
     // TODO: Close all the client connections
     // ??? For now, we just leak the memory
@@ -618,100 +1156,13 @@ void close_client_connection(conn_info *conn) {
 
 
 /**
- * This method is used to conveniently extract commands from the
- * command buffer. It scans up to a terminator, and then sets the
- * buf to the start of the buffer, and buf_len to the length
- * of the buffer. The output param should_free indicates that
- * the caller should free the buffer pointed to by buf when it is finished.
- * This method consumes the bytes from the underlying buffer, freeing
- * space for later reads.
+ * Returns the ASCII parser of the connection, which keeps
+ * the state of a partial command between reads.
  * @arg conn The client connection
- * @arg terminator The terminator charactor to look for. Replaced by null terminator.
- * @arg buf Output parameter, sets the start of the buffer.
- * @arg buf_len Output parameter, the length of the buffer.
- * @arg should_free Output parameter, should the buffer be freed by the caller.
- * @return 0 on success, -1 if the terminator is not found.
+ * @return The parser
  */
-int extract_to_terminator(statsite_conn_info *conn, char terminator, char **buf, int *buf_len, int *should_free) {
-    // First we need to find the terminator...
-    char *term_addr = NULL;
-    if (unlikely(conn->input.write_cursor < conn->input.read_cursor)) {
-        /*
-         * We need to scan from the read cursor to the end of
-         * the buffer, and then from the start of the buffer to
-         * the write cursor.
-        */
-        term_addr = memchr(conn->input.buffer+conn->input.read_cursor,
-                           terminator,
-                           conn->input.buf_size - conn->input.read_cursor);
-
-        // If we've found the terminator, we can just move up
-        // the read cursor
-        if (term_addr) {
-            *buf = conn->input.buffer + conn->input.read_cursor;
-            *buf_len = term_addr - *buf + 1;    // Difference between the terminator and location
-            *term_addr = '\0';              // Add a null terminator
-            *should_free = 0;               // No need to free, in the buffer
-
-            // Push the read cursor forward
-            conn->input.read_cursor = (term_addr - conn->input.buffer + 1) % conn->input.buf_size;
-            return 0;
-        }
-
-        // Wrap around
-        term_addr = memchr(conn->input.buffer,
-                           terminator,
-                           conn->input.write_cursor);
-
-        // If we've found the terminator, we need to allocate
-        // a contiguous buffer large enough to store everything
-        // and provide a linear buffer
-        if (term_addr) {
-            int start_size = term_addr - conn->input.buffer + 1;
-            int end_size = conn->input.buf_size - conn->input.read_cursor;
-            *buf_len = start_size + end_size;
-            *buf = malloc(*buf_len);
-
-            // Copy from the read cursor to the end
-            memcpy(*buf, conn->input.buffer+conn->input.read_cursor, end_size);
-
-            // Copy from the start to the terminator
-            *term_addr = '\0';              // Add a null terminator
-            memcpy(*buf+end_size, conn->input.buffer, start_size);
-
-            *should_free = 1;               // Must free, not in the buffer
-            conn->input.read_cursor = start_size; // Push the read cursor forward
-        }
-
-    } else {
-        /*
-         * We need to scan from the read cursor to write buffer.
-         */
-        term_addr = memchr(conn->input.buffer+conn->input.read_cursor,
-                           terminator,
-                           conn->input.write_cursor - conn->input.read_cursor);
-
-        // If we've found the terminator, we can just move up
-        // the read cursor
-        if (term_addr) {
-            *buf = conn->input.buffer + conn->input.read_cursor;
-            *buf_len = term_addr - *buf + 1; // Difference between the terminator and location
-            *term_addr = '\0';               // Add a null terminator
-            *should_free = 0;                // No need to free, in the buffer
-            conn->input.read_cursor = term_addr - conn->input.buffer + 1; // Push the read cursor forward
-        }
-    }
-
-    // Minor optimization, if our read-cursor has caught up
-    // with the write cursor, reset them to the beginning
-    // to avoid wrapping in the future
-    if (conn->input.read_cursor == conn->input.write_cursor) {
-        conn->input.read_cursor = 0;
-        conn->input.write_cursor = 0;
-    }
-
-    // Return success if we have a term address
-    return ((term_addr) ? 0 : -1);
+ascpp* client_parser(statsite_conn_info *conn) {
+    return &conn->parser;
 }
 
 
@@ -740,39 +1191,16 @@ int peek_client_byte(statsite_conn_info *conn, unsigned char* byte) {
 
 /**
  * This method is used to peek into the input buffer without
- * causing input to be consumed. It attempts to use the data
- * in-place, similar to read_client_bytes.
+ * causing input to be consumed. The data is used in-place,
+ * as the buffer is always contiguous.
  * @arg conn The client connection
  * @arg bytes The number of bytes to peek
  * @arg buf Output parameter, sets the start of the buffer.
- * @arg should_free Output parameter, should the buffer be freed by the caller.
  * @return 0 on success, -1 if there is insufficient data.
  */
-int peek_client_bytes(statsite_conn_info *conn, int bytes, char** buf, int* should_free) {
+int peek_client_bytes(statsite_conn_info *conn, int bytes, char** buf) {
     if (unlikely(bytes > circbuf_used_buf(&conn->input))) return -1;
-
-    // Handle the wrap around case
-    if (unlikely(conn->input.write_cursor < conn->input.read_cursor)) {
-        // Check if we can use a contiguous chunk
-        int end_size = conn->input.buf_size - conn->input.read_cursor;
-        if (end_size >= bytes) {
-            *buf = conn->input.buffer + conn->input.read_cursor;
-            *should_free = 0;
-
-        // Otherwise, allocate a dynamic slab, and copy
-        } else {
-            *buf = malloc(bytes);
-            memcpy(*buf, conn->input.buffer + conn->input.read_cursor, end_size);
-            memcpy(*buf + end_size, conn->input.buffer, bytes - end_size);
-            *should_free = 1;
-        }
-
-    // Handle the contiguous case
-    } else {
-        *buf = conn->input.buffer + conn->input.read_cursor;
-        *should_free = 0;
-    }
-
+    *buf = conn->input.buffer + conn->input.read_cursor;
     return 0;
 }
 
@@ -792,37 +1220,17 @@ int seek_client_bytes(statsite_conn_info *conn, int bytes) {
 
 
 /**
- * This method is used to read and consume the input buffer
+ * This method is used to read and consume the input buffer.
+ * The data is used in-place, and remains valid until the
+ * next read from the connection.
  * @arg conn The client connection
  * @arg bytes The number of bytes to read
  * @arg buf Output parameter, sets the start of the buffer.
- * @arg should_free Output parameter, should the buffer be freed by the caller.
  * @return 0 on success, -1 if there is insufficient data.
  */
-int read_client_bytes(statsite_conn_info *conn, int bytes, char** buf, int* should_free) {
+int read_client_bytes(statsite_conn_info *conn, int bytes, char** buf) {
     if (unlikely(bytes > circbuf_used_buf(&conn->input))) return -1;
-
-    // Handle the wrap around case
-    if (unlikely(conn->input.write_cursor < conn->input.read_cursor)) {
-        // Check if we can use a contiguous chunk
-        int end_size = conn->input.buf_size - conn->input.read_cursor;
-        if (end_size >= bytes) {
-            *buf = conn->input.buffer + conn->input.read_cursor;
-            *should_free = 0;
-
-        // Otherwise, allocate a dynamic slab, and copy
-        } else {
-            *buf = malloc(bytes);
-            memcpy(*buf, conn->input.buffer + conn->input.read_cursor, end_size);
-            memcpy(*buf + end_size, conn->input.buffer, bytes - end_size);
-            *should_free = 1;
-        }
-
-    // Handle the contiguous case
-    } else {
-        *buf = conn->input.buffer + conn->input.read_cursor;
-        *should_free = 0;
-    }
+    *buf = conn->input.buffer + conn->input.read_cursor;
 
     // Advance the read cursor
     circbuf_advance_read(&conn->input, bytes);
@@ -869,172 +1277,23 @@ static int set_client_sockopts(int client_fd) {
 /**
  * Returns the conn_info* object associated with the FD
  * or allocates a new one as necessary.
+ * @return The connection, or NULL if the buffers could not be allocated.
  */
 static conn_info* get_conn(statsite_networking *nc, int fd) {
     // Allocate space
     conn_info *conn = malloc(sizeof(conn_info));
 
     // Prepare the buffers
-    circbuf_init(&conn->input);
+    if (circbuf_init(&conn->input)) {
+        free(conn);
+        return NULL;
+    }
 
     // Store fd and a reference back to netconf
     conn->nc = nc;
     conn->client_fd = fd;
+    conn->closing = 0;
+    memset(&conn->parser, 0, sizeof(ascpp));
 
     return conn;
 }
-
-/*
- * Methods for manipulating our circular buffers
- */
-
-// Conditionally allocates if there is no buffer
-static void circbuf_init(circular_buffer *buf) {
-    buf->read_cursor = 0;
-    buf->write_cursor = 0;
-    buf->buf_size = INIT_CONN_BUF_SIZE * sizeof(char);
-    buf->buffer = malloc(buf->buf_size);
-}
-
-// Clears the circular buffer, reseting it.
-static void circbuf_clear(circular_buffer *buf) {
-    buf->read_cursor = 0;
-    buf->write_cursor = 0;
-}
-
-// Frees a buffer
-static void circbuf_free(circular_buffer *buf) {
-    if (buf->buffer) free(buf->buffer);
-    buf->buffer = NULL;
-}
-
-// Calculates the available buffer size
-static uint64_t circbuf_avail_buf(circular_buffer *buf) {
-    uint64_t avail_buf;
-    if (buf->write_cursor < buf->read_cursor) {
-        avail_buf = buf->read_cursor - buf->write_cursor - 1;
-    } else {
-        avail_buf = buf->buf_size - buf->write_cursor + buf->read_cursor - 1;
-    }
-    return avail_buf;
-}
-
-// Calculates the used buffer size
-static uint64_t circbuf_used_buf(circular_buffer *buf) {
-    uint64_t used_buf;
-    if (buf->write_cursor < buf->read_cursor) {
-        used_buf = buf->buf_size - buf->read_cursor + buf->write_cursor;
-    } else {
-        used_buf = buf->write_cursor - buf->read_cursor;
-    }
-    return used_buf;
-}
-
-// Grows the circular buffer to make room for more data
-static void circbuf_grow_buf(circular_buffer *buf) {
-    int new_size = buf->buf_size * CONN_BUF_MULTIPLIER * sizeof(char);
-    char *new_buf = malloc(new_size);
-    int bytes_written = 0;
-
-    // Check if the write has wrapped around
-    if (buf->write_cursor < buf->read_cursor) {
-        // Copy from the read cursor to the end of the buffer
-        bytes_written = buf->buf_size - buf->read_cursor;
-        memcpy(new_buf,
-               buf->buffer+buf->read_cursor,
-               bytes_written);
-
-        // Copy from the start to the write cursor
-        memcpy(new_buf+bytes_written,
-               buf->buffer,
-               buf->write_cursor);
-        bytes_written += buf->write_cursor;
-
-    // We haven't wrapped yet...
-    } else {
-        // Copy from the read cursor up to the write cursor
-        bytes_written = buf->write_cursor - buf->read_cursor;
-        memcpy(new_buf,
-               buf->buffer + buf->read_cursor,
-               bytes_written);
-    }
-
-    // Update the buffer locations and everything
-    free(buf->buffer);
-    buf->buffer = new_buf;
-    buf->buf_size = new_size;
-    buf->read_cursor = 0;
-    buf->write_cursor = bytes_written;
-}
-
-
-// Initializes a pair of iovectors to be used for readv
-static void circbuf_setup_readv_iovec(circular_buffer *buf, struct iovec *vectors, int *num_vectors) {
-    // Check if we've wrapped around
-    *num_vectors = 1;
-    if (buf->write_cursor < buf->read_cursor) {
-        vectors[0].iov_base = buf->buffer + buf->write_cursor;
-        vectors[0].iov_len = buf->read_cursor - buf->write_cursor - 1;
-    } else {
-        vectors[0].iov_base = buf->buffer + buf->write_cursor;
-        vectors[0].iov_len = buf->buf_size - buf->write_cursor - 1;
-        if (buf->read_cursor > 0)  {
-            vectors[0].iov_len += 1;
-            vectors[1].iov_base = buf->buffer;
-            vectors[1].iov_len = buf->read_cursor - 1;
-            *num_vectors = 2;
-        }
-    }
-}
-
-// Advances the cursors
-static void circbuf_advance_write(circular_buffer *buf, uint64_t bytes) {
-    buf->write_cursor = (buf->write_cursor + bytes) % buf->buf_size;
-}
-
-static void circbuf_advance_read(circular_buffer *buf, uint64_t bytes) {
-    buf->read_cursor = (buf->read_cursor + bytes) % buf->buf_size;
-
-    // Optimization, reset the cursors if they catchup with each other
-    if (buf->read_cursor == buf->write_cursor) {
-        buf->read_cursor = 0;
-        buf->write_cursor = 0;
-    }
-}
-
-/**
- * Writes the data from a given input buffer
- * into the circular buffer.
- * @return 0 on success.
- */
-static int circbuf_write(circular_buffer *buf, char *in, uint64_t bytes) {
-    // Check for available space
-    uint64_t avail = circbuf_avail_buf(buf);
-    while (avail < bytes) {
-        circbuf_grow_buf(buf);
-        avail = circbuf_avail_buf(buf);
-    }
-
-    if (buf->write_cursor < buf->read_cursor) {
-        memcpy(buf->buffer+buf->write_cursor, in, bytes);
-        buf->write_cursor += bytes;
-
-    } else {
-        uint64_t end_size = buf->buf_size - buf->write_cursor;
-        if (end_size >= bytes) {
-            memcpy(buf->buffer+buf->write_cursor, in, bytes);
-            buf->write_cursor += bytes;
-
-        } else {
-            // Copy the first end_size bytes
-            memcpy(buf->buffer+buf->write_cursor, in, end_size);
-
-            // Copy the remaining data
-            memcpy(buf->buffer, in+end_size, (bytes - end_size));
-            buf->write_cursor = (bytes - end_size);
-        }
-    }
-
-    return 0;
-}
-
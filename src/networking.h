@@ -1,6 +1,7 @@
 #ifndef NETWORKING_H
 #define NETWORKING_H
 #include "config.h"
+#include "ascii_parser.h"
 
 // Network configuration struct
 typedef struct statsite_networking statsite_networking;
@@ -41,21 +42,12 @@ int shutdown_networking(statsite_networking *netconf);
 void close_client_connection(statsite_conn_info *conn);
 
 /**
- * This method is used to conveniently extract commands from the
- * command buffer. It scans up to a terminator, and then sets the
- * buf to the start of the buffer, and buf_len to the length
- * of the buffer. The output param should_free indicates that
- * the caller should free the buffer pointed to by buf when it is finished.
- * This method consumes the bytes from the underlying buffer, freeing
- * space for later reads.
+ * Returns the ASCII parser of the connection, which keeps
+ * the state of a partial command between reads.
  * @arg conn The client connection
- * @arg terminator The terminator charactor to look for. Included in buf.
- * @arg buf Output parameter, sets the start of the buffer.
- * @arg buf_len Output parameter, the length of the buffer.
- * @arg should_free Output parameter, should the buffer be freed by the caller.
- * @return 0 on success, -1 if the terminator is not found.
+ * @return The parser
  */
-int extract_to_terminator(statsite_conn_info *conn, char terminator, char **buf, int *buf_len, int *should_free);
+ascpp* client_parser(statsite_conn_info *conn);
 
 /**
  * This method is used to query how much data is available
@@ -75,15 +67,14 @@ int peek_client_byte(statsite_conn_info *conn, unsigned char* byte);
 
 /**
  * This method is used to peek into the input buffer without
- * causing input to be consumed. It attempts to use the data
- * in-place, similar to read_client_bytes.
+ * causing input to be consumed. The data is used in-place,
+ * as the buffer is always contiguous.
  * @arg conn The client connection
  * @arg bytes The number of bytes to peek
  * @arg buf Output parameter, sets the start of the buffer.
- * @arg should_free Output parameter, should the buffer be freed by the caller.
  * @return 0 on success, -1 if there is insufficient data.
  */
-int peek_client_bytes(statsite_conn_info *conn, int bytes, char** buf, int* should_free);
+int peek_client_bytes(statsite_conn_info *conn, int bytes, char** buf);
 
 /**
  * This method is used to seek the input buffer without
@@ -96,13 +87,14 @@ int peek_client_bytes(statsite_conn_info *conn, int bytes, char** buf, int* shou
 int seek_client_bytes(statsite_conn_info *conn, int bytes);
 
 /**
- * This method is used to read and consume the input buffer
+ * This method is used to read and consume the input buffer.
+ * The data is used in-place, and remains valid until the
+ * next read from the connection.
  * @arg conn The client connection
  * @arg bytes The number of bytes to read
  * @arg buf Output parameter, sets the start of the buffer.
- * @arg should_free Output parameter, should the buffer be freed by the caller.
  * @return 0 on success, -1 if there is insufficient data.
  */
-int read_client_bytes(statsite_conn_info *conn, int bytes, char** buf, int* should_free);
+int read_client_bytes(statsite_conn_info *conn, int bytes, char** buf);
 
 #endif
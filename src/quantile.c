@@ -0,0 +1,180 @@
+#include <strings.h>
+#include "quantile.h"
+
+/**
+ * Initializes the quantile struct
+ * @arg engine The engine to use
+ * @arg eps The maximum error for the quantiles
+ * @arg quantiles A sorted array of double quantile values, must be on (0, 1)
+ * @arg num_quants The number of entries in the quantiles array
+ * @arg q The quantile struct to initialize
+ * @return 0 on success.
+ */
+int init_quantile(quantile_engine engine, double eps, double *quantiles, uint32_t num_quants, quantile *q) {
+    q->engine = engine;
+    switch (engine) {
+        case QUANTILE_TDIGEST:
+            // Large errors still need a few centroids
+            return init_tdigest((eps > 0.1) ? 10 : 1 / eps, &q->q.td);
+        case QUANTILE_DDSKETCH:
+            return init_ddsketch(eps, &q->q.dd);
+        default:
+            return init_cm_quantile(eps, quantiles, num_quants, &q->q.cm);
+    }
+}
+
+/**
+ * Destroy the quantile struct.
+ * @return 0 on success.
+ */
+int destroy_quantile(quantile *q) {
+    switch (q->engine) {
+        case QUANTILE_TDIGEST:
+            return destroy_tdigest(&q->q.td);
+        case QUANTILE_DDSKETCH:
+            return destroy_ddsketch(&q->q.dd);
+        default:
+            return destroy_cm_quantile(&q->q.cm);
+    }
+}
+
+/**
+ * Adds a new value
+ * @return 0 on success.
+ */
+int quantile_add_sample(quantile *q, double value) {
+    switch (q->engine) {
+        case QUANTILE_TDIGEST:
+            return td_add_sample(&q->q.td, value);
+        case QUANTILE_DDSKETCH:
+            return dd_add_sample(&q->q.dd, value);
+        default:
+            return cm_add_sample(&q->q.cm, value);
+    }
+}
+
+/**
+ * Queries for a quantile value
+ * @return The value on success or 0.
+ */
+double quantile_query(quantile *q, double quantile) {
+    switch (q->engine) {
+        case QUANTILE_TDIGEST:
+            return td_query(&q->q.td, quantile);
+        case QUANTILE_DDSKETCH:
+            return dd_query(&q->q.dd, quantile);
+        default:
+            return cm_query(&q->q.cm, quantile);
+    }
+}
+
+/**
+ * Forces any buffered values to be added
+ * @return 0 on success.
+ */
+int quantile_flush(quantile *q) {
+    switch (q->engine) {
+        case QUANTILE_TDIGEST:
+            return td_flush(&q->q.td);
+        case QUANTILE_DDSKETCH:
+            // Values are counted as they are added
+            return 0;
+        default:
+            return cm_flush(&q->q.cm);
+    }
+}
+
+/**
+ * Merges the values of one quantile into another, leaving it empty.
+ * @return 0 on success, -1 if they cannot be merged.
+ */
+int quantile_merge(quantile *into, quantile *from) {
+    if (into->engine != from->engine) return -1;
+    switch (into->engine) {
+        case QUANTILE_TDIGEST:
+            return td_merge(&into->q.td, &from->q.td);
+        case QUANTILE_DDSKETCH:
+            return dd_merge(&into->q.dd, &from->q.dd);
+        default:
+            return cm_merge(&into->q.cm, &from->q.cm);
+    }
+}
+
+/**
+ * Checks if a quantile can be merged into one of the engine and error.
+ * Only DDSketch requires the same error, the others merge within their error.
+ * @return 1 if it can be merged, 0 otherwise.
+ */
+int quantile_mergeable(quantile *q, quantile_engine engine, double eps) {
+    if (q->engine != engine) return 0;
+    if (engine == QUANTILE_DDSKETCH) return q->q.dd.alpha == eps;
+    return 1;
+}
+
+/**
+ * Encodes the engine and its summary
+ * @return 0 on success.
+ */
+int quantile_encode(quantile *q, codec_buf *buf) {
+    if (codec_put_u8(buf, q->engine)) return -1;
+    switch (q->engine) {
+        case QUANTILE_TDIGEST:
+            return td_encode(&q->q.td, buf);
+        case QUANTILE_DDSKETCH:
+            return dd_encode(&q->q.dd, buf);
+        default:
+            return cm_encode(&q->q.cm, buf);
+    }
+}
+
+/**
+ * Decodes a quantile, which can then be merged
+ * @return 0 on success, -1 on bad input.
+ */
+int quantile_decode(codec_reader *r, double *quantiles, uint32_t num_quants, quantile *q) {
+    uint8_t engine;
+    if (codec_get_u8(r, &engine)) return -1;
+    q->engine = engine;
+    switch (engine) {
+        case QUANTILE_TDIGEST:
+            return td_decode(r, &q->q.td);
+        case QUANTILE_DDSKETCH:
+            return dd_decode(r, &q->q.dd);
+        case QUANTILE_CM:
+            return cm_decode(r, quantiles, num_quants, &q->q.cm);
+        default:
+            return -1;
+    }
+}
+
+/**
+ * Returns the number of samples, centroids or
+ * buckets kept by the engine.
+ */
+uint64_t quantile_size(quantile *q) {
+    switch (q->engine) {
+        case QUANTILE_TDIGEST:
+            return q->q.td.num_centroids;
+        case QUANTILE_DDSKETCH:
+            return dd_num_buckets(&q->q.dd);
+        default:
+            return q->q.cm.num_samples;
+    }
+}
+
+/**
+ * Looks up an engine by name
+ * @return 0 on success, -1 if the name is unknown.
+ */
+int quantile_engine_from_name(const char *name, quantile_engine *engine) {
+    if (strcasecmp(name, "cm") == 0) {
+        *engine = QUANTILE_CM;
+    } else if (strcasecmp(name, "tdigest") == 0) {
+        *engine = QUANTILE_TDIGEST;
+    } else if (strcasecmp(name, "ddsketch") == 0) {
+        *engine = QUANTILE_DDSKETCH;
+    } else {
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,130 @@
+/**
+ * This module selects the algorithm used to estimate the
+ * quantiles of a timer. Each engine trades accuracy, memory
+ * and insert cost differently:
+ *  - cm: Cormode-Muthukrishnan, the error is a fraction of the rank
+ *  - tdigest: Centroids, most accurate near the tails
+ *  - ddsketch: Logarithmic buckets, the error is a fraction of the
+ *    value, inserts take constant time and memory is bounded
+ */
+#ifndef QUANTILE_H
+#define QUANTILE_H
+#include <stdint.h>
+#include "codec.h"
+#include "cm_quantile.h"
+#include "tdigest.h"
+#include "ddsketch.h"
+
+typedef enum {
+    QUANTILE_CM,
+    QUANTILE_TDIGEST,
+    QUANTILE_DDSKETCH
+} quantile_engine;
+
+typedef struct {
+    quantile_engine engine;
+    union {
+        cm_quantile cm;
+        tdigest td;
+        ddsketch dd;
+    } q;
+} quantile;
+
+/**
+ * Initializes the quantile struct
+ * @arg engine The engine to use
+ * @arg eps The maximum error for the quantiles. The t-digest
+ * uses a compression of 1 / eps, and DDSketch a relative error of eps.
+ * @arg quantiles A sorted array of double quantile values, must be on (0, 1)
+ * @arg num_quants The number of entries in the quantiles array
+ * @arg q The quantile struct to initialize
+ * @return 0 on success.
+ */
+int init_quantile(quantile_engine engine, double eps, double *quantiles, uint32_t num_quants, quantile *q);
+
+/**
+ * Destroy the quantile struct.
+ * @arg q The quantile to destroy
+ * @return 0 on success.
+ */
+int destroy_quantile(quantile *q);
+
+/**
+ * Adds a new value
+ * @arg q The quantile to add to
+ * @arg value The new value
+ * @return 0 on success.
+ */
+int quantile_add_sample(quantile *q, double value);
+
+/**
+ * Queries for a quantile value
+ * @arg q The quantile to query
+ * @arg quantile The quantile to query
+ * @return The value on success or 0.
+ */
+double quantile_query(quantile *q, double quantile);
+
+/**
+ * Forces any buffered values to be added,
+ * so that queries have maximum accuracy.
+ * @arg q The quantile to flush
+ * @return 0 on success.
+ */
+int quantile_flush(quantile *q);
+
+/**
+ * Merges the values of one quantile into another, leaving it empty.
+ * Both must use the same engine and error.
+ * @arg into The quantile to merge into
+ * @arg from The quantile to merge from
+ * @return 0 on success, -1 if they cannot be merged.
+ */
+int quantile_merge(quantile *into, quantile *from);
+
+/**
+ * Checks if a quantile can be merged into one of
+ * the given engine and error, before anything is merged.
+ * @arg q The quantile to merge from
+ * @arg engine The engine of the target
+ * @arg eps The maximum error of the target
+ * @return 1 if it can be merged, 0 otherwise.
+ */
+int quantile_mergeable(quantile *q, quantile_engine engine, double eps);
+
+/**
+ * Encodes the engine and its summary
+ * @arg q The quantile to encode
+ * @arg buf The buffer to append to
+ * @return 0 on success.
+ */
+int quantile_encode(quantile *q, codec_buf *buf);
+
+/**
+ * Decodes a quantile, which can then be merged. The engine
+ * and its error are those of the encoding.
+ * @arg r The reader of the encoding
+ * @arg quantiles A sorted array of double quantile values, must be on (0, 1)
+ * @arg num_quants The number of entries in the quantiles array
+ * @arg q The quantile struct to initialize
+ * @return 0 on success, -1 on bad input.
+ */
+int quantile_decode(codec_reader *r, double *quantiles, uint32_t num_quants, quantile *q);
+
+/**
+ * Returns the number of samples, centroids or
+ * buckets kept by the engine.
+ * @arg q The quantile
+ * @return The size of the summary
+ */
+uint64_t quantile_size(quantile *q);
+
+/**
+ * Looks up an engine by name
+ * @arg name The name, one of cm, tdigest or ddsketch
+ * @arg engine Output, the engine
+ * @return 0 on success, -1 if the name is unknown.
+ */
+int quantile_engine_from_name(const char *name, quantile_engine *engine);
+
+#endif
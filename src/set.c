@@ -7,6 +7,9 @@
 // Link the external murmur hash in
 extern void MurmurHash3_x64_128(const void * key, const int len, const uint32_t seed, void *out);
 
+/* Static declarations */
+static void set_add_hash(set_t *s, uint64_t hash);
+
 /**
  * Initializes a new set
  * @arg precision The precision to use when converting to an HLL
@@ -44,16 +47,17 @@ int set_destroy(set_t *s) {
  * Converts a full exact set to an approximate HLL set.
  */
 static void convert_exact_to_approx(set_t *s) {
-    // Store the hashes, as HLL initialization
-    // will step on the pointer
+    // Store the hashes and count, as HLL initialization
+    // will step on the union
     uint64_t *hashes = s->store.s.hashes;
+    uint32_t count = s->store.s.count;
 
     // Initialize the HLL
     s->type = APPROX;
     hll_init(s->store.s.precision, &s->store.h);
 
     // Add each hash to the HLL
-    for (int i=0; i < SET_MAX_EXACT; i++) {
+    for (int i=0; i < count; i++) {
         hll_add_hash(&s->store.h, hashes[i]);
     }
 
@@ -67,19 +71,28 @@ static void convert_exact_to_approx(set_t *s) {
  * @arg key The key to add
  */
 void set_add(set_t *s, char *key) {
-    uint32_t i;
     uint64_t out[2];
     MurmurHash3_x64_128(key, strlen(key), 0, &out);
+    set_add_hash(s, out[1]);
+}
+
+/**
+ * Adds a hashed key to the set
+ * @arg s The set to add to
+ * @arg hash The hash to add
+ */
+static void set_add_hash(set_t *s, uint64_t hash) {
+    uint32_t i;
     switch (s->type) {
         case EXACT:
             // Check if this element is already added
             for (i=0; i < s->store.s.count; i++) {
-                if (out[1] == s->store.s.hashes[i]) return;
+                if (hash == s->store.s.hashes[i]) return;
             }
 
             // Check if we can fit this in the array
             if (i < SET_MAX_EXACT) {
-                s->store.s.hashes[i] = out[1];
+                s->store.s.hashes[i] = hash;
                 s->store.s.count++;
                 return;
             }
@@ -90,7 +103,7 @@ void set_add(set_t *s, char *key) {
             convert_exact_to_approx(s);
 
         case APPROX:
-            hll_add_hash(&s->store.h, out[1]);
+            hll_add_hash(&s->store.h, hash);
             break;
     }
 }
@@ -113,3 +126,88 @@ uint64_t set_size(set_t *s) {
     }
 }
 
+/**
+ * Merges the contents of one set into another.
+ * Both sets must use the same precision.
+ * @arg into The set to merge into
+ * @arg from The set to merge from, left unchanged
+ * @return 0 on success.
+ */
+int set_merge(set_t *into, set_t *from) {
+    switch (from->type) {
+        case EXACT:
+            for (uint32_t i=0; i < from->store.s.count; i++) {
+                set_add_hash(into, from->store.s.hashes[i]);
+            }
+            return 0;
+
+        case APPROX:
+            if (into->type == EXACT) convert_exact_to_approx(into);
+            return hll_merge(&into->store.h, &from->store.h);
+
+        default:
+            abort();
+    }
+}
+
+/**
+ * Encodes the set, as its hashes or its HLL
+ * @arg s The set to encode
+ * @arg buf The buffer to append to
+ * @return 0 on success.
+ */
+int set_encode(set_t *s, codec_buf *buf) {
+    if (codec_put_version(buf)) return -1;
+    if (codec_put_u8(buf, s->type)) return -1;
+    switch (s->type) {
+        case EXACT:
+            if (codec_put_u8(buf, s->store.s.precision)) return -1;
+            if (codec_put_varint(buf, s->store.s.count)) return -1;
+            for (uint32_t i=0; i < s->store.s.count; i++) {
+                if (codec_put_u64(buf, s->store.s.hashes[i])) return -1;
+            }
+            return 0;
+
+        case APPROX:
+            return hll_encode(&s->store.h, buf);
+
+        default:
+            abort();
+    }
+}
+
+/**
+ * Decodes a set, which can then be merged
+ * @arg r The reader of the encoding
+ * @arg s The set to initialize
+ * @return 0 on success, -1 on bad input.
+ */
+int set_decode(codec_reader *r, set_t *s) {
+    uint8_t type, precision;
+    if (codec_get_version(r)) return -1;
+    if (codec_get_u8(r, &type)) return -1;
+    switch (type) {
+        case EXACT: {
+            uint32_t count;
+            uint64_t hash;
+            if (codec_get_u8(r, &precision)) return -1;
+            if (codec_get_u32(r, &count) || count > SET_MAX_EXACT) return -1;
+            if (set_init(precision, s)) return -1;
+            for (uint32_t i=0; i < count; i++) {
+                if (codec_get_u64(r, &hash)) {
+                    set_destroy(s);
+                    return -1;
+                }
+                set_add_hash(s, hash);
+            }
+            return 0;
+        }
+
+        case APPROX:
+            s->type = APPROX;
+            return hll_decode(r, &s->store.h);
+
+        default:
+            return -1;
+    }
+}
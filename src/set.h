@@ -58,5 +58,30 @@ void set_add(set_t *s, char *key);
  */
 uint64_t set_size(set_t *s);
 
+/**
+ * Merges the contents of one set into another.
+ * Both sets must use the same precision.
+ * @arg into The set to merge into
+ * @arg from The set to merge from, left unchanged
+ * @return 0 on success.
+ */
+int set_merge(set_t *into, set_t *from);
+
+/**
+ * Encodes the set, as its hashes or its HLL
+ * @arg s The set to encode
+ * @arg buf The buffer to append to
+ * @return 0 on success.
+ */
+int set_encode(set_t *s, codec_buf *buf);
+
+/**
+ * Decodes a set, which can then be merged
+ * @arg r The reader of the encoding
+ * @arg s The set to initialize
+ * @return 0 on success, -1 on bad input.
+ */
+int set_decode(codec_reader *r, set_t *s);
+
 
 #endif
@@ -0,0 +1,83 @@
+#include <stdint.h>
+#include <string.h>
+#include "sort.h"
+
+// Maps a double to an integer with the same order
+static inline uint64_t double_to_key(double val) {
+    uint64_t bits;
+    memcpy(&bits, &val, sizeof(bits));
+    return (bits >> 63) ? ~bits : bits | (1ULL << 63);
+}
+
+// Maps an ordered integer back to the double
+static inline double key_to_double(uint64_t key) {
+    uint64_t bits = (key >> 63) ? key & ~(1ULL << 63) : ~key;
+    double val;
+    memcpy(&val, &bits, sizeof(val));
+    return val;
+}
+
+/**
+ * Sorts the values in place. Small buffers use an insertion
+ * sort, others a radix sort on the bits of the values, one
+ * byte at a time from the lowest. Bytes that are the same in
+ * every value are skipped, which is common for the high bytes,
+ * and values that are already sorted are left as they are.
+ * @arg vals The values to sort
+ * @arg scratch Space for as many values
+ * @arg n The number of values
+ */
+void sort_doubles(double *vals, double *scratch, uint32_t n) {
+    if (n < SORT_RADIX_MIN) {
+        for (uint32_t i=1; i < n; i++) {
+            double val = vals[i];
+            uint32_t j = i;
+            for (; j > 0 && vals[j-1] > val; j--) vals[j] = vals[j-1];
+            vals[j] = val;
+        }
+        return;
+    }
+
+    // Values often arrive in order, stop at the first that is not
+    uint32_t sorted = 1;
+    while (sorted < n && vals[sorted-1] <= vals[sorted]) sorted++;
+    if (sorted == n) return;
+
+    // Convert in place, and count every byte in one pass
+    uint64_t *keys = (uint64_t*)vals, *tmp = (uint64_t*)scratch;
+    uint32_t counts[8][256];
+    memset(counts, 0, sizeof(counts));
+    for (uint32_t i=0; i < n; i++) {
+        uint64_t key = double_to_key(vals[i]);
+        keys[i] = key;
+        for (int b=0; b < 8; b++) counts[b][(key >> (b * 8)) & 0xff]++;
+    }
+
+    for (int b=0; b < 8; b++) {
+        int shift = b * 8;
+        uint32_t *count = counts[b];
+        if (count[(keys[0] >> shift) & 0xff] == n) continue;
+
+        // Turn the counts into offsets, and scatter
+        uint32_t offset = 0;
+        for (int d=0; d < 256; d++) {
+            uint32_t c = count[d];
+            count[d] = offset;
+            offset += c;
+        }
+        for (uint32_t i=0; i < n; i++) {
+            uint64_t key = keys[i];
+            tmp[count[(key >> shift) & 0xff]++] = key;
+        }
+        uint64_t *swap = keys;
+        keys = tmp;
+        tmp = swap;
+    }
+
+    // Convert back, into the values array
+    uint64_t *out = (uint64_t*)vals;
+    for (uint32_t i=0; i < n; i++) {
+        double val = key_to_double(keys[i]);
+        memcpy(out + i, &val, sizeof(val));
+    }
+}
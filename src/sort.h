@@ -0,0 +1,18 @@
+#ifndef SORT_H
+#define SORT_H
+#include <stdint.h>
+
+// Arrays smaller than this are insertion sorted
+#define SORT_RADIX_MIN 64
+
+/**
+ * Sorts an array of doubles in place. Large arrays are
+ * radix sorted on the bits of the values, in linear time.
+ * @arg vals The values to sort
+ * @arg scratch Space for as many values, used while sorting.
+ * May be NULL for fewer than SORT_RADIX_MIN values.
+ * @arg n The number of values
+ */
+void sort_doubles(double *vals, double *scratch, uint32_t n);
+
+#endif
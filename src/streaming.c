@@ -1,9 +1,20 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <sys/wait.h>
 #include <sys/types.h>
 #include "streaming.h"
 
+// The delay before restarting a sink that died, doubled up to the max
+#define MIN_RESTART_MS 1000
+#define MAX_RESTART_MS 60000
+
 // Struct to hold the callback info
 struct callback_info {
     FILE *f;
@@ -77,17 +88,179 @@ int stream_to_command(metrics *m, void *data, stream_callback cb, char *cmd) {
     // Start iterating
     metrics_iter(m, &info, stream_cb);
 
-    // Close everything out
+    // Close everything out, this closes the pipe
     fclose(f);
-    close(filedes[1]);
 
     // Wait for termination
-    do {
-        usleep(100000);
-        if (waitpid(pid, &status, 0) < 0) break;
-    } while (!WIFEXITED(status));
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR);
 
     // Return the result of the process
     return WEXITSTATUS(status);
 }
 
+/**
+ * A sink command that is kept running between flushes
+ */
+struct stream_sink {
+    char *cmd;
+    pthread_mutex_t lock;   // Held while a batch is written
+    pid_t pid;              // The running command, 0 if none
+    FILE *f;                // The stdin of the command
+    uint64_t started_at;    // When the command was last started
+    uint64_t restart_at;    // When a command that died is restarted
+    int backoff_ms;         // The least time between two starts
+};
+
+// Returns the monotonic time in milliseconds
+static uint64_t now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Prepares a sink, the command is started by the first batch
+ * @arg cmd The command to invoke, invoked with a shell.
+ * @arg sink_out Output. The new sink
+ * @return 0 on success.
+ */
+int stream_sink_init(char *cmd, stream_sink **sink_out) {
+    stream_sink *sink = calloc(1, sizeof(stream_sink));
+    if (!sink) return -1;
+    sink->cmd = strdup(cmd);
+    pthread_mutex_init(&sink->lock, NULL);
+    sink->backoff_ms = MIN_RESTART_MS;
+    *sink_out = sink;
+    return 0;
+}
+
+// Starts the command with a pipe to its stdin
+static int start_sink(stream_sink *sink) {
+    // A start that fails counts as one, so that it is retried with a backoff
+    sink->started_at = now_ms();
+    int filedes[2];
+    if (pipe(filedes) < 0) {
+        syslog(LOG_ERR, "Failed to create sink pipe! Err: %s", strerror(errno));
+        return -1;
+    }
+
+    // The write end must not leak into other commands
+    fcntl(filedes[1], F_SETFD, FD_CLOEXEC);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        syslog(LOG_ERR, "Failed to fork sink! Err: %s", strerror(errno));
+        close(filedes[0]);
+        close(filedes[1]);
+        return -1;
+    }
+
+    // Check if we are the child
+    if (pid == 0) {
+        if (dup2(filedes[0], STDIN_FILENO) < 0) {
+            perror("Failed to initialize stdin!");
+            exit(250);
+        }
+        if (filedes[0] != STDIN_FILENO) close(filedes[0]);
+        close(filedes[1]);
+        execl("/bin/sh", "sh", "-c", sink->cmd, NULL);
+        perror("Failed to execute command!");
+        exit(255);
+    }
+
+    close(filedes[0]);
+    sink->pid = pid;
+    sink->f = fdopen(filedes[1], "w");
+    syslog(LOG_INFO, "Started sink command, pid %d", pid);
+    return 0;
+}
+
+// Closes the stdin of the command, and waits for it to exit
+static int stop_sink(stream_sink *sink) {
+    int status = 0;
+    fclose(sink->f);
+    while (waitpid(sink->pid, &status, 0) < 0 && errno == EINTR);
+    sink->pid = 0;
+    sink->f = NULL;
+    return status;
+}
+
+// Delays the next start until the backoff has passed since the last
+// one. A command that ran for longer is restarted right away, and
+// the backoff only grows while the command keeps failing.
+static void delay_restart(stream_sink *sink) {
+    sink->restart_at = sink->started_at + sink->backoff_ms;
+    uint64_t now = now_ms();
+    if (sink->restart_at > now)
+        syslog(LOG_WARNING, "Restarting sink command in %d ms", (int)(sink->restart_at - now));
+    sink->backoff_ms *= 2;
+    if (sink->backoff_ms > MAX_RESTART_MS) sink->backoff_ms = MAX_RESTART_MS;
+}
+
+// Logs how a command ended, and delays its restart
+static void sink_ended(stream_sink *sink, int status) {
+    if (WIFSIGNALED(status))
+        syslog(LOG_WARNING, "Sink command killed by signal %d", WTERMSIG(status));
+    else
+        syslog(LOG_WARNING, "Sink command exited with status %d", WEXITSTATUS(status));
+    delay_restart(sink);
+}
+
+/**
+ * Streams the metrics as a batch to the sink command
+ * @return 0 on success, -1 if the batch was dropped.
+ */
+int stream_to_sink(stream_sink *sink, metrics *m, void *data, stream_callback cb,
+        const void *end, size_t end_len) {
+    pthread_mutex_lock(&sink->lock);
+
+    // Check if the command died since the last batch
+    int status;
+    if (sink->pid && waitpid(sink->pid, &status, WNOHANG) == sink->pid) {
+        fclose(sink->f);
+        sink->pid = 0;
+        sink->f = NULL;
+        sink_ended(sink, status);
+    }
+
+    // Start the command, unless it is backing off
+    if (!sink->pid && now_ms() >= sink->restart_at && start_sink(sink))
+        delay_restart(sink);
+    if (!sink->pid) {
+        syslog(LOG_WARNING, "Sink command is not running, dropping a batch!");
+        pthread_mutex_unlock(&sink->lock);
+        return -1;
+    }
+
+    // Write the batch and its end, and push it to the command
+    struct callback_info info = {sink->f, data, cb};
+    int res = metrics_iter(m, &info, stream_cb);
+    if (!res && end_len && !fwrite(end, end_len, 1, sink->f)) res = -1;
+    if (fflush(sink->f)) res = -1;
+
+    // A command that stopped reading is replaced
+    if (res) {
+        kill(sink->pid, SIGTERM);
+        sink_ended(sink, stop_sink(sink));
+        res = -1;
+    } else {
+        sink->backoff_ms = MIN_RESTART_MS;
+    }
+    pthread_mutex_unlock(&sink->lock);
+    return res;
+}
+
+/**
+ * Stops the sink command, letting it handle what
+ * it has read, and frees the sink.
+ * @return The exit status of the command.
+ */
+int stream_sink_destroy(stream_sink *sink) {
+    int status = 0;
+    if (sink->pid) status = stop_sink(sink);
+    pthread_mutex_destroy(&sink->lock);
+    free(sink->cmd);
+    free(sink);
+    return WEXITSTATUS(status);
+}
+
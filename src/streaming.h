@@ -20,5 +20,43 @@ typedef int(*stream_callback)(FILE *pipe, void *data, metric_type type, char *na
  */
 int stream_to_command(metrics *m, void *data, stream_callback cb, char *cmd);
 
+/**
+ * A sink command that is spawned once, and kept running
+ * to receive the metrics of every flush on its stdin.
+ */
+typedef struct stream_sink stream_sink;
+
+/**
+ * Prepares a sink, the command is started by the first batch
+ * @arg cmd The command to invoke, invoked with a shell.
+ * @arg sink_out Output. The new sink
+ * @return 0 on success.
+ */
+int stream_sink_init(char *cmd, stream_sink **sink_out);
+
+/**
+ * Streams the metrics stored in a metrics object to the
+ * sink command as a batch, followed by an end marker.
+ * Batches are written one at a time. If the command has
+ * died, it is restarted, after a backoff if it keeps dying.
+ * @arg sink The sink
+ * @arg m The metrics object to stream
+ * @arg data An opaque handle passed to the callback
+ * @arg cb The callback to invoke
+ * @arg end The marker written after the batch
+ * @arg end_len The length of the marker
+ * @return 0 on success, -1 if the batch was dropped.
+ */
+int stream_to_sink(stream_sink *sink, metrics *m, void *data, stream_callback cb,
+        const void *end, size_t end_len);
+
+/**
+ * Stops the sink command, letting it handle what
+ * it has read, and frees the sink.
+ * @arg sink The sink to destroy
+ * @return The exit status of the command.
+ */
+int stream_sink_destroy(stream_sink *sink);
+
 #endif
 
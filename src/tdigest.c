@@ -0,0 +1,298 @@
+/**
+ * This module implements the merging t-digest from
+ * "Computing Extremely Accurate Quantiles Using t-Digests"
+ * by Dunning and Ertl.
+ *
+ * New values are buffered, sorted, and merged with the sorted
+ * centroids in a single pass. The pass combines neighbouring
+ * values into a centroid while its quantile range stays within
+ * one unit of the k1 scale function, which is what bounds the
+ * size and error of the centroids.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "tdigest.h"
+#include "sort.h"
+
+/**
+ * The number of values buffered before they are merged.
+ * The buffer starts small, so that digests with few values
+ * stay cheap, and doubles up to this size.
+ */
+#define TD_BUFFER_SIZE 512
+#define TD_MIN_BUFFER_SIZE 16
+
+/* Static declarations */
+static void td_merge_sorted(tdigest *td, const double *vals, const td_centroid *others, uint32_t n, double weight);
+
+/**
+ * Initializes the t-digest
+ * @arg compression The compression, around 1 / the error.
+ * @arg td The tdigest to initialize
+ * @return 0 on success.
+ */
+int init_tdigest(double compression, tdigest *td) {
+    if (compression < 10) return -1;
+    td->compression = compression;
+    td->centroids = NULL;
+    td->scratch = NULL;
+    td->num_centroids = 0;
+    td->size = 0;
+    td->buffer = NULL;
+    td->num_buffered = 0;
+    td->buffer_size = 0;
+    td->total_weight = 0;
+    td->min = INFINITY;
+    td->max = -INFINITY;
+    return 0;
+}
+
+/**
+ * Destroy the t-digest
+ * @return 0 on success.
+ */
+int destroy_tdigest(tdigest *td) {
+    free(td->centroids);
+    free(td->scratch);
+    free(td->buffer);
+    return 0;
+}
+
+/**
+ * Adds a new value to the digest
+ * @return 0 on success.
+ */
+int td_add_sample(tdigest *td, double value) {
+    if (td->num_buffered == td->buffer_size) {
+        // Merge a full buffer, or grow a small one
+        if (td->buffer_size == TD_BUFFER_SIZE) {
+            td_flush(td);
+        } else {
+            // The second half is scratch space for sorting
+            uint32_t size = (td->buffer_size) ? td->buffer_size * 2 : TD_MIN_BUFFER_SIZE;
+            double *buffer = realloc(td->buffer, 2 * size * sizeof(double));
+            if (!buffer) return -1;
+            td->buffer = buffer;
+            td->buffer_size = size;
+        }
+    }
+    td->buffer[td->num_buffered++] = value;
+    if (value < td->min) td->min = value;
+    if (value > td->max) td->max = value;
+    return 0;
+}
+
+/**
+ * Merges any buffered values into the centroids
+ * @return 0 on success.
+ */
+int td_flush(tdigest *td) {
+    uint32_t n = td->num_buffered;
+    if (!n) return 0;
+    sort_doubles(td->buffer, td->buffer + td->buffer_size, n);
+    td_merge_sorted(td, td->buffer, NULL, n, n);
+    td->num_buffered = 0;
+    return 0;
+}
+
+/**
+ * Interpolates the value at a rank, between the
+ * centers of the centroids around it.
+ */
+static double td_interpolate(tdigest *td, double index) {
+    td_centroid *c = td->centroids;
+    uint32_t n = td->num_centroids;
+
+    // Before the center of the first centroid
+    double center = c[0].weight / 2;
+    if (index < center) {
+        return td->min + (c[0].mean - td->min) * index / center;
+    }
+
+    // Between the centers of two centroids
+    for (uint32_t i=0; i < n - 1; i++) {
+        double dw = (c[i].weight + c[i+1].weight) / 2;
+        if (center + dw > index) {
+            return c[i].mean + (c[i+1].mean - c[i].mean) * (index - center) / dw;
+        }
+        center += dw;
+    }
+
+    // After the center of the last centroid
+    double half = c[n-1].weight / 2;
+    return c[n-1].mean + (td->max - c[n-1].mean) * (index - center) / half;
+}
+
+/**
+ * Queries for a quantile value
+ * @return The value on success or 0.
+ */
+double td_query(tdigest *td, double quantile) {
+    td_flush(td);
+    if (!td->num_centroids) return 0;
+    if (td->num_centroids == 1) return td->centroids[0].mean;
+
+    double result = td_interpolate(td, quantile * td->total_weight);
+    if (result < td->min) return td->min;
+    if (result > td->max) return td->max;
+    return result;
+}
+
+/**
+ * Merges one digest into another, leaving the source empty.
+ * @return 0 on success.
+ */
+int td_merge(tdigest *into, tdigest *from) {
+    td_flush(into);
+    td_flush(from);
+    if (!from->num_centroids) return 0;
+
+    td_merge_sorted(into, NULL, from->centroids, from->num_centroids, from->total_weight);
+    if (from->min < into->min) into->min = from->min;
+    if (from->max > into->max) into->max = from->max;
+
+    // The source keeps its arrays, but no values
+    from->num_centroids = 0;
+    from->total_weight = 0;
+    from->min = INFINITY;
+    from->max = -INFINITY;
+    return 0;
+}
+
+// Reads the centroids, which must be sorted and have a weight
+static int td_decode_centroids(codec_reader *r, tdigest *td, uint32_t n) {
+    td->centroids = malloc(n * sizeof(td_centroid));
+    td->scratch = malloc(n * sizeof(td_centroid));
+    if (!td->centroids || !td->scratch) return -1;
+    td->size = n;
+
+    for (uint32_t i=0; i < n; i++) {
+        td_centroid *c = td->centroids + i;
+        if (codec_get_double(r, &c->mean)) return -1;
+        if (codec_get_double(r, &c->weight)) return -1;
+        if (!(c->weight > 0) || (i && c->mean < c[-1].mean)) return -1;
+        td->total_weight += c->weight;
+    }
+    td->num_centroids = n;
+    return 0;
+}
+
+/**
+ * Encodes the centroids, after flushing the buffer
+ * @return 0 on success.
+ */
+int td_encode(tdigest *td, codec_buf *buf) {
+    td_flush(td);
+    if (codec_put_double(buf, td->compression)) return -1;
+    if (codec_put_double(buf, td->min)) return -1;
+    if (codec_put_double(buf, td->max)) return -1;
+    if (codec_put_varint(buf, td->num_centroids)) return -1;
+    for (uint32_t i=0; i < td->num_centroids; i++) {
+        if (codec_put_double(buf, td->centroids[i].mean)) return -1;
+        if (codec_put_double(buf, td->centroids[i].weight)) return -1;
+    }
+    return 0;
+}
+
+/**
+ * Decodes a digest, which can then be merged
+ * @return 0 on success, -1 on bad input.
+ */
+int td_decode(codec_reader *r, tdigest *td) {
+    double compression, min, max;
+    uint32_t n;
+    if (codec_get_double(r, &compression)) return -1;
+    if (codec_get_double(r, &min)) return -1;
+    if (codec_get_double(r, &max)) return -1;
+    if (codec_get_u32(r, &n)) return -1;
+    if (codec_check_count(r, n, 2 * sizeof(double))) return -1;
+    if (!isfinite(compression) || init_tdigest(compression, td)) return -1;
+    if (!n) return 0;
+
+    if (td_decode_centroids(r, td, n)) {
+        destroy_tdigest(td);
+        return -1;
+    }
+    td->min = min;
+    td->max = max;
+    return 0;
+}
+
+/**
+ * Returns the highest quantile a centroid starting at q0 may
+ * reach, one unit further along the k1 scale function:
+ * k(q) = compression / (2 pi) * asin(2q - 1)
+ */
+static double td_q_limit(tdigest *td, double q0) {
+    double k = td->compression / (2 * M_PI) * asin(2 * q0 - 1) + 1;
+    double angle = k * 2 * M_PI / td->compression;
+    if (angle >= M_PI / 2) return 1;
+    return (sin(angle) + 1) / 2;
+}
+
+/**
+ * Merges sorted values, or sorted centroids, with the
+ * centroids in one pass, compressing them as they go.
+ * @arg vals Sorted values of weight 1, or NULL
+ * @arg others Sorted centroids, if vals is NULL
+ * @arg n The number of values or centroids
+ * @arg weight Their total weight
+ */
+static void td_merge_sorted(tdigest *td, const double *vals, const td_centroid *others, uint32_t n, double weight) {
+    // Make room for every input in the output
+    uint32_t needed = td->num_centroids + n;
+    if (needed > td->size) {
+        uint32_t size = (td->size) ? td->size : 64;
+        while (size < needed) size *= 2;
+        td_centroid *centroids = realloc(td->centroids, size * sizeof(td_centroid));
+        if (!centroids) return;
+        td->centroids = centroids;
+        td_centroid *scratch = realloc(td->scratch, size * sizeof(td_centroid));
+        if (!scratch) return;
+        td->scratch = scratch;
+        td->size = size;
+    }
+
+    double total = td->total_weight + weight;
+    td_centroid *in = td->centroids, *out = td->scratch;
+    uint32_t i = 0, j = 0, num_out = 0;
+    double so_far = 0;
+    double limit = total * td_q_limit(td, 0);
+    td_centroid cur, next;
+    int have_cur = 0;
+    while (i < td->num_centroids || j < n) {
+        // Take the input with the lower mean
+        double other_mean = 0;
+        if (j < n) other_mean = (vals) ? vals[j] : others[j].mean;
+        if (i < td->num_centroids && (j == n || in[i].mean <= other_mean)) {
+            next = in[i++];
+        } else {
+            next.mean = other_mean;
+            next.weight = (vals) ? 1 : others[j].weight;
+            j++;
+        }
+
+        if (!have_cur) {
+            cur = next;
+            have_cur = 1;
+        } else if (so_far + cur.weight + next.weight <= limit) {
+            // Combine into the current centroid
+            cur.weight += next.weight;
+            cur.mean += (next.mean - cur.mean) * next.weight / cur.weight;
+        } else {
+            // Close the current centroid
+            so_far += cur.weight;
+            out[num_out++] = cur;
+            limit = total * td_q_limit(td, so_far / total);
+            cur = next;
+        }
+    }
+    if (have_cur) out[num_out++] = cur;
+
+    td->scratch = td->centroids;
+    td->centroids = out;
+    td->num_centroids = num_out;
+    td->total_weight = total;
+}
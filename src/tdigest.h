@@ -0,0 +1,99 @@
+/**
+ * This module implements the merging t-digest from
+ * "Computing Extremely Accurate Quantiles Using t-Digests"
+ * by Dunning and Ertl. Values are summarized as centroids,
+ * which are small near the tails so that extreme quantiles
+ * stay accurate, and memory is bounded by the compression.
+ */
+#ifndef TDIGEST_H
+#define TDIGEST_H
+#include <stdint.h>
+#include "codec.h"
+
+typedef struct {
+    double mean;        // The mean of the values
+    double weight;      // The number of values
+} td_centroid;
+
+typedef struct {
+    double compression;     // Bounds the number of centroids
+
+    td_centroid *centroids; // Sorted array of centroids
+    td_centroid *scratch;   // Space to merge the centroids into
+    uint32_t num_centroids; // Number of centroids
+    uint32_t size;          // Size of both centroid arrays
+
+    double *buffer;         // Values not yet merged into the centroids
+    uint32_t num_buffered;  // Number of buffered values
+    uint32_t buffer_size;   // Size of the buffer
+
+    double total_weight;    // Weight of the centroids
+    double min;             // The smallest value
+    double max;             // The largest value
+} tdigest;
+
+/**
+ * Initializes the t-digest
+ * @arg compression The compression, around 1 / the error.
+ * Must be at least 10.
+ * @arg td The tdigest to initialize
+ * @return 0 on success.
+ */
+int init_tdigest(double compression, tdigest *td);
+
+/**
+ * Destroy the t-digest
+ * @arg td The tdigest to destroy
+ * @return 0 on success.
+ */
+int destroy_tdigest(tdigest *td);
+
+/**
+ * Adds a new value to the digest
+ * @arg td The tdigest to add to
+ * @arg value The new value
+ * @return 0 on success.
+ */
+int td_add_sample(tdigest *td, double value);
+
+/**
+ * Merges any buffered values into the centroids
+ * @arg td The tdigest to flush
+ * @return 0 on success.
+ */
+int td_flush(tdigest *td);
+
+/**
+ * Queries for a quantile value. Any buffered
+ * values are merged first.
+ * @arg td The tdigest to query
+ * @arg quantile The quantile to query
+ * @return The value on success or 0.
+ */
+double td_query(tdigest *td, double quantile);
+
+/**
+ * Merges one digest into another, leaving the source empty.
+ * @arg into The tdigest to merge into
+ * @arg from The tdigest to merge from
+ * @return 0 on success.
+ */
+int td_merge(tdigest *into, tdigest *from);
+
+/**
+ * Encodes the centroids, after flushing the buffer
+ * @arg td The tdigest to encode
+ * @arg buf The buffer to append to
+ * @return 0 on success.
+ */
+int td_encode(tdigest *td, codec_buf *buf);
+
+/**
+ * Decodes a digest, which can then be merged
+ * @arg r The reader of the encoding
+ * @arg td The tdigest to initialize
+ * @return 0 on success, -1 on bad input.
+ */
+int td_decode(codec_reader *r, tdigest *td);
+
+#endif
@@ -1,8 +1,20 @@
 #include <math.h>
+#include <stdlib.h>
+#include <string.h>
 #include "timer.h"
+#include "sort.h"
 
 /* Static declarations */
 static void finalize_timer(timer *timer);
+static int convert_exact_to_approx(timer *timer);
+static int add_value(timer *timer, double value);
+static double* alloc_values(timer *timer, uint32_t size);
+static void free_values(timer *timer, double *values, uint32_t size);
+
+// Returns the values of an exact timer
+static inline double* exact_values(exact_timer *e) {
+    return (e->size > TIMER_INLINE_EXACT) ? e->v.values : e->v.small;
+}
 
 /**
  * Initializes the timer struct
@@ -13,13 +25,107 @@ static void finalize_timer(timer *timer);
  * @return 0 on success.
  */
 int init_timer(double eps, double *quantiles, uint32_t num_quants, timer *timer) {
+    return init_timer_with_engine(QUANTILE_CM, eps, quantiles, num_quants, timer);
+}
+
+/**
+ * Initializes the timer struct with a quantile engine
+ * @arg engine The quantile engine to use past TIMER_MAX_EXACT values
+ * @arg eps The maximum error for the quantiles
+ * @arg quantiles A sorted array of double quantile values, must be on (0, 1)
+ * @arg num_quants The number of entries in the quantiles array
+ * @arg timer The timer struct to initialize
+ * @return 0 on success.
+ */
+int init_timer_with_engine(quantile_engine engine, double eps, double *quantiles, uint32_t num_quants, timer *timer) {
+    // Check the settings now, the engine is only created later
+    if (eps <= 0 || eps >= 0.5) return -1;
+    for (int i=0; i < num_quants; i++) {
+        if (quantiles[i] <= 0 || quantiles[i] >= 1) return -1;
+    }
+
     timer->actual_count = 0;
     timer->count = 0;
     timer->sum = 0;
     timer->squared_sum = 0;
+    timer->min = 0;
+    timer->max = 0;
     timer->finalized = 1;
-    int res = init_cm_quantile(eps, quantiles, num_quants, &timer->cm);
-    return res;
+    timer->engine = engine;
+    timer->eps = eps;
+    timer->quantiles = quantiles;
+    timer->num_quants = num_quants;
+    timer->pool = NULL;
+
+    // Start with the values kept inline
+    timer->type = TIMER_EXACT;
+    timer->store.e.count = 0;
+    timer->store.e.size = TIMER_INLINE_EXACT;
+    return 0;
+}
+
+/**
+ * Allocates the exact values of a timer from a pool.
+ * @arg timer The timer
+ * @arg pool The pool to use
+ */
+void timer_use_pool(timer *timer, timer_pool *pool) {
+    timer->pool = pool;
+}
+
+/**
+ * Initializes a pool of value arrays
+ * @arg mem The arena to allocate from
+ * @arg pool The pool to initialize
+ */
+void timer_pool_init(arena *mem, timer_pool *pool) {
+    pool->mem = mem;
+    timer_pool_clear(pool);
+}
+
+/**
+ * Empties the free lists of a pool
+ * @arg pool The pool to clear
+ */
+void timer_pool_clear(timer_pool *pool) {
+    for (int i=0; i < TIMER_POOL_SIZES; i++) {
+        pool->free[i] = NULL;
+    }
+}
+
+// Returns the free list of an array size
+static inline int pool_index(uint32_t size) {
+    return __builtin_ctz(size / (2 * TIMER_INLINE_EXACT));
+}
+
+/**
+ * Allocates an array for a number of exact values,
+ * and as many again as scratch space for sorting.
+ */
+static double* alloc_values(timer *timer, uint32_t size) {
+    timer_pool *pool = timer->pool;
+    if (!pool) return malloc(2 * size * sizeof(double));
+
+    // Reuse an array of this size, linked through its first bytes
+    void **head = &pool->free[pool_index(size)];
+    if (*head) {
+        void *values = *head;
+        *head = *(void**)values;
+        return values;
+    }
+    return arena_alloc(pool->mem, 2 * size * sizeof(double));
+}
+
+// Returns an array of exact values to the pool
+static void free_values(timer *timer, double *values, uint32_t size) {
+    timer_pool *pool = timer->pool;
+    if (!pool) {
+        free(values);
+        return;
+    }
+    void **head = &pool->free[pool_index(size)];
+    *(void**)values = *head;
+    *head = values;
 }
 
 /**
@@ -28,7 +134,16 @@ int init_timer(double eps, double *quantiles, uint32_t num_quants, timer *timer)
  * @return 0 on success.
  */
 int destroy_timer(timer *timer) {
-    return destroy_cm_quantile(&timer->cm);
+    switch (timer->type) {
+        case TIMER_EXACT:
+            if (timer->store.e.size > TIMER_INLINE_EXACT)
+                free_values(timer, timer->store.e.v.values, timer->store.e.size);
+            return 0;
+
+        case TIMER_APPROX:
+            return destroy_quantile(&timer->store.q);
+    }
+    return 0;
 }
 
 /**
@@ -39,12 +154,14 @@ int destroy_timer(timer *timer) {
  * @return 0 on success.
  */
 int timer_add_sample(timer *timer, double sample, double sample_rate) {
+    if (!timer->actual_count || sample < timer->min) timer->min = sample;
+    if (!timer->actual_count || sample > timer->max) timer->max = sample;
     timer->actual_count += 1;
     timer->count += (1 / sample_rate);
     timer->sum += sample;
     timer->squared_sum += pow(sample, 2);
     timer->finalized = 0;
-    return cm_add_sample(&timer->cm, sample);
+    return add_value(timer, sample);
 }
 
 /**
@@ -55,7 +172,16 @@ int timer_add_sample(timer *timer, double sample, double sample_rate) {
  */
 double timer_query(timer *timer, double quantile) {
     finalize_timer(timer);
-    return cm_query(&timer->cm, quantile);
+    if (timer->type == TIMER_APPROX)
+        return quantile_query(&timer->store.q, quantile);
+
+    // The nearest rank of the sorted values
+    exact_timer *e = &timer->store.e;
+    if (!e->count) return 0;
+    uint32_t rank = ceil(quantile * e->count);
+    if (rank > 0) rank--;
+    if (rank >= e->count) rank = e->count - 1;
+    return exact_values(e)[rank];
 }
 
 /**
@@ -73,9 +199,7 @@ uint64_t timer_count(timer *timer) {
  * @return The number of samples
  */
 double timer_min(timer *timer) {
-    finalize_timer(timer);
-    if (!timer->cm.samples) return 0;
-    return timer->cm.samples->value;
+    return timer->min;
 }
 
 /**
@@ -123,18 +247,193 @@ double timer_squared_sum(timer *timer) {
  * @return The maximum value
  */
 double timer_max(timer *timer) {
-    finalize_timer(timer);
-    if (!timer->cm.end) return 0;
-    return timer->cm.end->value;
+    return timer->max;
+}
+
+/**
+ * Merges the samples of one timer into another.
+ * The quantile samples of from are moved into the target.
+ * @arg into The timer to merge into
+ * @arg from The timer to merge from
+ * @return 0 on success.
+ */
+int timer_merge(timer *into, timer *from) {
+    // Check the summary can be combined before anything is added
+    if (from->type == TIMER_APPROX &&
+            !quantile_mergeable(&from->store.q, into->engine, into->eps)) return -1;
+
+    if (from->actual_count) {
+        if (!into->actual_count || from->min < into->min) into->min = from->min;
+        if (!into->actual_count || from->max > into->max) into->max = from->max;
+    }
+    into->actual_count += from->actual_count;
+    into->count += from->count;
+    into->sum += from->sum;
+    into->squared_sum += from->squared_sum;
+
+    int res = 0;
+    if (from->type == TIMER_EXACT) {
+        // Add the values, which may switch the target to its engine
+        exact_timer *e = &from->store.e;
+        double *values = exact_values(e);
+        for (uint32_t i=0; i < e->count && !res; i++) {
+            res = add_value(into, values[i]);
+        }
+        e->count = 0;
+    } else {
+        if (into->type == TIMER_EXACT) res = convert_exact_to_approx(into);
+        if (!res) res = quantile_merge(&into->store.q, &from->store.q);
+    }
+
+    from->min = 0;
+    from->max = 0;
+    into->finalized = 0;
+    from->finalized = 1;
+    return res;
+}
+
+/**
+ * Encodes the timer
+ * @arg timer The timer to encode
+ * @arg buf The buffer to append to
+ * @return 0 on success.
+ */
+int timer_encode(timer *timer, codec_buf *buf) {
+    if (codec_put_version(buf)) return -1;
+    if (codec_put_varint(buf, timer->actual_count)) return -1;
+    if (codec_put_varint(buf, timer->count)) return -1;
+    if (codec_put_double(buf, timer->sum)) return -1;
+    if (codec_put_double(buf, timer->squared_sum)) return -1;
+    if (codec_put_double(buf, timer->min)) return -1;
+    if (codec_put_double(buf, timer->max)) return -1;
+    if (codec_put_u8(buf, timer->type)) return -1;
+    if (timer->type == TIMER_APPROX)
+        return quantile_encode(&timer->store.q, buf);
+
+    exact_timer *e = &timer->store.e;
+    double *values = exact_values(e);
+    if (codec_put_varint(buf, e->count)) return -1;
+    for (uint32_t i=0; i < e->count; i++) {
+        if (codec_put_double(buf, values[i])) return -1;
+    }
+    return 0;
+}
+
+/**
+ * Decodes a timer into a new one
+ * @arg r The reader of the encoding
+ * @arg timer The timer to decode into
+ * @return 0 on success, -1 on bad input.
+ */
+int timer_decode(codec_reader *r, timer *timer) {
+    uint8_t type;
+    if (codec_get_version(r)) return -1;
+    if (codec_get_varint(r, &timer->actual_count)) return -1;
+    if (codec_get_varint(r, &timer->count)) return -1;
+    if (codec_get_double(r, &timer->sum)) return -1;
+    if (codec_get_double(r, &timer->squared_sum)) return -1;
+    if (codec_get_double(r, &timer->min)) return -1;
+    if (codec_get_double(r, &timer->max)) return -1;
+    if (codec_get_u8(r, &type)) return -1;
+    timer->finalized = 0;
+
+    switch (type) {
+        case TIMER_EXACT: {
+            uint32_t count;
+            double value;
+            if (codec_get_u32(r, &count) || count > TIMER_MAX_EXACT) return -1;
+            for (uint32_t i=0; i < count; i++) {
+                if (codec_get_double(r, &value)) return -1;
+                if (add_value(timer, value)) return -1;
+            }
+            return 0;
+        }
+
+        case TIMER_APPROX: {
+            // Decode aside, so a failure leaves the timer exact
+            quantile q;
+            if (quantile_decode(r, timer->quantiles, timer->num_quants, &q)) return -1;
+            timer->type = TIMER_APPROX;
+            timer->store.q = q;
+            return 0;
+        }
+
+        default:
+            return -1;
+    }
+}
+
+/**
+ * Adds a value to the exact values, or to the quantile.
+ * Exact values are kept inline, then in an array that
+ * doubles in size, until there are too many of them.
+ */
+static int add_value(timer *timer, double value) {
+    if (timer->type == TIMER_APPROX)
+        return quantile_add_sample(&timer->store.q, value);
+
+    exact_timer *e = &timer->store.e;
+    if (e->count == e->size) {
+        // Past the limit, switch to the quantile engine
+        if (e->size == TIMER_MAX_EXACT) {
+            if (convert_exact_to_approx(timer)) return -1;
+            return quantile_add_sample(&timer->store.q, value);
+        }
+
+        // Move to a larger array, with room to sort
+        uint32_t size = e->size * 2;
+        double *values = alloc_values(timer, size);
+        if (!values) return -1;
+        memcpy(values, exact_values(e), e->count * sizeof(double));
+        if (e->size > TIMER_INLINE_EXACT) free_values(timer, e->v.values, e->size);
+        e->v.values = values;
+        e->size = size;
+    }
+    exact_values(e)[e->count++] = value;
+    return 0;
+}
+
+/**
+ * Converts an exact timer to use its quantile engine.
+ */
+static int convert_exact_to_approx(timer *timer) {
+    // Copy the values out, as the quantile
+    // will step on the union
+    exact_timer e = timer->store.e;
+    double *values = exact_values(&e);
+
+    int res = init_quantile(timer->engine, timer->eps, timer->quantiles,
+            timer->num_quants, &timer->store.q);
+    if (res) {
+        timer->store.e = e;
+        return res;
+    }
+    timer->type = TIMER_APPROX;
+
+    for (uint32_t i=0; i < e.count && !res; i++) {
+        res = quantile_add_sample(&timer->store.q, values[i]);
+    }
+
+    // Free the array of values
+    if (e.size > TIMER_INLINE_EXACT) free_values(timer, e.v.values, e.size);
+    return res;
 }
 
 // Finalizes the timer for queries
 static void finalize_timer(timer *timer) {
     if (timer->finalized) return;
 
-    // Force the quantile to flush internal
-    // buffers so that queries are accurate.
-    cm_flush(&timer->cm);
+    if (timer->type == TIMER_EXACT) {
+        // Sort the values for the queries, small
+        // arrays are sorted without scratch space
+        exact_timer *e = &timer->store.e;
+        double *values = exact_values(e);
+        sort_doubles(values, (e->size > TIMER_INLINE_EXACT) ? values + e->size : NULL, e->count);
+    } else {
+        // Force the quantile to flush internal
+        // buffers so that queries are accurate.
+        quantile_flush(&timer->store.q);
+    }
 
     timer->finalized = 1;
 }
@@ -1,27 +1,119 @@
 #ifndef TIMER_H
 #define TIMER_H
 #include <stdint.h>
-#include "cm_quantile.h"
+#include "quantile.h"
+#include "arena.h"
+
+/**
+ * This is the maximum number of values we keep
+ * exactly before switching to a quantile engine
+ */
+#define TIMER_MAX_EXACT 128
+
+/**
+ * The number of values kept inside the timer,
+ * before an array is allocated for them
+ */
+#define TIMER_INLINE_EXACT 8
+
+// Number of array sizes, from 2 * TIMER_INLINE_EXACT to TIMER_MAX_EXACT
+#define TIMER_POOL_SIZES 4
+
+/**
+ * Allocates the value arrays of exact timers from an arena,
+ * so they are released at once with it. Arrays that a timer
+ * has outgrown are kept on a free list per size, and given
+ * to the next timer that needs that size.
+ */
+typedef struct {
+    arena *mem;                     // The arena arrays are carved from
+    void *free[TIMER_POOL_SIZES];   // Free arrays of each size
+} timer_pool;
+
+typedef enum {
+    TIMER_EXACT,    // Every value is kept, used for few values
+    TIMER_APPROX    // Values are summarized by a quantile engine
+} timer_type;
+
+typedef struct {
+    uint32_t count;     // Number of values
+    uint32_t size;      // Capacity, values are inline up to TIMER_INLINE_EXACT
+    union {
+        double small[TIMER_INLINE_EXACT];
+        double *values; // Twice the size, the second half is scratch for sorting
+    } v;
+} exact_timer;
 
 typedef struct {
     uint64_t actual_count; // Actual items recieved
     uint64_t count;     // Count of items (1 / sample rate)
     double sum;         // Sum of the values
     double squared_sum; // Sum of the squared values
-    int finalized;      // Is the cm_quantile finalized
-    cm_quantile cm;     // Quantile we use
+    double min;         // The smallest value
+    double max;         // The largest value
+    int finalized;      // Is the quantile finalized
+
+    // Used to initialize the quantile engine
+    quantile_engine engine;
+    double eps;
+    double *quantiles;  // Not owned, must outlive the timer
+    uint32_t num_quants;
+    timer_pool *pool;   // Allocates the exact values, or NULL for malloc
+
+    timer_type type;
+    union {
+        exact_timer e;
+        quantile q;     // Quantile we use
+    } store;
 } timer;
 
 /**
- * Initializes the timer struct
+ * Initializes the timer struct. The timer keeps its values
+ * exactly, until it has more than TIMER_MAX_EXACT of them.
  * @arg eps The maximum error for the quantiles
- * @arg quantiles A sorted array of double quantile values, must be on (0, 1)
+ * @arg quantiles A sorted array of double quantile values, must be on (0, 1).
+ * This is not copied, and must exist for the life of the timer.
  * @arg num_quants The number of entries in the quantiles array
  * @arg timeer The timer struct to initialize
  * @return 0 on success.
  */
 int init_timer(double eps, double *quantiles, uint32_t num_quants, timer *timer);
 
+/**
+ * Initializes the timer struct with a quantile engine
+ * @arg engine The quantile engine to use past TIMER_MAX_EXACT values
+ * @arg eps The maximum error for the quantiles
+ * @arg quantiles A sorted array of double quantile values, must be on (0, 1)
+ * @arg num_quants The number of entries in the quantiles array
+ * @arg timer The timer struct to initialize
+ * @return 0 on success.
+ */
+int init_timer_with_engine(quantile_engine engine, double eps, double *quantiles, uint32_t num_quants, timer *timer);
+
+/**
+ * Allocates the exact values of a timer from a pool. This
+ * must be set before any values are added, and the pool
+ * must exist for the life of the timer.
+ * @arg timer The timer
+ * @arg pool The pool to use
+ */
+void timer_use_pool(timer *timer, timer_pool *pool);
+
+/**
+ * Initializes a pool of value arrays. No memory is
+ * allocated until a timer needs an array.
+ * @arg mem The arena to allocate from
+ * @arg pool The pool to initialize
+ */
+void timer_pool_init(arena *mem, timer_pool *pool);
+
+/**
+ * Empties the free lists of a pool. This must be called
+ * whenever its arena is reset, or its memory moved away.
+ * @arg pool The pool to clear
+ */
+void timer_pool_clear(timer_pool *pool);
+
 /**
  * Destroy the timer struct.
  * @arg timer The timer to destroy
@@ -94,4 +186,33 @@ double timer_squared_sum(timer *timer);
  */
 double timer_max(timer *timer);
 
+/**
+ * Merges the samples of one timer into another.
+ * The quantile samples of from are moved into the target.
+ * @arg into The timer to merge into
+ * @arg from The timer to merge from
+ * @return 0 on success.
+ */
+int timer_merge(timer *into, timer *from);
+
+/**
+ * Encodes the timer, with its exact values or
+ * the summary of its quantile engine.
+ * @arg timer The timer to encode
+ * @arg buf The buffer to append to
+ * @return 0 on success.
+ */
+int timer_encode(timer *timer, codec_buf *buf);
+
+/**
+ * Decodes a timer, which can then be merged into one
+ * with the same settings. A summary keeps the engine
+ * and error it was encoded with.
+ * @arg r The reader of the encoding
+ * @arg timer A new timer, initialized with the local settings.
+ * It must be destroyed by the caller, even on failure.
+ * @return 0 on success, -1 on bad input.
+ */
+int timer_decode(codec_reader *r, timer *timer);
+
 #endif
@@ -0,0 +1,374 @@
+#include "uring.h"
+
+#ifdef HAVE_IO_URING
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <syslog.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+// Memory ordering of the ring indexes shared with the kernel
+#define load_acquire(p)         __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define store_release(p, v)     __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+/**
+ * A ring of buffers provided to the kernel
+ */
+struct uring_buf_group {
+    int group_id;
+    int count;
+    int size;       // Size handed to the kernel
+    int stride;     // Size plus the spare byte
+    char *buffers;
+    struct io_uring_buf_ring *ring;
+    struct uring_buf_group *next;
+};
+
+struct statsite_uring {
+    int fd;
+
+    // Submission queue
+    void *sq_map;
+    size_t sq_map_len;
+    unsigned *sq_khead;
+    unsigned *sq_ktail;
+    unsigned *sq_kflags;
+    unsigned *sq_array;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned sq_tail;       // Local tail, published on submit
+    unsigned sq_submitted;
+    struct io_uring_sqe *sqes;
+    size_t sqes_len;
+
+    // Completion queue
+    void *cq_map;
+    size_t cq_map_len;
+    unsigned *cq_khead;
+    unsigned *cq_ktail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+
+    uring_buf_group *groups;
+};
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p) {
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/**
+ * Creates a new ring.
+ * @arg entries The size of the submission queue
+ * @arg ring_out Output. The new ring
+ * @return 0 on success, -1 if io_uring is not supported.
+ */
+int uring_init(unsigned entries, statsite_uring **ring_out) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+
+    // Multishot requests produce many completions per
+    // submission, so use a larger completion queue
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = entries * 16;
+
+    int fd = sys_io_uring_setup(entries, &p);
+    if (fd < 0) {
+        syslog(LOG_WARNING, "Failed to setup io_uring! Err: %s", strerror(errno));
+        return -1;
+    }
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_NODROP)) {
+        syslog(LOG_WARNING, "Kernel io_uring is missing required features");
+        close(fd);
+        return -1;
+    }
+
+    statsite_uring *ring = calloc(1, sizeof(statsite_uring));
+    ring->fd = fd;
+
+    // The submission and completion rings share a mapping
+    ring->sq_map_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (cq_len > ring->sq_map_len) ring->sq_map_len = cq_len;
+    ring->sq_map = mmap(NULL, ring->sq_map_len, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ring->sq_map == MAP_FAILED) {
+        syslog(LOG_ERR, "Failed to map io_uring queues! Err: %s", strerror(errno));
+        close(fd);
+        free(ring);
+        return -1;
+    }
+    ring->cq_map = ring->sq_map;
+    ring->cq_map_len = ring->sq_map_len;
+
+    ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        syslog(LOG_ERR, "Failed to map io_uring entries! Err: %s", strerror(errno));
+        munmap(ring->sq_map, ring->sq_map_len);
+        close(fd);
+        free(ring);
+        return -1;
+    }
+
+    char *sq = ring->sq_map;
+    ring->sq_khead = (unsigned*)(sq + p.sq_off.head);
+    ring->sq_ktail = (unsigned*)(sq + p.sq_off.tail);
+    ring->sq_kflags = (unsigned*)(sq + p.sq_off.flags);
+    ring->sq_array = (unsigned*)(sq + p.sq_off.array);
+    ring->sq_mask = *(unsigned*)(sq + p.sq_off.ring_mask);
+    ring->sq_entries = p.sq_entries;
+    ring->sq_tail = *ring->sq_ktail;
+    ring->sq_submitted = ring->sq_tail;
+
+    char *cq = ring->cq_map;
+    ring->cq_khead = (unsigned*)(cq + p.cq_off.head);
+    ring->cq_ktail = (unsigned*)(cq + p.cq_off.tail);
+    ring->cq_mask = *(unsigned*)(cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+
+    *ring_out = ring;
+    return 0;
+}
+
+/**
+ * Destroys a ring. This cancels all the pending requests
+ * and frees the provided buffers.
+ * @arg ring The ring to destroy
+ */
+void uring_destroy(statsite_uring *ring) {
+    munmap(ring->sqes, ring->sqes_len);
+    munmap(ring->sq_map, ring->sq_map_len);
+    close(ring->fd);
+
+    uring_buf_group *group = ring->groups, *next;
+    while (group) {
+        next = group->next;
+        free(group->ring);
+        free(group->buffers);
+        free(group);
+        group = next;
+    }
+    free(ring);
+}
+
+/**
+ * Returns the file descriptor of the ring. It becomes
+ * readable when there are completions to reap.
+ */
+int uring_fd(statsite_uring *ring) {
+    return ring->fd;
+}
+
+/**
+ * Registers a ring of provided buffers with the kernel.
+ * @return 0 on success, -1 if buffer rings are not supported.
+ */
+int uring_add_buf_group(statsite_uring *ring, int group_id, int count, int size, uring_buf_group **group_out) {
+    uring_buf_group *group = calloc(1, sizeof(uring_buf_group));
+    group->group_id = group_id;
+    group->count = count;
+    group->size = size;
+    group->stride = size + 1;
+
+    // The buffer ring must be page aligned
+    if (posix_memalign((void**)&group->ring, getpagesize(), count * sizeof(struct io_uring_buf))) {
+        free(group);
+        return -1;
+    }
+    memset(group->ring, 0, count * sizeof(struct io_uring_buf));
+    group->buffers = malloc((size_t)count * group->stride);
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)group->ring;
+    reg.ring_entries = count;
+    reg.bgid = group_id;
+    if (sys_io_uring_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1)) {
+        syslog(LOG_WARNING, "Failed to register io_uring buffer ring! Err: %s", strerror(errno));
+        free(group->ring);
+        free(group->buffers);
+        free(group);
+        return -1;
+    }
+
+    // Provide all the buffers
+    for (int i=0; i < count; i++) {
+        uring_put_buf(group, i);
+    }
+
+    group->next = ring->groups;
+    ring->groups = group;
+    *group_out = group;
+    return 0;
+}
+
+/**
+ * Returns the address of a buffer of the group.
+ */
+char* uring_buf(uring_buf_group *group, int buf_id) {
+    return group->buffers + (size_t)buf_id * group->stride;
+}
+
+/**
+ * Hands a buffer back to the kernel once it has been consumed.
+ */
+void uring_put_buf(uring_buf_group *group, int buf_id) {
+    unsigned short tail = group->ring->tail;
+    struct io_uring_buf *buf = &group->ring->bufs[tail & (group->count - 1)];
+    buf->addr = (uint64_t)(uintptr_t)uring_buf(group, buf_id);
+    buf->len = group->size;
+    buf->bid = buf_id;
+    store_release(&group->ring->tail, (unsigned short)(tail + 1));
+}
+
+/**
+ * Gets the next free submission entry, submitting
+ * the queued entries if the queue is full.
+ * @return The entry, or NULL if the queue is full.
+ */
+static struct io_uring_sqe* get_sqe(statsite_uring *ring) {
+    if (ring->sq_tail - load_acquire(ring->sq_khead) >= ring->sq_entries) {
+        uring_submit(ring);
+        if (ring->sq_tail - load_acquire(ring->sq_khead) >= ring->sq_entries) {
+            return NULL;
+        }
+    }
+    unsigned idx = ring->sq_tail & ring->sq_mask;
+    struct io_uring_sqe *sqe = ring->sqes + idx;
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    ring->sq_array[idx] = idx;
+    ring->sq_tail++;
+    return sqe;
+}
+
+/**
+ * Queues a multishot accept.
+ */
+int uring_accept_multishot(statsite_uring *ring, int fd, uint64_t user_data) {
+    struct io_uring_sqe *sqe = get_sqe(ring);
+    if (!sqe) return -1;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = user_data;
+    return 0;
+}
+
+/**
+ * Queues a multishot receive.
+ */
+int uring_recv_multishot(statsite_uring *ring, int fd, uring_buf_group *group, uint64_t user_data) {
+    struct io_uring_sqe *sqe = get_sqe(ring);
+    if (!sqe) return -1;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->buf_group = group->group_id;
+    sqe->user_data = user_data;
+    return 0;
+}
+
+/**
+ * Queues a multishot recvmsg.
+ */
+int uring_recvmsg_multishot(statsite_uring *ring, int fd, struct msghdr *msg, uring_buf_group *group, uint64_t user_data) {
+    struct io_uring_sqe *sqe = get_sqe(ring);
+    if (!sqe) return -1;
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)msg;
+    sqe->len = 1;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->buf_group = group->group_id;
+    sqe->user_data = user_data;
+    return 0;
+}
+
+/**
+ * Returns the space a multishot recvmsg uses before the payload.
+ */
+int uring_recvmsg_overhead(struct msghdr *msg) {
+    return sizeof(struct io_uring_recvmsg_out) + msg->msg_namelen + msg->msg_controllen;
+}
+
+/**
+ * Locates the payload of a datagram received by a multishot recvmsg.
+ */
+char* uring_recvmsg_payload(struct msghdr *msg, char *buf, int res, int *len, int *truncated) {
+    struct io_uring_recvmsg_out *out = (struct io_uring_recvmsg_out*)buf;
+    int overhead = uring_recvmsg_overhead(msg);
+    *len = res - overhead;
+    *truncated = (out->flags & MSG_TRUNC) != 0;
+    return buf + overhead;
+}
+
+/**
+ * Queues a cancellation of a pending request.
+ */
+int uring_cancel(statsite_uring *ring, uint64_t target, uint64_t user_data) {
+    struct io_uring_sqe *sqe = get_sqe(ring);
+    if (!sqe) return -1;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = target;
+    sqe->user_data = user_data;
+    return 0;
+}
+
+/**
+ * Submits the queued requests to the kernel.
+ */
+int uring_submit(statsite_uring *ring) {
+    unsigned to_submit = ring->sq_tail - ring->sq_submitted;
+    if (!to_submit) return 0;
+
+    store_release(ring->sq_ktail, ring->sq_tail);
+    int res;
+    do {
+        res = sys_io_uring_enter(ring->fd, to_submit, 0, 0);
+    } while (res == -1 && errno == EINTR);
+    if (res == -1) {
+        syslog(LOG_ERR, "Failed to submit to io_uring! Err: %s", strerror(errno));
+        return -1;
+    }
+    ring->sq_submitted += res;
+    return 0;
+}
+
+/**
+ * Reaps the next completion, if any.
+ */
+int uring_next(statsite_uring *ring, uring_completion *comp) {
+    unsigned head = *ring->cq_khead;
+    if (head == load_acquire(ring->cq_ktail)) {
+        // Completions that did not fit the queue are held by
+        // the kernel until we ask for them
+        if (!(load_acquire(ring->sq_kflags) & IORING_SQ_CQ_OVERFLOW)) return 0;
+        sys_io_uring_enter(ring->fd, 0, 0, IORING_ENTER_GETEVENTS);
+        if (head == load_acquire(ring->cq_ktail)) return 0;
+    }
+
+    struct io_uring_cqe *cqe = ring->cqes + (head & ring->cq_mask);
+    comp->user_data = cqe->user_data;
+    comp->res = cqe->res;
+    comp->more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+    comp->buf_id = (cqe->flags & IORING_CQE_F_BUFFER) ? (int)(cqe->flags >> IORING_CQE_BUFFER_SHIFT) : -1;
+    store_release(ring->cq_khead, head + 1);
+    return 1;
+}
+
+#endif
@@ -0,0 +1,159 @@
+/**
+ * This module is a small wrapper around the Linux io_uring
+ * interface, using the raw system calls. It provides just
+ * enough for the networking stack to receive data using
+ * multishot requests that select from provided buffer rings,
+ * so that a single armed request keeps delivering completions
+ * without any further system calls.
+ */
+#ifndef URING_H
+#define URING_H
+#include "buildconfig.h"
+
+#ifdef HAVE_IO_URING
+#include <stdint.h>
+#include <sys/socket.h>
+
+typedef struct statsite_uring statsite_uring;
+typedef struct uring_buf_group uring_buf_group;
+
+/**
+ * A completion reaped from the ring
+ */
+typedef struct {
+    uint64_t user_data; // The user data of the request
+    int res;            // The result, negative errno on failure
+    int more;           // Set if the multishot request remains armed
+    int buf_id;         // The selected buffer, or -1
+} uring_completion;
+
+/**
+ * Creates a new ring.
+ * @arg entries The size of the submission queue
+ * @arg ring_out Output. The new ring
+ * @return 0 on success, -1 if io_uring is not supported.
+ */
+int uring_init(unsigned entries, statsite_uring **ring_out);
+
+/**
+ * Destroys a ring. This cancels all the pending requests
+ * and frees the provided buffers.
+ * @arg ring The ring to destroy
+ */
+void uring_destroy(statsite_uring *ring);
+
+/**
+ * Returns the file descriptor of the ring. It becomes
+ * readable when there are completions to reap.
+ * @arg ring The ring
+ * @return The file descriptor
+ */
+int uring_fd(statsite_uring *ring);
+
+/**
+ * Registers a ring of provided buffers with the kernel.
+ * Each buffer is followed by a spare byte, so that a record
+ * received into it can be terminated in place.
+ * @arg ring The ring
+ * @arg group_id The buffer group id to register
+ * @arg count The number of buffers, must be a power of 2
+ * @arg size The size of each buffer
+ * @arg group_out Output. The buffer group
+ * @return 0 on success, -1 if buffer rings are not supported.
+ */
+int uring_add_buf_group(statsite_uring *ring, int group_id, int count, int size, uring_buf_group **group_out);
+
+/**
+ * Returns the address of a buffer of the group.
+ * @arg group The buffer group
+ * @arg buf_id The buffer id from a completion
+ * @return The start of the buffer
+ */
+char* uring_buf(uring_buf_group *group, int buf_id);
+
+/**
+ * Hands a buffer back to the kernel once it has been consumed.
+ * @arg group The buffer group
+ * @arg buf_id The buffer id from a completion
+ */
+void uring_put_buf(uring_buf_group *group, int buf_id);
+
+/**
+ * Queues a multishot accept, which completes once
+ * for each new connection on the listener.
+ * @arg ring The ring
+ * @arg fd The listening socket
+ * @arg user_data Returned with each completion
+ * @return 0 on success, -1 if the queue is full.
+ */
+int uring_accept_multishot(statsite_uring *ring, int fd, uint64_t user_data);
+
+/**
+ * Queues a multishot receive, which completes each time
+ * data arrives on the socket, using a buffer from the group.
+ * @arg ring The ring
+ * @arg fd The socket
+ * @arg group The buffer group to select from
+ * @arg user_data Returned with each completion
+ * @return 0 on success, -1 if the queue is full.
+ */
+int uring_recv_multishot(statsite_uring *ring, int fd, uring_buf_group *group, uint64_t user_data);
+
+/**
+ * Queues a multishot recvmsg, which completes once for each
+ * datagram. The buffers hold a header before the payload,
+ * use uring_recvmsg_payload to locate it.
+ * @arg ring The ring
+ * @arg fd The socket
+ * @arg msg The message header template, must outlive the request
+ * @arg group The buffer group to select from
+ * @arg user_data Returned with each completion
+ * @return 0 on success, -1 if the queue is full.
+ */
+int uring_recvmsg_multishot(statsite_uring *ring, int fd, struct msghdr *msg, uring_buf_group *group, uint64_t user_data);
+
+/**
+ * Locates the payload of a datagram received by a multishot recvmsg.
+ * @arg msg The message header template of the request
+ * @arg buf The selected buffer
+ * @arg res The result of the completion
+ * @arg len Output. The length of the payload
+ * @arg truncated Output. Set if the datagram did not fit the buffer
+ * @return The start of the payload
+ */
+char* uring_recvmsg_payload(struct msghdr *msg, char *buf, int res, int *len, int *truncated);
+
+/**
+ * Returns the space a multishot recvmsg uses in each
+ * buffer before the payload.
+ * @arg msg The message header template of the request
+ * @return The number of bytes
+ */
+int uring_recvmsg_overhead(struct msghdr *msg);
+
+/**
+ * Queues a cancellation of a pending request.
+ * @arg ring The ring
+ * @arg target The user data of the request to cancel
+ * @arg user_data Returned with the completion of the cancel
+ * @return 0 on success, -1 if the queue is full.
+ */
+int uring_cancel(statsite_uring *ring, uint64_t target, uint64_t user_data);
+
+/**
+ * Submits the queued requests to the kernel.
+ * @arg ring The ring
+ * @return 0 on success.
+ */
+int uring_submit(statsite_uring *ring);
+
+/**
+ * Reaps the next completion, if any.
+ * @arg ring The ring
+ * @arg comp Output. The completion
+ * @return 1 if a completion was reaped, 0 if there are none.
+ */
+int uring_next(statsite_uring *ring, uring_completion *comp);
+
+#endif
+#endif
@@ -3,6 +3,8 @@
 #include <syslog.h>
 #include "test_hashmap.c"
 #include "test_cm_quantile.c"
+#include "test_tdigest.c"
+#include "test_ddsketch.c"
 #include "test_heap.c"
 #include "test_timer.c"
 #include "test_counter.c"
@@ -12,6 +14,13 @@
 #include "test_radix.c"
 #include "test_hll.c"
 #include "test_set.c"
+#include "test_circbuf.c"
+#include "test_fastfloat.c"
+#include "test_arena.c"
+#include "test_intern.c"
+#include "test_codec.c"
+#include "test_gauge.c"
+#include "test_forward.c"
 
 int main(void)
 {
@@ -29,6 +38,13 @@ int main(void)
     TCase *tc9 = tcase_create("radix");
     TCase *tc10 = tcase_create("hyperloglog");
     TCase *tc11 = tcase_create("set");
+    TCase *tc12 = tcase_create("circbuf");
+    TCase *tc13 = tcase_create("fastfloat");
+    TCase *tc14 = tcase_create("arena");
+    TCase *tc15 = tcase_create("intern");
+    TCase *tc16 = tcase_create("codec");
+    TCase *tc17 = tcase_create("gauge");
+    TCase *tc18 = tcase_create("forward");
     SRunner *sr = srunner_create(s1);
     int nf;
 
@@ -46,6 +62,12 @@ int main(void)
     tcase_add_test(tc1, test_map_iter_no_keys);
     tcase_add_test(tc1, test_map_put_iter_break);
     tcase_add_test(tc1, test_map_put_grow);
+    tcase_add_test(tc1, test_map_put_update);
+    tcase_add_test(tc1, test_map_get_or_insert);
+    tcase_add_test(tc1, test_map_delete_churn);
+    tcase_add_test(tc1, test_map_upsert);
+    tcase_add_test(tc1, test_map_reset);
+    tcase_add_test(tc1, test_map_borrowed_hashed);
 
     // Add the quantile tests
     suite_add_tcase(s1, tc2);
@@ -63,6 +85,28 @@ int main(void)
     tcase_add_test(tc2, test_cm_init_add_loop_tail_query_destroy);
     tcase_add_test(tc2, test_cm_init_add_loop_rev_query_destroy);
     tcase_add_test(tc2, test_cm_init_add_loop_random_query_destroy);
+    tcase_add_test(tc2, test_cm_merge_random_query_destroy);
+    tcase_add_test(tc2, test_cm_interleaved_query_destroy);
+    tcase_add_test(tc2, test_cm_mixed_signs_query_destroy);
+    tcase_add_test(tc2, test_td_init_and_destroy);
+    tcase_add_test(tc2, test_td_init_bad_compression);
+    tcase_add_test(tc2, test_td_query_empty);
+    tcase_add_test(tc2, test_td_add_query_destroy);
+    tcase_add_test(tc2, test_td_add_loop_query_destroy);
+    tcase_add_test(tc2, test_td_add_loop_random_query_destroy);
+    tcase_add_test(tc2, test_td_add_negative_query_destroy);
+    tcase_add_test(tc2, test_td_merge_random_query_destroy);
+    tcase_add_test(tc2, test_dd_init_and_destroy);
+    tcase_add_test(tc2, test_dd_init_bad_alpha);
+    tcase_add_test(tc2, test_dd_query_empty);
+    tcase_add_test(tc2, test_dd_add_query_destroy);
+    tcase_add_test(tc2, test_dd_add_loop_random_query_destroy);
+    tcase_add_test(tc2, test_dd_add_negative_query_destroy);
+    tcase_add_test(tc2, test_dd_bounded_buckets);
+    tcase_add_test(tc2, test_dd_merge_random_query_destroy);
+    tcase_add_test(tc2, test_cm_encode_decode);
+    tcase_add_test(tc2, test_td_encode_decode);
+    tcase_add_test(tc2, test_dd_encode_decode);
 
     // Add the heap tests
     suite_add_tcase(s1, tc3);
@@ -79,6 +123,12 @@ int main(void)
     tcase_add_test(tc4, test_timer_init_add_destroy);
     tcase_add_test(tc4, test_timer_add_loop);
     tcase_add_test(tc4, test_timer_sample_rate);
+    tcase_add_test(tc4, test_timer_merge);
+    tcase_add_test(tc4, test_timer_engines);
+    tcase_add_test(tc4, test_timer_exact);
+    tcase_add_test(tc4, test_timer_merge_exact);
+    tcase_add_test(tc4, test_timer_pool);
+    tcase_add_test(tc4, test_timer_encode_decode);
 
     // Add the counter tests
     suite_add_tcase(s1, tc5);
@@ -86,6 +136,8 @@ int main(void)
     tcase_add_test(tc5, test_counter_init_add);
     tcase_add_test(tc5, test_counter_add_loop);
     tcase_add_test(tc5, test_counter_sample_rate);
+    tcase_add_test(tc5, test_counter_merge);
+    tcase_add_test(tc5, test_counter_encode_decode);
 
     // Add the counter tests
     suite_add_tcase(s1, tc6);
@@ -96,6 +148,16 @@ int main(void)
     tcase_add_test(tc6, test_metrics_add_all_iter);
     tcase_add_test(tc6, test_metrics_histogram);
     tcase_add_test(tc6, test_metrics_gauges);
+    tcase_add_test(tc6, test_metrics_merge);
+    tcase_add_test(tc6, test_metrics_merge_timer_values);
+    tcase_add_test(tc6, test_metrics_reset);
+    tcase_add_test(tc6, test_metrics_merge_shared_names);
+    tcase_add_test(tc6, test_metrics_kv_order);
+    tcase_add_test(tc6, test_metrics_flush_inputs);
+    tcase_add_test(tc6, test_metrics_merge_state);
+    tcase_add_test(tc6, test_metrics_merge_state_bad);
+    tcase_add_test(tc6, test_metrics_merge_state_eps);
+    tcase_add_test(tc6, test_metrics_quantile_engines);
 
     // Add the streaming tests
     suite_add_tcase(s1, tc7);
@@ -103,6 +165,8 @@ int main(void)
     tcase_add_test(tc7, test_stream_some);
     tcase_add_test(tc7, test_stream_bad_cmd);
     tcase_add_test(tc7, test_stream_sigpipe);
+    tcase_add_test(tc7, test_stream_sink);
+    tcase_add_test(tc7, test_stream_sink_restart);
 
     // Add the config tests
     suite_add_tcase(s1, tc8);
@@ -121,10 +185,16 @@ int main(void)
     tcase_add_test(tc8, test_sane_histograms);
     tcase_add_test(tc8, test_sane_set_eps);
     tcase_add_test(tc8, test_config_histograms);
+    tcase_add_test(tc8, test_config_quantile_engines);
     tcase_add_test(tc8, test_build_radix);
     tcase_add_test(tc8, test_sane_prefixes);
     tcase_add_test(tc8, test_sane_global_prefix);
     tcase_add_test(tc8, test_sane_quantiles);
+    tcase_add_test(tc8, test_sane_worker_threads);
+    tcase_add_test(tc8, test_sane_udp_batch_size);
+    tcase_add_test(tc8, test_sane_key_idle_intervals);
+    tcase_add_test(tc8, test_sane_forward_hosts);
+    tcase_add_test(tc8, test_sane_forward_batch_size);
     tcase_add_test(tc8, test_extended_counters);
     tcase_add_test(tc8, test_timers_include_count_only);
     tcase_add_test(tc8, test_timers_include_count_rate);
@@ -148,6 +218,8 @@ int main(void)
     tcase_add_test(tc10, test_hll_size);
     tcase_add_test(tc10, test_hll_error_bound);
     tcase_add_test(tc10, test_hll_precision_for_error);
+    tcase_add_test(tc10, test_hll_merge);
+    tcase_add_test(tc10, test_hll_encode_decode);
 
     // Add the set tests
     suite_add_tcase(s1, tc11);
@@ -155,6 +227,66 @@ int main(void)
     tcase_add_test(tc11, test_set_add_size_exact);
     tcase_add_test(tc11, test_set_add_size_exact_dedup);
     tcase_add_test(tc11, test_set_error_bound);
+    tcase_add_test(tc11, test_set_merge_exact);
+    tcase_add_test(tc11, test_set_merge_approx);
+    tcase_add_test(tc11, test_set_encode_decode);
+
+    // Add the circular buffer tests
+    suite_add_tcase(s1, tc12);
+    tcase_add_test(tc12, test_circbuf_init_and_free);
+    tcase_add_test(tc12, test_circbuf_mirrored);
+    tcase_add_test(tc12, test_circbuf_write_read);
+    tcase_add_test(tc12, test_circbuf_wrapped_contiguous);
+    tcase_add_test(tc12, test_circbuf_grow_wrapped);
+    tcase_add_test(tc12, test_circbuf_advance_wraps);
+
+    // Add the float parser tests
+    suite_add_tcase(s1, tc13);
+    tcase_add_test(tc13, test_fastfloat_simple);
+    tcase_add_test(tc13, test_fastfloat_end);
+    tcase_add_test(tc13, test_fastfloat_invalid);
+    tcase_add_test(tc13, test_fastfloat_range);
+    tcase_add_test(tc13, test_fastfloat_hard_cases);
+    tcase_add_test(tc13, test_fastfloat_integers);
+    tcase_add_test(tc13, test_fastfloat_round_trip);
+    tcase_add_test(tc13, test_fastfloat_random_digits);
+
+    // Add the arena tests
+    suite_add_tcase(s1, tc14);
+    tcase_add_test(tc14, test_arena_init_and_destroy);
+    tcase_add_test(tc14, test_arena_alloc_aligned);
+    tcase_add_test(tc14, test_arena_alloc_large);
+    tcase_add_test(tc14, test_arena_strndup);
+    tcase_add_test(tc14, test_arena_merge);
+    tcase_add_test(tc14, test_arena_reset);
+
+    // Add the intern tests
+    suite_add_tcase(s1, tc15);
+    tcase_add_test(tc15, test_intern_init_and_destroy);
+    tcase_add_test(tc15, test_intern_name);
+    tcase_add_test(tc15, test_intern_dense_ids);
+    tcase_add_test(tc15, test_intern_evict);
+
+    // Add the codec tests
+    suite_add_tcase(s1, tc16);
+    tcase_add_test(tc16, test_codec_round_trip);
+    tcase_add_test(tc16, test_codec_little_endian);
+    tcase_add_test(tc16, test_codec_truncated);
+    tcase_add_test(tc16, test_codec_version);
+
+    // Add the gauge tests
+    suite_add_tcase(s1, tc17);
+    tcase_add_test(tc17, test_gauge_merge);
+    tcase_add_test(tc17, test_gauge_encode_decode);
+
+    // Add the forward tests
+    suite_add_tcase(s1, tc18);
+    tcase_add_test(tc18, test_ring_lookup);
+    tcase_add_test(tc18, test_ring_add_node);
+    tcase_add_test(tc18, test_ring_down);
+    tcase_add_test(tc18, test_forwarder_bad_hosts);
+    tcase_add_test(tc18, test_forwarder_local);
+    tcase_add_test(tc18, test_forwarder_upstream_down);
 
 
     srunner_run_all(sr, CK_ENV);
@@ -0,0 +1,119 @@
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "arena.h"
+
+START_TEST(test_arena_init_and_destroy)
+{
+    arena a;
+    arena_init(&a);
+    arena_destroy(&a);
+
+    // Can be used again after a destroy
+    fail_unless(arena_alloc(&a, 10) != NULL);
+    arena_destroy(&a);
+}
+END_TEST
+
+START_TEST(test_arena_alloc_aligned)
+{
+    arena a;
+    arena_init(&a);
+
+    // Allocations are aligned and do not overlap
+    char *last = NULL;
+    for (int i=1; i < 10000; i++) {
+        char *p = arena_alloc(&a, i % 100 + 1);
+        fail_unless(p != NULL);
+        fail_unless(((uintptr_t)p & 15) == 0);
+        memset(p, i & 0xff, i % 100 + 1);
+        if (last) fail_unless(last != p);
+        last = p;
+    }
+    arena_destroy(&a);
+}
+END_TEST
+
+START_TEST(test_arena_alloc_large)
+{
+    arena a;
+    arena_init(&a);
+
+    // Bigger than any block
+    size_t size = 16 * 1024 * 1024;
+    char *p = arena_alloc(&a, size);
+    fail_unless(p != NULL);
+    memset(p, 1, size);
+
+    // Smaller allocations keep working
+    char *q = arena_calloc(&a, 64);
+    fail_unless(q != NULL);
+    for (int i=0; i < 64; i++) fail_unless(q[i] == 0);
+    arena_destroy(&a);
+}
+END_TEST
+
+START_TEST(test_arena_strndup)
+{
+    arena a;
+    arena_init(&a);
+    char *s = arena_strndup(&a, "hello world", 5);
+    fail_unless(strcmp(s, "hello") == 0);
+    arena_destroy(&a);
+}
+END_TEST
+
+START_TEST(test_arena_merge)
+{
+    arena a, b;
+    arena_init(&a);
+    arena_init(&b);
+
+    char *s1 = arena_strndup(&a, "first", 5);
+    char *strs[1000];
+    for (int i=0; i < 1000; i++) {
+        char buf[32];
+        int len = snprintf(buf, sizeof(buf), "test%d", i);
+        strs[i] = arena_strndup(&b, buf, len);
+    }
+
+    // The memory of b now lives as long as a
+    arena_merge(&a, &b);
+    arena_destroy(&b);
+    char *s2 = arena_strndup(&a, "second", 6);
+
+    fail_unless(strcmp(s1, "first") == 0);
+    fail_unless(strcmp(s2, "second") == 0);
+    for (int i=0; i < 1000; i++) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "test%d", i);
+        fail_unless(strcmp(strs[i], buf) == 0);
+    }
+    arena_destroy(&a);
+}
+END_TEST
+
+START_TEST(test_arena_reset)
+{
+    arena a;
+    arena_init(&a);
+    arena_reset(&a);
+
+    // Fill a few blocks
+    for (int i=0; i < 1000; i++) {
+        fail_unless(arena_alloc(&a, 1000) != NULL);
+    }
+
+    // The memory is handed out again after a reset
+    arena_reset(&a);
+    char *p = arena_alloc(&a, 64);
+    arena_reset(&a);
+    fail_unless(arena_alloc(&a, 64) == p);
+
+    char *s = arena_strndup(&a, "hello", 5);
+    fail_unless(strcmp(s, "hello") == 0);
+    arena_destroy(&a);
+}
+END_TEST
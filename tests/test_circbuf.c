@@ -0,0 +1,123 @@
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "circbuf.h"
+
+START_TEST(test_circbuf_init_and_free)
+{
+    circular_buffer buf;
+    fail_unless(circbuf_init(&buf) == 0);
+    fail_unless(buf.buffer != NULL);
+    fail_unless(buf.buf_size >= 32768);
+    fail_unless(circbuf_used_buf(&buf) == 0);
+    fail_unless(circbuf_avail_buf(&buf) == buf.buf_size - 1);
+    circbuf_free(&buf);
+    fail_unless(buf.buffer == NULL);
+}
+END_TEST
+
+START_TEST(test_circbuf_mirrored)
+{
+    circular_buffer buf;
+    fail_unless(circbuf_init(&buf) == 0);
+
+    // Writes to either half are visible in the other
+    buf.buffer[10] = 'a';
+    fail_unless(buf.buffer[buf.buf_size + 10] == 'a');
+    buf.buffer[buf.buf_size + 20] = 'b';
+    fail_unless(buf.buffer[20] == 'b');
+
+    circbuf_free(&buf);
+}
+END_TEST
+
+START_TEST(test_circbuf_write_read)
+{
+    circular_buffer buf;
+    fail_unless(circbuf_init(&buf) == 0);
+
+    fail_unless(circbuf_write(&buf, "hello world", 11) == 0);
+    fail_unless(circbuf_used_buf(&buf) == 11);
+    fail_unless(memcmp(buf.buffer + buf.read_cursor, "hello world", 11) == 0);
+
+    circbuf_advance_read(&buf, 6);
+    fail_unless(circbuf_used_buf(&buf) == 5);
+    fail_unless(memcmp(buf.buffer + buf.read_cursor, "world", 5) == 0);
+
+    // Cursors are reset once everything is read
+    circbuf_advance_read(&buf, 5);
+    fail_unless(buf.read_cursor == 0);
+    fail_unless(buf.write_cursor == 0);
+
+    circbuf_free(&buf);
+}
+END_TEST
+
+START_TEST(test_circbuf_wrapped_contiguous)
+{
+    circular_buffer buf;
+    fail_unless(circbuf_init(&buf) == 0);
+
+    // Move the cursors close to the end of the buffer
+    buf.read_cursor = buf.buf_size - 4;
+    buf.write_cursor = buf.buf_size - 4;
+
+    fail_unless(circbuf_write(&buf, "wrapped record", 14) == 0);
+    fail_unless(buf.write_cursor == 10);
+    fail_unless(buf.write_cursor < buf.read_cursor);
+    fail_unless(circbuf_used_buf(&buf) == 14);
+
+    // The record is contiguous from the read cursor
+    fail_unless(memcmp(buf.buffer + buf.read_cursor, "wrapped record", 14) == 0);
+    fail_unless(memcmp(buf.buffer, "ped record", 10) == 0);
+
+    circbuf_free(&buf);
+}
+END_TEST
+
+START_TEST(test_circbuf_grow_wrapped)
+{
+    circular_buffer buf;
+    fail_unless(circbuf_init(&buf) == 0);
+    uint64_t size = buf.buf_size;
+
+    buf.read_cursor = size - 100;
+    buf.write_cursor = size - 100;
+
+    // Fill most of the buffer, wrapping around
+    char *data = malloc(size);
+    for (uint64_t i=0; i < size; i++) data[i] = 'a' + i % 26;
+    fail_unless(circbuf_write(&buf, data, size / 2) == 0);
+    fail_unless(buf.buf_size == size);
+
+    // Writing more than is available grows the buffer
+    fail_unless(circbuf_write(&buf, data + size / 2, size / 2) == 0);
+    fail_unless(buf.buf_size == 2 * size);
+    fail_unless(circbuf_used_buf(&buf) == size);
+    fail_unless(memcmp(buf.buffer + buf.read_cursor, data, size) == 0);
+
+    free(data);
+    circbuf_free(&buf);
+}
+END_TEST
+
+START_TEST(test_circbuf_advance_wraps)
+{
+    circular_buffer buf;
+    fail_unless(circbuf_init(&buf) == 0);
+
+    buf.read_cursor = buf.buf_size - 2;
+    buf.write_cursor = buf.buf_size - 2;
+    circbuf_advance_write(&buf, 5);
+    fail_unless(buf.write_cursor == 3);
+    fail_unless(circbuf_used_buf(&buf) == 5);
+    fail_unless(circbuf_avail_buf(&buf) == buf.buf_size - 6);
+
+    circbuf_advance_read(&buf, 2);
+    fail_unless(buf.read_cursor == 0);
+    fail_unless(circbuf_used_buf(&buf) == 3);
+
+    circbuf_free(&buf);
+}
+END_TEST
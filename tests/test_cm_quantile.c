@@ -156,10 +156,9 @@ START_TEST(test_cm_init_add_negative_query_destroy)
 END_TEST
 
 void print_cm(cm_quantile *cm) {
-    cm_sample *samp = cm->samples;
-    while (samp) {
+    for (uint64_t i=0; i < cm->num_samples; i++) {
+        cm_sample *samp = cm->samples + i;
         printf("%f - %lld %lld\n", samp->value, samp->width, samp->delta);
-        samp = samp->next;
     }
 }
 
@@ -285,4 +284,149 @@ START_TEST(test_cm_init_add_loop_random_query_destroy)
 }
 END_TEST
 
+START_TEST(test_cm_merge_random_query_destroy)
+{
+    cm_quantile cm1, cm2;
+    double quants[] = {0.5, 0.90, 0.99};
+    fail_unless(init_cm_quantile(0.01, (double*)&quants, 3, &cm1) == 0);
+    fail_unless(init_cm_quantile(0.01, (double*)&quants, 3, &cm2) == 0);
+
+    srandom(42);
+    for (int i=0; i < 100000; i++) {
+        fail_unless(cm_add_sample((i % 3) ? &cm1 : &cm2, random()) == 0);
+    }
+
+    fail_unless(cm_merge(&cm1, &cm2) == 0);
+    fail_unless(cm1.num_values == 100000);
+    fail_unless(cm2.num_values == 0);
+    fail_unless(cm2.samples == NULL);
+
+    // Merging doubles the error bound
+    double err = 2 * 21474836.0;
+    double val = cm_query(&cm1, 0.5);
+    fail_unless(val >= 1073741823 - err && val <= 1073741823 + err);
 
+    val = cm_query(&cm1, 0.90);
+    fail_unless(val >= 1932735282 - err && val <= 1932735282 + err);
+
+    val = cm_query(&cm1, 0.99);
+    fail_unless(val >= 2126008810 - err && val <= 2126008810 + err);
+
+    fail_unless(destroy_cm_quantile(&cm1) == 0);
+    fail_unless(destroy_cm_quantile(&cm2) == 0);
+}
+END_TEST
+
+START_TEST(test_cm_interleaved_query_destroy)
+{
+    cm_quantile cm;
+    double quants[] = {0.5, 0.90, 0.99};
+    fail_unless(init_cm_quantile(0.01, (double*)&quants, 3, &cm) == 0);
+
+    // Queries between the batches insert partial buffers
+    srandom(42);
+    for (int i=0; i < 100000; i++) {
+        fail_unless(cm_add_sample(&cm, random()) == 0);
+        if (i % 777 == 0) cm_query(&cm, 0.5);
+    }
+    fail_unless(cm_flush(&cm) == 0);
+    fail_unless(cm.num_values == 100000);
+
+    // The samples stay sorted
+    for (uint64_t i=1; i < cm.num_samples; i++) {
+        fail_unless(cm.samples[i-1].value <= cm.samples[i].value);
+    }
+
+    double val = cm_query(&cm, 0.5);
+    fail_unless(val >= 1073741823 - 21474836 && val <= 1073741823 + 21474836);
+
+    val = cm_query(&cm, 0.90);
+    fail_unless(val >= 1932735282 - 21474836 && val <= 1932735282 + 21474836);
+
+    val = cm_query(&cm, 0.99);
+    fail_unless(val >= 2126008810 - 21474836 && val <= 2126008810 + 21474836);
+
+    fail_unless(destroy_cm_quantile(&cm) == 0);
+}
+END_TEST
+
+START_TEST(test_cm_mixed_signs_query_destroy)
+{
+    cm_quantile cm;
+    double quants[] = {0.5, 0.90, 0.99};
+    fail_unless(init_cm_quantile(0.01, (double*)&quants, 3, &cm) == 0);
+
+    // Negative, zero and fractional values, in the full batches
+    srandom(42);
+    for (int i=0; i < 10000; i++) {
+        double val = (random() % 20001 - 10000) / 8.0;
+        if (i % 100 == 0) val = -0.0;
+        fail_unless(cm_add_sample(&cm, val) == 0);
+    }
+    fail_unless(cm_add_sample(&cm, -5000.0) == 0);
+    fail_unless(cm_add_sample(&cm, 5000.0) == 0);
+    fail_unless(cm_flush(&cm) == 0);
+
+    for (uint64_t i=1; i < cm.num_samples; i++) {
+        fail_unless(cm.samples[i-1].value <= cm.samples[i].value);
+    }
+    fail_unless(cm.samples[0].value == -5000.0);
+    fail_unless(cm.samples[cm.num_samples - 1].value == 5000.0);
+
+    double val = cm_query(&cm, 0.5);
+    fail_unless(val >= -25 && val <= 25);
+
+    fail_unless(destroy_cm_quantile(&cm) == 0);
+}
+END_TEST
+
+START_TEST(test_cm_encode_decode)
+{
+    cm_quantile cm1, cm2, cm3;
+    double quants[] = {0.5, 0.90, 0.99};
+    fail_unless(init_cm_quantile(0.01, (double*)&quants, 3, &cm1) == 0);
+
+    srandom(42);
+    for (int i=0; i < 10000; i++) {
+        fail_unless(cm_add_sample(&cm1, random()) == 0);
+    }
+
+    codec_buf buf;
+    codec_buf_init(&buf);
+    fail_unless(cm_encode(&cm1, &buf) == 0);
+
+    codec_reader r;
+    codec_reader_init(&r, buf.data, buf.len);
+    fail_unless(cm_decode(&r, (double*)&quants, 3, &cm2) == 0);
+    fail_unless(r.pos == buf.len);
+    fail_unless(cm2.num_values == 10000);
+    fail_unless(cm2.num_samples == cm1.num_samples);
+    for (int i=0; i < 3; i++) {
+        fail_unless(cm_query(&cm2, quants[i]) == cm_query(&cm1, quants[i]));
+    }
+
+    // Truncated input is rejected
+    codec_reader_init(&r, buf.data, buf.len - 1);
+    fail_unless(cm_decode(&r, (double*)&quants, 3, &cm3) == -1);
+
+    // Samples out of order are rejected
+    codec_buf bad;
+    codec_buf_init(&bad);
+    codec_put_double(&bad, 0.01);
+    codec_put_varint(&bad, 2);
+    codec_put_varint(&bad, 2);
+    double values[] = {5, 3};
+    for (int i=0; i < 2; i++) {
+        codec_put_double(&bad, values[i]);
+        codec_put_varint(&bad, 1);
+        codec_put_varint(&bad, 0);
+    }
+    codec_reader_init(&r, bad.data, bad.len);
+    fail_unless(cm_decode(&r, (double*)&quants, 3, &cm3) == -1);
+    codec_buf_destroy(&bad);
+
+    fail_unless(destroy_cm_quantile(&cm1) == 0);
+    fail_unless(destroy_cm_quantile(&cm2) == 0);
+    codec_buf_destroy(&buf);
+}
+END_TEST
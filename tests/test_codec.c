@@ -0,0 +1,122 @@
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include "codec.h"
+
+START_TEST(test_codec_round_trip)
+{
+    codec_buf buf;
+    codec_buf_init(&buf);
+
+    uint64_t ints[] = {0, 1, 127, 128, 300, UINT32_MAX, UINT64_MAX};
+    for (int i=0; i < 7; i++) {
+        fail_unless(codec_put_varint(&buf, ints[i]) == 0);
+    }
+    fail_unless(codec_put_svarint(&buf, -1) == 0);
+    fail_unless(codec_put_svarint(&buf, INT64_MIN) == 0);
+    fail_unless(codec_put_u8(&buf, 200) == 0);
+    fail_unless(codec_put_u64(&buf, 0x0102030405060708ULL) == 0);
+    fail_unless(codec_put_double(&buf, -1.5) == 0);
+    fail_unless(codec_put_double(&buf, INFINITY) == 0);
+
+    // Small values take a byte
+    fail_unless(buf.data[0] == 0 && buf.data[1] == 1 && buf.data[2] == 127);
+
+    codec_reader r;
+    codec_reader_init(&r, buf.data, buf.len);
+    uint64_t v;
+    for (int i=0; i < 7; i++) {
+        fail_unless(codec_get_varint(&r, &v) == 0);
+        fail_unless(v == ints[i]);
+    }
+    int64_t sv;
+    fail_unless(codec_get_svarint(&r, &sv) == 0);
+    fail_unless(sv == -1);
+    fail_unless(codec_get_svarint(&r, &sv) == 0);
+    fail_unless(sv == INT64_MIN);
+
+    uint8_t b;
+    fail_unless(codec_get_u8(&r, &b) == 0);
+    fail_unless(b == 200);
+    fail_unless(codec_get_u64(&r, &v) == 0);
+    fail_unless(v == 0x0102030405060708ULL);
+
+    double d;
+    fail_unless(codec_get_double(&r, &d) == 0);
+    fail_unless(d == -1.5);
+    fail_unless(codec_get_double(&r, &d) == 0);
+    fail_unless(d == INFINITY);
+
+    // Nothing is left
+    fail_unless(r.pos == r.len);
+    fail_unless(codec_get_u8(&r, &b) == -1);
+    codec_buf_destroy(&buf);
+}
+END_TEST
+
+START_TEST(test_codec_little_endian)
+{
+    codec_buf buf;
+    codec_buf_init(&buf);
+    fail_unless(codec_put_u64(&buf, 0x0102030405060708ULL) == 0);
+    fail_unless(buf.len == 8);
+    fail_unless(buf.data[0] == 0x08 && buf.data[7] == 0x01);
+    codec_buf_destroy(&buf);
+}
+END_TEST
+
+START_TEST(test_codec_truncated)
+{
+    // A varint that never ends
+    unsigned char cont[] = {0x80, 0x80, 0x80};
+    codec_reader r;
+    uint64_t v;
+    codec_reader_init(&r, cont, sizeof(cont));
+    fail_unless(codec_get_varint(&r, &v) == -1);
+
+    // More than 64 bits
+    unsigned char big[11];
+    for (int i=0; i < 11; i++) big[i] = 0xff;
+    codec_reader_init(&r, big, sizeof(big));
+    fail_unless(codec_get_varint(&r, &v) == -1);
+
+    // A u32 that does not fit
+    codec_buf buf;
+    codec_buf_init(&buf);
+    fail_unless(codec_put_varint(&buf, (uint64_t)UINT32_MAX + 1) == 0);
+    uint32_t v32;
+    codec_reader_init(&r, buf.data, buf.len);
+    fail_unless(codec_get_u32(&r, &v32) == -1);
+
+    // A partial double
+    double d;
+    codec_reader_init(&r, buf.data, 4);
+    fail_unless(codec_get_double(&r, &d) == -1);
+    codec_buf_destroy(&buf);
+}
+END_TEST
+
+START_TEST(test_codec_version)
+{
+    codec_buf buf;
+    codec_buf_init(&buf);
+    fail_unless(codec_put_version(&buf) == 0);
+
+    codec_reader r;
+    codec_reader_init(&r, buf.data, buf.len);
+    fail_unless(codec_get_version(&r) == 0);
+
+    buf.data[0] = CODEC_VERSION + 1;
+    codec_reader_init(&r, buf.data, buf.len);
+    fail_unless(codec_get_version(&r) == -1);
+
+    // Counts must fit in the input
+    codec_reader_init(&r, buf.data, buf.len);
+    fail_unless(codec_check_count(&r, 1, 1) == 0);
+    fail_unless(codec_check_count(&r, 2, 1) == -1);
+    fail_unless(codec_check_count(&r, 1, 8) == -1);
+    codec_buf_destroy(&buf);
+}
+END_TEST
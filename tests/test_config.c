@@ -36,10 +36,21 @@ static void check_default_config(statsite_config config) {
     fail_unless(config.timers_config.median == true);
     fail_unless(config.timers_config.sample_rate == true);
     fail_unless(config.prefix_binary_stream == false);
+    fail_unless(config.state_stream == false);
+    fail_unless(config.forward_hosts == NULL);
+    fail_unless(config.forward_batch_size == 65536);
+    fail_unless(config.persistent_stream == false);
     fail_unless(config.num_quantiles == 3);
     fail_unless(config.quantiles[0] == 0.5);
     fail_unless(config.quantiles[1] == 0.95);
     fail_unless(config.quantiles[2] == 0.99);
+    fail_unless(config.worker_threads == 0);
+    fail_unless(config.udp_batch_size == 32);
+    fail_unless(config.udp_batch_timer == NULL);
+    fail_unless(config.io_uring == false);
+    fail_unless(config.key_idle_intervals == 10);
+    fail_unless(config.quantile_engine == QUANTILE_CM);
+    fail_unless(config.quantile_configs == NULL);
 }
 
 START_TEST(test_config_get_default)
@@ -98,7 +109,16 @@ input_counter = foobar\n\
 pid_file = /tmp/statsite.pid\n\
 extended_counters = true\n\
 prefix_binary_stream = true\n\
-quantiles = 0.5, 0.90, 0.95, 0.99\n";
+state_stream = true\n\
+forward_hosts = localhost:9000, 10.0.0.2:9000\n\
+forward_batch_size = 4096\n\
+persistent_stream = true\n\
+quantiles = 0.5, 0.90, 0.95, 0.99\n\
+worker_threads = 4\n\
+udp_batch_size = 64\n\
+udp_batch_timer = statsite.udp_batch\n\
+io_uring = true\n\
+key_idle_intervals = 3\n";
     write(fh, buf, strlen(buf));
     fchmod(fh, 777);
     close(fh);
@@ -123,11 +143,20 @@ quantiles = 0.5, 0.90, 0.95, 0.99\n";
     fail_unless(strcmp(config.input_counter, "foobar") == 0);
     fail_unless(config.extended_counters == true);
     fail_unless(config.prefix_binary_stream == true);
+    fail_unless(config.state_stream == true);
+    fail_unless(strcmp(config.forward_hosts, "localhost:9000, 10.0.0.2:9000") == 0);
+    fail_unless(config.forward_batch_size == 4096);
+    fail_unless(config.persistent_stream == true);
     fail_unless(config.num_quantiles == 4);
     fail_unless(config.quantiles[0] == 0.5);
     fail_unless(config.quantiles[1] == 0.90);
     fail_unless(config.quantiles[2] == 0.95);
     fail_unless(config.quantiles[3] == 0.99);
+    fail_unless(config.worker_threads == 4);
+    fail_unless(config.udp_batch_size == 64);
+    fail_unless(strcmp(config.udp_batch_timer, "statsite.udp_batch") == 0);
+    fail_unless(config.io_uring == true);
+    fail_unless(config.key_idle_intervals == 3);
 
     unlink("/tmp/basic_config");
 }
@@ -293,6 +322,55 @@ START_TEST(test_sane_quantiles)
 }
 END_TEST
 
+START_TEST(test_sane_worker_threads)
+{
+    fail_unless(sane_worker_threads(-1) == 1);
+    fail_unless(sane_worker_threads(0) == 0);
+    fail_unless(sane_worker_threads(4) == 0);
+}
+END_TEST
+
+START_TEST(test_sane_udp_batch_size)
+{
+    fail_unless(sane_udp_batch_size(0) == 1);
+    fail_unless(sane_udp_batch_size(1) == 0);
+    fail_unless(sane_udp_batch_size(64) == 0);
+    fail_unless(sane_udp_batch_size(4096) == 1);
+}
+END_TEST
+
+START_TEST(test_sane_forward_hosts)
+{
+    fail_unless(sane_forward_hosts(NULL) == 0);
+    fail_unless(sane_forward_hosts("localhost:8125") == 0);
+    fail_unless(sane_forward_hosts("a:8125, b:8126,c:8127") == 0);
+    fail_unless(sane_forward_hosts("[::1]:8125") == 0);
+    fail_unless(sane_forward_hosts("") == 1);
+    fail_unless(sane_forward_hosts(" , ") == 1);
+    fail_unless(sane_forward_hosts("localhost") == 1);
+    fail_unless(sane_forward_hosts(":8125") == 1);
+    fail_unless(sane_forward_hosts("a:8125,b:") == 1);
+    fail_unless(sane_forward_hosts("a:99999") == 1);
+}
+END_TEST
+
+START_TEST(test_sane_forward_batch_size)
+{
+    fail_unless(sane_forward_batch_size(0) == 1);
+    fail_unless(sane_forward_batch_size(512) == 0);
+    fail_unless(sane_forward_batch_size(65536) == 0);
+    fail_unless(sane_forward_batch_size(4194304) == 1);
+}
+END_TEST
+
+START_TEST(test_sane_key_idle_intervals)
+{
+    fail_unless(sane_key_idle_intervals(-1) == 1);
+    fail_unless(sane_key_idle_intervals(0) == 0);
+    fail_unless(sane_key_idle_intervals(10) == 0);
+}
+END_TEST
+
 
 START_TEST(test_config_histograms)
 {
@@ -372,6 +450,64 @@ width=25\n\
 }
 END_TEST
 
+START_TEST(test_config_quantile_engines)
+{
+    int fh = open("/tmp/quantile_engines", O_CREAT|O_RDWR, 0777);
+    char *buf = "[statsite]\n\
+quantile_engine = tdigest\n\
+\n\
+[quantile_api]\n\
+prefix=api.\n\
+engine=ddsketch\n\
+\n\
+[quantile_site]\n\
+prefix=site.\n\
+engine=cm\n\
+\n\
+";
+    write(fh, buf, strlen(buf));
+    fchmod(fh, 777);
+    close(fh);
+
+    statsite_config config;
+    int res = config_from_filename("/tmp/quantile_engines", &config);
+    fail_unless(res == 0);
+    fail_unless(config.quantile_engine == QUANTILE_TDIGEST);
+
+    quantile_config *c = config.quantile_configs;
+    fail_unless(c != NULL);
+    fail_unless(strcmp(c->prefix, "site.") == 0);
+    fail_unless(c->engine == QUANTILE_CM);
+
+    c = c->next;
+    fail_unless(strcmp(c->prefix, "api.") == 0);
+    fail_unless(c->engine == QUANTILE_DDSKETCH);
+    fail_unless(c->next == NULL);
+
+    // The tree finds the engine by prefix
+    fail_unless(build_prefix_tree(&config) == 0);
+    void *val;
+    fail_unless(radix_longest_prefix(config.quantile_engines, "api.latency", &val) == 0);
+    fail_unless(((quantile_config*)val)->engine == QUANTILE_DDSKETCH);
+    fail_unless(radix_longest_prefix(config.quantile_engines, "web.latency", &val) != 0);
+
+    unlink("/tmp/quantile_engines");
+
+    // Unknown engines are rejected
+    fh = open("/tmp/quantile_engines", O_CREAT|O_RDWR|O_TRUNC, 0777);
+    buf = "[statsite]\n\
+quantile_engine = foo\n\
+";
+    write(fh, buf, strlen(buf));
+    close(fh);
+
+    res = config_from_filename("/tmp/quantile_engines", &config);
+    fail_unless(res != 0);
+
+    unlink("/tmp/quantile_engines");
+}
+END_TEST
+
 START_TEST(test_build_radix)
 {
     statsite_config config;
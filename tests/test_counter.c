@@ -53,3 +53,49 @@ START_TEST(test_counter_sample_rate)
     fail_unless(counter_sum(&c) == 5050);
 }
 END_TEST
+
+START_TEST(test_counter_merge)
+{
+    counter c1, c2;
+    fail_unless(init_counter(&c1) == 0);
+    fail_unless(init_counter(&c2) == 0);
+
+    for (int i=1; i<=50; i++)
+        fail_unless(counter_add_sample(&c1, i, 1.0) == 0);
+    for (int i=51; i<=100; i++)
+        fail_unless(counter_add_sample(&c2, i, 0.5) == 0);
+
+    fail_unless(counter_merge(&c1, &c2) == 0);
+    fail_unless(counter_sum(&c1) == 5050);
+    fail_unless(counter_count(&c1) == 150);
+}
+END_TEST
+
+START_TEST(test_counter_encode_decode)
+{
+    counter c1, c2;
+    fail_unless(init_counter(&c1) == 0);
+    for (int i=1; i<=100; i++)
+        fail_unless(counter_add_sample(&c1, i, 0.5) == 0);
+
+    codec_buf buf;
+    codec_buf_init(&buf);
+    fail_unless(counter_encode(&c1, &buf) == 0);
+
+    codec_reader r;
+    codec_reader_init(&r, buf.data, buf.len);
+    fail_unless(counter_decode(&r, &c2) == 0);
+    fail_unless(counter_sum(&c2) == 5050);
+    fail_unless(counter_count(&c2) == 200);
+
+    // The decoded counter merges like the original
+    fail_unless(counter_merge(&c1, &c2) == 0);
+    fail_unless(counter_sum(&c1) == 10100);
+
+    // Other versions are rejected
+    buf.data[0]++;
+    codec_reader_init(&r, buf.data, buf.len);
+    fail_unless(counter_decode(&r, &c2) == -1);
+    codec_buf_destroy(&buf);
+}
+END_TEST
@@ -0,0 +1,201 @@
+#include <check.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include "ddsketch.h"
+
+START_TEST(test_dd_init_and_destroy)
+{
+    ddsketch dd;
+    int res = init_ddsketch(0.01, &dd);
+    fail_unless(res == 0);
+    res = destroy_ddsketch(&dd);
+    fail_unless(res == 0);
+}
+END_TEST
+
+START_TEST(test_dd_init_bad_alpha)
+{
+    ddsketch dd;
+    fail_unless(init_ddsketch(0, &dd) == -1);
+    fail_unless(init_ddsketch(1, &dd) == -1);
+    fail_unless(init_ddsketch(-0.5, &dd) == -1);
+}
+END_TEST
+
+START_TEST(test_dd_query_empty)
+{
+    ddsketch dd;
+    fail_unless(init_ddsketch(0.01, &dd) == 0);
+    fail_unless(dd_query(&dd, 0.5) == 0);
+    fail_unless(destroy_ddsketch(&dd) == 0);
+}
+END_TEST
+
+START_TEST(test_dd_add_query_destroy)
+{
+    ddsketch dd;
+    fail_unless(init_ddsketch(0.01, &dd) == 0);
+
+    // A single value is clamped to itself
+    fail_unless(dd_add_sample(&dd, 100.0) == 0);
+    fail_unless(dd_query(&dd, 0.5) == 100.0);
+
+    fail_unless(dd_add_sample(&dd, 0) == 0);
+    fail_unless(dd_query(&dd, 0) == 0);
+    fail_unless(dd_query(&dd, 1) == 100.0);
+
+    fail_unless(destroy_ddsketch(&dd) == 0);
+}
+END_TEST
+
+START_TEST(test_dd_add_loop_random_query_destroy)
+{
+    ddsketch dd;
+    fail_unless(init_ddsketch(0.01, &dd) == 0);
+
+    srandom(42);
+    for (int i=0; i < 100000; i++) {
+        fail_unless(dd_add_sample(&dd, random()) == 0);
+    }
+    fail_unless(dd.count == 100000);
+
+    // Within 1% of the value, and the sampling error
+    double val = dd_query(&dd, 0.5);
+    fail_unless(fabs(val - 1073741823) <= 0.02 * 1073741823);
+
+    val = dd_query(&dd, 0.90);
+    fail_unless(fabs(val - 1932735282) <= 0.02 * 1932735282);
+
+    val = dd_query(&dd, 0.99);
+    fail_unless(fabs(val - 2126008810) <= 0.02 * 2126008810);
+
+    fail_unless(destroy_ddsketch(&dd) == 0);
+}
+END_TEST
+
+START_TEST(test_dd_add_negative_query_destroy)
+{
+    ddsketch dd;
+    fail_unless(init_ddsketch(0.01, &dd) == 0);
+
+    for (int i=-1000; i <= 1000; i++) {
+        fail_unless(dd_add_sample(&dd, i) == 0);
+    }
+
+    fail_unless(dd_query(&dd, 0.5) == 0);
+
+    double val = dd_query(&dd, 0.01);
+    fail_unless(fabs(val + 980) <= 0.01 * 980 + 1);
+
+    val = dd_query(&dd, 0.99);
+    fail_unless(fabs(val - 980) <= 0.01 * 980 + 1);
+
+    fail_unless(dd_query(&dd, 0) == -1000);
+    fail_unless(dd_query(&dd, 1) == 1000);
+
+    fail_unless(destroy_ddsketch(&dd) == 0);
+}
+END_TEST
+
+START_TEST(test_dd_bounded_buckets)
+{
+    ddsketch dd;
+    fail_unless(init_ddsketch(0.01, &dd) == 0);
+
+    // Values from 1e-6 to 1e12 need more buckets than are kept
+    for (int i=0; i < 19000; i++) {
+        fail_unless(dd_add_sample(&dd, pow(10, (i % 19) - 6)) == 0);
+    }
+    fail_unless(dd_num_buckets(&dd) <= 2048);
+
+    // The lowest buckets are collapsed, the high quantiles are not
+    double val = dd_query(&dd, 0.99);
+    fail_unless(fabs(val - 1e12) <= 0.01 * 1e12);
+
+    val = dd_query(&dd, 0.5);
+    fail_unless(fabs(val - 1e3) <= 0.01 * 1e3);
+
+    fail_unless(destroy_ddsketch(&dd) == 0);
+}
+END_TEST
+
+START_TEST(test_dd_merge_random_query_destroy)
+{
+    ddsketch dd1, dd2, dd3;
+    fail_unless(init_ddsketch(0.01, &dd1) == 0);
+    fail_unless(init_ddsketch(0.01, &dd2) == 0);
+    fail_unless(init_ddsketch(0.05, &dd3) == 0);
+
+    srandom(42);
+    for (int i=0; i < 100000; i++) {
+        fail_unless(dd_add_sample((i % 3) ? &dd1 : &dd2, random()) == 0);
+    }
+
+    // Only sketches of the same accuracy merge
+    fail_unless(dd_merge(&dd1, &dd3) == -1);
+
+    fail_unless(dd_merge(&dd1, &dd2) == 0);
+    fail_unless(dd1.count == 100000);
+    fail_unless(dd2.count == 0);
+    fail_unless(dd2.positive.counts == NULL);
+
+    // Merging does not add error
+    double val = dd_query(&dd1, 0.5);
+    fail_unless(fabs(val - 1073741823) <= 0.02 * 1073741823);
+
+    val = dd_query(&dd1, 0.90);
+    fail_unless(fabs(val - 1932735282) <= 0.02 * 1932735282);
+
+    val = dd_query(&dd1, 0.99);
+    fail_unless(fabs(val - 2126008810) <= 0.02 * 2126008810);
+
+    fail_unless(destroy_ddsketch(&dd1) == 0);
+    fail_unless(destroy_ddsketch(&dd2) == 0);
+    fail_unless(destroy_ddsketch(&dd3) == 0);
+}
+END_TEST
+
+START_TEST(test_dd_encode_decode)
+{
+    ddsketch dd1, dd2, dd3;
+    fail_unless(init_ddsketch(0.01, &dd1) == 0);
+    fail_unless(init_ddsketch(0.01, &dd2) == 0);
+
+    srandom(42);
+    for (int i=0; i < 100000; i++) {
+        fail_unless(dd_add_sample((i % 3) ? &dd1 : &dd2, random() - 1073741823) == 0);
+    }
+    fail_unless(dd_add_sample(&dd2, 0) == 0);
+
+    codec_buf buf;
+    codec_buf_init(&buf);
+    fail_unless(dd_encode(&dd2, &buf) == 0);
+
+    codec_reader r;
+    codec_reader_init(&r, buf.data, buf.len);
+    fail_unless(dd_decode(&r, &dd3) == 0);
+    fail_unless(r.pos == buf.len);
+    fail_unless(dd3.count == dd2.count);
+    fail_unless(dd3.zero_count == 1);
+    for (int i=1; i < 100; i++) {
+        fail_unless(dd_query(&dd3, i / 100.0) == dd_query(&dd2, i / 100.0));
+    }
+
+    // The decoded sketch merges like the original
+    fail_unless(dd_merge(&dd1, &dd3) == 0);
+    fail_unless(dd1.count == 100001);
+    double val = dd_query(&dd1, 0.90);
+    fail_unless(fabs(val - 858993459) <= 0.02 * 858993459);
+
+    // Truncated input is rejected
+    codec_reader_init(&r, buf.data, buf.len - 1);
+    fail_unless(dd_decode(&r, &dd3) == -1);
+
+    fail_unless(destroy_ddsketch(&dd1) == 0);
+    fail_unless(destroy_ddsketch(&dd2) == 0);
+    codec_buf_destroy(&buf);
+}
+END_TEST
@@ -0,0 +1,183 @@
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <math.h>
+#include <float.h>
+#include "fastfloat.h"
+
+// Checks that a string parses to the same bits, end and errno as strtod
+static int matches_strtod(const char *s) {
+    char *strtod_end, *end;
+    errno = 0;
+    double expected = strtod(s, &strtod_end);
+    int expected_errno = errno;
+    errno = 0;
+    double val = fastfloat_parse(s, strlen(s), &end);
+    if (memcmp(&expected, &val, sizeof(double)) || end != strtod_end || errno != expected_errno) {
+        printf("Mismatch on %s: %.17g vs %.17g\n", s, expected, val);
+        return 0;
+    }
+    return 1;
+}
+
+// Simple xorshift, so the inputs are the same on each run
+static uint64_t next_rand(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+START_TEST(test_fastfloat_simple)
+{
+    char *end;
+    fail_unless(fastfloat_parse("1", 1, &end) == 1.0);
+    fail_unless(fastfloat_parse("-42", 3, &end) == -42.0);
+    fail_unless(fastfloat_parse("+0.5", 4, &end) == 0.5);
+    fail_unless(fastfloat_parse("12345678", 8, &end) == 12345678.0);
+    fail_unless(fastfloat_parse("1.5e3", 5, &end) == 1500.0);
+    fail_unless(*end == '\0');
+}
+END_TEST
+
+START_TEST(test_fastfloat_end)
+{
+    // Stops at the first byte that is not part of the number
+    char *end;
+    char *s = "100|c";
+    fail_unless(fastfloat_parse(s, strlen(s), &end) == 100.0);
+    fail_unless(end == s + 3);
+
+    // An exponent without digits is not consumed
+    s = "2e|ms";
+    fail_unless(fastfloat_parse(s, strlen(s), &end) == 2.0);
+    fail_unless(end == s + 1);
+
+    // Stops at the length, even if more digits follow
+    s = "123456789";
+    fail_unless(fastfloat_parse(s, 4, &end) == 1234.0);
+    fail_unless(end == s + 4);
+}
+END_TEST
+
+START_TEST(test_fastfloat_invalid)
+{
+    char *end;
+    char *inputs[] = {"", "-", "+", ".", "-.e5", "abc", "e5", " 1"};
+    for (int i=0; i < sizeof(inputs) / sizeof(char*); i++) {
+        fail_unless(fastfloat_parse(inputs[i], strlen(inputs[i]), &end) == 0.0);
+        fail_unless(end == inputs[i]);
+    }
+}
+END_TEST
+
+START_TEST(test_fastfloat_range)
+{
+    char *end;
+    errno = 0;
+    fail_unless(fastfloat_parse("1e309", 5, &end) == HUGE_VAL);
+    fail_unless(errno == ERANGE);
+    errno = 0;
+    fail_unless(fastfloat_parse("-1e309", 6, &end) == -HUGE_VAL);
+    fail_unless(errno == ERANGE);
+    errno = 0;
+    fail_unless(fastfloat_parse("1e-400", 6, &end) == 0.0);
+    fail_unless(errno == ERANGE);
+    errno = 0;
+    fail_unless(fastfloat_parse("3E-311", 6, &end) == strtod("3E-311", NULL));
+    fail_unless(errno == ERANGE);
+    errno = 0;
+    fail_unless(fastfloat_parse("2.2250738585072012e-308", 23, &end) == DBL_MIN);
+    fail_unless(errno == ERANGE);
+    errno = 0;
+    fail_unless(fastfloat_parse("2.2250738585072014e-308", 23, &end) == DBL_MIN);
+    fail_unless(errno == 0);
+    errno = 0;
+    fail_unless(fastfloat_parse("0e999", 5, &end) == 0.0);
+    fail_unless(errno == 0);
+}
+END_TEST
+
+START_TEST(test_fastfloat_hard_cases)
+{
+    // Halfway cases, boundaries and long inputs
+    char *inputs[] = {
+        "9007199254740993", "9007199254740992", "9007199254740991.5",
+        "0.1", "0.3", "1e22", "1e23", "1e-22", "1e-23",
+        "2.2250738585072011e-308", "2.2250738585072014e-308",
+        "4.9406564584124654e-324", "2.4703282292062327e-324",
+        "2.4703282292062328e-324", "1.7976931348623157e308",
+        "1.7976931348623158e308", "1.7976931348623159e308",
+        "7.2057594037927933e16", "00000000000000000000000000001",
+        "123456789012345678901234567890",
+        "3.14159265358979323846264338327950288",
+        "0.000000000000000000000000000001234567890123456789012",
+        "1.00000000000000011102230246251565404236316680908203124",
+        "1.00000000000000011102230246251565404236316680908203125",
+        "1.00000000000000011102230246251565404236316680908203126",
+    };
+    for (int i=0; i < sizeof(inputs) / sizeof(char*); i++) {
+        fail_unless(matches_strtod(inputs[i]));
+    }
+}
+END_TEST
+
+START_TEST(test_fastfloat_integers)
+{
+    // Every integer and short decimal a client is likely to send
+    char buf[32];
+    for (int i=0; i < 1000000; i++) {
+        snprintf(buf, sizeof(buf), "%d", i);
+        fail_unless(matches_strtod(buf));
+        snprintf(buf, sizeof(buf), "-%d.%d", i % 1000, i);
+        fail_unless(matches_strtod(buf));
+    }
+}
+END_TEST
+
+START_TEST(test_fastfloat_round_trip)
+{
+    // Random doubles printed at every precision must round trip
+    char buf[64];
+    uint64_t state = 88172645463325252ULL;
+    for (int i=0; i < 200000; i++) {
+        uint64_t bits = next_rand(&state);
+        double d;
+        memcpy(&d, &bits, sizeof(double));
+        if (d != d) continue;
+
+        snprintf(buf, sizeof(buf), "%.17g", d);
+        fail_unless(matches_strtod(buf));
+        fail_unless(fastfloat_parse(buf, strlen(buf), NULL) == d);
+
+        snprintf(buf, sizeof(buf), "%.*g", (int)(1 + i % 17), d);
+        fail_unless(matches_strtod(buf));
+    }
+}
+END_TEST
+
+START_TEST(test_fastfloat_random_digits)
+{
+    // Random digit strings, with long mantissas and any exponent
+    char buf[64];
+    uint64_t state = 2463534242ULL;
+    for (int i=0; i < 200000; i++) {
+        int digits = 1 + next_rand(&state) % 30;
+        int dot = next_rand(&state) % (digits + 1);
+        int pos = 0;
+        if (next_rand(&state) & 1) buf[pos++] = '-';
+        for (int j=0; j < digits; j++) {
+            if (j == dot) buf[pos++] = '.';
+            buf[pos++] = '0' + next_rand(&state) % 10;
+        }
+        if (next_rand(&state) % 3 == 0) {
+            pos += sprintf(buf + pos, "e%d", (int)(next_rand(&state) % 700) - 350);
+        }
+        buf[pos] = '\0';
+        fail_unless(matches_strtod(buf));
+    }
+}
+END_TEST
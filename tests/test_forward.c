@@ -0,0 +1,239 @@
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "forward.h"
+
+START_TEST(test_ring_lookup)
+{
+    char *names[] = {"a:8125", "b:8125", "c:8125"};
+    char *reversed[] = {"c:8125", "b:8125", "a:8125"};
+    forward_ring r1, r2;
+    fail_unless(forward_ring_init(&r1, names, 3) == 0);
+    fail_unless(forward_ring_init(&r2, reversed, 3) == 0);
+
+    // The node of a key only depends on the names
+    char key[32];
+    int counts[3] = {0, 0, 0};
+    for (int i=0; i < 30000; i++) {
+        int len = sprintf(key, "metric.%d", i);
+        int node = forward_ring_lookup(&r1, key, len);
+        fail_unless(node >= 0 && node < 3);
+        fail_unless(forward_ring_lookup(&r1, key, len) == node);
+        fail_unless(forward_ring_lookup(&r2, key, len) == 2 - node);
+        counts[node]++;
+    }
+
+    // The keys spread evenly
+    for (int i=0; i < 3; i++) {
+        fail_unless(counts[i] > 7000 && counts[i] < 13000);
+    }
+
+    forward_ring_destroy(&r1);
+    forward_ring_destroy(&r2);
+}
+END_TEST
+
+START_TEST(test_ring_add_node)
+{
+    char *names[] = {"a:8125", "b:8125", "c:8125", "d:8125", "e:8125"};
+    forward_ring r1, r2;
+    fail_unless(forward_ring_init(&r1, names, 4) == 0);
+    fail_unless(forward_ring_init(&r2, names, 5) == 0);
+
+    // Only the keys taken by the new node move
+    char key[32];
+    int moved = 0;
+    for (int i=0; i < 10000; i++) {
+        int len = sprintf(key, "metric.%d", i);
+        int before = forward_ring_lookup(&r1, key, len);
+        int after = forward_ring_lookup(&r2, key, len);
+        if (before != after) {
+            fail_unless(after == 4);
+            moved++;
+        }
+    }
+    fail_unless(moved > 1000 && moved < 3000);
+
+    forward_ring_destroy(&r1);
+    forward_ring_destroy(&r2);
+}
+END_TEST
+
+START_TEST(test_ring_down)
+{
+    char *names[] = {"a:8125", "b:8125", "c:8125"};
+    forward_ring r;
+    fail_unless(forward_ring_init(&r, names, 3) == 0);
+
+    char key[32];
+    int nodes[1000];
+    for (int i=0; i < 1000; i++) {
+        int len = sprintf(key, "metric.%d", i);
+        nodes[i] = forward_ring_lookup(&r, key, len);
+    }
+
+    // Only the keys of the node that is down move
+    forward_ring_set_down(&r, 1, 1);
+    for (int i=0; i < 1000; i++) {
+        int len = sprintf(key, "metric.%d", i);
+        int node = forward_ring_lookup(&r, key, len);
+        fail_unless(node != 1);
+        if (nodes[i] != 1) fail_unless(node == nodes[i]);
+    }
+
+    // No node is left
+    forward_ring_set_down(&r, 0, 1);
+    forward_ring_set_down(&r, 2, 1);
+    fail_unless(forward_ring_lookup(&r, "foo", 3) == -1);
+
+    // And the keys move back
+    forward_ring_set_down(&r, 0, 0);
+    forward_ring_set_down(&r, 1, 0);
+    forward_ring_set_down(&r, 2, 0);
+    for (int i=0; i < 1000; i++) {
+        int len = sprintf(key, "metric.%d", i);
+        fail_unless(forward_ring_lookup(&r, key, len) == nodes[i]);
+    }
+    forward_ring_destroy(&r);
+}
+END_TEST
+
+START_TEST(test_forwarder_bad_hosts)
+{
+    forwarder fw;
+    fail_unless(init_forwarder("localhost", 512, &fw) == -1);
+    fail_unless(init_forwarder(" ", 512, &fw) == -1);
+}
+END_TEST
+
+// Listens on a free local port
+static int listen_local(int *port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, (struct sockaddr*)&addr, len) || listen(fd, 4)) {
+        close(fd);
+        return -1;
+    }
+    getsockname(fd, (struct sockaddr*)&addr, &len);
+    *port = ntohs(addr.sin_port);
+    return fd;
+}
+
+// Reads everything a listener received on one connection
+static size_t read_local(int listen_fd, char *buf, size_t size) {
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0) return 0;
+    struct timeval timeout = {0, 200000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    size_t len = 0;
+    ssize_t n;
+    while (len < size - 1 && (n = recv(fd, buf + len, size - 1 - len, 0)) > 0) {
+        len += n;
+    }
+    buf[len] = 0;
+    close(fd);
+    return len;
+}
+
+START_TEST(test_forwarder_local)
+{
+    int ports[2], fds[2];
+    for (int i=0; i < 2; i++) {
+        fds[i] = listen_local(ports + i);
+        fail_unless(fds[i] >= 0);
+    }
+    char hosts[64];
+    sprintf(hosts, "127.0.0.1:%d, 127.0.0.1:%d", ports[0], ports[1]);
+
+    forwarder fw;
+    fail_unless(init_forwarder(hosts, 512, &fw) == 0);
+    fail_unless(fw.num_upstreams == 2);
+    fail_unless(fw.upstreams[0].addrs != NULL);
+
+    // Forward more than a batch
+    char line[64];
+    size_t sent = 0;
+    for (int i=0; i < 1000; i++) {
+        int key_len = sprintf(line, "key.%d", i);
+        int len = key_len + sprintf(line + key_len, ":%d|c\n", i);
+        fail_unless(forward_command(&fw, FORWARD_ASCII, line, key_len, line, len) == 0);
+        sent += len;
+    }
+    fail_unless(forward_drain(&fw, 2000) == 0);
+
+    // Each line arrives whole, at the upstream of its key
+    char *buf = malloc(65536);
+    size_t received = 0;
+    int lines = 0;
+    for (int i=0; i < 2; i++) {
+        received += read_local(fds[i], buf, 65536);
+        for (char *l = strtok(buf, "\n"); l; l = strtok(NULL, "\n")) {
+            char *sep = strchr(l, ':');
+            fail_unless(sep != NULL);
+            fail_unless(forward_ring_lookup(&fw.ring, l, sep - l) == i);
+            fail_unless(atoi(sep + 1) == atoi(l + 4));
+            lines++;
+        }
+    }
+    fail_unless(received == sent);
+    fail_unless(lines == 1000);
+
+    free(buf);
+    destroy_forwarder(&fw);
+    close(fds[0]);
+    close(fds[1]);
+}
+END_TEST
+
+START_TEST(test_forwarder_upstream_down)
+{
+    // Find a port nothing listens on
+    int port, live_port;
+    close(listen_local(&port));
+    int live_fd = listen_local(&live_port);
+    fail_unless(live_fd >= 0);
+
+    char hosts[64];
+    sprintf(hosts, "127.0.0.1:%d,127.0.0.1:%d", port, live_port);
+    forwarder fw;
+    fail_unless(init_forwarder(hosts, 512, &fw) == 0);
+
+    // Find a key of the closed port
+    char key[32];
+    int len;
+    for (int i=0; ; i++) {
+        len = sprintf(key, "key.%d", i);
+        if (forward_ring_lookup(&fw.ring, key, len) == 0) break;
+    }
+    fail_unless(forward_command(&fw, FORWARD_ASCII, key, len, "x:1|c\n", 6) == 0);
+    forward_flush(&fw);
+
+    // Once it fails, its keys go to the other upstream
+    for (int i=0; i < 10 && !fw.ring.down[0]; i++) {
+        usleep(10000);
+        forward_flush(&fw);
+    }
+    fail_unless(fw.ring.down[0]);
+    fail_unless(forward_ring_lookup(&fw.ring, key, len) == 1);
+    fail_unless(forward_command(&fw, FORWARD_BINARY, key, len, "y", 1) == 0);
+    fail_unless(fw.upstreams[1].conns[FORWARD_BINARY].len == 1);
+
+    // Nothing is forwarded once all are down
+    forward_ring_set_down(&fw.ring, 1, 1);
+    fail_unless(forward_command(&fw, FORWARD_ASCII, key, len, "x:1|c\n", 6) == -1);
+
+    destroy_forwarder(&fw);
+    close(live_fd);
+}
+END_TEST
@@ -0,0 +1,48 @@
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include "gauge.h"
+
+START_TEST(test_gauge_merge)
+{
+    // Deltas add up
+    gauge_t g1 = {5, false}, g2 = {3, false};
+    fail_unless(gauge_merge(&g1, &g2) == 0);
+    fail_unless(g1.value == 8 && !g1.absolute);
+
+    // Deltas apply on top of an absolute value
+    gauge_t g3 = {100, true};
+    fail_unless(gauge_merge(&g1, &g3) == 0);
+    fail_unless(g1.value == 108 && g1.absolute);
+
+    gauge_t g4 = {2, false};
+    fail_unless(gauge_merge(&g3, &g4) == 0);
+    fail_unless(g3.value == 102 && g3.absolute);
+
+    // Only one absolute value is kept
+    gauge_t g5 = {50, true};
+    fail_unless(gauge_merge(&g3, &g5) == 0);
+    fail_unless(g3.value == 102 && g3.absolute);
+}
+END_TEST
+
+START_TEST(test_gauge_encode_decode)
+{
+    gauge_t g1 = {-12.5, true}, g2;
+    codec_buf buf;
+    codec_buf_init(&buf);
+    fail_unless(gauge_encode(&g1, &buf) == 0);
+
+    codec_reader r;
+    codec_reader_init(&r, buf.data, buf.len);
+    fail_unless(gauge_decode(&r, &g2) == 0);
+    fail_unless(g2.value == -12.5 && g2.absolute);
+    fail_unless(r.pos == buf.len);
+
+    // Truncated input is rejected
+    codec_reader_init(&r, buf.data, buf.len - 1);
+    fail_unless(gauge_decode(&r, &g2) == -1);
+    codec_buf_destroy(&buf);
+}
+END_TEST
@@ -6,6 +6,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <stdint.h>
 #include "hashmap.h"
 
 START_TEST(test_map_init_and_destroy)
@@ -294,3 +295,216 @@ START_TEST(test_map_put_grow)
 }
 END_TEST
 
+
+START_TEST(test_map_put_update)
+{
+    hashmap *map;
+    int res = hashmap_init(0, &map);
+    fail_unless(res == 0);
+
+    fail_unless(hashmap_put(map, "key", (void*)1) == 1);
+    fail_unless(hashmap_put(map, "key", (void*)2) == 0);
+    fail_unless(hashmap_size(map) == 1);
+
+    void *out;
+    fail_unless(hashmap_get(map, "key", &out) == 0);
+    fail_unless(out == (void*)2);
+
+    // Keys that are prefixes of each other are distinct
+    fail_unless(hashmap_get(map, "ke", &out) == -1);
+    fail_unless(hashmap_get(map, "key2", &out) == -1);
+
+    res = hashmap_destroy(map);
+    fail_unless(res == 0);
+}
+END_TEST
+
+START_TEST(test_map_get_or_insert)
+{
+    hashmap *map;
+    int res = hashmap_init(0, &map);
+    fail_unless(res == 0);
+
+    char buf[100];
+    void *out;
+    for (int i=0; i<1000;i++) {
+        snprintf((char*)&buf, 100, "test%d", i);
+        fail_unless(hashmap_get_or_insert(map, (char*)buf, (void*)(uintptr_t)i, &out) == 1);
+    }
+    fail_unless(hashmap_size(map) == 1000);
+
+    // Existing keys return their value, and are not replaced
+    for (int i=0; i<1000;i++) {
+        snprintf((char*)&buf, 100, "test%d", i);
+        fail_unless(hashmap_get_or_insert(map, (char*)buf, NULL, &out) == 0);
+        fail_unless(out == (void*)(uintptr_t)i);
+    }
+    fail_unless(hashmap_size(map) == 1000);
+
+    res = hashmap_destroy(map);
+    fail_unless(res == 0);
+}
+END_TEST
+
+START_TEST(test_map_delete_churn)
+{
+    hashmap *map;
+    int res = hashmap_init(32, &map);
+    fail_unless(res == 0);
+
+    // Keep replacing keys, so deleted slots pile up and get reclaimed
+    char buf[100];
+    void *out;
+    for (int i=0; i<10000;i++) {
+        snprintf((char*)&buf, 100, "test%d", i);
+        fail_unless(hashmap_put(map, (char*)buf, (void*)(uintptr_t)i) == 1);
+        if (i >= 20) {
+            snprintf((char*)&buf, 100, "test%d", i - 20);
+            fail_unless(hashmap_delete(map, (char*)buf) == 0);
+        }
+    }
+    fail_unless(hashmap_size(map) == 20);
+
+    // Only the last keys remain
+    for (int i=0; i<10000;i++) {
+        snprintf((char*)&buf, 100, "test%d", i);
+        if (i < 10000 - 20) {
+            fail_unless(hashmap_get(map, (char*)buf, &out) == -1);
+        } else {
+            fail_unless(hashmap_get(map, (char*)buf, &out) == 0);
+            fail_unless(out == (void*)(uintptr_t)i);
+        }
+    }
+
+    int val = 0;
+    fail_unless(hashmap_iter(map, iter_test, (void*)&val) == 0);
+    fail_unless(val == 20);
+
+    res = hashmap_destroy(map);
+    fail_unless(res == 0);
+}
+END_TEST
+
+START_TEST(test_map_upsert)
+{
+    hashmap *map;
+    int res = hashmap_init(32, &map);
+    fail_unless(res == 0);
+
+    // New keys get an empty slot to fill in
+    char buf[100];
+    void **slot;
+    for (int i=0; i<1000;i++) {
+        snprintf((char*)&buf, 100, "test%d", i);
+        fail_unless(hashmap_upsert(map, (char*)buf, &slot) == 1);
+        fail_unless(*slot == NULL);
+        *slot = (void*)(uintptr_t)(i + 1);
+    }
+    fail_unless(hashmap_size(map) == 1000);
+
+    // Existing keys return their slot
+    for (int i=0; i<1000;i++) {
+        snprintf((char*)&buf, 100, "test%d", i);
+        fail_unless(hashmap_upsert(map, (char*)buf, &slot) == 0);
+        fail_unless(*slot == (void*)(uintptr_t)(i + 1));
+        *slot = (void*)(uintptr_t)i;
+    }
+    fail_unless(hashmap_size(map) == 1000);
+
+    // Updates through the slot are visible
+    void *out;
+    for (int i=0; i<1000;i++) {
+        snprintf((char*)&buf, 100, "test%d", i);
+        fail_unless(hashmap_get(map, (char*)buf, &out) == 0);
+        fail_unless(out == (void*)(uintptr_t)i);
+    }
+
+    res = hashmap_destroy(map);
+    fail_unless(res == 0);
+}
+END_TEST
+
+START_TEST(test_map_reset)
+{
+    hashmap *map;
+    int res = hashmap_init(0, &map);
+    fail_unless(res == 0);
+
+    char buf[100];
+    for (int i=0; i<1000;i++) {
+        snprintf((char*)&buf, 100, "test%d", i);
+        fail_unless(hashmap_put(map, (char*)buf, NULL) == 1);
+    }
+
+    // Resetting to a larger size empties the map
+    fail_unless(hashmap_reset(map, 5000) == 0);
+    fail_unless(hashmap_size(map) == 0);
+    void *out;
+    fail_unless(hashmap_get(map, "test1", &out) == -1);
+
+    for (int i=0; i<5000;i++) {
+        snprintf((char*)&buf, 100, "test%d", i);
+        fail_unless(hashmap_put(map, (char*)buf, (void*)(uintptr_t)i) == 1);
+    }
+    fail_unless(hashmap_size(map) == 5000);
+
+    // And to a smaller one
+    fail_unless(hashmap_reset(map, 10) == 0);
+    fail_unless(hashmap_size(map) == 0);
+    for (int i=0; i<100;i++) {
+        snprintf((char*)&buf, 100, "test%d", i);
+        fail_unless(hashmap_put(map, (char*)buf, (void*)(uintptr_t)i) == 1);
+    }
+    for (int i=0; i<100;i++) {
+        snprintf((char*)&buf, 100, "test%d", i);
+        fail_unless(hashmap_get(map, (char*)buf, &out) == 0);
+        fail_unless(out == (void*)(uintptr_t)i);
+    }
+    fail_unless(hashmap_size(map) == 100);
+
+    res = hashmap_destroy(map);
+    fail_unless(res == 0);
+}
+END_TEST
+
+START_TEST(test_map_borrowed_hashed)
+{
+    hashmap *map;
+    int res = hashmap_init_borrowed(0, &map);
+    fail_unless(res == 0);
+
+    // The keys are stored as given
+    char *keys[100];
+    char buf[100];
+    void **slot;
+    for (int i=0; i<100;i++) {
+        snprintf((char*)&buf, 100, "test%d", i);
+        keys[i] = strdup(buf);
+        uint32_t len = strlen(keys[i]);
+        fail_unless(hashmap_upsert_hashed(map, keys[i], len, hashmap_hash(keys[i], len), &slot) == 1);
+        *slot = keys[i];
+    }
+    fail_unless(hashmap_size(map) == 100);
+
+    // Found by their hash, or by a copy of the key
+    void *out;
+    for (int i=0; i<100;i++) {
+        snprintf((char*)&buf, 100, "test%d", i);
+        uint32_t len = strlen(buf);
+        fail_unless(hashmap_get_hashed(map, buf, len, hashmap_hash(buf, len), &out) == 0);
+        fail_unless(out == keys[i]);
+        fail_unless(hashmap_upsert(map, buf, &slot) == 0);
+        fail_unless(*slot == keys[i]);
+    }
+    fail_unless(hashmap_get_hashed(map, "test", 4, hashmap_hash("test", 4), &out) == -1);
+
+    // The keys are not freed by the map
+    fail_unless(hashmap_delete(map, "test1") == 0);
+    fail_unless(hashmap_destroy(map) == 0);
+    for (int i=0; i<100;i++) {
+        snprintf((char*)&buf, 100, "test%d", i);
+        fail_unless(strcmp(keys[i], buf) == 0);
+        free(keys[i]);
+    }
+}
+END_TEST
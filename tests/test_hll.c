@@ -120,4 +120,61 @@ START_TEST(test_hll_precision_for_error)
 }
 END_TEST
 
+START_TEST(test_hll_merge)
+{
+    hll_t h1, h2, h3;
+    fail_unless(hll_init(14, &h1) == 0);
+    fail_unless(hll_init(14, &h2) == 0);
+    fail_unless(hll_init(12, &h3) == 0);
+
+    // Overlapping halves
+    char buf[100];
+    for (int i=0; i < 10000; i++) {
+        fail_unless(sprintf((char*)&buf, "test%d", i));
+        if (i < 6000) hll_add(&h1, (char*)&buf);
+        if (i >= 4000) hll_add(&h2, (char*)&buf);
+    }
+
+    fail_unless(hll_merge(&h1, &h2) == 0);
+    double s = hll_size(&h1);
+    fail_unless(s > 9900 && s < 10100);
+
+    // Precision must match
+    fail_unless(hll_merge(&h1, &h3) == -1);
+
+    fail_unless(hll_destroy(&h1) == 0);
+    fail_unless(hll_destroy(&h2) == 0);
+    fail_unless(hll_destroy(&h3) == 0);
+}
+END_TEST
 
+START_TEST(test_hll_encode_decode)
+{
+    hll_t h1, h2, h3;
+    fail_unless(hll_init(10, &h1) == 0);
+
+    char buf[100];
+    for (int i=0; i < 1000; i++) {
+        fail_unless(sprintf((char*)&buf, "test%d", i));
+        hll_add(&h1, (char*)&buf);
+    }
+
+    codec_buf out;
+    codec_buf_init(&out);
+    fail_unless(hll_encode(&h1, &out) == 0);
+
+    codec_reader r;
+    codec_reader_init(&r, out.data, out.len);
+    fail_unless(hll_decode(&r, &h2) == 0);
+    fail_unless(h2.precision == 10);
+    fail_unless(hll_size(&h2) == hll_size(&h1));
+
+    // Truncated registers are rejected
+    codec_reader_init(&r, out.data, out.len - 1);
+    fail_unless(hll_decode(&r, &h3) == -1);
+
+    fail_unless(hll_destroy(&h1) == 0);
+    fail_unless(hll_destroy(&h2) == 0);
+    codec_buf_destroy(&out);
+}
+END_TEST
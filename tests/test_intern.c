@@ -0,0 +1,97 @@
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "intern.h"
+#include "hashmap.h"
+
+START_TEST(test_intern_init_and_destroy)
+{
+    intern_table *t;
+    fail_unless(intern_init(&t) == 0);
+    fail_unless(intern_size(t) == 0);
+    fail_unless(intern_max_id(t) == 0);
+    fail_unless(intern_destroy(t) == 0);
+}
+END_TEST
+
+START_TEST(test_intern_name)
+{
+    intern_table *t;
+    fail_unless(intern_init(&t) == 0);
+
+    intern_key *foo = intern_name(t, "foo.bar", 3);
+    fail_unless(strcmp(foo->name, "foo") == 0);
+    fail_unless(foo->len == 3);
+    fail_unless(foo->hash == hashmap_hash("foo", 3));
+
+    // The same name gives the same key
+    intern_key *bar = intern_name(t, "bar", 3);
+    fail_unless(bar != foo);
+    fail_unless(bar->id != foo->id);
+    fail_unless(intern_name(t, "foo", 3) == foo);
+    fail_unless(intern_size(t) == 2);
+    fail_unless(intern_max_id(t) == 2);
+
+    fail_unless(intern_destroy(t) == 0);
+}
+END_TEST
+
+START_TEST(test_intern_dense_ids)
+{
+    intern_table *t;
+    fail_unless(intern_init(&t) == 0);
+
+    char buf[32];
+    int seen[1000] = {0};
+    for (int i=0; i < 1000; i++) {
+        int len = snprintf(buf, sizeof(buf), "test%d", i);
+        intern_key *k = intern_name(t, buf, len);
+        fail_unless(k->id < 1000);
+        fail_unless(!seen[k->id]);
+        seen[k->id] = 1;
+    }
+    fail_unless(intern_max_id(t) == 1000);
+    fail_unless(intern_destroy(t) == 0);
+}
+END_TEST
+
+START_TEST(test_intern_evict)
+{
+    intern_table *t;
+    fail_unless(intern_init(&t) == 0);
+
+    char buf[32];
+    for (int i=0; i < 100; i++) {
+        int len = snprintf(buf, sizeof(buf), "test%d", i);
+        intern_name(t, buf, len);
+    }
+
+    // Only the first half is used in the next two intervals
+    for (int interval=0; interval < 2; interval++) {
+        fail_unless(intern_next_interval(t, 2) == 0);
+        for (int i=0; i < 50; i++) {
+            int len = snprintf(buf, sizeof(buf), "test%d", i);
+            intern_name(t, buf, len);
+        }
+    }
+    fail_unless(intern_next_interval(t, 2) == 50);
+    fail_unless(intern_size(t) == 50);
+
+    // The IDs of evicted names are reused
+    for (int i=100; i < 150; i++) {
+        int len = snprintf(buf, sizeof(buf), "test%d", i);
+        fail_unless(intern_name(t, buf, len)->id < 100);
+    }
+    fail_unless(intern_max_id(t) == 100);
+    fail_unless(intern_size(t) == 100);
+
+    // Never evicts without idle intervals
+    for (int interval=0; interval < 5; interval++) {
+        fail_unless(intern_next_interval(t, 0) == 0);
+    }
+    fail_unless(intern_size(t) == 100);
+
+    fail_unless(intern_destroy(t) == 0);
+}
+END_TEST
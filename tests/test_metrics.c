@@ -195,6 +195,46 @@ START_TEST(test_metrics_histogram)
 }
 END_TEST
 
+static int iter_test_engines(void *data, metric_type type, char *key, void *val) {
+    int *o = data;
+    timer_hist *t = val;
+    if (strcmp(key, "api.latency") == 0 && t->tm.engine == QUANTILE_DDSKETCH) {
+        *o = *o | 1;
+    } else if (strcmp(key, "web.latency") == 0 && t->tm.engine == QUANTILE_TDIGEST) {
+        *o = *o | (1 << 1);
+    } else
+        return 1;
+    return 0;
+}
+
+START_TEST(test_metrics_quantile_engines)
+{
+    statsite_config config;
+    int res = config_from_filename(NULL, &config);
+
+    // Timers under api. use DDSketch, the rest the t-digest
+    quantile_config c1 = {"api.", QUANTILE_DDSKETCH, NULL, 0};
+    config.quantile_configs = &c1;
+    fail_unless(build_prefix_tree(&config) == 0);
+
+    metrics m;
+    double quants[] = {0.5, 0.90, 0.99};
+    res = init_metrics(0.01, (double*)&quants, 3, config.histograms, 12, &m);
+    fail_unless(res == 0);
+    fail_unless(metrics_set_quantile_engines(&m, QUANTILE_TDIGEST, config.quantile_engines) == 0);
+
+    fail_unless(metrics_add_sample(&m, TIMER, "api.latency", 1, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m, TIMER, "web.latency", 1, 1.0) == 0);
+
+    int okay = 0;
+    fail_unless(metrics_iter(&m, (void*)&okay, iter_test_engines) == 0);
+    fail_unless(okay == 3);
+
+    res = destroy_metrics(&m);
+    fail_unless(res == 0);
+}
+END_TEST
+
 static int iter_test_gauge(void *data, metric_type type, char *key, void *val) {
     int *o = data;
     if (strcmp(key, "g1") == 0 && ((gauge_t*)val)->value == 42) {
@@ -228,3 +268,451 @@ START_TEST(test_metrics_gauges)
     fail_unless(res == 0);
 }
 END_TEST
+
+static int iter_test_merge(void *data, metric_type type, char *key, void *val) {
+    int *o = data;
+    switch (type) {
+        case KEY_VAL:
+            if (strcmp(key, "test") == 0 && *(double*)val == 100)
+                *o = *o | 1;
+            if (strcmp(key, "test2") == 0 && *(double*)val == 42)
+                *o = *o | 1 << 1;
+            break;
+        case COUNTER:
+            if (strcmp(key, "foo") == 0 && counter_sum(val) == 10)
+                *o = *o | 1 << 2;
+            if (strcmp(key, "bar") == 0 && counter_sum(val) == 20)
+                *o = *o | 1 << 3;
+            break;
+        case TIMER:
+            if (strcmp(key, "baz") == 0 && timer_sum(val) == 11 && timer_count(val) == 2)
+                *o = *o | 1 << 4;
+            break;
+        case SET:
+            if (strcmp(key, "zip") == 0 && set_size(val) == 3)
+                *o = *o | 1 << 5;
+            break;
+        case GAUGE:
+            if (strcmp(key, "g1") == 0 && ((gauge_t*)val)->value == 205)
+                *o = *o | 1 << 6;
+            if (strcmp(key, "g2") == 0 && ((gauge_t*)val)->value == 3)
+                *o = *o | 1 << 7;
+            break;
+        default:
+            return 1;
+    }
+    return 0;
+}
+
+START_TEST(test_metrics_merge)
+{
+    metrics m1, m2;
+    fail_unless(init_metrics_defaults(&m1) == 0);
+    fail_unless(init_metrics_defaults(&m2) == 0);
+
+    fail_unless(metrics_add_sample(&m1, KEY_VAL, "test", 100, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m2, KEY_VAL, "test2", 42, 1.0) == 0);
+
+    fail_unless(metrics_add_sample(&m1, COUNTER, "foo", 4, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m2, COUNTER, "foo", 6, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m2, COUNTER, "bar", 20, 1.0) == 0);
+
+    fail_unless(metrics_add_sample(&m1, TIMER, "baz", 1, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m2, TIMER, "baz", 10, 1.0) == 0);
+
+    fail_unless(metrics_set_update(&m1, "zip", "foo") == 0);
+    fail_unless(metrics_set_update(&m2, "zip", "foo") == 0);
+    fail_unless(metrics_set_update(&m2, "zip", "wow") == 0);
+    fail_unless(metrics_set_update(&m2, "zip", "bar") == 0);
+
+    // Deltas apply on top of an absolute value from the other side
+    fail_unless(metrics_add_sample(&m1, GAUGE_DELTA, "g1", 5, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m2, GAUGE, "g1", 200, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m1, GAUGE_DELTA, "g2", 1, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m2, GAUGE_DELTA, "g2", 2, 1.0) == 0);
+
+    fail_unless(metrics_merge(&m1, &m2) == 0);
+
+    int okay = 0;
+    fail_unless(metrics_iter(&m1, (void*)&okay, iter_test_merge) == 0);
+    fail_unless(okay == 255);
+
+    // The source is left empty
+    fail_unless(metrics_iter(&m2, NULL, iter_cancel_cb) == 0);
+
+    fail_unless(destroy_metrics(&m1) == 0);
+    fail_unless(destroy_metrics(&m2) == 0);
+}
+END_TEST
+
+START_TEST(test_metrics_merge_timer_values)
+{
+    metrics m1, m2, m3;
+    fail_unless(init_metrics_defaults(&m1) == 0);
+    fail_unless(init_metrics_defaults(&m2) == 0);
+    fail_unless(init_metrics_defaults(&m3) == 0);
+
+    // Enough values for the timers to allocate arrays from the pools
+    for (int i=0; i < 40; i++) {
+        fail_unless(metrics_add_sample(&m1, TIMER, "shared", i, 1.0) == 0);
+        fail_unless(metrics_add_sample(&m2, TIMER, "shared", 40 + i, 1.0) == 0);
+        fail_unless(metrics_add_sample(&m2, TIMER, "moved", i, 1.0) == 0);
+        fail_unless(metrics_add_sample(&m3, TIMER, "moved", 40 + i, 1.0) == 0);
+    }
+    fail_unless(metrics_merge(&m1, &m2) == 0);
+
+    // The sources can be reused while the merged metrics live on
+    fail_unless(reset_metrics(&m2, &(metrics_sizes){0, 1, 0, 0}) == 0);
+    for (int i=0; i < 40; i++) {
+        fail_unless(metrics_add_sample(&m2, TIMER, "other", i, 1.0) == 0);
+    }
+
+    // The moved timer grows from the pool of its new metrics
+    fail_unless(metrics_merge(&m1, &m3) == 0);
+    fail_unless(destroy_metrics(&m3) == 0);
+
+    timer_hist *t = m1.timers.values[0];
+    fail_unless(timer_count(&t->tm) == 80);
+    fail_unless(timer_query(&t->tm, 0.5) == 39);
+    t = m1.timers.values[1];
+    fail_unless(timer_count(&t->tm) == 80);
+    fail_unless(timer_query(&t->tm, 0.99) == 79);
+
+    fail_unless(destroy_metrics(&m1) == 0);
+    fail_unless(destroy_metrics(&m2) == 0);
+}
+END_TEST
+
+START_TEST(test_metrics_reset)
+{
+    metrics m;
+    fail_unless(init_metrics_defaults(&m) == 0);
+
+    fail_unless(metrics_add_sample(&m, KEY_VAL, "test", 100, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m, COUNTER, "foo", 4, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m, COUNTER, "bar", 4, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m, TIMER, "baz", 1, 1.0) == 0);
+    fail_unless(metrics_set_update(&m, "zip", "foo") == 0);
+    fail_unless(metrics_add_sample(&m, GAUGE, "g1", 1, 1.0) == 0);
+
+    metrics_sizes sizes;
+    metrics_get_sizes(&m, &sizes);
+    fail_unless(sizes.counters == 2);
+    fail_unless(sizes.timers == 1);
+    fail_unless(sizes.sets == 1);
+    fail_unless(sizes.gauges == 1);
+
+    // Reset leaves nothing behind
+    sizes.counters = 1000;
+    fail_unless(reset_metrics(&m, &sizes) == 0);
+    fail_unless(metrics_iter(&m, NULL, iter_cancel_cb) == 0);
+
+    // And can be used like new
+    int okay = 0;
+    fail_unless(metrics_add_sample(&m, KEY_VAL, "test", 100, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m, COUNTER, "foo", 4, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m, TIMER, "baz", 1, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m, TIMER, "baz", 10, 1.0) == 0);
+    fail_unless(metrics_iter(&m, (void*)&okay, iter_test_cb) == 0);
+    fail_unless(okay == 1);
+
+    fail_unless(destroy_metrics(&m) == 0);
+}
+END_TEST
+
+static int iter_sum_cb(void *data, metric_type type, char *name, void *value) {
+    double *sums = data;
+    switch (type) {
+        case COUNTER:
+            sums[0] += counter_sum(value);
+            sums[1] += counter_count(value);
+            break;
+        case GAUGE:
+            sums[2] += ((gauge_t*)value)->value;
+            break;
+        default:
+            break;
+    }
+    return 0;
+}
+
+START_TEST(test_metrics_merge_shared_names)
+{
+    intern_table *names;
+    fail_unless(intern_init(&names) == 0);
+
+    metrics m1, m2;
+    fail_unless(init_metrics_defaults(&m1) == 0);
+    fail_unless(init_metrics_defaults(&m2) == 0);
+    fail_unless(metrics_share_names(&m1, names) == 0);
+    fail_unless(metrics_share_names(&m2, names) == 0);
+
+    // Enough names to grow the lists, half of them in both
+    char buf[32];
+    for (int i=0; i < 300; i++) {
+        snprintf(buf, sizeof(buf), "c%d", i);
+        if (i < 200) fail_unless(metrics_add_sample(&m1, COUNTER, buf, 1, 1.0) == 0);
+        if (i >= 100) fail_unless(metrics_add_sample(&m2, COUNTER, buf, 2, 1.0) == 0);
+        snprintf(buf, sizeof(buf), "g%d", i);
+        if (i < 200) fail_unless(metrics_add_sample(&m1, GAUGE, buf, 1, 1.0) == 0);
+        if (i >= 100) fail_unless(metrics_add_sample(&m2, GAUGE_DELTA, buf, 2, 1.0) == 0);
+    }
+
+    fail_unless(metrics_merge(&m1, &m2) == 0);
+    metrics_sizes sizes;
+    metrics_get_sizes(&m1, &sizes);
+    fail_unless(sizes.counters == 300);
+    fail_unless(sizes.gauges == 300);
+
+    double sums[3] = {0, 0, 0};
+    fail_unless(metrics_iter(&m1, sums, iter_sum_cb) == 0);
+    fail_unless(sums[0] == 200 + 400);
+    fail_unless(sums[1] == 400);
+    fail_unless(sums[2] == 200 + 400);
+
+    // The source is left empty
+    fail_unless(metrics_iter(&m2, NULL, iter_cancel_cb) == 0);
+
+    fail_unless(destroy_metrics(&m1) == 0);
+    fail_unless(destroy_metrics(&m2) == 0);
+    fail_unless(intern_destroy(names) == 0);
+}
+END_TEST
+
+static int iter_kv_order_cb(void *data, metric_type type, char *name, void *value) {
+    int *next = data;
+    if (type != KEY_VAL) return 0;
+    char buf[64];
+    snprintf(buf, sizeof(buf), "kv.%d.padding.to.fill.the.chunks", *next);
+    if (strcmp(name, buf) || *(double*)value != *next) return 1;
+    (*next)++;
+    return 0;
+}
+
+START_TEST(test_metrics_kv_order)
+{
+    metrics m1, m2;
+    fail_unless(init_metrics_defaults(&m1) == 0);
+    fail_unless(init_metrics_defaults(&m2) == 0);
+
+    // Enough pairs to span many chunks, split over two objects
+    char buf[64];
+    for (int i=0; i < 20000; i++) {
+        snprintf(buf, sizeof(buf), "kv.%d.padding.to.fill.the.chunks", i);
+        fail_unless(metrics_add_sample((i < 10000) ? &m1 : &m2, KEY_VAL, buf, i, 1.0) == 0);
+    }
+
+    // Merging keeps the order they arrived in
+    fail_unless(metrics_merge(&m1, &m2) == 0);
+    int next = 0;
+    fail_unless(metrics_iter(&m1, &next, iter_kv_order_cb) == 0);
+    fail_unless(next == 20000);
+
+    next = 0;
+    fail_unless(metrics_iter(&m2, &next, iter_kv_order_cb) == 0);
+    fail_unless(next == 0);
+
+    fail_unless(destroy_metrics(&m1) == 0);
+    fail_unless(destroy_metrics(&m2) == 0);
+}
+END_TEST
+
+START_TEST(test_metrics_flush_inputs)
+{
+    metrics m1, m2;
+    fail_unless(init_metrics_defaults(&m1) == 0);
+    fail_unless(init_metrics_defaults(&m2) == 0);
+
+    // Nothing counted, nothing added
+    fail_unless(metrics_flush_inputs(&m1, "inputs") == 0);
+    fail_unless(metrics_iter(&m1, NULL, iter_cancel_cb) == 0);
+
+    // The inputs add to a counter of the same name
+    fail_unless(metrics_add_sample(&m1, COUNTER, "inputs", 4, 1.0) == 0);
+    m1.inputs += 3;
+    m2.inputs += 5;
+    fail_unless(metrics_merge(&m1, &m2) == 0);
+    fail_unless(m1.inputs == 8);
+    fail_unless(m2.inputs == 0);
+    fail_unless(metrics_flush_inputs(&m1, "inputs") == 0);
+    fail_unless(m1.inputs == 0);
+
+    double sums[3] = {0, 0, 0};
+    fail_unless(metrics_iter(&m1, sums, iter_sum_cb) == 0);
+    fail_unless(sums[0] == 12);
+    fail_unless(sums[1] == 9);
+
+    fail_unless(destroy_metrics(&m1) == 0);
+    fail_unless(destroy_metrics(&m2) == 0);
+}
+END_TEST
+
+// Encodes each metric, and merges it into other metrics
+static int iter_forward_state(void *data, metric_type type, char *name, void *value) {
+    metrics *into = data;
+    if (type == KEY_VAL) return 0;
+
+    codec_buf buf;
+    codec_buf_init(&buf);
+    int res = metrics_encode_state(type, value, &buf);
+    if (!res) {
+        codec_reader r;
+        codec_reader_init(&r, buf.data, buf.len);
+        res = metrics_merge_state(into, type, name, &r);
+        if (r.pos != r.len) res = 1;
+    }
+    codec_buf_destroy(&buf);
+    return res;
+}
+
+// Prints the output of each metric
+static int iter_print_outputs(void *data, metric_type type, char *name, void *value) {
+    char *out = data;
+    size_t len = strlen(out);
+    timer_hist *t;
+    switch (type) {
+        case COUNTER:
+            sprintf(out + len, "c %s %g %llu\n", name, counter_sum(value),
+                    (unsigned long long)counter_count(value));
+            break;
+        case GAUGE:
+            sprintf(out + len, "g %s %g %d\n", name, ((gauge_t*)value)->value, ((gauge_t*)value)->absolute);
+            break;
+        case SET:
+            sprintf(out + len, "s %s %llu\n", name, (unsigned long long)set_size(value));
+            break;
+        case TIMER:
+            t = value;
+            len += sprintf(out + len, "t %s %llu %g %g %g %g %g %g %g %g", name,
+                    (unsigned long long)timer_count(&t->tm), timer_sum(&t->tm),
+                    timer_squared_sum(&t->tm), timer_min(&t->tm), timer_max(&t->tm),
+                    timer_stddev(&t->tm), timer_query(&t->tm, 0.5),
+                    timer_query(&t->tm, 0.9), timer_query(&t->tm, 0.99));
+            for (int i=0; t->conf && i < t->conf->num_bins; i++) {
+                len += sprintf(out + len, " %u", t->counts[i]);
+            }
+            sprintf(out + len, "\n");
+            break;
+        default:
+            break;
+    }
+    return 0;
+}
+
+START_TEST(test_metrics_merge_state)
+{
+    statsite_config config;
+    fail_unless(config_from_filename(NULL, &config) == 0);
+    histogram_config c1 = {"t", 0, 100, 10, 12, NULL, 0};
+    config.hist_configs = &c1;
+    fail_unless(build_prefix_tree(&config) == 0);
+
+    // Two edges, the central metrics, and a single instance
+    metrics m[4];
+    double quants[] = {0.5, 0.90, 0.99};
+    for (int i=0; i < 4; i++) {
+        fail_unless(init_metrics(0.01, (double*)&quants, 3, config.histograms, 12, m + i) == 0);
+        metrics_set_quantile_engines(m + i, QUANTILE_DDSKETCH, NULL);
+    }
+    metrics *single = m + 3;
+
+    char buf[32];
+    for (int e=0; e < 2; e++) {
+        for (int j=0; j < 2; j++) {
+            metrics *into = (j) ? single : m + e;
+            fail_unless(metrics_add_sample(into, COUNTER, "c", e + 1, 0.5) == 0);
+            fail_unless(metrics_add_sample(into, (e) ? GAUGE_DELTA : GAUGE, "g", 10 + e, 1.0) == 0);
+            for (int i=0; i < 50; i++) {
+                sprintf(buf, "v%d", e * 25 + i);
+                fail_unless(metrics_set_update(into, "s", buf) == 0);
+                fail_unless(metrics_add_sample(into, TIMER, "t", e * 50 + i, 1.0) == 0);
+            }
+            for (int i=0; i < 1000; i++) {
+                fail_unless(metrics_add_sample(into, TIMER, "big", e * 1000 + i, 0.5) == 0);
+            }
+        }
+    }
+
+    // The central metrics merge the state of each edge
+    fail_unless(metrics_iter(m, m + 2, iter_forward_state) == 0);
+    fail_unless(metrics_iter(m + 1, m + 2, iter_forward_state) == 0);
+
+    // And output what a single instance would
+    char *central = calloc(1, 4096), *expected = calloc(1, 4096);
+    fail_unless(metrics_iter(m + 2, central, iter_print_outputs) == 0);
+    fail_unless(metrics_iter(single, expected, iter_print_outputs) == 0);
+    fail_unless(strlen(expected) > 0);
+    fail_unless(strcmp(central, expected) == 0);
+
+    free(central);
+    free(expected);
+    for (int i=0; i < 4; i++) {
+        fail_unless(destroy_metrics(m + i) == 0);
+    }
+}
+END_TEST
+
+START_TEST(test_metrics_merge_state_bad)
+{
+    metrics m1, m2;
+    fail_unless(init_metrics_defaults(&m1) == 0);
+    fail_unless(init_metrics_defaults(&m2) == 0);
+    metrics_set_quantile_engines(&m2, QUANTILE_TDIGEST, NULL);
+    for (int i=0; i < 1000; i++) {
+        fail_unless(metrics_add_sample(&m1, TIMER, "t", i, 1.0) == 0);
+    }
+
+    codec_buf buf;
+    codec_buf_init(&buf);
+    fail_unless(metrics_encode_state(TIMER, m1.timers.values[0], &buf) == 0);
+
+    // A summary of another engine is not merged
+    codec_reader r;
+    codec_reader_init(&r, buf.data, buf.len);
+    fail_unless(metrics_merge_state(&m2, TIMER, "t", &r) == -1);
+
+    // Nor is a truncated state
+    codec_reader_init(&r, buf.data, buf.len - 1);
+    fail_unless(metrics_merge_state(&m1, TIMER, "t", &r) == -1);
+    fail_unless(metrics_merge_state(&m1, KEY_VAL, "t", &r) == -1);
+    fail_unless(metrics_iter(&m2, NULL, iter_cancel_cb) == 0);
+    fail_unless(timer_count(&((timer_hist*)m1.timers.values[0])->tm) == 1000);
+
+    codec_buf_destroy(&buf);
+    fail_unless(destroy_metrics(&m1) == 0);
+    fail_unless(destroy_metrics(&m2) == 0);
+}
+END_TEST
+
+START_TEST(test_metrics_merge_state_eps)
+{
+    metrics m1, m2;
+    double quants[] = {0.5, 0.90, 0.99};
+    fail_unless(init_metrics(0.01, (double*)&quants, 3, NULL, 12, &m1) == 0);
+    fail_unless(init_metrics(0.02, (double*)&quants, 3, NULL, 12, &m2) == 0);
+    metrics_set_quantile_engines(&m1, QUANTILE_DDSKETCH, NULL);
+    metrics_set_quantile_engines(&m2, QUANTILE_DDSKETCH, NULL);
+    for (int i=0; i < 1000; i++) {
+        fail_unless(metrics_add_sample(&m1, TIMER, "t", i, 1.0) == 0);
+    }
+    fail_unless(metrics_add_sample(&m2, TIMER, "t", 5, 1.0) == 0);
+
+    codec_buf buf;
+    codec_buf_init(&buf);
+    fail_unless(metrics_encode_state(TIMER, m1.timers.values[0], &buf) == 0);
+
+    // A sketch of another error is not merged, and the timer is untouched
+    codec_reader r;
+    codec_reader_init(&r, buf.data, buf.len);
+    fail_unless(metrics_merge_state(&m2, TIMER, "t", &r) == -1);
+    timer *t = &((timer_hist*)m2.timers.values[0])->tm;
+    fail_unless(timer_count(t) == 1);
+    fail_unless(timer_sum(t) == 5);
+    fail_unless(timer_max(t) == 5);
+    fail_unless(timer_query(t, 0.5) == 5);
+
+    codec_buf_destroy(&buf);
+    fail_unless(destroy_metrics(&m1) == 0);
+    fail_unless(destroy_metrics(&m2) == 0);
+}
+END_TEST
@@ -71,4 +71,97 @@ START_TEST(test_set_error_bound)
 }
 END_TEST
 
+START_TEST(test_set_merge_exact)
+{
+    set_t s1, s2;
+    fail_unless(set_init(14, &s1) == 0);
+    fail_unless(set_init(14, &s2) == 0);
+
+    char buf[100];
+    for (int i=0; i < 30; i++) {
+        fail_unless(sprintf((char*)&buf, "test%d", i));
+        if (i < 20) set_add(&s1, (char*)&buf);
+        if (i >= 10) set_add(&s2, (char*)&buf);
+    }
+
+    fail_unless(set_merge(&s1, &s2) == 0);
+    fail_unless(s1.type == EXACT);
+    fail_unless(set_size(&s1) == 30);
+
+    fail_unless(set_destroy(&s1) == 0);
+    fail_unless(set_destroy(&s2) == 0);
+}
+END_TEST
+
+START_TEST(test_set_merge_approx)
+{
+    set_t s1, s2;
+    fail_unless(set_init(14, &s1) == 0);
+    fail_unless(set_init(14, &s2) == 0);
+
+    // One exact and one approximate set
+    char buf[100];
+    for (int i=0; i < 10000; i++) {
+        fail_unless(sprintf((char*)&buf, "test%d", i));
+        if (i < 10) set_add(&s1, (char*)&buf);
+        else set_add(&s2, (char*)&buf);
+    }
+
+    fail_unless(set_merge(&s1, &s2) == 0);
+    fail_unless(s1.type == APPROX);
+    uint64_t size = set_size(&s1);
+    fail_unless(size > 9900 && size < 10100);
 
+    fail_unless(set_destroy(&s1) == 0);
+    fail_unless(set_destroy(&s2) == 0);
+}
+END_TEST
+
+START_TEST(test_set_encode_decode)
+{
+    set_t s1, s2, s3;
+    fail_unless(set_init(14, &s1) == 0);
+    fail_unless(set_init(14, &s2) == 0);
+
+    // One exact and one approximate set
+    char buf[100];
+    for (int i=0; i < 10000; i++) {
+        fail_unless(sprintf((char*)&buf, "test%d", i));
+        if (i < 10) set_add(&s1, (char*)&buf);
+        else set_add(&s2, (char*)&buf);
+    }
+
+    codec_buf out;
+    codec_buf_init(&out);
+    fail_unless(set_encode(&s1, &out) == 0);
+    size_t exact_len = out.len;
+    fail_unless(set_encode(&s2, &out) == 0);
+
+    codec_reader r;
+    codec_reader_init(&r, out.data, out.len);
+    fail_unless(set_decode(&r, &s3) == 0);
+    fail_unless(s3.type == EXACT);
+    fail_unless(set_size(&s3) == 10);
+    fail_unless(r.pos == exact_len);
+
+    // Merge the decoded sets, as the originals would be
+    set_t s4;
+    fail_unless(set_decode(&r, &s4) == 0);
+    fail_unless(s4.type == APPROX);
+    fail_unless(set_size(&s4) == set_size(&s2));
+    fail_unless(set_merge(&s3, &s4) == 0);
+    uint64_t size = set_size(&s3);
+    fail_unless(size > 9900 && size < 10100);
+    fail_unless(r.pos == out.len);
+    fail_unless(set_destroy(&s4) == 0);
+
+    // Truncated input is rejected
+    codec_reader_init(&r, out.data, exact_len - 1);
+    fail_unless(set_decode(&r, &s4) == -1);
+
+    fail_unless(set_destroy(&s1) == 0);
+    fail_unless(set_destroy(&s2) == 0);
+    fail_unless(set_destroy(&s3) == 0);
+    codec_buf_destroy(&out);
+}
+END_TEST
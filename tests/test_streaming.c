@@ -7,6 +7,7 @@
 #include <sys/stat.h>
 #include <errno.h>
 #include <math.h>
+#include <signal.h>
 #include "streaming.h"
 
 static int empty_cb(FILE *pipe, void *data, metric_type type, char *name, void *value) {
@@ -90,8 +91,8 @@ START_TEST(test_stream_some)
     ssize_t read = fread(&buf, 1, 256, f);
     buf[read] = 0;
 
-    char *check = "kv.test2.42.000000\n\
-kv.test.100.000000\n\
+    char *check = "kv.test.100.000000\n\
+kv.test2.42.000000\n\
 counts.foo.10.000000\n\
 counts.bar.30.000000\n\
 timers.baz.11.000000\n";
@@ -153,3 +154,91 @@ START_TEST(test_stream_sigpipe)
     fail_unless(res == 0);
 }
 END_TEST
+
+START_TEST(test_stream_sink)
+{
+    metrics m;
+    int res = init_metrics_defaults(&m);
+    fail_unless(res == 0);
+    fail_unless(metrics_add_sample(&m, KEY_VAL, "test", 100, 1.0) == 0);
+    fail_unless(metrics_add_sample(&m, COUNTER, "foo", 4, 1.0) == 0);
+
+    // The command is started once, for all the batches
+    stream_sink *sink;
+    unlink("/tmp/stream_sink");
+    fail_unless(stream_sink_init("echo started >> /tmp/stream_sink; cat >> /tmp/stream_sink", &sink) == 0);
+
+    int called = 0;
+    fail_unless(stream_to_sink(sink, &m, &called, some_cb, "\n", 1) == 0);
+    fail_unless(metrics_add_sample(&m, COUNTER, "foo", 6, 1.0) == 0);
+    fail_unless(stream_to_sink(sink, &m, &called, some_cb, "\n", 1) == 0);
+    fail_unless(called == 4);
+
+    // The command handles everything before it exits
+    fail_unless(stream_sink_destroy(sink) == 0);
+
+    FILE *f = fopen("/tmp/stream_sink", "r");
+    char buf[256];
+    ssize_t read = fread(&buf, 1, 255, f);
+    buf[read] = 0;
+    fclose(f);
+
+    char *check = "started\n\
+kv.test.100.000000\n\
+counts.foo.4.000000\n\
+\n\
+kv.test.100.000000\n\
+counts.foo.10.000000\n\
+\n";
+    fail_unless(strcmp(check, (char*)&buf) == 0);
+
+    res = destroy_metrics(&m);
+    fail_unless(res == 0);
+    fail_unless(unlink("/tmp/stream_sink") == 0);
+}
+END_TEST
+
+START_TEST(test_stream_sink_restart)
+{
+    // Writes to a command that died fail instead of signalling
+    signal(SIGPIPE, SIG_IGN);
+
+    metrics m;
+    int res = init_metrics_defaults(&m);
+    fail_unless(res == 0);
+    fail_unless(metrics_add_sample(&m, COUNTER, "foo", 4, 1.0) == 0);
+
+    // The command exits after the first line
+    stream_sink *sink;
+    unlink("/tmp/stream_sink_restart");
+    fail_unless(stream_sink_init("echo started >> /tmp/stream_sink_restart; head -n1 > /dev/null", &sink) == 0);
+
+    int called = 0;
+    stream_to_sink(sink, &m, &called, some_cb, "\n", 1);
+    usleep(100000);
+
+    // The next batch is dropped, while the restart backs off
+    fail_unless(stream_to_sink(sink, &m, &called, some_cb, "\n", 1) == -1);
+
+    // Then the command is started again
+    usleep(1100000);
+    fail_unless(stream_to_sink(sink, &m, &called, some_cb, "\n", 1) == 0);
+
+    // A command that ran for longer than the backoff is
+    // restarted at once, and gets the batch
+    usleep(1100000);
+    fail_unless(stream_to_sink(sink, &m, &called, some_cb, "\n", 1) == 0);
+    stream_sink_destroy(sink);
+
+    FILE *f = fopen("/tmp/stream_sink_restart", "r");
+    char buf[256];
+    ssize_t read = fread(&buf, 1, 255, f);
+    buf[read] = 0;
+    fclose(f);
+    fail_unless(strcmp("started\nstarted\nstarted\n", (char*)&buf) == 0);
+
+    res = destroy_metrics(&m);
+    fail_unless(res == 0);
+    fail_unless(unlink("/tmp/stream_sink_restart") == 0);
+}
+END_TEST
@@ -0,0 +1,189 @@
+#include <check.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "tdigest.h"
+
+START_TEST(test_td_init_and_destroy)
+{
+    tdigest td;
+    int res = init_tdigest(100, &td);
+    fail_unless(res == 0);
+    res = destroy_tdigest(&td);
+    fail_unless(res == 0);
+}
+END_TEST
+
+START_TEST(test_td_init_bad_compression)
+{
+    tdigest td;
+    int res = init_tdigest(1, &td);
+    fail_unless(res == -1);
+}
+END_TEST
+
+START_TEST(test_td_query_empty)
+{
+    tdigest td;
+    fail_unless(init_tdigest(100, &td) == 0);
+    fail_unless(td_query(&td, 0.5) == 0);
+    fail_unless(destroy_tdigest(&td) == 0);
+}
+END_TEST
+
+START_TEST(test_td_add_query_destroy)
+{
+    tdigest td;
+    fail_unless(init_tdigest(100, &td) == 0);
+
+    fail_unless(td_add_sample(&td, 100.0) == 0);
+    fail_unless(td_query(&td, 0.5) == 100.0);
+    fail_unless(td_query(&td, 0.99) == 100.0);
+
+    fail_unless(destroy_tdigest(&td) == 0);
+}
+END_TEST
+
+START_TEST(test_td_add_loop_query_destroy)
+{
+    tdigest td;
+    fail_unless(init_tdigest(100, &td) == 0);
+
+    for (int i=0; i < 100000; i++) {
+        fail_unless(td_add_sample(&td, i) == 0);
+    }
+    fail_unless(td_flush(&td) == 0);
+    fail_unless(td.total_weight == 100000);
+
+    // Memory is bounded by the compression
+    fail_unless(td.num_centroids <= 200);
+
+    double val = td_query(&td, 0.5);
+    fail_unless(val >= 49000 && val <= 51000);
+
+    val = td_query(&td, 0.90);
+    fail_unless(val >= 89000 && val <= 91000);
+
+    val = td_query(&td, 0.99);
+    fail_unless(val >= 98900 && val <= 99100);
+
+    // The extremes are exact
+    fail_unless(td_query(&td, 0) == 0);
+    fail_unless(td_query(&td, 1) == 99999);
+
+    fail_unless(destroy_tdigest(&td) == 0);
+}
+END_TEST
+
+START_TEST(test_td_add_loop_random_query_destroy)
+{
+    tdigest td;
+    fail_unless(init_tdigest(100, &td) == 0);
+
+    srandom(42);
+    for (int i=0; i < 100000; i++) {
+        fail_unless(td_add_sample(&td, random()) == 0);
+    }
+
+    double val = td_query(&td, 0.5);
+    fail_unless(val >= 1073741823 - 21474836 && val <= 1073741823 + 21474836);
+
+    val = td_query(&td, 0.90);
+    fail_unless(val >= 1932735282 - 21474836 && val <= 1932735282 + 21474836);
+
+    val = td_query(&td, 0.99);
+    fail_unless(val >= 2126008810 - 21474836 && val <= 2126008810 + 21474836);
+
+    fail_unless(destroy_tdigest(&td) == 0);
+}
+END_TEST
+
+START_TEST(test_td_add_negative_query_destroy)
+{
+    tdigest td;
+    fail_unless(init_tdigest(100, &td) == 0);
+
+    for (int i=-1000; i <= 1000; i++) {
+        fail_unless(td_add_sample(&td, i) == 0);
+    }
+
+    double val = td_query(&td, 0.5);
+    fail_unless(val >= -20 && val <= 20);
+
+    val = td_query(&td, 0.01);
+    fail_unless(val >= -990 && val <= -970);
+
+    fail_unless(destroy_tdigest(&td) == 0);
+}
+END_TEST
+
+START_TEST(test_td_merge_random_query_destroy)
+{
+    tdigest td1, td2;
+    fail_unless(init_tdigest(100, &td1) == 0);
+    fail_unless(init_tdigest(100, &td2) == 0);
+
+    srandom(42);
+    for (int i=0; i < 100000; i++) {
+        fail_unless(td_add_sample((i % 3) ? &td1 : &td2, random()) == 0);
+    }
+
+    fail_unless(td_merge(&td1, &td2) == 0);
+    fail_unless(td1.total_weight == 100000);
+    fail_unless(td2.total_weight == 0);
+    fail_unless(td2.num_centroids == 0);
+
+    double val = td_query(&td1, 0.5);
+    fail_unless(val >= 1073741823 - 21474836 && val <= 1073741823 + 21474836);
+
+    val = td_query(&td1, 0.90);
+    fail_unless(val >= 1932735282 - 21474836 && val <= 1932735282 + 21474836);
+
+    val = td_query(&td1, 0.99);
+    fail_unless(val >= 2126008810 - 21474836 && val <= 2126008810 + 21474836);
+
+    fail_unless(destroy_tdigest(&td1) == 0);
+    fail_unless(destroy_tdigest(&td2) == 0);
+}
+END_TEST
+
+START_TEST(test_td_encode_decode)
+{
+    tdigest td1, td2, td3;
+    fail_unless(init_tdigest(100, &td1) == 0);
+    fail_unless(init_tdigest(100, &td2) == 0);
+
+    srandom(42);
+    for (int i=0; i < 100000; i++) {
+        fail_unless(td_add_sample((i % 3) ? &td1 : &td2, random()) == 0);
+    }
+
+    codec_buf buf;
+    codec_buf_init(&buf);
+    fail_unless(td_encode(&td2, &buf) == 0);
+
+    codec_reader r;
+    codec_reader_init(&r, buf.data, buf.len);
+    fail_unless(td_decode(&r, &td3) == 0);
+    fail_unless(r.pos == buf.len);
+    fail_unless(td3.num_centroids == td2.num_centroids);
+    fail_unless(td3.total_weight == td2.total_weight);
+    fail_unless(td_query(&td3, 0.5) == td_query(&td2, 0.5));
+
+    // The decoded digest merges like the original
+    fail_unless(td_merge(&td1, &td3) == 0);
+    fail_unless(td1.total_weight == 100000);
+    double val = td_query(&td1, 0.5);
+    fail_unless(val >= 1073741823 - 21474836 && val <= 1073741823 + 21474836);
+    fail_unless(destroy_tdigest(&td3) == 0);
+
+    // Truncated input is rejected
+    codec_reader_init(&r, buf.data, buf.len - 1);
+    fail_unless(td_decode(&r, &td3) == -1);
+
+    fail_unless(destroy_tdigest(&td1) == 0);
+    fail_unless(destroy_tdigest(&td2) == 0);
+    codec_buf_destroy(&buf);
+}
+END_TEST
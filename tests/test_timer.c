@@ -94,3 +94,272 @@ START_TEST(test_timer_sample_rate)
   fail_unless(res == 0);
 }
 END_TEST
+
+START_TEST(test_timer_merge)
+{
+    timer t1, t2;
+    double quants[] = {0.5, 0.90, 0.99};
+    fail_unless(init_timer(0.01, (double*)&quants, 3, &t1) == 0);
+    fail_unless(init_timer(0.01, (double*)&quants, 3, &t2) == 0);
+
+    // Interleave the samples between the timers
+    for (int i=1; i<=100; i++)
+        fail_unless(timer_add_sample((i % 2) ? &t1 : &t2, i, 1.0) == 0);
+
+    fail_unless(timer_merge(&t1, &t2) == 0);
+    fail_unless(timer_count(&t1) == 100);
+    fail_unless(timer_sum(&t1) == 5050);
+    fail_unless(timer_squared_sum(&t1) == 338350);
+    fail_unless(timer_min(&t1) == 1);
+    fail_unless(timer_max(&t1) == 100);
+    fail_unless(timer_mean(&t1) == 50.5);
+    fail_unless(timer_query(&t1, 0.5) >= 49 && timer_query(&t1, 0.5) <= 51);
+    fail_unless(timer_query(&t1, 0.90) >= 89 && timer_query(&t1, 0.90) <= 91);
+    fail_unless(timer_query(&t1, 0.99) >= 98 && timer_query(&t1, 0.99) <= 100);
+
+    // The merged timer is left empty
+    fail_unless(timer_min(&t2) == 0);
+    fail_unless(timer_max(&t2) == 0);
+
+    fail_unless(destroy_timer(&t1) == 0);
+    fail_unless(destroy_timer(&t2) == 0);
+}
+END_TEST
+
+START_TEST(test_timer_engines)
+{
+    quantile_engine engines[] = {QUANTILE_TDIGEST, QUANTILE_DDSKETCH};
+    double quants[] = {0.5, 0.90, 0.99};
+    for (int e=0; e < 2; e++) {
+        timer t1, t2;
+        fail_unless(init_timer_with_engine(engines[e], 0.01, (double*)&quants, 3, &t1) == 0);
+        fail_unless(init_timer_with_engine(engines[e], 0.01, (double*)&quants, 3, &t2) == 0);
+
+        for (int i=1; i<=1000; i++)
+            fail_unless(timer_add_sample((i % 2) ? &t1 : &t2, i, 1.0) == 0);
+        fail_unless(t1.type == TIMER_APPROX);
+        fail_unless(t1.store.q.engine == engines[e]);
+
+        fail_unless(timer_merge(&t1, &t2) == 0);
+        fail_unless(timer_count(&t1) == 1000);
+        fail_unless(timer_min(&t1) == 1);
+        fail_unless(timer_max(&t1) == 1000);
+        fail_unless(timer_query(&t1, 0.5) >= 490 && timer_query(&t1, 0.5) <= 510);
+        fail_unless(timer_query(&t1, 0.90) >= 890 && timer_query(&t1, 0.90) <= 910);
+        fail_unless(timer_query(&t1, 0.99) >= 980 && timer_query(&t1, 0.99) <= 1000);
+
+        fail_unless(destroy_timer(&t1) == 0);
+        fail_unless(destroy_timer(&t2) == 0);
+    }
+
+    // Timers of different engines cannot be merged
+    timer t1, t2;
+    fail_unless(init_timer(0.01, (double*)&quants, 3, &t1) == 0);
+    fail_unless(init_timer_with_engine(QUANTILE_DDSKETCH, 0.01, (double*)&quants, 3, &t2) == 0);
+    for (int i=0; i < 1000; i++) {
+        fail_unless(timer_add_sample(&t1, i, 1.0) == 0);
+        fail_unless(timer_add_sample(&t2, i, 1.0) == 0);
+    }
+    fail_unless(timer_merge(&t1, &t2) == -1);
+    fail_unless(destroy_timer(&t1) == 0);
+    fail_unless(destroy_timer(&t2) == 0);
+}
+END_TEST
+
+START_TEST(test_timer_exact)
+{
+    timer t;
+    double quants[] = {0.5, 0.90, 0.99};
+    fail_unless(init_timer(0.01, (double*)&quants, 3, &t) == 0);
+
+    // Few values are kept exactly, in reverse order to be sorted
+    for (int i=TIMER_MAX_EXACT; i > 0; i--)
+        fail_unless(timer_add_sample(&t, i, 1.0) == 0);
+    fail_unless(t.type == TIMER_EXACT);
+    fail_unless(t.store.e.count == TIMER_MAX_EXACT);
+
+    fail_unless(timer_query(&t, 0.5) == 64);
+    fail_unless(timer_query(&t, 0.75) == 96);
+    fail_unless(timer_query(&t, 0.99) == 127);
+    fail_unless(timer_min(&t) == 1);
+    fail_unless(timer_max(&t) == 128);
+
+    // One more switches to the quantile engine
+    fail_unless(timer_add_sample(&t, 129, 1.0) == 0);
+    fail_unless(t.type == TIMER_APPROX);
+    fail_unless(timer_count(&t) == 129);
+    fail_unless(timer_query(&t, 0.5) >= 63 && timer_query(&t, 0.5) <= 67);
+    fail_unless(timer_max(&t) == 129);
+
+    fail_unless(destroy_timer(&t) == 0);
+}
+END_TEST
+
+START_TEST(test_timer_merge_exact)
+{
+    timer t1, t2, t3;
+    double quants[] = {0.5, 0.90, 0.99};
+    fail_unless(init_timer(0.01, (double*)&quants, 3, &t1) == 0);
+    fail_unless(init_timer(0.01, (double*)&quants, 3, &t2) == 0);
+    fail_unless(init_timer(0.01, (double*)&quants, 3, &t3) == 0);
+
+    // Two small exact timers stay exact
+    for (int i=1; i<=50; i++) {
+        fail_unless(timer_add_sample(&t1, i, 1.0) == 0);
+        fail_unless(timer_add_sample(&t2, 100 + i, 1.0) == 0);
+    }
+    fail_unless(timer_merge(&t1, &t2) == 0);
+    fail_unless(t1.type == TIMER_EXACT);
+    fail_unless(t2.store.e.count == 0);
+    fail_unless(timer_query(&t1, 0.5) == 50);
+    fail_unless(timer_query(&t1, 0.51) == 101);
+
+    // An approximate timer switches the exact target
+    for (int i=1; i<=1000; i++)
+        fail_unless(timer_add_sample(&t3, i, 1.0) == 0);
+    fail_unless(t3.type == TIMER_APPROX);
+    fail_unless(timer_merge(&t1, &t3) == 0);
+    fail_unless(t1.type == TIMER_APPROX);
+    fail_unless(timer_count(&t1) == 1100);
+    fail_unless(timer_min(&t1) == 1);
+    fail_unless(timer_max(&t1) == 1000);
+    fail_unless(timer_query(&t1, 0.5) >= 440 && timer_query(&t1, 0.5) <= 470);
+
+    fail_unless(destroy_timer(&t1) == 0);
+    fail_unless(destroy_timer(&t2) == 0);
+    fail_unless(destroy_timer(&t3) == 0);
+}
+END_TEST
+
+START_TEST(test_timer_pool)
+{
+    arena mem;
+    timer_pool pool;
+    arena_init(&mem);
+    timer_pool_init(&mem, &pool);
+
+    timer t1, t2;
+    double quants[] = {0.5, 0.90, 0.99};
+    fail_unless(init_timer(0.01, (double*)&quants, 3, &t1) == 0);
+    fail_unless(init_timer(0.01, (double*)&quants, 3, &t2) == 0);
+    timer_use_pool(&t1, &pool);
+    timer_use_pool(&t2, &pool);
+
+    // Growing frees the smaller arrays into the pool
+    for (int i=1; i<=100; i++)
+        fail_unless(timer_add_sample(&t1, i, 1.0) == 0);
+    fail_unless(t1.store.e.size == 128);
+    fail_unless(pool.free[0] != NULL);
+    fail_unless(pool.free[1] != NULL);
+    fail_unless(pool.free[2] != NULL);
+    fail_unless(pool.free[3] == NULL);
+    fail_unless(timer_query(&t1, 0.5) == 50);
+
+    // The next timer reuses them
+    void *reused = pool.free[0];
+    for (int i=1; i<=10; i++)
+        fail_unless(timer_add_sample(&t2, i, 1.0) == 0);
+    fail_unless(t2.store.e.v.values == reused);
+    fail_unless(pool.free[0] == NULL);
+
+    // Switching to the engine returns the array
+    for (int i=101; i<=200; i++)
+        fail_unless(timer_add_sample(&t1, i, 1.0) == 0);
+    fail_unless(t1.type == TIMER_APPROX);
+    fail_unless(pool.free[3] != NULL);
+
+    fail_unless(destroy_timer(&t1) == 0);
+    fail_unless(destroy_timer(&t2) == 0);
+    fail_unless(pool.free[0] != NULL);
+    arena_destroy(&mem);
+}
+END_TEST
+
+START_TEST(test_timer_encode_decode)
+{
+    double quants[] = {0.5, 0.90, 0.99};
+    quantile_engine engines[] = {QUANTILE_CM, QUANTILE_TDIGEST, QUANTILE_DDSKETCH};
+    for (int e=0; e < 3; e++) {
+        // An exact timer and a summarized one
+        timer t1, t2, t3, t4;
+        fail_unless(init_timer_with_engine(engines[e], 0.01, (double*)&quants, 3, &t1) == 0);
+        fail_unless(init_timer_with_engine(engines[e], 0.01, (double*)&quants, 3, &t2) == 0);
+        for (int i=1; i<=50; i++)
+            fail_unless(timer_add_sample(&t1, i, 0.5) == 0);
+        for (int i=51; i<=1000; i++)
+            fail_unless(timer_add_sample(&t2, i, 1.0) == 0);
+
+        codec_buf buf;
+        codec_buf_init(&buf);
+        fail_unless(timer_encode(&t1, &buf) == 0);
+        size_t exact_len = buf.len;
+        fail_unless(timer_encode(&t2, &buf) == 0);
+
+        codec_reader r;
+        codec_reader_init(&r, buf.data, buf.len);
+        fail_unless(init_timer_with_engine(engines[e], 0.01, (double*)&quants, 3, &t3) == 0);
+        fail_unless(timer_decode(&r, &t3) == 0);
+        fail_unless(t3.type == TIMER_EXACT);
+        fail_unless(timer_count(&t3) == 100);
+        fail_unless(timer_sum(&t3) == 1275);
+        fail_unless(timer_query(&t3, 0.5) == 25);
+
+        fail_unless(init_timer_with_engine(engines[e], 0.01, (double*)&quants, 3, &t4) == 0);
+        fail_unless(timer_decode(&r, &t4) == 0);
+        fail_unless(r.pos == buf.len);
+        fail_unless(t4.type == TIMER_APPROX);
+        fail_unless(t4.store.q.engine == engines[e]);
+        fail_unless(timer_min(&t4) == 51 && timer_max(&t4) == 1000);
+        fail_unless(timer_query(&t4, 0.5) == timer_query(&t2, 0.5));
+
+        // The decoded timers merge like the originals
+        fail_unless(timer_merge(&t3, &t4) == 0);
+        fail_unless(timer_merge(&t1, &t2) == 0);
+        fail_unless(timer_count(&t3) == 1050);
+        fail_unless(timer_sum(&t3) == timer_sum(&t1));
+        fail_unless(timer_min(&t3) == 1 && timer_max(&t3) == 1000);
+        for (int i=0; i < 3; i++) {
+            fail_unless(timer_query(&t3, quants[i]) == timer_query(&t1, quants[i]));
+        }
+        fail_unless(destroy_timer(&t3) == 0);
+
+        // Truncated input is rejected
+        codec_reader_init(&r, buf.data, exact_len - 1);
+        fail_unless(init_timer_with_engine(engines[e], 0.01, (double*)&quants, 3, &t3) == 0);
+        fail_unless(timer_decode(&r, &t3) == -1);
+        fail_unless(destroy_timer(&t3) == 0);
+
+        codec_reader_init(&r, buf.data + exact_len, buf.len - exact_len - 1);
+        fail_unless(init_timer_with_engine(engines[e], 0.01, (double*)&quants, 3, &t3) == 0);
+        fail_unless(timer_decode(&r, &t3) == -1);
+        fail_unless(t3.type == TIMER_EXACT);
+        fail_unless(destroy_timer(&t3) == 0);
+
+        fail_unless(destroy_timer(&t1) == 0);
+        fail_unless(destroy_timer(&t2) == 0);
+        fail_unless(destroy_timer(&t4) == 0);
+        codec_buf_destroy(&buf);
+    }
+
+    // A summary only merges into a timer of the same engine
+    timer t1, t2, t3;
+    fail_unless(init_timer_with_engine(QUANTILE_TDIGEST, 0.01, (double*)&quants, 3, &t1) == 0);
+    for (int i=1; i<=1000; i++)
+        fail_unless(timer_add_sample(&t1, i, 1.0) == 0);
+    codec_buf buf;
+    codec_buf_init(&buf);
+    fail_unless(timer_encode(&t1, &buf) == 0);
+
+    codec_reader r;
+    codec_reader_init(&r, buf.data, buf.len);
+    fail_unless(init_timer(0.01, (double*)&quants, 3, &t2) == 0);
+    fail_unless(init_timer(0.01, (double*)&quants, 3, &t3) == 0);
+    fail_unless(timer_decode(&r, &t2) == 0);
+    fail_unless(timer_merge(&t3, &t2) == -1);
+
+    fail_unless(destroy_timer(&t1) == 0);
+    fail_unless(destroy_timer(&t2) == 0);
+    fail_unless(destroy_timer(&t3) == 0);
+    codec_buf_destroy(&buf);
+}
+END_TEST